@@ -0,0 +1,125 @@
+#ifndef VOXEL_ARENA_H
+#define VOXEL_ARENA_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef _WIN32
+#include <malloc.h>
+#endif
+
+// Scratch memory kept across frames. Kernels borrow blocks with voxel_arena_alloc
+// during matrix_calc and hand them all back with voxel_arena_release at the end.
+// Blocks are 64-byte aligned and rounded up to power-of-two size classes, so once
+// the frame size settles every request is served from a free list and calc does
+// no heap traffic. An arena is not thread safe; borrow from the calling thread and
+// give a worker thread its own.
+#define VOXEL_ARENA_ALIGN 64
+#define VOXEL_ARENA_MIN_CLASS 6     // 64 bytes
+#define VOXEL_ARENA_CLASSES 40
+#define VOXEL_ARENA_PAGE 4096
+
+// sits in front of every block, padded so the data after it stays aligned
+typedef union _voxel_arena_block {
+    struct {
+        union _voxel_arena_block *next;
+        long size_class;
+    } h;
+    char pad[VOXEL_ARENA_ALIGN];
+} t_voxel_arena_block;
+
+typedef struct _voxel_arena {
+    t_voxel_arena_block *free_list[VOXEL_ARENA_CLASSES];
+    t_voxel_arena_block *borrowed;
+    long allocations;       // heap allocations made since the arena was created
+    long bytes;             // bytes held, borrowed or free
+} t_voxel_arena;
+
+static inline void voxel_arena_init(t_voxel_arena *arena) {
+    memset(arena, 0, sizeof(t_voxel_arena));
+}
+
+static inline void *voxel_arena_heap_alloc(size_t size) {
+#ifdef _WIN32
+    return _aligned_malloc(size, VOXEL_ARENA_ALIGN);
+#else
+    void *p = NULL;
+    return posix_memalign(&p, VOXEL_ARENA_ALIGN, size) == 0 ? p : NULL;
+#endif
+}
+
+static inline void voxel_arena_heap_free(void *p) {
+#ifdef _WIN32
+    _aligned_free(p);
+#else
+    free(p);
+#endif
+}
+
+// returns an aligned block of at least size bytes, valid until the next release
+static inline void *voxel_arena_alloc(t_voxel_arena *arena, size_t size) {
+    t_voxel_arena_block *block;
+    long size_class = VOXEL_ARENA_MIN_CLASS;
+
+    while (((size_t)1 << size_class) < size) {
+        size_class++;
+    }
+    if (size_class - VOXEL_ARENA_MIN_CLASS >= VOXEL_ARENA_CLASSES) {
+        return NULL;
+    }
+
+    block = arena->free_list[size_class - VOXEL_ARENA_MIN_CLASS];
+    if (block) {
+        arena->free_list[size_class - VOXEL_ARENA_MIN_CLASS] = block->h.next;
+    } else {
+        block = (t_voxel_arena_block *)voxel_arena_heap_alloc(sizeof(t_voxel_arena_block) + ((size_t)1 << size_class));
+        if (!block) {
+            return NULL;
+        }
+        block->h.size_class = size_class;
+        arena->allocations++;
+        arena->bytes += (long)1 << size_class;
+    }
+
+    block->h.next = arena->borrowed;
+    arena->borrowed = block;
+    return block + 1;
+}
+
+// rows of at least bytes each, one per slab thread, every row starting on a page of
+// its own: the thread that writes its row first places those pages, on its own node
+// when pinned, and no two threads share a line. *stride is the bytes between rows
+static inline void *voxel_arena_alloc_rows(t_voxel_arena *arena, long rows, size_t bytes, size_t *stride) {
+    char *p;
+
+    *stride = (bytes + VOXEL_ARENA_PAGE - 1) & ~(size_t)(VOXEL_ARENA_PAGE - 1);
+    p = (char *)voxel_arena_alloc(arena, rows * *stride + VOXEL_ARENA_PAGE - VOXEL_ARENA_ALIGN);
+    return p ? (void *)(((uintptr_t)p + VOXEL_ARENA_PAGE - 1) & ~(uintptr_t)(VOXEL_ARENA_PAGE - 1)) : NULL;
+}
+
+// returns every borrowed block to its free list
+static inline void voxel_arena_release(t_voxel_arena *arena) {
+    while (arena->borrowed) {
+        t_voxel_arena_block *block = arena->borrowed;
+        long c = block->h.size_class - VOXEL_ARENA_MIN_CLASS;
+
+        arena->borrowed = block->h.next;
+        block->h.next = arena->free_list[c];
+        arena->free_list[c] = block;
+    }
+}
+
+static inline void voxel_arena_free(t_voxel_arena *arena) {
+    voxel_arena_release(arena);
+    for (long c = 0; c < VOXEL_ARENA_CLASSES; c++) {
+        while (arena->free_list[c]) {
+            t_voxel_arena_block *block = arena->free_list[c];
+
+            arena->free_list[c] = block->h.next;
+            voxel_arena_heap_free(block);
+        }
+    }
+    arena->bytes = 0;
+}
+
+#endif
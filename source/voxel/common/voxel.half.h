@@ -0,0 +1,191 @@
+#ifndef VOXEL_HALF_H
+#define VOXEL_HALF_H
+
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#if (defined(__x86_64__) || defined(__i386__)) && (defined(__GNUC__) || defined(__clang__))
+#define VOXEL_HALF_F16C 1
+#include <immintrin.h>
+#elif defined(__aarch64__)
+#define VOXEL_HALF_NEON 1
+#include <arm_neon.h>
+#endif
+
+// Half precision grids. Jitter has no 16-bit float type, so a grid stored in half
+// precision travels as a char matrix with two planes per float plane: each cell holds
+// IEEE 754 binary16 values in native byte order. Kernels convert whole rows to float
+// on load and back on store and accumulate in float, so only storage and the bytes
+// moved between objects shrink. Objects only read a char matrix this way with
+// @precision half. On x86 the row converters use F16C when the cpu has it, on arm64
+// NEON; elsewhere they fall back to the scalar conversions below.
+#define VOXEL_HALF_ONE 0x3c00
+#define VOXEL_HALF_EPSILON (1.0f / 2048.0f)    // largest rounding error relative to the value
+
+enum {
+    VOXEL_GRID_INVALID = -1,
+    VOXEL_GRID_FLOAT32 = 0,
+    VOXEL_GRID_HALF
+};
+
+// storage format of a grid matrix; planes is set to the number of values per cell. A
+// char matrix is only read as half, two chars per value, when the object's precision
+// attribute asks for it, so an ordinary char matrix is refused rather than misread
+static inline long voxel_grid_format(t_jit_matrix_info *info, long half, long *planes) {
+    if (info->type == _jit_sym_float32 && info->planecount > 0) {
+        *planes = info->planecount;
+        return VOXEL_GRID_FLOAT32;
+    }
+    if (half && info->type == _jit_sym_char && info->planecount > 0 && info->planecount % 2 == 0) {
+        *planes = info->planecount / 2;
+        return VOXEL_GRID_HALF;
+    }
+    *planes = 0;
+    return VOXEL_GRID_INVALID;
+}
+
+// precision attribute of the objects reading grids: float32, or half to take char
+// input as binary16 pairs
+static inline void voxel_grid_class_attrs(void *c, long precision_offset) {
+    long attrflags = JIT_ATTR_GET_DEFER_LOW | JIT_ATTR_SET_USURP_LOW;
+    t_jit_object *attr;
+
+    attr = jit_object_new(_jit_sym_jit_attr_offset, "precision", _jit_sym_symbol, attrflags,
+                          (method)NULL, (method)NULL, precision_offset);
+    jit_class_addattr(c, attr);
+    CLASS_ATTR_LABEL(c, "precision", 0, "Grid Precision");
+    CLASS_ATTR_ENUM(c, "precision", 0, "float32 half");
+}
+
+// round to nearest even; out of range values become infinity
+static inline uint16_t voxel_half_from_float(float value) {
+    uint32_t u, sign, abs;
+
+    memcpy(&u, &value, sizeof(u));
+    sign = (u >> 16) & 0x8000;
+    abs = u & 0x7fffffff;
+
+    if (abs >= 0x7f800000) {
+        return (uint16_t)(sign | 0x7c00 | (abs > 0x7f800000 ? 0x200 : 0));
+    }
+    if (abs >= 0x477ff000) {
+        return (uint16_t)(sign | 0x7c00);
+    }
+    if (abs < 0x38800000) {
+        // subnormal in half precision, in units of 2^-24
+        float a;
+        memcpy(&a, &abs, sizeof(a));
+        return (uint16_t)(sign | (uint32_t)lrintf(a * 16777216.0f));
+    }
+    // rebias the exponent from 127 to 15 and round the dropped 13 mantissa bits
+    abs += 0xc8000fff + ((abs >> 13) & 1);
+    return (uint16_t)(sign | (abs >> 13));
+}
+
+static inline float voxel_half_to_float(uint16_t h) {
+    uint32_t sign = (uint32_t)(h & 0x8000) << 16;
+    uint32_t exponent = (h >> 10) & 0x1f;
+    uint32_t mantissa = h & 0x3ff;
+    uint32_t u;
+    float value;
+
+    if (exponent == 0) {
+        value = mantissa * (1.0f / 16777216.0f);
+        return sign ? -value : value;
+    }
+    u = sign | (exponent == 31 ? 0x7f800000 : (exponent + 112) << 23) | (mantissa << 13);
+    memcpy(&value, &u, sizeof(value));
+    return value;
+}
+
+#if VOXEL_HALF_F16C
+// the runtime fills in the cpu model when the module loads, so slab threads can all
+// ask it directly rather than race on a lazily set flag
+static inline int voxel_half_f16c(void) {
+    return __builtin_cpu_supports("f16c") && __builtin_cpu_supports("avx");
+}
+
+__attribute__((target("avx,f16c")))
+static long voxel_half_load_f16c(const char *src, float *dst, long n) {
+    long i = 0;
+
+    for (; i + 8 <= n; i += 8) {
+        _mm256_storeu_ps(dst + i, _mm256_cvtph_ps(_mm_loadu_si128((const __m128i *)(src + i * 2))));
+    }
+    return i;
+}
+
+__attribute__((target("avx,f16c")))
+static long voxel_half_store_f16c(const float *src, char *dst, long n) {
+    long i = 0;
+
+    for (; i + 8 <= n; i += 8) {
+        _mm_storeu_si128((__m128i *)(dst + i * 2), _mm256_cvtps_ph(_mm256_loadu_ps(src + i), _MM_FROUND_TO_NEAREST_INT));
+    }
+    return i;
+}
+#endif
+
+// n halves spaced stride bytes apart to packed floats
+static inline void voxel_half_load(const char *src, long stride, float *dst, long n) {
+    long i = 0;
+
+    if (stride == sizeof(uint16_t)) {
+#if VOXEL_HALF_F16C
+        if (voxel_half_f16c()) {
+            i = voxel_half_load_f16c(src, dst, n);
+        }
+#elif VOXEL_HALF_NEON
+        for (; i + 4 <= n; i += 4) {
+            vst1q_f32(dst + i, vcvt_f32_f16(vreinterpret_f16_u16(vld1_u16((const uint16_t *)(src + i * 2)))));
+        }
+#endif
+    }
+    for (; i < n; i++) {
+        uint16_t h;
+        memcpy(&h, src + i * stride, sizeof(h));
+        dst[i] = voxel_half_to_float(h);
+    }
+}
+
+// n packed floats to halves spaced stride bytes apart
+static inline void voxel_half_store(const float *src, char *dst, long stride, long n) {
+    long i = 0;
+
+    if (stride == sizeof(uint16_t)) {
+#if VOXEL_HALF_F16C
+        if (voxel_half_f16c()) {
+            i = voxel_half_store_f16c(src, dst, n);
+        }
+#elif VOXEL_HALF_NEON
+        for (; i + 4 <= n; i += 4) {
+            vst1_u16((uint16_t *)(dst + i * 2), vreinterpret_u16_f16(vcvt_f16_f32(vld1q_f32(src + i))));
+        }
+#endif
+    }
+    for (; i < n; i++) {
+        uint16_t h = voxel_half_from_float(src[i]);
+        memcpy(dst + i * stride, &h, sizeof(h));
+    }
+}
+
+// single values, for the paths that touch scattered voxels
+static inline float voxel_grid_read(const char *p, long format) {
+    if (format == VOXEL_GRID_HALF) {
+        uint16_t h;
+        memcpy(&h, p, sizeof(h));
+        return voxel_half_to_float(h);
+    }
+    return *(const float *)p;
+}
+
+static inline void voxel_grid_write(char *p, long format, float value) {
+    if (format == VOXEL_GRID_HALF) {
+        uint16_t h = voxel_half_from_float(value);
+        memcpy(p, &h, sizeof(h));
+    } else {
+        *(float *)p = value;
+    }
+}
+
+#endif
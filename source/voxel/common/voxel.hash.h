@@ -0,0 +1,172 @@
+#ifndef VOXEL_HASH_H
+#define VOXEL_HASH_H
+
+#include <stdint.h>
+#include <string.h>
+#include "voxel.parallel.h"
+
+// Input fingerprints behind the "cache" attribute. With cache on, matrix_calc keys the
+// frame on a hash of the input cells, the input and output layouts, the output buffer
+// and the attributes that shape the result. When the key matches the last computed
+// frame the output matrix and the stats still hold that frame's result, so calc
+// returns without running the kernel. The cells are hashed row by row across threads
+// in 64-bit multiply-rotate lanes; padding between rows is skipped.
+#define VOXEL_HASH_PRIME1 0x9e3779b185ebca87ULL
+#define VOXEL_HASH_PRIME2 0xc2b2ae3d27d4eb4fULL
+#define VOXEL_HASH_PRIME3 0x165667b19e3779f9ULL
+
+typedef struct _voxel_cache {
+    long enabled;
+    long hits;              // frames answered from the cache
+    long valid;
+    uint64_t key;
+} t_voxel_cache;
+
+static inline void voxel_cache_clear(t_voxel_cache *cache) {
+    cache->enabled = 0;
+    cache->hits = 0;
+    cache->valid = 0;
+    cache->key = 0;
+}
+
+// cache and cachehits attributes on a t_voxel_cache member
+static inline void voxel_cache_class_attrs(void *c, long cache_offset) {
+    long attrflags = JIT_ATTR_GET_DEFER_LOW | JIT_ATTR_SET_USURP_LOW;
+    long statflags = JIT_ATTR_SET_OPAQUE_USER | JIT_ATTR_GET_DEFER_LOW;
+    t_jit_object *attr;
+
+    attr = jit_object_new(_jit_sym_jit_attr_offset, "cache", _jit_sym_long, attrflags,
+                          (method)NULL, (method)NULL, cache_offset + calcoffset(t_voxel_cache, enabled));
+    jit_class_addattr(c, attr);
+    CLASS_ATTR_LABEL(c, "cache", 0, "Skip Unchanged Input");
+    CLASS_ATTR_STYLE(c, "cache", 0, "onoff");
+
+    attr = jit_object_new(_jit_sym_jit_attr_offset, "cachehits", _jit_sym_long, statflags,
+                          (method)NULL, (method)NULL, cache_offset + calcoffset(t_voxel_cache, hits));
+    jit_class_addattr(c, attr);
+}
+
+static inline uint64_t voxel_hash_round(uint64_t lane, uint64_t word) {
+    lane += word * VOXEL_HASH_PRIME2;
+    lane = (lane << 31) | (lane >> 33);
+    return lane * VOXEL_HASH_PRIME1;
+}
+
+// final avalanche, so nearby inputs land far apart
+static inline uint64_t voxel_hash_mix(uint64_t h) {
+    h ^= h >> 33;
+    h *= VOXEL_HASH_PRIME2;
+    h ^= h >> 29;
+    h *= VOXEL_HASH_PRIME3;
+    return h ^ (h >> 32);
+}
+
+// folds n bytes into h; four independent lanes keep the multiplies in flight
+static inline uint64_t voxel_hash_bytes(uint64_t h, const void *p, size_t n) {
+    const char *bytes = (const char *)p;
+    uint64_t lanes[4] = { h + VOXEL_HASH_PRIME1, h + VOXEL_HASH_PRIME2, h, h - VOXEL_HASH_PRIME1 };
+    uint64_t word;
+    size_t i = 0;
+
+    for (; i + 32 <= n; i += 32) {
+        for (int k = 0; k < 4; k++) {
+            memcpy(&word, bytes + i + k * 8, sizeof(word));
+            lanes[k] = voxel_hash_round(lanes[k], word);
+        }
+    }
+    for (; i + 8 <= n; i += 8) {
+        memcpy(&word, bytes + i, sizeof(word));
+        lanes[0] = voxel_hash_round(lanes[0], word);
+    }
+    if (i < n) {
+        word = 0;
+        memcpy(&word, bytes + i, n - i);
+        lanes[1] = voxel_hash_round(lanes[1], word);
+    }
+    h = lanes[0] ^ ((lanes[1] << 7) | (lanes[1] >> 57)) ^ ((lanes[2] << 12) | (lanes[2] >> 52)) ^
+        ((lanes[3] << 18) | (lanes[3] >> 46));
+    return voxel_hash_mix(h + n);
+}
+
+// type, planes and dims; the strides are left out since they do not change the cells
+static inline uint64_t voxel_hash_info(uint64_t h, t_jit_matrix_info *info) {
+    h = voxel_hash_bytes(h, &info->type, sizeof(info->type));
+    h = voxel_hash_bytes(h, &info->planecount, sizeof(info->planecount));
+    h = voxel_hash_bytes(h, &info->dimcount, sizeof(info->dimcount));
+    return voxel_hash_bytes(h, info->dim, info->dimcount * sizeof(info->dim[0]));
+}
+
+typedef struct _voxel_hash_frame {
+    char *bp;
+    t_jit_matrix_info *info;
+    uint64_t partials[VOXEL_MAX_THREADS];
+} t_voxel_hash_frame;
+
+// row hashes are tagged with their index and summed, so the result does not depend on
+// how the rows were split between threads
+static void voxel_hash_slab(void *ctx, long thread, long start, long end) {
+    t_voxel_hash_frame *f = (t_voxel_hash_frame *)ctx;
+    t_jit_matrix_info *info = f->info;
+    size_t row_bytes = info->dim[0] * info->dimstride[0];
+    uint64_t sum = 0;
+
+    for (long row = start; row < end; row++) {
+        long offset = 0, rest = row;
+
+        for (long d = 1; d < info->dimcount; d++) {
+            offset += (rest % info->dim[d]) * info->dimstride[d];
+            rest /= info->dim[d];
+        }
+        sum += voxel_hash_bytes((uint64_t)row * VOXEL_HASH_PRIME3, f->bp + offset, row_bytes);
+    }
+    f->partials[thread] = sum;
+}
+
+static inline uint64_t voxel_hash_matrix(long num_threads, long affinity, t_jit_matrix_info *info, char *bp) {
+    t_voxel_hash_frame frame;
+    long rows = 1, slabs;
+    uint64_t h = 0;
+
+    for (long d = 1; d < info->dimcount; d++) {
+        rows *= info->dim[d];
+    }
+    frame.bp = bp;
+    frame.info = info;
+    slabs = voxel_parallel_for(num_threads, affinity, rows, voxel_hash_slab, &frame);
+    for (long thread = 0; thread < slabs; thread++) {
+        h += frame.partials[thread];
+    }
+    return voxel_hash_info(voxel_hash_mix(h), info);
+}
+
+// key for one input and, when there is one, the output it fills. The output data
+// pointer is part of the key so a reallocated output is recomputed
+static inline uint64_t voxel_cache_key(long num_threads, long affinity, t_jit_matrix_info *in_info, char *in_bp,
+                                       t_jit_matrix_info *out_info, char *out_bp) {
+    uint64_t h = voxel_hash_matrix(num_threads, affinity, in_info, in_bp);
+
+    if (out_info) {
+        h = voxel_hash_info(h, out_info);
+        h = voxel_hash_bytes(h, &out_bp, sizeof(out_bp));
+    }
+    return h;
+}
+
+// true when the last computed frame had this key; counts the hit. On a miss the
+// outputs are about to be overwritten, so nothing is cached until the next store
+static inline int voxel_cache_hit(t_voxel_cache *cache, uint64_t key) {
+    if (cache->enabled && cache->valid && cache->key == key) {
+        cache->hits++;
+        return 1;
+    }
+    cache->valid = 0;
+    return 0;
+}
+
+// remembers the key of a frame once it has been computed; failed frames are not reused
+static inline void voxel_cache_store(t_voxel_cache *cache, uint64_t key, t_jit_err err) {
+    cache->key = key;
+    cache->valid = cache->enabled && err == JIT_ERR_NONE;
+}
+
+#endif
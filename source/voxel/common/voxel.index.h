@@ -0,0 +1,61 @@
+#ifndef VOXEL_INDEX_H
+#define VOXEL_INDEX_H
+
+// Cell-list spatial index over a point cloud, built by voxel.pcloud2grid and
+// read by voxel.neighbors through the "spatialindex" method of the registered
+// pcloud2grid object. Cells are the voxels of the grid; points of cell c are
+// points[cell_start[c] .. cell_start[c + 1]), in input order within the cell.
+typedef struct _voxel_index {
+    long dim[3];
+    long point_count;
+    float *points;          // normalized xyz, sorted by cell
+    t_int32 *ids;           // position of each sorted point in the input matrix
+    t_int32 *cell_start;    // dim[0] * dim[1] * dim[2] + 1 offsets
+    t_int32 *cells;         // per input point cell, -1 if outside the grid
+    long point_capacity;
+    long cell_capacity;
+} t_voxel_index;
+
+static inline void voxel_index_clear(t_voxel_index *index) {
+    index->dim[0] = index->dim[1] = index->dim[2] = 0;
+    index->point_count = 0;
+    index->points = NULL;
+    index->ids = NULL;
+    index->cell_start = NULL;
+    index->cells = NULL;
+    index->point_capacity = 0;
+    index->cell_capacity = 0;
+}
+
+static inline void voxel_index_free(t_voxel_index *index) {
+    if (index->points) free(index->points);
+    if (index->ids) free(index->ids);
+    if (index->cell_start) free(index->cell_start);
+    if (index->cells) free(index->cells);
+    voxel_index_clear(index);
+}
+
+// grows the buffers for point_count input points and cell_count cells
+static inline t_jit_err voxel_index_reserve(t_voxel_index *index, long point_count, long cell_count) {
+    if (point_count > index->point_capacity) {
+        if (index->points) free(index->points);
+        if (index->ids) free(index->ids);
+        if (index->cells) free(index->cells);
+        index->points = (float *)malloc(point_count * 3 * sizeof(float));
+        index->ids = (t_int32 *)malloc(point_count * sizeof(t_int32));
+        index->cells = (t_int32 *)malloc(point_count * sizeof(t_int32));
+        index->point_capacity = point_count;
+    }
+    if (cell_count + 1 > index->cell_capacity) {
+        if (index->cell_start) free(index->cell_start);
+        index->cell_start = (t_int32 *)malloc((cell_count + 1) * sizeof(t_int32));
+        index->cell_capacity = cell_count + 1;
+    }
+    if (!index->points || !index->ids || !index->cells || !index->cell_start) {
+        voxel_index_free(index);
+        return JIT_ERR_OUT_OF_MEM;
+    }
+    return JIT_ERR_NONE;
+}
+
+#endif
@@ -0,0 +1,376 @@
+#ifndef VOXEL_PARALLEL_H
+#define VOXEL_PARALLEL_H
+
+// Threads come from pthreads on every platform (winpthreads or pthreads4w on Windows).
+// Pinning on Linux needs the GNU affinity calls, so build with _GNU_SOURCE defined
+// before any system header; the CMake files do this. Without it pinning is a no-op.
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <unistd.h>
+#endif
+#if defined(__linux__)
+#include <sched.h>
+#elif defined(__APPLE__)
+#include <mach/mach.h>
+#include <mach/thread_policy.h>
+#endif
+
+#define VOXEL_MAX_THREADS 64
+#define VOXEL_MAX_CPUS 1024
+
+// called once per slab with the half-open range [start, end)
+typedef void (*t_voxel_slab_fn)(void *ctx, long thread, long start, long end);
+
+typedef struct _voxel_slab {
+    t_voxel_slab_fn fn;
+    void *ctx;
+    long thread;
+    long count;             // slabs in the dispatch
+    long start;
+    long end;
+    long affinity;
+} t_voxel_slab;
+
+// workers started on first use and kept for the life of the process, each blocked on
+// wake between dispatches. One voxel_parallel_for at a time owns them through dispatch
+typedef struct _voxel_pool {
+    pthread_mutex_t dispatch;
+    pthread_mutex_t mutex;
+    pthread_cond_t wake;
+    pthread_cond_t done;
+    pthread_t threads[VOXEL_MAX_THREADS];
+    long started;
+    long cpus;              // entries in order
+    long order[VOXEL_MAX_CPUS];     // the cpus workers are pinned to, see voxel_parallel_order
+    t_voxel_slab *slabs;
+    long count;             // slabs handed to workers in this dispatch, worker i runs slabs[i]
+    long pending;
+    unsigned long generation;
+} t_voxel_pool;
+
+static t_voxel_pool voxel_pool = { PTHREAD_MUTEX_INITIALIZER, PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER,
+                                   PTHREAD_COND_INITIALIZER };
+
+// cpus this process may run on
+static inline long voxel_parallel_cpus(void) {
+#if defined(_WIN32)
+    DWORD_PTR process, system;
+    long n = 0;
+
+    if (GetProcessAffinityMask(GetCurrentProcess(), &process, &system)) {
+        for (; process; process &= process - 1) {
+            n++;
+        }
+    }
+    return n > 0 ? n : 1;
+#else
+#if defined(__linux__) && defined(CPU_COUNT)
+    cpu_set_t set;
+
+    if (!sched_getaffinity(0, sizeof(set), &set)) {
+        return MAX(CPU_COUNT(&set), 1);
+    }
+#endif
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    return n > 0 ? n : 1;
+#endif
+}
+
+// number of slabs voxel_parallel_for uses for num_threads, before limiting to count
+static inline long voxel_parallel_threads(long num_threads) {
+    return MIN(num_threads > 0 ? num_threads : voxel_parallel_cpus(), VOXEL_MAX_THREADS);
+}
+
+// the cpus this process may run on, numa node by node and in OS order within a node,
+// so the neighboring slabs of a dispatch, which read neighboring slices, share a node.
+// Nodes come from sysfs on Linux and GetNumaNodeProcessorMaskEx on Windows; cpus
+// outside any known node, and every cpu elsewhere, follow in OS order
+static inline long voxel_parallel_order(long *order, long max) {
+    long n = 0;
+#if defined(_WIN32)
+    DWORD_PTR process, system;
+    ULONG highest = 0;
+
+    if (!GetProcessAffinityMask(GetCurrentProcess(), &process, &system)) {
+        return 0;
+    }
+    if (GetNumaHighestNodeNumber(&highest)) {
+        for (ULONG node = 0; node <= highest; node++) {
+            GROUP_AFFINITY group;
+
+            // the process mask covers its first processor group only
+            if (!GetNumaNodeProcessorMaskEx((USHORT)node, &group) || group.Group != 0) {
+                continue;
+            }
+            for (long cpu = 0; cpu < (long)(sizeof(DWORD_PTR) * 8) && n < max; cpu++) {
+                if ((group.Mask & process & ((DWORD_PTR)1 << cpu))) {
+                    order[n++] = cpu;
+                    process &= ~((DWORD_PTR)1 << cpu);
+                }
+            }
+        }
+    }
+    for (long cpu = 0; cpu < (long)(sizeof(DWORD_PTR) * 8) && n < max; cpu++) {
+        if (process & ((DWORD_PTR)1 << cpu)) {
+            order[n++] = cpu;
+        }
+    }
+#elif defined(__linux__) && defined(CPU_SET)
+    cpu_set_t allowed;
+    long left;
+
+    if (sched_getaffinity(0, sizeof(allowed), &allowed)) {
+        return 0;
+    }
+    left = CPU_COUNT(&allowed);
+    // node numbers may have gaps, so look until every allowed cpu has a node
+    for (long node = 0; node < VOXEL_MAX_CPUS && left > 0; node++) {
+        char path[64];
+        long lo, hi;
+        FILE *list;
+
+        snprintf(path, sizeof(path), "/sys/devices/system/node/node%ld/cpulist", node);
+        if (!(list = fopen(path, "r"))) {
+            if (node == 0) {
+                break;
+            }
+            continue;
+        }
+        // ranges like 0-3,8-11
+        while (fscanf(list, "%ld", &lo) == 1) {
+            if (fscanf(list, "-%ld", &hi) != 1) {
+                hi = lo;
+            }
+            for (long cpu = lo; cpu <= hi && cpu < CPU_SETSIZE && n < max; cpu++) {
+                if (CPU_ISSET(cpu, &allowed)) {
+                    order[n++] = cpu;
+                    CPU_CLR(cpu, &allowed);
+                    left--;
+                }
+            }
+            if (fgetc(list) != ',') {
+                break;
+            }
+        }
+        fclose(list);
+    }
+    for (long cpu = 0; cpu < CPU_SETSIZE && n < max; cpu++) {
+        if (CPU_ISSET(cpu, &allowed)) {
+            order[n++] = cpu;
+        }
+    }
+#endif
+    return n;
+}
+
+// pins the calling thread to one cpu from voxel_parallel_order, or with cpu < 0 lets it
+// run on every cpu the process may use again. macOS has no pinning: on Intel the cpu
+// is passed as an affinity tag, a placement hint the scheduler may ignore, and Apple
+// Silicon ignores the tag altogether
+static inline void voxel_parallel_pin(long cpu) {
+#if defined(_WIN32)
+    DWORD_PTR process, system;
+
+    if (!GetProcessAffinityMask(GetCurrentProcess(), &process, &system) || !process) {
+        return;
+    }
+    SetThreadAffinityMask(GetCurrentThread(), cpu < 0 ? process : process & ((DWORD_PTR)1 << cpu));
+#elif defined(__linux__) && defined(CPU_SET)
+    cpu_set_t set;
+
+    if (cpu < 0) {
+        if (!sched_getaffinity(0, sizeof(set), &set)) {
+            pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+        }
+        return;
+    }
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+#elif defined(__APPLE__) && defined(__x86_64__)
+    thread_affinity_policy_data_t policy = { (integer_t)(cpu < 0 ? 0 : cpu + 1) };
+    thread_policy_set(pthread_mach_thread_np(pthread_self()), THREAD_AFFINITY_POLICY,
+                      (thread_policy_t)&policy, THREAD_AFFINITY_POLICY_COUNT);
+#endif
+}
+
+// the cpu slab thread of count is pinned to: slabs are spread evenly over the order,
+// so a few slabs land on every node rather than all on the first, and consecutive
+// slabs stay together. -1 when nothing is known about the cpus
+static inline long voxel_parallel_place(long thread, long count) {
+    if (voxel_pool.cpus <= 0) {
+        return -1;
+    }
+    return voxel_pool.order[thread * voxel_pool.cpus / MAX(count, 1)];
+}
+
+static void *voxel_parallel_worker(void *arg) {
+    long index = (long)(intptr_t)arg;
+    unsigned long seen;
+    long pinned = -1;
+
+    // workers are started by a dispatch holding the mutex, which bumps the generation
+    // before this thread can take it, so that dispatch is the one before the current
+    pthread_mutex_lock(&voxel_pool.mutex);
+    seen = voxel_pool.generation - 1;
+    for (;;) {
+        t_voxel_slab slab;
+        long cpu;
+
+        while (voxel_pool.generation == seen) {
+            pthread_cond_wait(&voxel_pool.wake, &voxel_pool.mutex);
+        }
+        seen = voxel_pool.generation;
+        if (index >= voxel_pool.count) {
+            continue;
+        }
+        slab = voxel_pool.slabs[index];
+        cpu = slab.affinity ? voxel_parallel_place(slab.thread, slab.count) : -1;
+        pthread_mutex_unlock(&voxel_pool.mutex);
+
+        if (cpu != pinned) {
+            voxel_parallel_pin(cpu);
+            pinned = cpu;
+        }
+        slab.fn(slab.ctx, slab.thread, slab.start, slab.end);
+
+        pthread_mutex_lock(&voxel_pool.mutex);
+        if (--voxel_pool.pending == 0) {
+            pthread_cond_signal(&voxel_pool.done);
+        }
+    }
+    return NULL;
+}
+
+static void *voxel_parallel_spawned(void *arg) {
+    t_voxel_slab *slab = (t_voxel_slab *)arg;
+    slab->fn(slab->ctx, slab->thread, slab->start, slab->end);
+    return NULL;
+}
+
+// one thread per slab but the last, which runs on the calling thread. Used when the
+// pool is busy, from a slab of another dispatch or a second caller
+static inline void voxel_parallel_spawn(t_voxel_slab *slabs, long n) {
+    pthread_t threads[VOXEL_MAX_THREADS];
+    char started[VOXEL_MAX_THREADS];
+
+    for (long i = 0; i < n - 1; i++) {
+        started[i] = pthread_create(&threads[i], NULL, voxel_parallel_spawned, &slabs[i]) == 0;
+    }
+    slabs[n - 1].fn(slabs[n - 1].ctx, n - 1, slabs[n - 1].start, slabs[n - 1].end);
+    for (long i = 0; i < n - 1; i++) {
+        if (started[i]) {
+            pthread_join(threads[i], NULL);
+        } else {
+            // thread could not be created, do its share here
+            slabs[i].fn(slabs[i].ctx, i, slabs[i].start, slabs[i].end);
+        }
+    }
+}
+
+// Splits [0, count) into contiguous slabs, one per thread, and blocks until all are done.
+// num_threads <= 0 uses one thread per cpu. Returns the number of slabs used so callers
+// can merge per-thread partial results.
+//
+// Slabs go to the pool workers and the last one runs on the calling thread. With
+// affinity every slab goes to a worker instead, pinned to the cpu voxel_parallel_place
+// picks, so the caller is never pinned. The split depends only on count and
+// num_threads, so a given slab runs on the same worker, and with affinity the same
+// cpu and node, every frame; scratch a slab writes first is placed on that node.
+static inline long voxel_parallel_for(long num_threads, long affinity, long count, t_voxel_slab_fn fn, void *ctx) {
+    t_voxel_slab slabs[VOXEL_MAX_THREADS];
+    long n = voxel_parallel_threads(num_threads);
+    long workers;
+
+    if (count <= 0) {
+        return 0;
+    }
+    n = MIN(n, count);
+
+    long per_slab = count / n;
+    long remaining = count % n;
+    long start = 0;
+
+    for (long i = 0; i < n; i++) {
+        slabs[i].fn = fn;
+        slabs[i].ctx = ctx;
+        slabs[i].thread = i;
+        slabs[i].count = n;
+        slabs[i].start = start;
+        slabs[i].end = start + per_slab + (i < remaining ? 1 : 0);
+        slabs[i].affinity = affinity;
+        start = slabs[i].end;
+    }
+
+    if (n == 1 && !affinity) {
+        fn(ctx, 0, slabs[0].start, slabs[0].end);
+        return 1;
+    }
+    if (pthread_mutex_trylock(&voxel_pool.dispatch)) {
+        voxel_parallel_spawn(slabs, n);
+        return n;
+    }
+
+    workers = affinity ? n : n - 1;
+    pthread_mutex_lock(&voxel_pool.mutex);
+    if (!voxel_pool.started) {
+        voxel_pool.cpus = voxel_parallel_order(voxel_pool.order, VOXEL_MAX_CPUS);
+    }
+    while (voxel_pool.started < workers &&
+           !pthread_create(&voxel_pool.threads[voxel_pool.started], NULL, voxel_parallel_worker,
+                           (void *)(intptr_t)voxel_pool.started)) {
+        pthread_detach(voxel_pool.threads[voxel_pool.started]);
+        voxel_pool.started++;
+    }
+    // slabs past the workers that could be started run here
+    workers = MIN(workers, voxel_pool.started);
+    voxel_pool.slabs = slabs;
+    voxel_pool.count = workers;
+    voxel_pool.pending = workers;
+    voxel_pool.generation++;
+    pthread_cond_broadcast(&voxel_pool.wake);
+    pthread_mutex_unlock(&voxel_pool.mutex);
+
+    for (long i = workers; i < n; i++) {
+        fn(ctx, i, slabs[i].start, slabs[i].end);
+    }
+
+    pthread_mutex_lock(&voxel_pool.mutex);
+    while (voxel_pool.pending) {
+        pthread_cond_wait(&voxel_pool.done, &voxel_pool.mutex);
+    }
+    voxel_pool.count = 0;
+    pthread_mutex_unlock(&voxel_pool.mutex);
+    pthread_mutex_unlock(&voxel_pool.dispatch);
+
+    return n;
+}
+
+// threads, affinity and calctime attributes shared by every threaded kernel
+static inline void voxel_parallel_class_attrs(void *c, long threads_offset, long affinity_offset, long calctime_offset) {
+    long attrflags = JIT_ATTR_GET_DEFER_LOW | JIT_ATTR_SET_USURP_LOW;
+    long statflags = JIT_ATTR_SET_OPAQUE_USER | JIT_ATTR_GET_DEFER_LOW;
+    t_jit_object *attr;
+
+    attr = jit_object_new(_jit_sym_jit_attr_offset, "threads", _jit_sym_long, attrflags,
+                          (method)NULL, (method)NULL, threads_offset);
+    jit_class_addattr(c, attr);
+    CLASS_ATTR_LABEL(c, "threads", 0, "Worker Threads (0 = All CPUs)");
+    CLASS_ATTR_FILTER_CLIP(c, "threads", 0, VOXEL_MAX_THREADS);
+
+    attr = jit_object_new(_jit_sym_jit_attr_offset, "affinity", _jit_sym_long, attrflags,
+                          (method)NULL, (method)NULL, affinity_offset);
+    jit_class_addattr(c, attr);
+    CLASS_ATTR_LABEL(c, "affinity", 0, "Pin Worker Threads");
+    CLASS_ATTR_STYLE(c, "affinity", 0, "onoff");
+
+    attr = jit_object_new(_jit_sym_jit_attr_offset, "calctime", _jit_sym_float32, statflags,
+                          (method)NULL, (method)NULL, calctime_offset);
+    jit_class_addattr(c, attr);
+}
+
+#endif
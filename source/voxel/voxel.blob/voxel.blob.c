@@ -0,0 +1,674 @@
+#include "jit.common.h"
+#include "voxel.parallel.h"
+#include "voxel.arena.h"
+#include "voxel.half.h"
+
+#define BLOB_PLANES 17
+#define BLOB_MAX_OUTPUT 4096
+
+// one run of occupied voxels along x in a row, [start, end)
+typedef struct _blob_run {
+    long start;
+    long end;
+    long label;             // node the run was added to; may have been merged since
+} t_blob_run;
+
+// running moments of one provisional label. Positions are voxel indices relative to
+// the grid center to keep the second moments small
+typedef struct _blob_node {
+    long count;
+    long first;             // linear index of the first voxel in scan order
+    double moments[10];     // weight; weighted x y z; weighted xx xy xz yy yz zz
+} t_blob_node;
+
+// per thread state. Buffers come from the thread's own arena, released after the
+// merge, so steady frames do not allocate. Slices of runs alternate between buffers
+// 0 and 1; the slab's first slice goes in buffer 2 and stays there for the merge with
+// the slab before it
+typedef struct _blob_slab {
+    t_voxel_arena arena;
+    t_blob_node *nodes;
+    long *parent;
+    long nodes_used;
+    long nodes_size;
+    long parent_size;
+    t_blob_run *runs[3];
+    long runs_size[3];
+    long *rows[3];          // first run of each row, dim[1] + 1 entries
+    long rows_size[3];
+    float *line;
+    long line_size;
+    long start;
+    long end;
+    long error;
+} t_blob_slab;
+
+typedef struct _blob {
+    t_object ob;
+    t_symbol *precision;
+    t_symbol *connectivity;
+    long minsize;
+    long maxblobs;
+    long blobs;
+    t_blob_slab slabs[VOXEL_MAX_THREADS];
+    t_voxel_arena arena;
+    long allocations;
+    long num_threads;
+    long affinity;
+    float calctime;
+} t_blob;
+
+typedef struct _blob_frame {
+    t_blob *x;
+    char *in_bp;
+    long *in_stride;
+    long format;
+    long *dim;
+    long center[3];
+    const long *reach;
+} t_blob_frame;
+
+typedef struct _blob_order {
+    long count;
+    long first;
+    long index;
+} t_blob_order;
+
+BEGIN_USING_C_LINKAGE
+t_jit_err blob_init(void);
+t_blob *blob_new(void);
+void blob_free(t_blob *x);
+t_jit_err blob_matrix_calc(t_blob *x, void *inputs, void *outputs);
+END_USING_C_LINKAGE
+
+static void *_blob_class = NULL;
+
+static t_symbol *ps_face;
+static t_symbol *ps_edge;
+static t_symbol *ps_vertex;
+static t_symbol *ps_half;
+
+// how far apart in x two runs may end and still touch, for the row above in the same
+// slice and the rows y - 1, y, y + 1 of the slice before; -1 where no voxel of the
+// row is a neighbor. Rows are face, edge and vertex connectivity
+static const long blob_reach[3][4] = {
+    { 0, -1, 0, -1 },
+    { 1, 0, 1, 0 },
+    { 1, 1, 1, 1 },
+};
+
+t_jit_err blob_init(void) {
+    long attrflags = JIT_ATTR_GET_DEFER_LOW | JIT_ATTR_SET_USURP_LOW;
+    long statflags = JIT_ATTR_SET_OPAQUE_USER | JIT_ATTR_GET_DEFER_LOW;
+    t_jit_object *attr;
+    t_jit_object *mop;
+
+    ps_face = gensym("face");
+    ps_edge = gensym("edge");
+    ps_vertex = gensym("vertex");
+    ps_half = gensym("half");
+
+    _blob_class = jit_class_new("blob", (method)blob_new, (method)blob_free, sizeof(t_blob), 0L);
+
+    // one cell per blob, sized in calc
+    mop = jit_object_new(_jit_sym_jit_mop, 1, 1);
+    jit_mop_output_nolink(mop, 1);
+    jit_class_addadornment(_blob_class, mop);
+
+    // methods
+    jit_class_addmethod(_blob_class, (method)blob_matrix_calc, "matrix_calc", A_CANT, 0L);
+
+    // attributes
+    attr = jit_object_new(_jit_sym_jit_attr_offset, "connectivity", _jit_sym_symbol, attrflags,
+                          (method)NULL, (method)NULL, calcoffset(t_blob, connectivity));
+    jit_class_addattr(_blob_class, attr);
+    CLASS_ATTR_LABEL(_blob_class, "connectivity", 0, "Neighbors Share A");
+    CLASS_ATTR_ENUM(_blob_class, "connectivity", 0, "face edge vertex");
+
+    attr = jit_object_new(_jit_sym_jit_attr_offset, "minsize", _jit_sym_long, attrflags,
+                          (method)NULL, (method)NULL, calcoffset(t_blob, minsize));
+    jit_class_addattr(_blob_class, attr);
+    CLASS_ATTR_LABEL(_blob_class, "minsize", 0, "Minimum Voxels Per Blob");
+
+    attr = jit_object_new(_jit_sym_jit_attr_offset, "maxblobs", _jit_sym_long, attrflags,
+                          (method)NULL, (method)NULL, calcoffset(t_blob, maxblobs));
+    jit_class_addattr(_blob_class, attr);
+    CLASS_ATTR_LABEL(_blob_class, "maxblobs", 0, "Maximum Blobs Output");
+
+    attr = jit_object_new(_jit_sym_jit_attr_offset, "blobs", _jit_sym_long, statflags,
+                          (method)NULL, (method)NULL, calcoffset(t_blob, blobs));
+    jit_class_addattr(_blob_class, attr);
+
+    attr = jit_object_new(_jit_sym_jit_attr_offset, "allocations", _jit_sym_long, statflags,
+                          (method)NULL, (method)NULL, calcoffset(t_blob, allocations));
+    jit_class_addattr(_blob_class, attr);
+
+    voxel_grid_class_attrs(_blob_class, calcoffset(t_blob, precision));
+    voxel_parallel_class_attrs(_blob_class, calcoffset(t_blob, num_threads), calcoffset(t_blob, affinity), calcoffset(t_blob, calctime));
+
+    jit_class_register(_blob_class);
+
+    return JIT_ERR_NONE;
+}
+
+t_blob *blob_new(void) {
+    t_blob *x;
+
+    if ((x = (t_blob *)jit_object_alloc(_blob_class))) {
+        x->precision = _jit_sym_float32;
+        x->connectivity = ps_vertex;
+        x->minsize = 1;
+        x->maxblobs = 64;
+        x->blobs = 0;
+        memset(x->slabs, 0, sizeof(x->slabs));
+        for (long i = 0; i < VOXEL_MAX_THREADS; i++) {
+            voxel_arena_init(&x->slabs[i].arena);
+        }
+        voxel_arena_init(&x->arena);
+        x->allocations = 0;
+        x->num_threads = 0;
+        x->affinity = 0;
+        x->calctime = 0.0f;
+    } else {
+        x = NULL;
+    }
+
+    return x;
+}
+
+void blob_free(t_blob *x) {
+    for (long i = 0; i < VOXEL_MAX_THREADS; i++) {
+        voxel_arena_free(&x->slabs[i].arena);
+    }
+    voxel_arena_free(&x->arena);
+}
+
+// grows *p to at least need elements of bytes each from the slab's arena, keeping the
+// first used. The old block stays borrowed until the release after the merge
+static int blob_reserve(t_blob_slab *s, void **p, long *size, long used, long need, size_t bytes) {
+    if (need > *size) {
+        long grown = MAX(need, *size * 2);
+        void *q = voxel_arena_alloc(&s->arena, grown * bytes);
+
+        if (!q) {
+            return 0;
+        }
+        if (used) {
+            memcpy(q, *p, used * bytes);
+        }
+        *p = q;
+        *size = grown;
+    }
+    return 1;
+}
+
+// forgets the buffers of the last frame, whose blocks the release handed back
+static void blob_slab_reset(t_blob_slab *s) {
+    s->nodes = NULL;
+    s->parent = NULL;
+    s->nodes_size = s->parent_size = 0;
+    for (int b = 0; b < 3; b++) {
+        s->runs[b] = NULL;
+        s->rows[b] = NULL;
+        s->runs_size[b] = s->rows_size[b] = 0;
+    }
+    s->line = NULL;
+    s->line_size = 0;
+}
+
+static long blob_find(long *parent, long i) {
+    while (parent[i] != i) {
+        parent[i] = parent[parent[i]];
+        i = parent[i];
+    }
+    return i;
+}
+
+// the lower label becomes the root, so a root is always the label created first
+static long blob_union(long *parent, long a, long b) {
+    a = blob_find(parent, a);
+    b = blob_find(parent, b);
+    if (a > b) {
+        long swap = a;
+        a = b;
+        b = swap;
+    }
+    parent[b] = a;
+    return a;
+}
+
+// merges label with every run of a neighboring row that run touches and returns the
+// root; label < 0 takes the first touching run's root. Runs arrive in increasing x, so
+// the cursor skips the neighbors left behind for good
+static long blob_link(long *parent, const t_blob_run *row, long count, long *cursor, long reach, long offset,
+                      const t_blob_run *run, long label) {
+    long i;
+
+    while (*cursor < count && row[*cursor].end + reach <= run->start) {
+        (*cursor)++;
+    }
+    for (i = *cursor; i < count && row[i].start < run->end + reach; i++) {
+        long neighbor = row[i].label + offset;
+
+        label = label < 0 ? blob_find(parent, neighbor) : blob_union(parent, label, neighbor);
+    }
+    return label;
+}
+
+// one row of the input as packed floats
+static const float *blob_row(t_blob_frame *f, t_blob_slab *s, long vox_y, long vox_z) {
+    char *row = f->in_bp + vox_y * f->in_stride[1] + vox_z * f->in_stride[2];
+
+    if (f->format == VOXEL_GRID_HALF) {
+        voxel_half_load(row, f->in_stride[0], s->line, f->dim[0]);
+        return s->line;
+    }
+    if (f->in_stride[0] == sizeof(float)) {
+        return (const float *)row;
+    }
+    for (long vox_x = 0; vox_x < f->dim[0]; vox_x++) {
+        s->line[vox_x] = *(float *)(row + vox_x * f->in_stride[0]);
+    }
+    return s->line;
+}
+
+// streams the slices of one z slab: every row is cut into runs, each run is joined to
+// the runs it touches in the row above and in the slice before, and its moments are
+// added to its label. Only two slices of runs are kept, plus the slab's first slice
+static void blob_slab(void *ctx, long thread, long start, long end) {
+    t_blob_frame *f = (t_blob_frame *)ctx;
+    t_blob_slab *s = &f->x->slabs[thread];
+    long *dim = f->dim;
+    long prev = -1;
+
+    blob_slab_reset(s);
+    s->nodes_used = 0;
+    s->start = start;
+    s->end = end;
+    s->error = 0;
+
+    for (int b = 0; b < 3; b++) {
+        if (!blob_reserve(s, (void **)&s->rows[b], &s->rows_size[b], 0, dim[1] + 1, sizeof(long))) {
+            s->error = 1;
+            return;
+        }
+    }
+    if (!blob_reserve(s, (void **)&s->line, &s->line_size, 0, dim[0], sizeof(float))) {
+        s->error = 1;
+        return;
+    }
+
+    for (long vox_z = start; vox_z < end; vox_z++) {
+        long cur = vox_z == start ? 2 : (vox_z - start) & 1;
+        long *rows = s->rows[cur];
+        long used = 0;
+
+        for (long vox_y = 0; vox_y < dim[1]; vox_y++) {
+            const float *v = blob_row(f, s, vox_y, vox_z);
+            const t_blob_run *near[4] = { NULL, NULL, NULL, NULL };
+            long count[4] = { 0, 0, 0, 0 }, cursor[4] = { 0, 0, 0, 0 };
+            double cy = vox_y - f->center[1], cz = vox_z - f->center[2];
+            t_blob_run *runs;
+
+            // a row holds at most one run per two voxels
+            if (!blob_reserve(s, (void **)&s->runs[cur], &s->runs_size[cur], used, used + (dim[0] + 1) / 2, sizeof(t_blob_run))) {
+                s->error = 1;
+                return;
+            }
+            runs = s->runs[cur];
+            rows[vox_y] = used;
+
+            if (vox_y > 0) {
+                near[0] = runs + rows[vox_y - 1];
+                count[0] = used - rows[vox_y - 1];
+            }
+            for (long j = 1; j < 4 && prev >= 0; j++) {
+                long y = vox_y + j - 2;
+
+                if (y >= 0 && y < dim[1] && f->reach[j] >= 0) {
+                    near[j] = s->runs[prev] + s->rows[prev][y];
+                    count[j] = s->rows[prev][y + 1] - s->rows[prev][y];
+                }
+            }
+
+            for (long vox_x = 0; vox_x < dim[0];) {
+                t_blob_run *run;
+                t_blob_node *node;
+                double weight = 0.0, wx = 0.0, wxx = 0.0;
+                long label = -1;
+
+                if (!(v[vox_x] > 0)) {
+                    vox_x++;
+                    continue;
+                }
+                run = &runs[used];
+                run->start = vox_x;
+                for (; vox_x < dim[0] && v[vox_x] > 0; vox_x++) {
+                    double w = v[vox_x], cx = vox_x - f->center[0];
+
+                    weight += w;
+                    wx += w * cx;
+                    wxx += w * cx * cx;
+                }
+                run->end = vox_x;
+
+                for (int j = 0; j < 4; j++) {
+                    if (count[j]) {
+                        label = blob_link(s->parent, near[j], count[j], &cursor[j], f->reach[j], 0, run, label);
+                    }
+                }
+                if (label < 0) {
+                    if (!blob_reserve(s, (void **)&s->nodes, &s->nodes_size, s->nodes_used, s->nodes_used + 1, sizeof(t_blob_node)) ||
+                        !blob_reserve(s, (void **)&s->parent, &s->parent_size, s->nodes_used, s->nodes_used + 1, sizeof(long))) {
+                        s->error = 1;
+                        return;
+                    }
+                    label = s->nodes_used++;
+                    s->parent[label] = label;
+                    node = &s->nodes[label];
+                    memset(node, 0, sizeof(t_blob_node));
+                    node->first = run->start + vox_y * dim[0] + vox_z * dim[0] * dim[1];
+                }
+                run->label = label;
+                used++;
+
+                node = &s->nodes[label];
+                node->count += run->end - run->start;
+                node->moments[0] += weight;
+                node->moments[1] += wx;
+                node->moments[2] += cy * weight;
+                node->moments[3] += cz * weight;
+                node->moments[4] += wxx;
+                node->moments[5] += cy * wx;
+                node->moments[6] += cz * wx;
+                node->moments[7] += cy * cy * weight;
+                node->moments[8] += cy * cz * weight;
+                node->moments[9] += cz * cz * weight;
+            }
+        }
+        rows[dim[1]] = used;
+        prev = cur;
+    }
+}
+
+// eigen decomposition of a symmetric 3x3 matrix (xx xy xz yy yz zz) by cyclic Jacobi
+// rotations; values come out in descending order with axes[i] the unit axis of values[i]
+static void blob_eigen(const double *cov, double *values, double axes[3][3]) {
+    double a[3][3] = { { cov[0], cov[1], cov[2] }, { cov[1], cov[3], cov[4] }, { cov[2], cov[4], cov[5] } };
+    double v[3][3] = { { 1.0, 0.0, 0.0 }, { 0.0, 1.0, 0.0 }, { 0.0, 0.0, 1.0 } };
+    int order[3] = { 0, 1, 2 };
+
+    for (int sweep = 0; sweep < 32; sweep++) {
+        double off = a[0][1] * a[0][1] + a[0][2] * a[0][2] + a[1][2] * a[1][2];
+        double diagonal = a[0][0] * a[0][0] + a[1][1] * a[1][1] + a[2][2] * a[2][2];
+
+        if (off <= 1e-30 * diagonal) {
+            break;
+        }
+        for (int p = 0; p < 2; p++) {
+            for (int q = p + 1; q < 3; q++) {
+                double theta, t, c, s;
+
+                if (a[p][q] == 0.0) {
+                    continue;
+                }
+                theta = (a[q][q] - a[p][p]) / (2.0 * a[p][q]);
+                t = (theta >= 0.0 ? 1.0 : -1.0) / (fabs(theta) + sqrt(theta * theta + 1.0));
+                c = 1.0 / sqrt(t * t + 1.0);
+                s = t * c;
+                for (int k = 0; k < 3; k++) {
+                    double kp = a[k][p], kq = a[k][q];
+                    a[k][p] = c * kp - s * kq;
+                    a[k][q] = s * kp + c * kq;
+                }
+                for (int k = 0; k < 3; k++) {
+                    double pk = a[p][k], qk = a[q][k];
+                    a[p][k] = c * pk - s * qk;
+                    a[q][k] = s * pk + c * qk;
+                }
+                for (int k = 0; k < 3; k++) {
+                    double kp = v[k][p], kq = v[k][q];
+                    v[k][p] = c * kp - s * kq;
+                    v[k][q] = s * kp + c * kq;
+                }
+            }
+        }
+    }
+
+    for (int i = 0; i < 2; i++) {
+        for (int j = i + 1; j < 3; j++) {
+            if (a[order[j]][order[j]] > a[order[i]][order[i]]) {
+                int swap = order[i];
+                order[i] = order[j];
+                order[j] = swap;
+            }
+        }
+    }
+    for (int i = 0; i < 3; i++) {
+        values[i] = a[order[i]][order[i]];
+        for (int k = 0; k < 3; k++) {
+            axes[i][k] = v[k][order[i]];
+        }
+    }
+}
+
+// count, mass, mean, axes and extents of one merged label. The axes are the
+// covariance eigenvectors, major first, each pointing along its largest component
+// with the minor axis completing a right handed frame; the extents are the half
+// lengths sqrt(3 lambda) of the box with the same second moments
+static void blob_output(t_blob_frame *f, t_blob_node *node, float *out) {
+    double *m = node->moments;
+    double mean[3], cov[6], values[3], axes[3][3];
+    long *dim = f->dim;
+
+    for (int a = 0; a < 3; a++) {
+        mean[a] = m[1 + a] / m[0];
+    }
+    cov[0] = (m[4] / m[0] - mean[0] * mean[0]) / ((double)dim[0] * dim[0]);
+    cov[1] = (m[5] / m[0] - mean[0] * mean[1]) / ((double)dim[0] * dim[1]);
+    cov[2] = (m[6] / m[0] - mean[0] * mean[2]) / ((double)dim[0] * dim[2]);
+    cov[3] = (m[7] / m[0] - mean[1] * mean[1]) / ((double)dim[1] * dim[1]);
+    cov[4] = (m[8] / m[0] - mean[1] * mean[2]) / ((double)dim[1] * dim[2]);
+    cov[5] = (m[9] / m[0] - mean[2] * mean[2]) / ((double)dim[2] * dim[2]);
+    blob_eigen(cov, values, axes);
+
+    for (int i = 0; i < 2; i++) {
+        int largest = 0;
+
+        for (int k = 1; k < 3; k++) {
+            if (fabs(axes[i][k]) > fabs(axes[i][largest])) {
+                largest = k;
+            }
+        }
+        if (axes[i][largest] < 0.0) {
+            for (int k = 0; k < 3; k++) {
+                axes[i][k] = -axes[i][k];
+            }
+        }
+    }
+    axes[2][0] = axes[0][1] * axes[1][2] - axes[0][2] * axes[1][1];
+    axes[2][1] = axes[0][2] * axes[1][0] - axes[0][0] * axes[1][2];
+    axes[2][2] = axes[0][0] * axes[1][1] - axes[0][1] * axes[1][0];
+
+    out[0] = (float)node->count;
+    out[1] = (float)m[0];
+    for (int a = 0; a < 3; a++) {
+        out[2 + a] = (float)((mean[a] + f->center[a] + 0.5) / dim[a]);
+    }
+    for (int i = 0; i < 3; i++) {
+        for (int k = 0; k < 3; k++) {
+            out[5 + i * 3 + k] = (float)axes[i][k];
+        }
+        out[14 + i] = (float)sqrt(3.0 * MAX(values[i], 0.0));
+    }
+}
+
+// most voxels first, then scan order
+static int blob_compare(const void *a, const void *b) {
+    const t_blob_order *p = (const t_blob_order *)a, *q = (const t_blob_order *)b;
+
+    if (p->count != q->count) {
+        return p->count > q->count ? -1 : 1;
+    }
+    return p->first < q->first ? -1 : p->first > q->first;
+}
+
+t_jit_err blob_matrix_calc(t_blob *x, void *inputs, void *outputs) {
+    double calc_start = systimer_gettime();
+    t_jit_err err = JIT_ERR_NONE;
+    t_jit_matrix_info in_minfo, out_minfo;
+    t_jit_object *in_matrix, *out_matrix;
+    long in_savelock, out_savelock, planes, slabs, total = 0, roots = 0, emitted;
+    long offset[VOXEL_MAX_THREADS];
+    void *in_mdata, *out_mdata;
+    t_blob_frame frame;
+    t_blob_node *nodes;
+    t_blob_order *order;
+    long *parent;
+
+    in_matrix = jit_object_method(inputs, _jit_sym_getindex, 0);
+    out_matrix = jit_object_method(outputs, _jit_sym_getindex, 0);
+
+    if (!in_matrix || !out_matrix) {
+        return JIT_ERR_INVALID_INPUT;
+    }
+
+    in_savelock = (long)jit_object_method(in_matrix, _jit_sym_lock, 1);
+    out_savelock = (long)jit_object_method(out_matrix, _jit_sym_lock, 1);
+
+    jit_object_method(in_matrix, _jit_sym_getinfo, &in_minfo);
+    jit_object_method(in_matrix, _jit_sym_getdata, &in_mdata);
+
+    if (!in_mdata) {
+        err = JIT_ERR_INVALID_INPUT;
+        goto out;
+    }
+
+    // single plane 3d grid, float32 or half stored as char pairs
+    frame.format = voxel_grid_format(&in_minfo, x->precision == ps_half, &planes);
+    if (frame.format == VOXEL_GRID_INVALID || planes != 1 || in_minfo.dimcount != 3) {
+        err = JIT_ERR_MISMATCH_TYPE;
+        goto out;
+    }
+
+    frame.x = x;
+    frame.in_bp = (char *)in_mdata;
+    frame.in_stride = in_minfo.dimstride;
+    frame.dim = in_minfo.dim;
+    frame.reach = x->connectivity == ps_face ? blob_reach[0] : x->connectivity == ps_edge ? blob_reach[1] : blob_reach[2];
+    for (int a = 0; a < 3; a++) {
+        frame.center[a] = in_minfo.dim[a] / 2;
+    }
+
+    slabs = voxel_parallel_for(x->num_threads, x->affinity, in_minfo.dim[2], blob_slab, &frame);
+
+    for (long thread = 0; thread < slabs; thread++) {
+        if (x->slabs[thread].error) {
+            err = JIT_ERR_OUT_OF_MEM;
+            goto out;
+        }
+        offset[thread] = total;
+        total += x->slabs[thread].nodes_used;
+    }
+
+    // labels of all slabs in one forest, in slab order so roots stay the first created
+    nodes = (t_blob_node *)voxel_arena_alloc(&x->arena, MAX(total, 1) * sizeof(t_blob_node));
+    parent = (long *)voxel_arena_alloc(&x->arena, MAX(total, 1) * sizeof(long));
+    order = (t_blob_order *)voxel_arena_alloc(&x->arena, MAX(total, 1) * sizeof(t_blob_order));
+    if (!nodes || !parent || !order) {
+        err = JIT_ERR_OUT_OF_MEM;
+        goto out;
+    }
+    for (long thread = 0; thread < slabs; thread++) {
+        t_blob_slab *s = &x->slabs[thread];
+
+        for (long i = 0; i < s->nodes_used; i++) {
+            nodes[offset[thread] + i] = s->nodes[i];
+            parent[offset[thread] + i] = offset[thread] + s->parent[i];
+        }
+    }
+
+    // join each slab's first slice to the last slice of the slab before
+    for (long thread = 1; thread < slabs; thread++) {
+        t_blob_slab *below = &x->slabs[thread - 1], *s = &x->slabs[thread];
+        long tail = below->end - 1 == below->start ? 2 : (below->end - 1 - below->start) & 1;
+
+        for (long vox_y = 0; vox_y < in_minfo.dim[1]; vox_y++) {
+            long cursor[3] = { 0, 0, 0 };
+
+            for (long i = s->rows[2][vox_y]; i < s->rows[2][vox_y + 1]; i++) {
+                long label = offset[thread] + s->runs[2][i].label;
+
+                for (long j = 1; j < 4; j++) {
+                    long y = vox_y + j - 2;
+
+                    if (y >= 0 && y < in_minfo.dim[1] && frame.reach[j] >= 0) {
+                        label = blob_link(parent, below->runs[tail] + below->rows[tail][y], below->rows[tail][y + 1] - below->rows[tail][y],
+                                          &cursor[j - 1], frame.reach[j], offset[thread - 1], &s->runs[2][i], label);
+                    }
+                }
+            }
+        }
+    }
+
+    // fold every label into its root
+    for (long i = 0; i < total; i++) {
+        long root = blob_find(parent, i);
+
+        if (root != i) {
+            nodes[root].count += nodes[i].count;
+            for (int k = 0; k < 10; k++) {
+                nodes[root].moments[k] += nodes[i].moments[k];
+            }
+        }
+    }
+    x->blobs = 0;
+    for (long i = 0; i < total; i++) {
+        if (parent[i] == i) {
+            roots++;
+            if (nodes[i].count >= x->minsize) {
+                order[x->blobs].count = nodes[i].count;
+                order[x->blobs].first = nodes[i].first;
+                order[x->blobs].index = i;
+                x->blobs++;
+            }
+        }
+    }
+    qsort(order, x->blobs, sizeof(t_blob_order), blob_compare);
+    emitted = MIN(x->blobs, CLAMP(x->maxblobs, 1, BLOB_MAX_OUTPUT));
+
+    // count, mass, mean xyz, major, middle and minor axis, extents along them
+    out_minfo = in_minfo;
+    out_minfo.type = _jit_sym_float32;
+    out_minfo.planecount = BLOB_PLANES;
+    out_minfo.dimcount = 1;
+    out_minfo.dim[0] = MAX(emitted, 1);
+    jit_object_method(out_matrix, _jit_sym_setinfo, &out_minfo);
+    jit_object_method(out_matrix, _jit_sym_getinfo, &out_minfo);
+    jit_object_method(out_matrix, _jit_sym_getdata, &out_mdata);
+
+    if (!out_mdata) {
+        err = JIT_ERR_INVALID_OUTPUT;
+        goto out;
+    }
+
+    // an empty grid still gets one cell, with a count of zero
+    if (!emitted) {
+        memset(out_mdata, 0, BLOB_PLANES * sizeof(float));
+    }
+    for (long i = 0; i < emitted; i++) {
+        blob_output(&frame, &nodes[order[i].index], (float *)((char *)out_mdata + i * out_minfo.dimstride[0]));
+    }
+
+out:
+    x->calctime = (float)(systimer_gettime() - calc_start);
+    voxel_arena_release(&x->arena);
+    x->allocations = x->arena.allocations;
+    for (long thread = 0; thread < VOXEL_MAX_THREADS; thread++) {
+        voxel_arena_release(&x->slabs[thread].arena);
+        x->allocations += x->slabs[thread].arena.allocations;
+    }
+    jit_object_method(in_matrix, _jit_sym_lock, in_savelock);
+    jit_object_method(out_matrix, _jit_sym_lock, out_savelock);
+    return err;
+}
@@ -1,10 +1,35 @@
 #include "jit.common.h"
+#include "voxel.parallel.h"
+#include "voxel.arena.h"
+#include "voxel.half.h"
+#include "voxel.hash.h"
+#include "voxel.centroid.h"
 
 typedef struct _centroid {
     t_object ob;
+    t_symbol *precision;
     float mean[3];
+    float means[CENTROID_MAX_GRIDS * 3];
+    long means_count;
+    t_voxel_arena arena;
+    long allocations;
+    t_voxel_cache cache;
+    long num_threads;
+    long affinity;
+    float calctime;
 } t_centroid;
 
+typedef struct _centroid_frame {
+    char *in_bp;
+    long *dim;
+    long *stride;
+    long batch_stride;
+    long format;
+    float *lines;           // one row per thread for converting half grids
+    size_t line_stride;     // bytes from one thread's row to the next
+    double *partials;
+} t_centroid_frame;
+
 BEGIN_USING_C_LINKAGE
 t_jit_err centroid_init(void);
 t_centroid *centroid_new(void);
@@ -13,12 +38,16 @@ t_jit_err centroid_matrix_calc(t_centroid *x, void *inputs, void *outputs);
 END_USING_C_LINKAGE
 
 static void *_centroid_class = NULL;
+static t_symbol *ps_half;
 
 t_jit_err centroid_init(void) {
     long attrflags = JIT_ATTR_SET_OPAQUE_USER | JIT_ATTR_GET_DEFER_LOW;
+    long statflags = JIT_ATTR_SET_OPAQUE_USER | JIT_ATTR_GET_DEFER_LOW;
     t_jit_object *attr;
     t_jit_object *mop;
 
+    ps_half = gensym("half");
+
     _centroid_class = jit_class_new("centroid", (method)centroid_new, (method)centroid_free, sizeof(t_centroid), 0L);
 
     mop = jit_object_new(_jit_sym_jit_mop, 1, 0);
@@ -32,6 +61,18 @@ t_jit_err centroid_init(void) {
         (method)0L, (method)0L, 0, calcoffset(t_centroid, mean));
     jit_class_addattr(_centroid_class, attr);
 
+    attr = jit_object_new(_jit_sym_jit_attr_offset_array, "means", _jit_sym_float32, CENTROID_MAX_GRIDS * 3, attrflags,
+        (method)0L, (method)0L, calcoffset(t_centroid, means_count), calcoffset(t_centroid, means));
+    jit_class_addattr(_centroid_class, attr);
+
+    attr = jit_object_new(_jit_sym_jit_attr_offset, "allocations", _jit_sym_long, statflags,
+        (method)0L, (method)0L, calcoffset(t_centroid, allocations));
+    jit_class_addattr(_centroid_class, attr);
+
+    voxel_grid_class_attrs(_centroid_class, calcoffset(t_centroid, precision));
+    voxel_cache_class_attrs(_centroid_class, calcoffset(t_centroid, cache));
+    voxel_parallel_class_attrs(_centroid_class, calcoffset(t_centroid, num_threads), calcoffset(t_centroid, affinity), calcoffset(t_centroid, calctime));
+
     jit_class_register(_centroid_class);
 
     return JIT_ERR_NONE;
@@ -41,10 +82,18 @@ t_centroid *centroid_new(void) {
     t_centroid *x;
 
     if ((x = (t_centroid *)jit_object_alloc(_centroid_class))) {
+        x->precision = _jit_sym_float32;
         // Initialize mean values to 0
         x->mean[0] = 0.0f;
         x->mean[1] = 0.0f;
         x->mean[2] = 0.0f;
+        x->means_count = 0;
+        voxel_arena_init(&x->arena);
+        x->allocations = 0;
+        voxel_cache_clear(&x->cache);
+        x->num_threads = 0;
+        x->affinity = 0;
+        x->calctime = 0.0f;
     } else {
         x = NULL;
     }
@@ -53,9 +102,48 @@ t_centroid *centroid_new(void) {
 }
 
 void centroid_free(t_centroid *x) {
+    voxel_arena_free(&x->arena);
+}
+
+// weighted position sums for each slice of each grid: x, y, z, weight
+static void centroid_slab(void *ctx, long thread, long start, long end) {
+    t_centroid_frame *f = (t_centroid_frame *)ctx;
+    long *dim = f->dim;
+
+    for (long slice = start; slice < end; slice++) {
+        long grid = slice / dim[2];
+        long vox_z = slice % dim[2];
+        char *in_bp = f->in_bp + grid * f->batch_stride;
+        double sum[4] = { 0.0, 0.0, 0.0, 0.0 };
+
+        for (long vox_y = 0; vox_y < dim[1]; vox_y++) {
+            char *row = in_bp + vox_y * f->stride[1] + vox_z * f->stride[2];
+            float *line = NULL;
+
+            if (f->format == VOXEL_GRID_HALF) {
+                line = (float *)((char *)f->lines + thread * f->line_stride);
+                voxel_half_load(row, f->stride[0], line, dim[0]);
+            }
+            for (long vox_x = 0; vox_x < dim[0]; vox_x++) {
+                float weight = line ? line[vox_x] : *(float *)(row + vox_x * f->stride[0]);
+
+                if (weight > 0) {
+                    sum[0] += ((float)vox_x / dim[0] + 1.0f / dim[0] * .5f) * weight;
+                    sum[1] += ((float)vox_y / dim[1] + 1.0f / dim[1] * .5f) * weight;
+                    sum[2] += ((float)vox_z / dim[2] + 1.0f / dim[2] * .5f) * weight;
+                    sum[3] += weight;
+                }
+            }
+        }
+
+        for (int j = 0; j < 4; j++) {
+            f->partials[slice * 4 + j] = sum[j];
+        }
+    }
 }
 
 t_jit_err centroid_matrix_calc(t_centroid *x, void *inputs, void *outputs) {
+    double calc_start = systimer_gettime();
     t_jit_err err = JIT_ERR_NONE;
     t_jit_matrix_info in_minfo;
     char *in_bp;
@@ -63,10 +151,10 @@ t_jit_err centroid_matrix_calc(t_centroid *x, void *inputs, void *outputs) {
     long savelock;
     void *in_mdata;
     float *fip;
-    long in_dimcount, in_planecount, in_length;
-    int vox_x, vox_y, vox_z;
+    long in_dimcount, in_planecount, in_length, format;
     float weight;
     float samples = 0;
+    uint64_t key = 0;
 
     in_matrix = jit_object_method(inputs, _jit_sym_getindex, 0);
 
@@ -80,14 +168,35 @@ t_jit_err centroid_matrix_calc(t_centroid *x, void *inputs, void *outputs) {
     jit_object_method(in_matrix, _jit_sym_getdata, &in_mdata);
 
     if (!in_mdata) {
-        return JIT_ERR_INVALID_INPUT;
+        err = JIT_ERR_INVALID_INPUT;
+        goto out;
     }
     
     in_dimcount = in_minfo.dimcount;
-    in_planecount = in_minfo.planecount;
+
+    // the means attribute holds CENTROID_MAX_GRIDS grids; a larger batch is refused
+    // rather than cut short
+    if (in_dimcount == 4 && in_minfo.dim[3] > CENTROID_MAX_GRIDS) {
+        jit_object_error((t_object *)x, "voxel.centroid: batch of %ld grids, at most %d", in_minfo.dim[3], CENTROID_MAX_GRIDS);
+        err = JIT_ERR_MISMATCH_DIM;
+        goto out;
+    }
     in_length = in_minfo.dim[0] * in_minfo.dim[1] * in_minfo.dim[2];
-    
-    if(in_minfo.type != _jit_sym_float32){ return err; }
+
+    // float32, or half stored as char pairs; in_planecount counts values, not bytes
+    format = voxel_grid_format(&in_minfo, x->precision == ps_half, &in_planecount);
+    if (format == VOXEL_GRID_INVALID) {
+        err = JIT_ERR_MISMATCH_TYPE;
+        goto out;
+    }
+
+    // the means from the last frame are still in place when the input has not changed
+    if (x->cache.enabled) {
+        key = voxel_cache_key(x->num_threads, x->affinity, &in_minfo, (char *)in_mdata, NULL, NULL);
+        if (voxel_cache_hit(&x->cache, key)) {
+            goto out;
+        }
+    }
 
     // Reset mean values to 0
     for(int j = 0; j < 3; j++){
@@ -96,26 +205,53 @@ t_jit_err centroid_matrix_calc(t_centroid *x, void *inputs, void *outputs) {
     
     in_bp = (char *)in_mdata;
     
-    if(in_dimcount == 3 && in_planecount == 1){ //if voxel grid
-        for(vox_z = 0; vox_z < in_minfo.dim[2]; vox_z++){
-            for(vox_y = 0; vox_y < in_minfo.dim[1]; vox_y++){
-                for(vox_x = 0; vox_x < in_minfo.dim[0]; vox_x++){
-                    long index = vox_x * in_minfo.dimstride[0] + vox_y * in_minfo.dimstride[1] + vox_z * in_minfo.dimstride[2];
-                    fip = (float *)(in_bp + index);
-                    weight = fip[0];
-
-                    if(weight > 0){
-                        x->mean[0] += ((float)vox_x / in_minfo.dim[0] + 1.0f / in_minfo.dim[0] * .5f) * weight;
-                        x->mean[1] += ((float)vox_y / in_minfo.dim[1] + 1.0f / in_minfo.dim[1] * .5f) * weight;
-                        x->mean[2] += ((float)vox_z / in_minfo.dim[2] + 1.0f / in_minfo.dim[2] * .5f) * weight;
-                        
-                        samples += weight;
-                    }
+    if((in_dimcount == 3 || in_dimcount == 4) && in_planecount == 1){ //if voxel grid, or a batch of them along dim 3
+        long batch = in_dimcount == 4 ? in_minfo.dim[3] : 1;
+        long slices = in_minfo.dim[2] * batch;
+        t_centroid_frame frame;
+
+        frame.in_bp = in_bp;
+        frame.dim = in_minfo.dim;
+        frame.stride = in_minfo.dimstride;
+        frame.batch_stride = batch > 1 ? in_minfo.dimstride[3] : 0;
+        frame.format = format;
+        frame.lines = NULL;
+        if (format == VOXEL_GRID_HALF) {
+            frame.lines = (float *)voxel_arena_alloc_rows(&x->arena, voxel_parallel_threads(x->num_threads),
+                                                          in_minfo.dim[0] * sizeof(float), &frame.line_stride);
+        }
+        frame.partials = (double *)voxel_arena_alloc(&x->arena, slices * 4 * sizeof(double));
+
+        if (!frame.partials || (format == VOXEL_GRID_HALF && !frame.lines)) {
+            err = JIT_ERR_OUT_OF_MEM;
+            goto out;
+        }
+
+        voxel_parallel_for(x->num_threads, x->affinity, slices, centroid_slab, &frame);
+
+        // merge in slice order so the result does not depend on the thread count
+        for (long grid = 0; grid < batch; grid++) {
+            double sum[4] = { 0.0, 0.0, 0.0, 0.0 };
+
+            for (long vox_z = 0; vox_z < in_minfo.dim[2]; vox_z++) {
+                for (int j = 0; j < 4; j++) {
+                    sum[j] += frame.partials[(grid * in_minfo.dim[2] + vox_z) * 4 + j];
                 }
             }
+            for (int j = 0; j < 3; j++) {
+                x->means[grid * 3 + j] = sum[3] > 0 ? (float)(sum[j] / sum[3]) : 0.0f;
+            }
         }
+
+        x->means_count = batch * 3;
+        for (int j = 0; j < 3; j++) {
+            x->mean[j] = x->means[j];
+        }
+
+        voxel_cache_store(&x->cache, key, err);
+        goto out;
     }
-    else if(in_dimcount == 1 && in_planecount == 4){ //if vertex array
+    if(in_dimcount == 1 && in_planecount == 4 && format == VOXEL_GRID_FLOAT32){ //if vertex array
         for(int i = 0; i < in_minfo.dim[0]; i++){
             fip = (float *)(in_bp + i * in_minfo.dimstride[0]);
             weight = fip[3];
@@ -135,7 +271,15 @@ t_jit_err centroid_matrix_calc(t_centroid *x, void *inputs, void *outputs) {
             x->mean[j] /= samples;
         }
     }
+    for(int j = 0; j < 3; j++){
+        x->means[j] = x->mean[j];
+    }
+    x->means_count = 3;
+    voxel_cache_store(&x->cache, key, err);
 out:
+    x->calctime = (float)(systimer_gettime() - calc_start);
+    voxel_arena_release(&x->arena);
+    x->allocations = x->arena.allocations;
     jit_object_method(in_matrix, _jit_sym_lock, savelock);
     return err;
 }
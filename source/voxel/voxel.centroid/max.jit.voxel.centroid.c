@@ -1,5 +1,8 @@
 #include "jit.common.h"
 #include "max.jit.mop.h"
+#include "voxel.centroid.h"
+
+#define MAX_CENTROID_ATOMS (CENTROID_MAX_GRIDS * 3)
 
 typedef struct _max_centroid {
     t_object ob;
@@ -46,12 +49,13 @@ void ext_main(void *r) {
 }
 
 void max_centroid_bang(t_max_centroid *x) {
-    long ac;
+    long ac = MAX_CENTROID_ATOMS;
     void *o;
 
+    // one xyz triple per grid, so a batch outputs all of its means in one list
     if (max_jit_mop_getoutputmode(x) && x->av) {
         o = max_jit_obex_jitob_get(x);
-        jit_object_method(o, gensym("getmean"), &ac, &(x->av));
+        jit_object_method(o, gensym("getmeans"), &ac, &(x->av));
         outlet_anything(x->meanout, _jit_sym_list, ac, x->av);
     }
 }
@@ -92,7 +96,7 @@ void max_centroid_free(t_max_centroid *x) {
     jit_object_free(max_jit_obex_jitob_get(x));
 
     if (x->av) {
-        jit_freebytes(x->av, sizeof(t_atom) * JIT_MATRIX_MAX_PLANECOUNT);
+        jit_freebytes(x->av, sizeof(t_atom) * MAX_CENTROID_ATOMS);
     }
 
     max_jit_object_free(x);
@@ -112,7 +116,7 @@ void * max_centroid_new(t_symbol *s, long argc, t_atom *argv) {
         if (o) {
             max_jit_mop_setup_simple(x, o, argc, argv);
             x->meanout = outlet_new(x, 0L);
-            x->av = jit_getbytes(sizeof(t_atom) * JIT_MATRIX_MAX_PLANECOUNT);
+            x->av = jit_getbytes(sizeof(t_atom) * MAX_CENTROID_ATOMS);
             max_jit_attr_args(x, argc, argv);
         } else {
             jit_object_error((t_object *)x,
@@ -0,0 +1,8 @@
+#ifndef VOXEL_CENTROID_H
+#define VOXEL_CENTROID_H
+
+// grids in one batch: the means attribute and the wrapper's list hold one xyz triple
+// for each
+#define CENTROID_MAX_GRIDS 64
+
+#endif
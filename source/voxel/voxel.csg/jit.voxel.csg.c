@@ -0,0 +1,403 @@
+#include "jit.common.h"
+#include "voxel.parallel.h"
+#include "voxel.arena.h"
+#include "voxel.half.h"
+#include <stdint.h>
+
+#define CSG_MAX_INPUTS 16
+
+enum {
+    CSG_UNION = 0,
+    CSG_INTERSECT,
+    CSG_SUBTRACT,
+    CSG_XOR
+};
+
+typedef struct _csg {
+    t_object ob;
+    t_symbol *precision;
+    t_symbol *ops[CSG_MAX_INPUTS - 1];
+    long ops_count;
+    float threshold;
+    long count;
+    long counts[CSG_MAX_INPUTS - 1];
+    long counts_count;
+    long occupied;
+    t_voxel_arena arena;
+    long allocations;
+    long num_threads;
+    long affinity;
+    float calctime;
+} t_csg;
+
+typedef struct _csg_frame {
+    t_csg *x;
+    long inputs;
+    char *in_bp[CSG_MAX_INPUTS];
+    long *in_stride[CSG_MAX_INPUTS];
+    long in_format[CSG_MAX_INPUTS];
+    long ops[CSG_MAX_INPUTS - 1];
+    char *out_bp;
+    long *out_stride;
+    long out_format;
+    long *dim;
+    long words;             // 64-voxel words per row
+    float *lines;           // one float row per thread
+    uint64_t *bits;         // two rows of words per thread
+    long partials[VOXEL_MAX_THREADS][CSG_MAX_INPUTS];  // occupied after input 0 and after each op
+} t_csg_frame;
+
+BEGIN_USING_C_LINKAGE
+t_jit_err csg_init(void);
+t_csg *csg_new(void);
+void csg_free(t_csg *x);
+t_jit_err csg_matrix_calc(t_csg *x, void *inputs, void *outputs);
+t_jit_err csg_ops_set(t_csg *x, void *attr, long ac, t_atom *av);
+END_USING_C_LINKAGE
+
+static void *_csg_class = NULL;
+static t_symbol *ps_union, *ps_intersect, *ps_subtract, *ps_xor, *ps_half;
+
+t_jit_err csg_init(void) {
+    long attrflags = JIT_ATTR_GET_DEFER_LOW | JIT_ATTR_SET_USURP_LOW;
+    long statflags = JIT_ATTR_SET_OPAQUE_USER | JIT_ATTR_GET_DEFER_LOW;
+    t_jit_object *attr;
+    t_jit_object *mop;
+
+    ps_union = gensym("union");
+    ps_intersect = gensym("intersect");
+    ps_subtract = gensym("subtract");
+    ps_xor = gensym("xor");
+    ps_half = gensym("half");
+
+    _csg_class = jit_class_new("csg", (method)csg_new, (method)csg_free, sizeof(t_csg), 0L);
+
+    // any number of inputs, set by the max wrapper; the output is sized in calc
+    mop = jit_object_new(_jit_sym_jit_mop, -1, 1);
+    jit_mop_output_nolink(mop, 1);
+    jit_class_addadornment(_csg_class, mop);
+
+    // methods
+    jit_class_addmethod(_csg_class, (method)csg_matrix_calc, "matrix_calc", A_CANT, 0L);
+
+    // attributes
+    attr = jit_object_new(_jit_sym_jit_attr_offset_array, "ops", _jit_sym_symbol, CSG_MAX_INPUTS - 1, attrflags,
+                          (method)NULL, (method)csg_ops_set, calcoffset(t_csg, ops_count), calcoffset(t_csg, ops));
+    jit_class_addattr(_csg_class, attr);
+    CLASS_ATTR_LABEL(_csg_class, "ops", 0, "Operations (union intersect subtract xor)");
+
+    attr = jit_object_new(_jit_sym_jit_attr_offset, "threshold", _jit_sym_float32, attrflags,
+                          (method)NULL, (method)NULL, calcoffset(t_csg, threshold));
+    jit_class_addattr(_csg_class, attr);
+    CLASS_ATTR_LABEL(_csg_class, "threshold", 0, "Occupied Above");
+
+    attr = jit_object_new(_jit_sym_jit_attr_offset, "count", _jit_sym_long, attrflags,
+                          (method)NULL, (method)NULL, calcoffset(t_csg, count));
+    jit_class_addattr(_csg_class, attr);
+    CLASS_ATTR_LABEL(_csg_class, "count", 0, "Count Occupied Voxels");
+    CLASS_ATTR_STYLE(_csg_class, "count", 0, "onoff");
+
+    attr = jit_object_new(_jit_sym_jit_attr_offset_array, "counts", _jit_sym_long, CSG_MAX_INPUTS - 1, statflags,
+                          (method)NULL, (method)NULL, calcoffset(t_csg, counts_count), calcoffset(t_csg, counts));
+    jit_class_addattr(_csg_class, attr);
+
+    attr = jit_object_new(_jit_sym_jit_attr_offset, "occupied", _jit_sym_long, statflags,
+                          (method)NULL, (method)NULL, calcoffset(t_csg, occupied));
+    jit_class_addattr(_csg_class, attr);
+
+    attr = jit_object_new(_jit_sym_jit_attr_offset, "allocations", _jit_sym_long, statflags,
+                          (method)NULL, (method)NULL, calcoffset(t_csg, allocations));
+    jit_class_addattr(_csg_class, attr);
+
+    voxel_grid_class_attrs(_csg_class, calcoffset(t_csg, precision));
+    voxel_parallel_class_attrs(_csg_class, calcoffset(t_csg, num_threads), calcoffset(t_csg, affinity), calcoffset(t_csg, calctime));
+
+    jit_class_register(_csg_class);
+
+    return JIT_ERR_NONE;
+}
+
+t_csg *csg_new(void) {
+    t_csg *x;
+
+    if ((x = (t_csg *)jit_object_alloc(_csg_class))) {
+        x->precision = _jit_sym_float32;
+        for (int i = 0; i < CSG_MAX_INPUTS - 1; i++) {
+            x->ops[i] = ps_union;
+            x->counts[i] = 0;
+        }
+        x->ops_count = 1;
+        x->threshold = 0.0f;
+        x->count = 0;
+        x->counts_count = 0;
+        x->occupied = 0;
+        voxel_arena_init(&x->arena);
+        x->allocations = 0;
+        x->num_threads = 0;
+        x->affinity = 0;
+        x->calctime = 0.0f;
+    } else {
+        x = NULL;
+    }
+
+    return x;
+}
+
+void csg_free(t_csg *x) {
+    voxel_arena_free(&x->arena);
+}
+
+// op i combines the result so far with input i + 1; inputs past the list are unioned
+// ops apply in order, so a list with a bad entry is refused whole rather than
+// applied with the later ops shifted onto the wrong inputs
+t_jit_err csg_ops_set(t_csg *x, void *attr, long ac, t_atom *av) {
+    if (ac > CSG_MAX_INPUTS - 1) {
+        jit_object_error((t_object *)x, "voxel.csg: %ld ops, at most %d", ac, CSG_MAX_INPUTS - 1);
+        return JIT_ERR_INVALID_INPUT;
+    }
+    for (long i = 0; i < ac; i++) {
+        t_symbol *op = atom_getsym(av + i);
+
+        if (op != ps_union && op != ps_intersect && op != ps_subtract && op != ps_xor) {
+            jit_object_error((t_object *)x, "voxel.csg: unknown op %s, expected union, intersect, subtract or xor", op->s_name);
+            return JIT_ERR_INVALID_INPUT;
+        }
+    }
+    for (long i = 0; i < ac; i++) {
+        x->ops[i] = atom_getsym(av + i);
+    }
+    x->ops_count = ac;
+    return JIT_ERR_NONE;
+}
+
+static inline long csg_popcount(const uint64_t *bits, long words) {
+    long n = 0;
+
+    for (long w = 0; w < words; w++) {
+        n += __builtin_popcountll(bits[w]);
+    }
+    return n;
+}
+
+// one row of input i as occupancy bits, 64 voxels per word. bits past the end of the
+// row stay clear, and every op keeps them clear
+static void csg_load_bits(t_csg_frame *f, long i, long vox_y, long vox_z, float *line, uint64_t *bits) {
+    long n = f->dim[0];
+    long step = f->in_stride[i][0];
+    char *row = f->in_bp[i] + vox_y * f->in_stride[i][1] + vox_z * f->in_stride[i][2];
+    const float *values = (const float *)row;
+    float threshold = f->x->threshold;
+
+    if (f->in_format[i] == VOXEL_GRID_HALF) {
+        voxel_half_load(row, step, line, n);
+        values = line;
+    } else if (step != sizeof(float)) {
+        for (long vox_x = 0; vox_x < n; vox_x++) {
+            line[vox_x] = *(float *)(row + vox_x * step);
+        }
+        values = line;
+    }
+
+    // compare into bytes, which vectorizes, then gather eight bytes at a time into
+    // a bit each with one multiply
+    for (long w = 0; w < f->words; w++) {
+        const float *v = values + w * 64;
+        long width = MIN(64, n - w * 64);
+        uint8_t mask[64];
+        uint64_t word = 0;
+
+        for (long b = 0; b < width; b++) {
+            mask[b] = v[b] > threshold;
+        }
+        memset(mask + width, 0, 64 - width);
+        for (int k = 0; k < 8; k++) {
+            uint64_t bytes;
+            memcpy(&bytes, mask + k * 8, sizeof(bytes));
+            word |= ((bytes * 0x0102040810204080ULL) >> 56) << (k * 8);
+        }
+        bits[w] = word;
+    }
+}
+
+static void csg_store_row(t_csg_frame *f, long vox_y, long vox_z, const uint64_t *bits, float *line) {
+    long n = f->dim[0];
+    long step = f->out_stride[0];
+    char *row = f->out_bp + vox_y * f->out_stride[1] + vox_z * f->out_stride[2];
+    float *dst = f->out_format == VOXEL_GRID_FLOAT32 && step == sizeof(float) ? (float *)row : line;
+
+    for (long vox_x = 0; vox_x < n; vox_x++) {
+        dst[vox_x] = (float)((bits[vox_x >> 6] >> (vox_x & 63)) & 1);
+    }
+    if (f->out_format == VOXEL_GRID_HALF) {
+        voxel_half_store(line, row, step, n);
+    } else if (dst == line) {
+        for (long vox_x = 0; vox_x < n; vox_x++) {
+            *(float *)(row + vox_x * step) = line[vox_x];
+        }
+    }
+}
+
+// the whole op list for z slices [start, end): every input row is thresholded to
+// bits once and the ops run a word at a time, so each voxel is read and written once
+static void csg_slab(void *ctx, long thread, long start, long end) {
+    t_csg_frame *f = (t_csg_frame *)ctx;
+    long words = f->words;
+    float *line = f->lines + thread * f->dim[0];
+    uint64_t *acc = f->bits + thread * words * 2;
+    uint64_t *bits = acc + words;
+    long *partial = f->partials[thread];
+    int count = f->x->count;
+
+    memset(partial, 0, f->inputs * sizeof(long));
+
+    for (long vox_z = start; vox_z < end; vox_z++) {
+        for (long vox_y = 0; vox_y < f->dim[1]; vox_y++) {
+            csg_load_bits(f, 0, vox_y, vox_z, line, acc);
+            if (count) {
+                partial[0] += csg_popcount(acc, words);
+            }
+
+            for (long i = 1; i < f->inputs; i++) {
+                csg_load_bits(f, i, vox_y, vox_z, line, bits);
+
+                switch (f->ops[i - 1]) {
+                    case CSG_INTERSECT:
+                        for (long w = 0; w < words; w++) acc[w] &= bits[w];
+                        break;
+                    case CSG_SUBTRACT:
+                        for (long w = 0; w < words; w++) acc[w] &= ~bits[w];
+                        break;
+                    case CSG_XOR:
+                        for (long w = 0; w < words; w++) acc[w] ^= bits[w];
+                        break;
+                    default:
+                        for (long w = 0; w < words; w++) acc[w] |= bits[w];
+                        break;
+                }
+                if (count) {
+                    partial[i] += csg_popcount(acc, words);
+                }
+            }
+
+            csg_store_row(f, vox_y, vox_z, acc, line);
+        }
+    }
+}
+
+t_jit_err csg_matrix_calc(t_csg *x, void *inputs, void *outputs) {
+    double calc_start = systimer_gettime();
+    t_jit_err err = JIT_ERR_NONE;
+    t_jit_matrix_info in_minfo[CSG_MAX_INPUTS], out_minfo;
+    t_jit_object *in_matrix[CSG_MAX_INPUTS], *out_matrix;
+    long in_savelock[CSG_MAX_INPUTS], out_savelock;
+    void *in_mdata, *out_mdata;
+    long count, planes, slabs, threads;
+    t_csg_frame frame;
+
+    count = MIN((long)jit_object_method(inputs, _jit_sym_getsize), CSG_MAX_INPUTS);
+    out_matrix = jit_object_method(outputs, _jit_sym_getindex, 0);
+
+    if (count < 1 || !out_matrix) {
+        return JIT_ERR_INVALID_INPUT;
+    }
+    for (long i = 0; i < count; i++) {
+        if (!(in_matrix[i] = jit_object_method(inputs, _jit_sym_getindex, i))) {
+            return JIT_ERR_INVALID_INPUT;
+        }
+    }
+
+    for (long i = 0; i < count; i++) {
+        in_savelock[i] = (long)jit_object_method(in_matrix[i], _jit_sym_lock, 1);
+    }
+    out_savelock = (long)jit_object_method(out_matrix, _jit_sym_lock, 1);
+
+    frame.x = x;
+    frame.inputs = count;
+
+    // float32 or half grids, all the size of the first
+    for (long i = 0; i < count; i++) {
+        jit_object_method(in_matrix[i], _jit_sym_getinfo, &in_minfo[i]);
+        jit_object_method(in_matrix[i], _jit_sym_getdata, &in_mdata);
+
+        if (!in_mdata) {
+            err = JIT_ERR_INVALID_INPUT;
+            goto out;
+        }
+        frame.in_format[i] = voxel_grid_format(&in_minfo[i], x->precision == ps_half, &planes);
+        if (frame.in_format[i] == VOXEL_GRID_INVALID) {
+            err = JIT_ERR_MISMATCH_TYPE;
+            goto out;
+        }
+        if (in_minfo[i].dimcount != 3 || in_minfo[i].dim[0] != in_minfo[0].dim[0] ||
+            in_minfo[i].dim[1] != in_minfo[0].dim[1] || in_minfo[i].dim[2] != in_minfo[0].dim[2]) {
+            err = JIT_ERR_MISMATCH_DIM;
+            goto out;
+        }
+        frame.in_bp[i] = (char *)in_mdata;
+        frame.in_stride[i] = in_minfo[i].dimstride;
+    }
+
+    // a single plane grid in the first input's format
+    out_minfo = in_minfo[0];
+    out_minfo.planecount = frame.in_format[0] == VOXEL_GRID_HALF ? 2 : 1;
+    out_minfo.flags = 0;
+
+    jit_object_method(out_matrix, _jit_sym_setinfo, &out_minfo);
+    jit_object_method(out_matrix, _jit_sym_getinfo, &out_minfo);
+    jit_object_method(out_matrix, _jit_sym_getdata, &out_mdata);
+
+    if (!out_mdata) {
+        err = JIT_ERR_INVALID_OUTPUT;
+        goto out;
+    }
+
+    for (long i = 0; i < count - 1; i++) {
+        t_symbol *op = i < x->ops_count ? x->ops[i] : ps_union;
+
+        frame.ops[i] = op == ps_intersect ? CSG_INTERSECT : op == ps_subtract ? CSG_SUBTRACT : op == ps_xor ? CSG_XOR : CSG_UNION;
+    }
+    frame.out_bp = (char *)out_mdata;
+    frame.out_stride = out_minfo.dimstride;
+    frame.out_format = voxel_grid_format(&out_minfo, x->precision == ps_half, &planes);
+    frame.dim = in_minfo[0].dim;
+    frame.words = (frame.dim[0] + 63) / 64;
+
+    threads = voxel_parallel_threads(x->num_threads);
+    frame.lines = (float *)voxel_arena_alloc(&x->arena, threads * frame.dim[0] * sizeof(float));
+    frame.bits = (uint64_t *)voxel_arena_alloc(&x->arena, threads * frame.words * 2 * sizeof(uint64_t));
+
+    if (!frame.lines || !frame.bits) {
+        err = JIT_ERR_OUT_OF_MEM;
+        goto out;
+    }
+
+    slabs = voxel_parallel_for(x->num_threads, x->affinity, frame.dim[2], csg_slab, &frame);
+
+    // occupied voxels after each op, summed over threads
+    x->counts_count = 0;
+    x->occupied = 0;
+    if (x->count) {
+        long totals[CSG_MAX_INPUTS] = { 0 };
+
+        for (long t = 0; t < slabs; t++) {
+            for (long i = 0; i < count; i++) {
+                totals[i] += frame.partials[t][i];
+            }
+        }
+        for (long i = 1; i < count; i++) {
+            x->counts[i - 1] = totals[i];
+        }
+        x->counts_count = count - 1;
+        x->occupied = totals[count - 1];
+    }
+
+out:
+    x->calctime = (float)(systimer_gettime() - calc_start);
+    voxel_arena_release(&x->arena);
+    x->allocations = x->arena.allocations;
+    for (long i = 0; i < count; i++) {
+        jit_object_method(in_matrix[i], _jit_sym_lock, in_savelock[i]);
+    }
+    jit_object_method(out_matrix, _jit_sym_lock, out_savelock);
+    return err;
+}
@@ -0,0 +1,139 @@
+#include "jit.common.h"
+#include "max.jit.mop.h"
+
+#define MAX_CSG_MAX_INPUTS 16     // CSG_MAX_INPUTS in jit.voxel.csg.c
+
+typedef struct _max_csg {
+    t_object ob;
+    void *obex;
+    void *countout;
+    t_atom *av;
+} t_max_csg;
+
+BEGIN_USING_C_LINKAGE
+t_jit_err csg_init(void);
+void * max_csg_new(t_symbol *s, long argc, t_atom *argv);
+void max_csg_free(t_max_csg *x);
+void max_csg_assist(t_max_csg *x, void *b, long m, long a, char *s);
+void max_csg_mproc(t_max_csg *x, void *mop);
+END_USING_C_LINKAGE
+
+static void *max_csg_class = NULL;
+
+void ext_main(void *r) {
+    t_class *max_class, *jit_class;
+
+    csg_init();
+
+    max_class = class_new("voxel.csg", (method)max_csg_new, (method)max_csg_free, sizeof(t_max_csg), NULL, A_GIMME, 0);
+    max_jit_class_obex_setup(max_class, calcoffset(t_max_csg, obex));
+
+    jit_class = jit_class_findbyname(gensym("csg"));
+    max_jit_class_mop_wrap(max_class, jit_class,  MAX_JIT_MOP_FLAGS_OWN_ADAPT | MAX_JIT_MOP_FLAGS_OWN_OUTPUTMODE);
+    max_jit_classex_mop_mproc(max_class, jit_class, max_csg_mproc);
+    max_jit_class_wrap_standard(max_class, jit_class, 0);
+
+    class_addmethod(max_class, (method)max_csg_assist, "assist", A_CANT, 0);
+
+    class_register(CLASS_BOX, max_class);
+    max_csg_class = max_class;
+}
+
+void max_csg_mproc(t_max_csg *x, void *mop) {
+    t_jit_err err;
+    void *o;
+    t_atom_long counts[MAX_CSG_MAX_INPUTS - 1];
+    long n;
+
+    if (mop) {
+        o = max_jit_obex_jitob_get(x);
+
+        if ((err = (t_jit_err)jit_object_method(
+                 o, _jit_sym_matrix_calc,
+                 jit_object_method(mop, _jit_sym_getinputlist),
+                 jit_object_method(mop, _jit_sym_getoutputlist)))) {
+            jit_error_code(x, err);
+        } else {
+            // counts first, so downstream gates are set before the grid arrives
+            if (jit_attr_getlong(o, gensym("count"))) {
+                n = jit_attr_getlong_array(o, gensym("counts"), MAX_CSG_MAX_INPUTS - 1, counts);
+                atom_setlong(x->av, jit_attr_getlong(o, gensym("occupied")));
+                atom_setlong_array(n, x->av + 1, n, counts);
+                outlet_anything(x->countout, _jit_sym_list, n + 1, x->av);
+            }
+
+            max_jit_mop_outputmatrix(x);
+        }
+    }
+}
+
+void max_csg_assist(t_max_csg *x, void *b, long m, long a, char *s) {
+    if (m == 1) { // input
+        sprintf(s, "(matrix) voxel grid %ld", a + 1);
+    } else { // output
+        switch (a) {
+            case 0:
+                sprintf(s, "(matrix) combined voxel grid");
+                break;
+
+            case 1:
+                sprintf(s, "(list) occupied count, then the count after each op");
+                break;
+
+            default:
+                sprintf(s, "dumpout");
+                break;
+        }
+    }
+}
+
+/************************************************************************************/
+// Object Life Cycle
+
+void * max_csg_new(t_symbol *s, long argc, t_atom *argv) {
+    t_max_csg *x;
+    void *o;
+    long inputs = 2;
+
+    x = (t_max_csg *)max_jit_object_alloc(max_csg_class, gensym("csg"));
+
+    if (x) {
+        x->av = NULL;
+        o = jit_object_new(gensym("csg"));
+
+        if (o) {
+            // optional leading argument: number of grid inputs
+            if (argc && atom_gettype(argv) == A_LONG) {
+                inputs = CLAMP(atom_getlong(argv), 1, MAX_CSG_MAX_INPUTS);
+            }
+
+            max_jit_obex_jitob_set(x,o);
+            max_jit_obex_dumpout_set(x,outlet_new(x,NULL));
+            x->countout = outlet_new(x, 0L);
+            x->av = jit_getbytes(sizeof(t_atom) * MAX_CSG_MAX_INPUTS);
+            max_jit_mop_setup(x);
+            max_jit_mop_variable_addinputs(x, inputs);
+            max_jit_mop_inputs(x);
+            max_jit_mop_outputs(x);
+
+            max_jit_attr_args(x, argc, argv);
+        } else {
+            jit_object_error((t_object *)x, "voxel.csg: could not allocate object");
+            object_free((t_object *)x);
+            x = NULL;
+        }
+    }
+
+    return (x);
+}
+
+void max_csg_free(t_max_csg *x) {
+    max_jit_mop_free(x);
+    jit_object_free(max_jit_obex_jitob_get(x));
+
+    if (x->av) {
+        jit_freebytes(x->av, sizeof(t_atom) * MAX_CSG_MAX_INPUTS);
+    }
+
+    max_jit_object_free(x);
+}
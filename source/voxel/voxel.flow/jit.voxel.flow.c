@@ -0,0 +1,594 @@
+#include "jit.common.h"
+#include "voxel.parallel.h"
+#include "voxel.arena.h"
+#include "voxel.half.h"
+#include <float.h>
+#if defined(__SSE2__) || defined(_M_X64)
+#define FLOW_SAD_SSE 1
+#include <emmintrin.h>
+#elif defined(__aarch64__)
+#define FLOW_SAD_NEON 1
+#include <arm_neon.h>
+#endif
+
+#define FLOW_MAX_LEVELS 4
+#define FLOW_MAX_BRICK 64
+#define FLOW_MAX_SEARCH 8
+#define FLOW_REFINE 2
+
+// one pyramid level inside a history buffer. Every level is padded by the largest
+// displacement the search can reach on it, so shifted reads never leave the buffer;
+// the padding is zeroed once when the buffer is allocated and never written
+typedef struct _flow_level {
+    long dim[3];
+    long margin;
+    long stride[3];         // in floats
+    long origin;            // floats from the start of the buffer to voxel 0 of the level
+} t_flow_level;
+
+typedef struct _flow {
+    t_object ob;
+    t_symbol *precision;
+    long brick;
+    long search;
+    long levels;
+    long moving;
+    float *history[2];      // previous and current pyramid, swapped every frame
+    long history_dim[3];
+    long history_levels;
+    long history_search;
+    long history_valid;     // history[0] holds the previous frame
+    t_voxel_arena arena;
+    long allocations;
+    long num_threads;
+    long affinity;
+    float calctime;
+} t_flow;
+
+// search state of one brick between levels
+typedef struct _flow_estimate {
+    long d[3];              // displacement on the level searched last
+    long occupied;
+} t_flow_estimate;
+
+typedef struct _flow_frame {
+    char *in_bp;
+    long *in_stride;
+    long format;
+    char *out_bp;
+    long *out_stride;
+    long *dim;
+    long brick;
+    long search;
+    long levels;
+    long track;             // 0 on the first frame, when there is nothing to match against
+    t_flow_level level[FLOW_MAX_LEVELS];
+    long size;              // floats in one history buffer
+    long build;             // level flow_downsample_slab fills
+    long bricks[3];
+    long search_level;      // level flow_slab searches
+    t_flow_estimate *estimate[2];   // per brick; the level above is read from one while the other is written
+    float *prev;
+    float *cur;
+    long partials[VOXEL_MAX_THREADS];   // moving bricks per thread
+} t_flow_frame;
+
+BEGIN_USING_C_LINKAGE
+t_jit_err flow_init(void);
+t_flow *flow_new(void);
+void flow_free(t_flow *x);
+t_jit_err flow_matrix_calc(t_flow *x, void *inputs, void *outputs);
+void flow_reset(t_flow *x);
+END_USING_C_LINKAGE
+
+static void *_flow_class = NULL;
+static t_symbol *ps_half;
+
+t_jit_err flow_init(void) {
+    long attrflags = JIT_ATTR_GET_DEFER_LOW | JIT_ATTR_SET_USURP_LOW;
+    long statflags = JIT_ATTR_SET_OPAQUE_USER | JIT_ATTR_GET_DEFER_LOW;
+    t_jit_object *attr;
+    t_jit_object *mop;
+
+    ps_half = gensym("half");
+
+    _flow_class = jit_class_new("flow", (method)flow_new, (method)flow_free, sizeof(t_flow), 0L);
+
+    // the vector field is sized by the brick count in calc
+    mop = jit_object_new(_jit_sym_jit_mop, 1, 1);
+    jit_mop_output_nolink(mop, 1);
+    jit_class_addadornment(_flow_class, mop);
+
+    // methods
+    jit_class_addmethod(_flow_class, (method)flow_matrix_calc, "matrix_calc", A_CANT, 0L);
+    jit_class_addmethod(_flow_class, (method)flow_reset, "reset", 0L);
+
+    // attributes
+    attr = jit_object_new(_jit_sym_jit_attr_offset, "brick", _jit_sym_long, attrflags,
+                          (method)NULL, (method)NULL, calcoffset(t_flow, brick));
+    jit_class_addattr(_flow_class, attr);
+    CLASS_ATTR_LABEL(_flow_class, "brick", 0, "Brick Size");
+
+    attr = jit_object_new(_jit_sym_jit_attr_offset, "search", _jit_sym_long, attrflags,
+                          (method)NULL, (method)NULL, calcoffset(t_flow, search));
+    jit_class_addattr(_flow_class, attr);
+    CLASS_ATTR_LABEL(_flow_class, "search", 0, "Search Radius On Coarsest Level");
+
+    attr = jit_object_new(_jit_sym_jit_attr_offset, "levels", _jit_sym_long, attrflags,
+                          (method)NULL, (method)NULL, calcoffset(t_flow, levels));
+    jit_class_addattr(_flow_class, attr);
+    CLASS_ATTR_LABEL(_flow_class, "levels", 0, "Pyramid Levels");
+
+    attr = jit_object_new(_jit_sym_jit_attr_offset, "moving", _jit_sym_long, statflags,
+                          (method)NULL, (method)NULL, calcoffset(t_flow, moving));
+    jit_class_addattr(_flow_class, attr);
+
+    attr = jit_object_new(_jit_sym_jit_attr_offset, "allocations", _jit_sym_long, statflags,
+                          (method)NULL, (method)NULL, calcoffset(t_flow, allocations));
+    jit_class_addattr(_flow_class, attr);
+
+    voxel_grid_class_attrs(_flow_class, calcoffset(t_flow, precision));
+    voxel_parallel_class_attrs(_flow_class, calcoffset(t_flow, num_threads), calcoffset(t_flow, affinity), calcoffset(t_flow, calctime));
+
+    jit_class_register(_flow_class);
+
+    return JIT_ERR_NONE;
+}
+
+t_flow *flow_new(void) {
+    t_flow *x;
+
+    if ((x = (t_flow *)jit_object_alloc(_flow_class))) {
+        x->precision = _jit_sym_float32;
+        x->brick = 8;
+        x->search = 2;
+        x->levels = 2;
+        x->moving = 0;
+        x->history[0] = x->history[1] = NULL;
+        x->history_dim[0] = x->history_dim[1] = x->history_dim[2] = 0;
+        x->history_levels = 0;
+        x->history_search = 0;
+        x->history_valid = 0;
+        voxel_arena_init(&x->arena);
+        x->allocations = 0;
+        x->num_threads = 0;
+        x->affinity = 0;
+        x->calctime = 0.0f;
+    } else {
+        x = NULL;
+    }
+
+    return x;
+}
+
+void flow_free(t_flow *x) {
+    for (int i = 0; i < 2; i++) {
+        if (x->history[i]) {
+            free(x->history[i]);
+        }
+    }
+    voxel_arena_free(&x->arena);
+}
+
+void flow_reset(t_flow *x) {
+    // the next frame only seeds the history and reports no motion
+    x->history_valid = 0;
+}
+
+// level sizes and padding; the displacement on a level is at most twice the largest on
+// the level above plus FLOW_REFINE, and at most search on the top level
+static void flow_layout(t_flow_frame *f) {
+    long margin = f->search;
+
+    f->size = 0;
+    for (long l = f->levels - 1; l >= 0; l--) {
+        t_flow_level *lv = &f->level[l];
+        long padded[3];
+
+        lv->margin = margin;
+        for (int a = 0; a < 3; a++) {
+            lv->dim[a] = (f->dim[a] + (1L << l) - 1) >> l;
+            padded[a] = lv->dim[a] + 2 * margin;
+        }
+        lv->stride[0] = 1;
+        lv->stride[1] = padded[0];
+        lv->stride[2] = padded[0] * padded[1];
+        lv->origin = f->size + margin * (1 + lv->stride[1] + lv->stride[2]);
+        f->size += padded[0] * padded[1] * padded[2];
+        margin = margin * 2 + FLOW_REFINE;
+    }
+}
+
+static t_jit_err flow_history_alloc(t_flow *x, t_flow_frame *f) {
+    for (int i = 0; i < 2; i++) {
+        if (x->history[i]) {
+            free(x->history[i]);
+        }
+        x->history[i] = (float *)calloc(f->size, sizeof(float));
+    }
+    if (!x->history[0] || !x->history[1]) {
+        for (int i = 0; i < 2; i++) {
+            if (x->history[i]) free(x->history[i]);
+            x->history[i] = NULL;
+        }
+        return JIT_ERR_OUT_OF_MEM;
+    }
+    return JIT_ERR_NONE;
+}
+
+// level 0 of the current pyramid: the input as packed floats
+static void flow_convert_slab(void *ctx, long thread, long start, long end) {
+    t_flow_frame *f = (t_flow_frame *)ctx;
+    t_flow_level *lv = &f->level[0];
+
+    for (long vox_z = start; vox_z < end; vox_z++) {
+        for (long vox_y = 0; vox_y < f->dim[1]; vox_y++) {
+            char *row = f->in_bp + vox_y * f->in_stride[1] + vox_z * f->in_stride[2];
+            float *dst = f->cur + lv->origin + vox_y * lv->stride[1] + vox_z * lv->stride[2];
+
+            if (f->format == VOXEL_GRID_HALF) {
+                voxel_half_load(row, f->in_stride[0], dst, f->dim[0]);
+            } else {
+                for (long vox_x = 0; vox_x < f->dim[0]; vox_x++) {
+                    dst[vox_x] = *(float *)(row + vox_x * f->in_stride[0]);
+                }
+            }
+        }
+    }
+}
+
+// level f->build from the one below: the mean of each voxel's children inside the grid
+static void flow_downsample_slab(void *ctx, long thread, long start, long end) {
+    t_flow_frame *f = (t_flow_frame *)ctx;
+    t_flow_level *lv = &f->level[f->build];
+    t_flow_level *below = &f->level[f->build - 1];
+
+    for (long vox_z = start; vox_z < end; vox_z++) {
+        long nz = MIN(2, below->dim[2] - 2 * vox_z);
+
+        for (long vox_y = 0; vox_y < lv->dim[1]; vox_y++) {
+            long ny = MIN(2, below->dim[1] - 2 * vox_y);
+            const float *src = f->cur + below->origin + 2 * vox_y * below->stride[1] + 2 * vox_z * below->stride[2];
+            float *dst = f->cur + lv->origin + vox_y * lv->stride[1] + vox_z * lv->stride[2];
+
+            for (long vox_x = 0; vox_x < lv->dim[0]; vox_x++) {
+                long nx = MIN(2, below->dim[0] - 2 * vox_x);
+                float sum = 0.0f;
+
+                for (long k = 0; k < nz; k++) {
+                    for (long j = 0; j < ny; j++) {
+                        for (long i = 0; i < nx; i++) {
+                            sum += src[2 * vox_x + i + j * below->stride[1] + k * below->stride[2]];
+                        }
+                    }
+                }
+                dst[vox_x] = sum / (nx * ny * nz);
+            }
+        }
+    }
+}
+
+// |a - b| of one slice of a brick added into one sum per column; each column adds its
+// rows in order, so the vector paths give the same sums as the scalar one
+static inline void flow_sad_slice(const float *a, const float *b, long stride, long rows, float *columns, long n) {
+    long x = 0;
+
+#if FLOW_SAD_SSE
+    const __m128 sign = _mm_set1_ps(-0.0f);
+
+    for (; x + 8 <= n; x += 8) {
+        __m128 lo = _mm_loadu_ps(columns + x), hi = _mm_loadu_ps(columns + x + 4);
+
+        for (long y = 0; y < rows; y++) {
+            const float *pa = a + y * stride + x, *pb = b + y * stride + x;
+
+            lo = _mm_add_ps(lo, _mm_andnot_ps(sign, _mm_sub_ps(_mm_loadu_ps(pa), _mm_loadu_ps(pb))));
+            hi = _mm_add_ps(hi, _mm_andnot_ps(sign, _mm_sub_ps(_mm_loadu_ps(pa + 4), _mm_loadu_ps(pb + 4))));
+        }
+        _mm_storeu_ps(columns + x, lo);
+        _mm_storeu_ps(columns + x + 4, hi);
+    }
+    for (; x + 4 <= n; x += 4) {
+        __m128 acc = _mm_loadu_ps(columns + x);
+
+        for (long y = 0; y < rows; y++) {
+            acc = _mm_add_ps(acc, _mm_andnot_ps(sign, _mm_sub_ps(_mm_loadu_ps(a + y * stride + x), _mm_loadu_ps(b + y * stride + x))));
+        }
+        _mm_storeu_ps(columns + x, acc);
+    }
+#elif FLOW_SAD_NEON
+    for (; x + 8 <= n; x += 8) {
+        float32x4_t lo = vld1q_f32(columns + x), hi = vld1q_f32(columns + x + 4);
+
+        for (long y = 0; y < rows; y++) {
+            const float *pa = a + y * stride + x, *pb = b + y * stride + x;
+
+            lo = vaddq_f32(lo, vabdq_f32(vld1q_f32(pa), vld1q_f32(pb)));
+            hi = vaddq_f32(hi, vabdq_f32(vld1q_f32(pa + 4), vld1q_f32(pb + 4)));
+        }
+        vst1q_f32(columns + x, lo);
+        vst1q_f32(columns + x + 4, hi);
+    }
+    for (; x + 4 <= n; x += 4) {
+        float32x4_t acc = vld1q_f32(columns + x);
+
+        for (long y = 0; y < rows; y++) {
+            acc = vaddq_f32(acc, vabdq_f32(vld1q_f32(a + y * stride + x), vld1q_f32(b + y * stride + x)));
+        }
+        vst1q_f32(columns + x, acc);
+    }
+#endif
+    for (; x < n; x++) {
+        float acc = columns[x];
+
+        for (long y = 0; y < rows; y++) {
+            acc += fabsf(a[y * stride + x] - b[y * stride + x]);
+        }
+        columns[x] = acc;
+    }
+}
+
+// SAD of a brick between cur and prev moved back by d. The column sums are added up
+// once per slice and the search gives up on a candidate as soon as it reaches best,
+// since only a strictly lower SAD replaces it
+static float flow_sad(t_flow_frame *f, t_flow_level *lv, long *origin, long *size, long *d, float best) {
+    long offset = lv->origin + origin[0] + origin[1] * lv->stride[1] + origin[2] * lv->stride[2];
+    long shift = d[0] + d[1] * lv->stride[1] + d[2] * lv->stride[2];
+    float columns[FLOW_MAX_BRICK];
+    float sum = 0.0f;
+
+    memset(columns, 0, size[0] * sizeof(float));
+    for (long z = 0; z < size[2]; z++) {
+        flow_sad_slice(f->cur + offset + z * lv->stride[2], f->prev + offset - shift + z * lv->stride[2],
+                       lv->stride[1], size[1], columns, size[0]);
+        sum = 0.0f;
+        for (long x = 0; x < size[0]; x++) {
+            sum += columns[x];
+        }
+        if (sum >= best) {
+            break;
+        }
+    }
+    return sum;
+}
+
+// one level of the coarse to fine search for one brick: +-search voxels around zero on
+// the top level. On each level below, the doubled estimate from the level above, the
+// zero vector and the doubled estimates of the six face neighbors are scored, and the
+// best of them is refined by +-FLOW_REFINE. A candidate is kept only when its SAD is
+// lower. A refine of +-1 cannot undo a one voxel error once it is doubled, and a brick
+// only a few voxels wide on the top level often matches wrongly where its neighbors do
+// not. Bricks with nothing occupied in the current frame report no motion
+static void flow_brick(t_flow_frame *f, long index, long *b, float *out) {
+    long l = f->search_level, top = l == f->levels - 1;
+    t_flow_estimate *above = f->estimate[(l + 1) & 1] + index;
+    t_flow_estimate *e = f->estimate[l & 1] + index;
+    t_flow_level *lv = &f->level[l];
+    long origin[3], size[3], center[3], radius = top ? f->search : FLOW_REFINE;
+    float best;
+
+    if (top) {
+        float mass = 0.0f;
+
+        e->occupied = 0;
+        lv = &f->level[0];
+        for (long z = b[2] * f->brick; z < MIN((b[2] + 1) * f->brick, f->dim[2]); z++) {
+            for (long y = b[1] * f->brick; y < MIN((b[1] + 1) * f->brick, f->dim[1]); y++) {
+                const float *row = f->cur + lv->origin + y * lv->stride[1] + z * lv->stride[2];
+
+                for (long x = b[0] * f->brick; x < MIN((b[0] + 1) * f->brick, f->dim[0]); x++) {
+                    mass += row[x];
+                    e->occupied += row[x] > 0;
+                }
+            }
+        }
+        out[3] = mass;
+        lv = &f->level[l];
+    } else {
+        e->occupied = above->occupied;
+    }
+
+    for (int a = 0; a < 3; a++) {
+        origin[a] = (b[a] * f->brick) >> l;
+        size[a] = MIN(MAX(f->brick >> l, 1), lv->dim[a] - origin[a]);
+        center[a] = top ? 0 : above->d[a] * 2;
+        e->d[a] = center[a];
+    }
+    if (!f->track || !e->occupied) {
+        e->d[0] = e->d[1] = e->d[2] = 0;
+        return;
+    }
+    best = flow_sad(f, lv, origin, size, center, FLT_MAX);
+
+    // zero, then the face neighbors -x +x -y +y -z +z
+    for (int n = 0; n < 7 && !top && best > 0.0f; n++) {
+        long candidate[3] = { 0, 0, 0 };
+        float sad;
+
+        if (n) {
+            long axis = (n - 1) >> 1, step = (n & 1) ? -1 : 1;
+            long neighbor = index + step * (axis == 0 ? 1 : axis == 1 ? f->bricks[0] : f->bricks[0] * f->bricks[1]);
+
+            if (b[axis] + step < 0 || b[axis] + step >= f->bricks[axis]) {
+                continue;
+            }
+            for (int a = 0; a < 3; a++) {
+                candidate[a] = f->estimate[(l + 1) & 1][neighbor].d[a] * 2;
+            }
+        }
+        if (candidate[0] == center[0] && candidate[1] == center[1] && candidate[2] == center[2]) {
+            continue;
+        }
+        sad = flow_sad(f, lv, origin, size, candidate, best);
+        if (sad < best) {
+            best = sad;
+            e->d[0] = candidate[0];
+            e->d[1] = candidate[1];
+            e->d[2] = candidate[2];
+        }
+    }
+
+    center[0] = e->d[0];
+    center[1] = e->d[1];
+    center[2] = e->d[2];
+    for (long k = -radius; k <= radius && best > 0.0f; k++) {
+        for (long j = -radius; j <= radius; j++) {
+            for (long i = -radius; i <= radius; i++) {
+                long candidate[3] = { center[0] + i, center[1] + j, center[2] + k };
+                float sad;
+
+                if (!i && !j && !k) {
+                    continue;
+                }
+                sad = flow_sad(f, lv, origin, size, candidate, best);
+                if (sad < best) {
+                    best = sad;
+                    e->d[0] = candidate[0];
+                    e->d[1] = candidate[1];
+                    e->d[2] = candidate[2];
+                }
+            }
+        }
+    }
+}
+
+static void flow_slab(void *ctx, long thread, long start, long end) {
+    t_flow_frame *f = (t_flow_frame *)ctx;
+    long moving = 0;
+
+    for (long index = start; index < end; index++) {
+        long b[3] = { index % f->bricks[0], (index / f->bricks[0]) % f->bricks[1], index / (f->bricks[0] * f->bricks[1]) };
+        float *out = (float *)(f->out_bp + b[0] * f->out_stride[0] + b[1] * f->out_stride[1] + b[2] * f->out_stride[2]);
+        long *d = f->estimate[0][index].d;
+
+        flow_brick(f, index, b, out);
+        if (!f->search_level) {
+            out[0] = (float)d[0];
+            out[1] = (float)d[1];
+            out[2] = (float)d[2];
+            moving += d[0] || d[1] || d[2];
+        }
+    }
+    f->partials[thread] = moving;
+}
+
+t_jit_err flow_matrix_calc(t_flow *x, void *inputs, void *outputs) {
+    double calc_start = systimer_gettime();
+    t_jit_err err = JIT_ERR_NONE;
+    t_jit_matrix_info in_minfo, out_minfo;
+    t_jit_object *in_matrix, *out_matrix;
+    long in_savelock, out_savelock, planes, slabs = 0, finest, count;
+    void *in_mdata, *out_mdata;
+    t_flow_frame frame;
+    float *swap;
+
+    in_matrix = jit_object_method(inputs, _jit_sym_getindex, 0);
+    out_matrix = jit_object_method(outputs, _jit_sym_getindex, 0);
+
+    if (!in_matrix || !out_matrix) {
+        return JIT_ERR_INVALID_INPUT;
+    }
+
+    in_savelock = (long)jit_object_method(in_matrix, _jit_sym_lock, 1);
+    out_savelock = (long)jit_object_method(out_matrix, _jit_sym_lock, 1);
+
+    jit_object_method(in_matrix, _jit_sym_getinfo, &in_minfo);
+    jit_object_method(in_matrix, _jit_sym_getdata, &in_mdata);
+
+    if (!in_mdata) {
+        err = JIT_ERR_INVALID_INPUT;
+        goto out;
+    }
+
+    // single plane 3d grid, float32 or half stored as char pairs
+    frame.format = voxel_grid_format(&in_minfo, x->precision == ps_half, &planes);
+    if (frame.format == VOXEL_GRID_INVALID || planes != 1 || in_minfo.dimcount != 3) {
+        err = JIT_ERR_MISMATCH_TYPE;
+        goto out;
+    }
+
+    // the top level needs bricks of at least one voxel
+    frame.brick = CLAMP(x->brick, 2, FLOW_MAX_BRICK);
+    frame.search = CLAMP(x->search, 1, FLOW_MAX_SEARCH);
+    frame.levels = CLAMP(x->levels, 1, FLOW_MAX_LEVELS);
+    for (finest = 1; (frame.brick >> finest) > 0 && finest < frame.levels; finest++);
+    frame.levels = finest;
+
+    frame.in_bp = (char *)in_mdata;
+    frame.in_stride = in_minfo.dimstride;
+    frame.dim = in_minfo.dim;
+    flow_layout(&frame);
+
+    if (!x->history[0] || x->history_levels != frame.levels || x->history_search != frame.search ||
+        x->history_dim[0] != in_minfo.dim[0] || x->history_dim[1] != in_minfo.dim[1] || x->history_dim[2] != in_minfo.dim[2]) {
+        x->history_valid = 0;
+        x->history_levels = 0;
+        if ((err = flow_history_alloc(x, &frame))) {
+            goto out;
+        }
+        x->history_dim[0] = in_minfo.dim[0];
+        x->history_dim[1] = in_minfo.dim[1];
+        x->history_dim[2] = in_minfo.dim[2];
+        x->history_levels = frame.levels;
+        x->history_search = frame.search;
+    }
+
+    // dx dy dz in voxels of the input grid, then the brick's weight sum
+    out_minfo = in_minfo;
+    out_minfo.type = _jit_sym_float32;
+    out_minfo.planecount = 4;
+    for (int a = 0; a < 3; a++) {
+        frame.bricks[a] = (in_minfo.dim[a] + frame.brick - 1) / frame.brick;
+        out_minfo.dim[a] = frame.bricks[a];
+    }
+    jit_object_method(out_matrix, _jit_sym_setinfo, &out_minfo);
+    jit_object_method(out_matrix, _jit_sym_getinfo, &out_minfo);
+    jit_object_method(out_matrix, _jit_sym_getdata, &out_mdata);
+
+    if (!out_mdata) {
+        err = JIT_ERR_INVALID_OUTPUT;
+        goto out;
+    }
+    frame.out_bp = (char *)out_mdata;
+    frame.out_stride = out_minfo.dimstride;
+
+    frame.prev = x->history[0];
+    frame.cur = x->history[1];
+    frame.track = x->history_valid;
+
+    voxel_parallel_for(x->num_threads, x->affinity, in_minfo.dim[2], flow_convert_slab, &frame);
+    for (frame.build = 1; frame.build < frame.levels; frame.build++) {
+        voxel_parallel_for(x->num_threads, x->affinity, frame.level[frame.build].dim[2], flow_downsample_slab, &frame);
+    }
+
+    // one pass per level, since each brick reads its neighbors' estimates from the level above
+    count = frame.bricks[0] * frame.bricks[1] * frame.bricks[2];
+    frame.estimate[0] = (t_flow_estimate *)voxel_arena_alloc(&x->arena, count * sizeof(t_flow_estimate));
+    frame.estimate[1] = (t_flow_estimate *)voxel_arena_alloc(&x->arena, count * sizeof(t_flow_estimate));
+    if (!frame.estimate[0] || !frame.estimate[1]) {
+        err = JIT_ERR_OUT_OF_MEM;
+        goto out;
+    }
+    for (frame.search_level = frame.levels - 1; frame.search_level >= 0; frame.search_level--) {
+        slabs = voxel_parallel_for(x->num_threads, x->affinity, count, flow_slab, &frame);
+    }
+
+    x->moving = 0;
+    for (long thread = 0; thread < slabs; thread++) {
+        x->moving += frame.partials[thread];
+    }
+
+    // this frame's pyramid is the one the next frame is matched against
+    swap = x->history[0];
+    x->history[0] = x->history[1];
+    x->history[1] = swap;
+    x->history_valid = 1;
+
+out:
+    x->calctime = (float)(systimer_gettime() - calc_start);
+    voxel_arena_release(&x->arena);
+    x->allocations = x->arena.allocations;
+    jit_object_method(in_matrix, _jit_sym_lock, in_savelock);
+    jit_object_method(out_matrix, _jit_sym_lock, out_savelock);
+    return err;
+}
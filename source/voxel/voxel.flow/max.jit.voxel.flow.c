@@ -0,0 +1,124 @@
+#include "jit.common.h"
+#include "max.jit.mop.h"
+
+typedef struct _max_flow {
+    t_object ob;
+    void *obex;
+    void *statsout;
+    t_atom *av;
+} t_max_flow;
+
+BEGIN_USING_C_LINKAGE
+t_jit_err flow_init(void);
+void * max_flow_new(t_symbol *s, long argc, t_atom *argv);
+void max_flow_free(t_max_flow *x);
+void max_flow_assist(t_max_flow *x, void *b, long m, long a, char *s);
+void max_flow_mproc(t_max_flow *x, void *mop);
+END_USING_C_LINKAGE
+
+static void *max_flow_class = NULL;
+
+void ext_main(void *r) {
+    t_class *max_class, *jit_class;
+
+    flow_init();
+
+    max_class = class_new("voxel.flow", (method)max_flow_new, (method)max_flow_free, sizeof(t_max_flow), NULL, A_GIMME, 0);
+    max_jit_class_obex_setup(max_class, calcoffset(t_max_flow, obex));
+
+    jit_class = jit_class_findbyname(gensym("flow"));
+    max_jit_class_mop_wrap(max_class, jit_class,  MAX_JIT_MOP_FLAGS_OWN_ADAPT | MAX_JIT_MOP_FLAGS_OWN_OUTPUTMODE);
+    max_jit_classex_mop_mproc(max_class, jit_class, max_flow_mproc);
+    max_jit_class_wrap_standard(max_class, jit_class, 0);
+
+    class_addmethod(max_class, (method)max_flow_assist, "assist", A_CANT, 0);
+
+    class_register(CLASS_BOX, max_class);
+    max_flow_class = max_class;
+}
+
+void max_flow_mproc(t_max_flow *x, void *mop) {
+    t_jit_err err;
+    void *o;
+
+    if (mop) {
+        o = max_jit_obex_jitob_get(x);
+
+        if ((err = (t_jit_err)jit_object_method(
+                 o, _jit_sym_matrix_calc,
+                 jit_object_method(mop, _jit_sym_getinputlist),
+                 jit_object_method(mop, _jit_sym_getoutputlist)))) {
+            jit_error_code(x, err);
+        } else {
+            // moving brick count first, so a gate can drop still frames before the field arrives
+            atom_setlong(x->av, jit_attr_getlong(o, gensym("moving")));
+            outlet_anything(x->statsout, _jit_sym_list, 1, x->av);
+
+            max_jit_mop_outputmatrix(x);
+        }
+    }
+}
+
+void max_flow_assist(t_max_flow *x, void *b, long m, long a, char *s) {
+    if (m == 1) { // input
+        max_jit_mop_assist(x, b, m, a, s);
+    } else { // output
+        switch (a) {
+            case 0:
+                sprintf(s, "(matrix) per brick displacement dx dy dz and mass");
+                break;
+
+            case 1:
+                sprintf(s, "(int) moving brick count");
+                break;
+
+            default:
+                sprintf(s, "dumpout");
+                break;
+        }
+    }
+}
+
+/************************************************************************************/
+// Object Life Cycle
+
+void * max_flow_new(t_symbol *s, long argc, t_atom *argv) {
+    t_max_flow *x;
+    void *o;
+
+    x = (t_max_flow *)max_jit_object_alloc(max_flow_class, gensym("flow"));
+
+    if (x) {
+        x->av = NULL;
+        o = jit_object_new(gensym("flow"));
+
+        if (o) {
+            max_jit_obex_jitob_set(x,o);
+            max_jit_obex_dumpout_set(x,outlet_new(x,NULL));
+            x->statsout = outlet_new(x, 0L);
+            x->av = jit_getbytes(sizeof(t_atom));
+            max_jit_mop_setup(x);
+            max_jit_mop_inputs(x);
+            max_jit_mop_outputs(x);
+
+            max_jit_attr_args(x, argc, argv);
+        } else {
+            jit_object_error((t_object *)x, "voxel.flow: could not allocate object");
+            object_free((t_object *)x);
+            x = NULL;
+        }
+    }
+
+    return (x);
+}
+
+void max_flow_free(t_max_flow *x) {
+    max_jit_mop_free(x);
+    jit_object_free(max_jit_obex_jitob_get(x));
+
+    if (x->av) {
+        jit_freebytes(x->av, sizeof(t_atom));
+    }
+
+    max_jit_object_free(x);
+}
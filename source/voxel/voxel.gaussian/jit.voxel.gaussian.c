@@ -1,26 +1,85 @@
 #include "jit.common.h"
+#include "voxel.parallel.h"
+#include "voxel.arena.h"
+#include "voxel.half.h"
+#include "voxel.hash.h"
 #include <math.h>
-#include <pthread.h>
-#include <unistd.h>
+
+enum {
+    GAUSSIAN_BOUNDARY_ZERO = 0,
+    GAUSSIAN_BOUNDARY_CLAMP,
+    GAUSSIAN_BOUNDARY_MIRROR,
+    GAUSSIAN_BOUNDARY_RENORMALIZE
+};
+
+// packed float grid (or 4d batch of grids) handed between calc and the async worker,
+// with the attributes of the frame it was taken from
+typedef struct _gaussian_buffer {
+    float *data;
+    long size;
+    long dim[4];
+    double stamp;
+    long boundary;
+    long num_threads;
+    long affinity;
+} t_gaussian_buffer;
 
 typedef struct _gaussian {
     t_object ob;
-    long radius;
-    float sigma;
-    float *weight_cache;
-    long cache_size;
+    t_symbol *precision;
+    long radius[3];
+    float sigma[3];
+    float spacing[3];
+    t_symbol *boundary;
+    float *weights[3];
+    float *cumulative[3];
+    long taps[3];
     long num_threads;
+    long affinity;
+    float calctime;
+    long async;
+    float latency;
+    long dropped;
+    long allocations;
+    t_voxel_cache cache;
+    pthread_t worker;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    int worker_started;
+    int worker_quit;
+    int pending_valid;
+    int busy;
+    int result_fresh;
+    long async_allocations;     // async_arena's count, published by the worker under mutex
+    t_gaussian_buffer staging;  // calc's next snapshot, filled without the mutex
+    t_gaussian_buffer pending;
+    t_gaussian_buffer working;
+    t_gaussian_buffer front;
+    t_gaussian_buffer back;
+    t_gaussian_buffer shown;    // the result calc is outputting, only calc touches it
+    t_voxel_arena arena;
+    t_voxel_arena async_arena;
+    t_voxel_arena tables[2];    // weights and cumulative: the current ones in tables[table]
+    long table;
 } t_gaussian;
 
-typedef struct _thread_data {
+typedef struct _gaussian_frame {
     t_gaussian *x;
     char *in_bp;
     char *out_bp;
     long *dim;
-    long *stride;
-    long start_slice;
-    long end_slice;
-} t_thread_data;
+    long *in_stride;
+    long *out_stride;
+    long batch_stride[2];
+    long in_format;
+    long out_format;
+    long boundary;
+    long num_threads;
+    long affinity;
+    float *tmp[2];
+    float *lines;           // one row per thread for converting half input
+    size_t line_stride;     // bytes from one thread's row to the next
+} t_gaussian_frame;
 
 BEGIN_USING_C_LINKAGE
 t_jit_err gaussian_init(void);
@@ -29,19 +88,27 @@ void gaussian_free(t_gaussian *x);
 t_jit_err gaussian_matrix_calc(t_gaussian *x, void *inputs, void *outputs);
 t_jit_err gaussian_radius_set(t_gaussian *x, void *attr, long ac, t_atom *av);
 t_jit_err gaussian_sigma_set(t_gaussian *x, void *attr, long ac, t_atom *av);
+t_jit_err gaussian_spacing_set(t_gaussian *x, void *attr, long ac, t_atom *av);
 void gaussian_clear(t_gaussian *x);
-void gaussian_precompute_weights(t_gaussian *x);
-void *gaussian_thread_worker(void *arg);
-float convolve(t_gaussian *x, char *in_bp, long *dim, long *stride, long gx, long gy, long gz);
+t_jit_err gaussian_precompute_weights(t_gaussian *x);
+void *gaussian_async_worker(void *arg);
 END_USING_C_LINKAGE
 
 static void *_gaussian_class = NULL;
+static t_symbol *ps_zero, *ps_clamp, *ps_mirror, *ps_renormalize, *ps_half;
 
 t_jit_err gaussian_init(void) {
     long attrflags = JIT_ATTR_GET_DEFER_LOW | JIT_ATTR_SET_USURP_LOW;
+    long statflags = JIT_ATTR_SET_OPAQUE_USER | JIT_ATTR_GET_DEFER_LOW;
     t_jit_object *attr;
     t_jit_object *mop;
 
+    ps_zero = gensym("zero");
+    ps_clamp = gensym("clamp");
+    ps_mirror = gensym("mirror");
+    ps_renormalize = gensym("renormalize");
+    ps_half = gensym("half");
+
     _gaussian_class = jit_class_new("gaussian", (method)gaussian_new, (method)gaussian_free, sizeof(t_gaussian), 0L);
 
     mop = jit_object_new(_jit_sym_jit_mop, 1, 1);
@@ -51,16 +118,49 @@ t_jit_err gaussian_init(void) {
     jit_class_addmethod(_gaussian_class, (method)gaussian_matrix_calc, "matrix_calc", A_CANT, 0L);
 
     // attributes
-    attr = jit_object_new(_jit_sym_jit_attr_offset, "radius", _jit_sym_long, attrflags,
-                          (method)NULL, (method)gaussian_radius_set, calcoffset(t_gaussian, radius));
+    attr = jit_object_new(_jit_sym_jit_attr_offset_array, "radius", _jit_sym_long, 3, attrflags,
+                          (method)NULL, (method)gaussian_radius_set, 0, calcoffset(t_gaussian, radius));
     jit_class_addattr(_gaussian_class, attr);
     CLASS_ATTR_LABEL(_gaussian_class, "radius", 0, "Radius");
-    
-    attr = jit_object_new(_jit_sym_jit_attr_offset, "sigma", _jit_sym_float32, attrflags,
-                          (method)NULL, (method)gaussian_sigma_set, calcoffset(t_gaussian, sigma));
+
+    attr = jit_object_new(_jit_sym_jit_attr_offset_array, "sigma", _jit_sym_float32, 3, attrflags,
+                          (method)NULL, (method)gaussian_sigma_set, 0, calcoffset(t_gaussian, sigma));
     jit_class_addattr(_gaussian_class, attr);
     CLASS_ATTR_LABEL(_gaussian_class, "sigma", 0, "Standard Deviation");
 
+    attr = jit_object_new(_jit_sym_jit_attr_offset_array, "spacing", _jit_sym_float32, 3, attrflags,
+                          (method)NULL, (method)gaussian_spacing_set, 0, calcoffset(t_gaussian, spacing));
+    jit_class_addattr(_gaussian_class, attr);
+    CLASS_ATTR_LABEL(_gaussian_class, "spacing", 0, "Voxel Spacing");
+
+    attr = jit_object_new(_jit_sym_jit_attr_offset, "boundary", _jit_sym_symbol, attrflags,
+                          (method)NULL, (method)NULL, calcoffset(t_gaussian, boundary));
+    jit_class_addattr(_gaussian_class, attr);
+    CLASS_ATTR_LABEL(_gaussian_class, "boundary", 0, "Boundary Mode");
+    CLASS_ATTR_ENUM(_gaussian_class, "boundary", 0, "zero clamp mirror renormalize");
+
+    attr = jit_object_new(_jit_sym_jit_attr_offset, "async", _jit_sym_long, attrflags,
+                          (method)NULL, (method)NULL, calcoffset(t_gaussian, async));
+    jit_class_addattr(_gaussian_class, attr);
+    CLASS_ATTR_LABEL(_gaussian_class, "async", 0, "Compute In Background");
+    CLASS_ATTR_STYLE(_gaussian_class, "async", 0, "onoff");
+
+    attr = jit_object_new(_jit_sym_jit_attr_offset, "latency", _jit_sym_float32, statflags,
+                          (method)NULL, (method)NULL, calcoffset(t_gaussian, latency));
+    jit_class_addattr(_gaussian_class, attr);
+
+    attr = jit_object_new(_jit_sym_jit_attr_offset, "dropped", _jit_sym_long, statflags,
+                          (method)NULL, (method)NULL, calcoffset(t_gaussian, dropped));
+    jit_class_addattr(_gaussian_class, attr);
+
+    attr = jit_object_new(_jit_sym_jit_attr_offset, "allocations", _jit_sym_long, statflags,
+                          (method)NULL, (method)NULL, calcoffset(t_gaussian, allocations));
+    jit_class_addattr(_gaussian_class, attr);
+
+    voxel_grid_class_attrs(_gaussian_class, calcoffset(t_gaussian, precision));
+    voxel_cache_class_attrs(_gaussian_class, calcoffset(t_gaussian, cache));
+    voxel_parallel_class_attrs(_gaussian_class, calcoffset(t_gaussian, num_threads), calcoffset(t_gaussian, affinity), calcoffset(t_gaussian, calctime));
+
     jit_class_register(_gaussian_class);
 
     return JIT_ERR_NONE;
@@ -70,11 +170,43 @@ t_gaussian *gaussian_new(void) {
     t_gaussian *x;
 
     if ((x = (t_gaussian *)jit_object_alloc(_gaussian_class))) {
-        x->radius = 1;
-        x->sigma = 1.0f;
-        x->weight_cache = NULL;
-        x->cache_size = 0;
-        x->num_threads = sysconf(_SC_NPROCESSORS_ONLN);
+        x->precision = _jit_sym_float32;
+        for (int i = 0; i < 3; i++) {
+            x->radius[i] = 1;
+            x->sigma[i] = 1.0f;
+            x->spacing[i] = 1.0f;
+            x->weights[i] = NULL;
+            x->cumulative[i] = NULL;
+            x->taps[i] = 0;
+        }
+        x->boundary = ps_zero;
+        x->num_threads = 0;
+        x->affinity = 0;
+        x->calctime = 0.0f;
+        x->async = 0;
+        x->latency = 0.0f;
+        x->dropped = 0;
+        x->allocations = 0;
+        voxel_cache_clear(&x->cache);
+        x->worker_started = 0;
+        x->worker_quit = 0;
+        x->pending_valid = 0;
+        x->busy = 0;
+        x->result_fresh = 0;
+        x->async_allocations = 0;
+        memset(&x->staging, 0, sizeof(t_gaussian_buffer));
+        memset(&x->pending, 0, sizeof(t_gaussian_buffer));
+        memset(&x->working, 0, sizeof(t_gaussian_buffer));
+        memset(&x->front, 0, sizeof(t_gaussian_buffer));
+        memset(&x->back, 0, sizeof(t_gaussian_buffer));
+        memset(&x->shown, 0, sizeof(t_gaussian_buffer));
+        voxel_arena_init(&x->arena);
+        voxel_arena_init(&x->async_arena);
+        voxel_arena_init(&x->tables[0]);
+        voxel_arena_init(&x->tables[1]);
+        x->table = 0;
+        pthread_mutex_init(&x->mutex, NULL);
+        pthread_cond_init(&x->cond, NULL);
         gaussian_precompute_weights(x);
     } else {
         x = NULL;
@@ -84,88 +216,543 @@ t_gaussian *gaussian_new(void) {
 }
 
 void gaussian_free(t_gaussian *x) {
-    if (x->weight_cache) {
-        free(x->weight_cache);
+    if (x->worker_started) {
+        pthread_mutex_lock(&x->mutex);
+        x->worker_quit = 1;
+        pthread_cond_broadcast(&x->cond);
+        pthread_mutex_unlock(&x->mutex);
+        pthread_join(x->worker, NULL);
     }
+    pthread_mutex_destroy(&x->mutex);
+    pthread_cond_destroy(&x->cond);
+
+    if (x->staging.data) free(x->staging.data);
+    if (x->pending.data) free(x->pending.data);
+    if (x->working.data) free(x->working.data);
+    if (x->front.data) free(x->front.data);
+    if (x->back.data) free(x->back.data);
+    if (x->shown.data) free(x->shown.data);
+    voxel_arena_free(&x->arena);
+    voxel_arena_free(&x->async_arena);
+    voxel_arena_free(&x->tables[0]);
+    voxel_arena_free(&x->tables[1]);
+}
+
+// blocks until the async worker is between frames, so the weights can be swapped safely
+static void gaussian_async_pause(t_gaussian *x) {
+    pthread_mutex_lock(&x->mutex);
+    while (x->busy) {
+        pthread_cond_wait(&x->cond, &x->mutex);
+    }
+}
+
+static void gaussian_async_resume(t_gaussian *x) {
+    pthread_mutex_unlock(&x->mutex);
 }
 
+// radius, sigma and spacing take one value for all axes or one per axis; a change
+// whose kernel cannot be allocated is refused and the previous values stay
 t_jit_err gaussian_radius_set(t_gaussian *x, void *attr, long ac, t_atom *av){
-    x->radius = atom_getlong(av);
-    gaussian_precompute_weights(x);
-    return JIT_ERR_NONE;
+    long previous[3];
+    t_jit_err err;
+
+    if (ac < 1 || !av) {
+        return JIT_ERR_NONE;
+    }
+    gaussian_async_pause(x);
+    memcpy(previous, x->radius, sizeof(previous));
+    for (long i = 0; i < 3; i++) {
+        x->radius[i] = MAX(0, atom_getlong(av + (i < ac ? i : 0)));
+    }
+    if ((err = gaussian_precompute_weights(x))) {
+        memcpy(x->radius, previous, sizeof(previous));
+    }
+    gaussian_async_resume(x);
+    return err;
 }
 
 t_jit_err gaussian_sigma_set(t_gaussian *x, void *attr, long ac, t_atom *av){
-    x->sigma = atom_getfloat(av);
-    gaussian_precompute_weights(x);
+    float previous[3];
+    t_jit_err err;
+
+    if (ac < 1 || !av) {
+        return JIT_ERR_NONE;
+    }
+    gaussian_async_pause(x);
+    memcpy(previous, x->sigma, sizeof(previous));
+    for (long i = 0; i < 3; i++) {
+        x->sigma[i] = atom_getfloat(av + (i < ac ? i : 0));
+    }
+    if ((err = gaussian_precompute_weights(x))) {
+        memcpy(x->sigma, previous, sizeof(previous));
+    }
+    gaussian_async_resume(x);
+    return err;
+}
+
+t_jit_err gaussian_spacing_set(t_gaussian *x, void *attr, long ac, t_atom *av){
+    float previous[3];
+    t_jit_err err;
+
+    if (ac < 1 || !av) {
+        return JIT_ERR_NONE;
+    }
+    gaussian_async_pause(x);
+    memcpy(previous, x->spacing, sizeof(previous));
+    for (long i = 0; i < 3; i++) {
+        float spacing = atom_getfloat(av + (i < ac ? i : 0));
+        x->spacing[i] = spacing > 0.0f ? spacing : 1.0f;
+    }
+    if ((err = gaussian_precompute_weights(x))) {
+        memcpy(x->spacing, previous, sizeof(previous));
+    }
+    gaussian_async_resume(x);
+    return err;
+}
+
+// The 3d kernel is the product of one normalized 1d kernel per axis, which is the
+// old cube kernel exactly when all axes agree. radius counts voxels of the finest
+// spacing, so coarser axes get proportionally fewer taps and the kernel stays the
+// same physical size on every axis.
+t_jit_err gaussian_precompute_weights(t_gaussian *x) {
+    float finest = MIN(x->spacing[0], MIN(x->spacing[1], x->spacing[2]));
+    t_voxel_arena *tables = &x->tables[!x->table];
+    float *weights[3];
+    long taps[3];
+
+    // the new tables are built in the arena not holding the current ones, so the
+    // current kernel stays in use when they cannot be had. The tables of an axis share
+    // one block, and a size either arena has seen before comes from its free list
+    voxel_arena_release(tables);
+    for (int i = 0; i < 3; i++) {
+        taps[i] = lroundf(x->radius[i] * finest / x->spacing[i]) * 2 + 1;
+        weights[i] = (float *)voxel_arena_alloc(tables, (taps[i] * 2 + 1) * sizeof(float));
+        if (!weights[i]) {
+            voxel_arena_release(tables);
+            jit_object_error((t_object *)x, "voxel.gaussian: no memory for a radius of %ld, keeping the previous kernel", x->radius[i]);
+            return JIT_ERR_OUT_OF_MEM;
+        }
+    }
+
+    for (int i = 0; i < 3; i++) {
+        long r = taps[i] / 2;
+        float *cumulative = weights[i] + taps[i];
+        float sigma_sq_2 = 2.0f * x->sigma[i] * x->sigma[i];
+        float total_weight = 0.0f;
+
+        for (long k = -r; k <= r; k++) {
+            float norm = r > 0 ? (float)k / r : 0.0f;
+            float weight = expf(-norm * norm / sigma_sq_2);
+
+            weights[i][k + r] = weight;
+            total_weight += weight;
+        }
+
+        // Normalize weights so they sum to 1
+        if (total_weight > 0.0f) {
+            for (long k = 0; k < taps[i]; k++) {
+                weights[i][k] /= total_weight;
+            }
+        }
+
+        // prefix sums, so the weight that falls inside the grid at a border is two lookups
+        cumulative[0] = 0.0f;
+        for (long k = 0; k < taps[i]; k++) {
+            cumulative[k + 1] = cumulative[k] + weights[i][k];
+        }
+
+        x->weights[i] = weights[i];
+        x->cumulative[i] = cumulative;
+        x->taps[i] = taps[i];
+    }
+
+    voxel_arena_release(&x->tables[x->table]);
+    x->table = !x->table;
     return JIT_ERR_NONE;
 }
 
-void gaussian_precompute_weights(t_gaussian *x) {
-    if (x->weight_cache) {
-        free(x->weight_cache);
-    }
-    
-    long diameter = x->radius * 2 + 1;
-    x->cache_size = diameter * diameter * diameter;
-    x->weight_cache = (float *)malloc(x->cache_size * sizeof(float));
-    
-    float total_weight = 0.0f;
-    long idx = 0;
-    float sigma_sq_2 = 2.0f * x->sigma * x->sigma;
-    
-    for (long gz = 0; gz < diameter; gz++) {
-        for (long gy = 0; gy < diameter; gy++) {
-            for (long gx = 0; gx < diameter; gx++) {
-                float norm_x = ((float)gx / (diameter - 1)) * 2.0f - 1.0f;
-                float norm_y = ((float)gy / (diameter - 1)) * 2.0f - 1.0f;
-                float norm_z = ((float)gz / (diameter - 1)) * 2.0f - 1.0f;
-                
-                float dist_sq = norm_x * norm_x + norm_y * norm_y + norm_z * norm_z;
-                float weight = expf(-dist_sq / sigma_sq_2);
-                
-                x->weight_cache[idx++] = weight;
-                total_weight += weight;
+// source voxel of tap position i on an axis of n voxels, -1 if the tap contributes nothing
+static inline long gaussian_boundary_index(long boundary, long i, long n) {
+    if (i >= 0 && i < n) {
+        return i;
+    }
+    switch (boundary) {
+        case GAUSSIAN_BOUNDARY_CLAMP:
+            return i < 0 ? 0 : n - 1;
+        case GAUSSIAN_BOUNDARY_MIRROR:
+            // reflect about the edge voxels, which repeats with period 2 * (n - 1)
+            if (n == 1) {
+                return 0;
             }
+            i = labs(i) % (2 * (n - 1));
+            return i < n ? i : 2 * (n - 1) - i;
+        default:
+            return -1;
+    }
+}
+
+// scale for voxel p of an axis of n voxels: 1 / (weight of the taps inside the axis)
+// in renormalize mode, 1 otherwise. The 3d kernel is a product of the axis kernels,
+// so renormalizing each pass renormalizes the whole kernel.
+static inline float gaussian_boundary_scale(t_gaussian *x, long boundary, int axis, long p, long n) {
+    long r = x->taps[axis] / 2;
+    float inside;
+
+    if (boundary != GAUSSIAN_BOUNDARY_RENORMALIZE) {
+        return 1.0f;
+    }
+    inside = x->cumulative[axis][MIN(r, n - 1 - p) + r + 1] - x->cumulative[axis][MAX(-r, -p) + r];
+    return inside > 0.0f ? 1.0f / inside : 0.0f;
+}
+
+static t_jit_err gaussian_buffer_reserve(t_gaussian_buffer *b, long size) {
+    if (size > b->size) {
+        if (b->data) {
+            free(b->data);
+        }
+        b->data = (float *)malloc(size * sizeof(float));
+        b->size = b->data ? size : 0;
+
+        if (!b->data) {
+            return JIT_ERR_OUT_OF_MEM;
         }
     }
-    
-    // Normalize weights so they sum to 1
-    if (total_weight > 0.0f) {
-        for (long i = 0; i < x->cache_size; i++) {
-            x->weight_cache[i] /= total_weight;
+    return JIT_ERR_NONE;
+}
+
+// dst += src * w over a packed row
+static inline void gaussian_axpy(float *restrict dst, const float *restrict src, float w, long n) {
+    for (long i = 0; i < n; i++) {
+        dst[i] += src[i] * w;
+    }
+}
+
+static inline void gaussian_scale(float *dst, float s, long n) {
+    for (long i = 0; i < n; i++) {
+        dst[i] *= s;
+    }
+}
+
+// x tap sum of a voxel within radius of either end of its row
+static float gaussian_x_border(t_gaussian_frame *f, char *row, long step, long vox_x, const float *wx) {
+    long rx = f->x->taps[0] / 2;
+    float sum = 0.0f;
+
+    for (long k = -rx; k <= rx; k++) {
+        long src = gaussian_boundary_index(f->boundary, vox_x + k, f->dim[0]);
+
+        if (src >= 0) {
+            sum += *(float *)(row + src * step) * wx[k];
         }
     }
+    return sum * gaussian_boundary_scale(f->x, f->boundary, 0, vox_x, f->dim[0]);
 }
 
-void *gaussian_thread_worker(void *arg) {
-    t_thread_data *data = (t_thread_data *)arg;
-    t_gaussian *x = data->x;
-    char *in_bp = data->in_bp;
-    char *out_bp = data->out_bp;
-    long *dim = data->dim;
-    long *stride = data->stride;
-    
-    for (long vox_z = data->start_slice; vox_z <= data->end_slice; vox_z++) {
+// x then y pass of each slice, input -> tmp[0] -> tmp[1]. slices of every grid in
+// a batch are numbered consecutively, so one dispatch balances the whole batch
+static void gaussian_xy_slab(void *ctx, long thread, long start, long end) {
+    t_gaussian_frame *f = (t_gaussian_frame *)ctx;
+    long *dim = f->dim;
+    long slice_size = dim[0] * dim[1];
+    long rx = f->x->taps[0] / 2;
+    long ry = f->x->taps[1] / 2;
+    const float *wx = f->x->weights[0] + rx;
+    const float *wy = f->x->weights[1] + ry;
+    long x_lo = MIN(rx, dim[0]);
+    long x_hi = MAX(x_lo, dim[0] - rx);
+
+    for (long slice = start; slice < end; slice++) {
+        long grid = slice / dim[2];
+        long vox_z = slice % dim[2];
+        char *in_bp = f->in_bp + grid * f->batch_stride[0] + vox_z * f->in_stride[2];
+        float *xp = f->tmp[0] + slice * slice_size;
+        float *yp = f->tmp[1] + slice * slice_size;
+
         for (long vox_y = 0; vox_y < dim[1]; vox_y++) {
-            for (long vox_x = 0; vox_x < dim[0]; vox_x++) {
-                long index = vox_x * stride[0] + vox_y * stride[1] + vox_z * stride[2];
-                float *fop = (float *)(out_bp + index);
-                fop[0] = convolve(x, in_bp, dim, stride, vox_x, vox_y, vox_z);
+            char *row = in_bp + vox_y * f->in_stride[1];
+            long step = f->in_stride[0];
+            float *dst = xp + vox_y * dim[0];
+
+            if (f->in_format == VOXEL_GRID_HALF) {
+                float *line = (float *)((char *)f->lines + thread * f->line_stride);
+
+                voxel_half_load(row, step, line, dim[0]);
+                row = (char *)line;
+                step = sizeof(float);
+            }
+
+            // interior voxels see every tap, so only the border goes through the boundary mode
+            for (long vox_x = x_lo; vox_x < x_hi; vox_x++) {
+                float sum = 0.0f;
+
+                for (long k = -rx; k <= rx; k++) {
+                    sum += *(float *)(row + (vox_x + k) * step) * wx[k];
+                }
+                dst[vox_x] = sum;
+            }
+            for (long vox_x = 0; vox_x < x_lo; vox_x++) {
+                dst[vox_x] = gaussian_x_border(f, row, step, vox_x, wx);
+            }
+            for (long vox_x = x_hi; vox_x < dim[0]; vox_x++) {
+                dst[vox_x] = gaussian_x_border(f, row, step, vox_x, wx);
+            }
+        }
+
+        for (long vox_y = 0; vox_y < dim[1]; vox_y++) {
+            float *dst = yp + vox_y * dim[0];
+
+            memset(dst, 0, dim[0] * sizeof(float));
+            for (long k = -ry; k <= ry; k++) {
+                long src = gaussian_boundary_index(f->boundary, vox_y + k, dim[1]);
+
+                if (src >= 0) {
+                    gaussian_axpy(dst, xp + src * dim[0], wy[k], dim[0]);
+                }
+            }
+            if (vox_y < ry || vox_y >= dim[1] - ry) {
+                gaussian_scale(dst, gaussian_boundary_scale(f->x, f->boundary, 1, vox_y, dim[1]), dim[0]);
             }
         }
     }
-    
+}
+
+// z pass, tmp[1] -> output. rows are accumulated in the slice's own part of
+// tmp[0], which the xy pass no longer needs
+static void gaussian_z_slab(void *ctx, long thread, long start, long end) {
+    t_gaussian_frame *f = (t_gaussian_frame *)ctx;
+    long *dim = f->dim;
+    long slice_size = dim[0] * dim[1];
+    long rz = f->x->taps[2] / 2;
+    const float *wz = f->x->weights[2] + rz;
+
+    for (long slice = start; slice < end; slice++) {
+        long grid = slice / dim[2];
+        long vox_z = slice % dim[2];
+        float scale = gaussian_boundary_scale(f->x, f->boundary, 2, vox_z, dim[2]);
+        char *out_bp = f->out_bp + grid * f->batch_stride[1] + vox_z * f->out_stride[2];
+
+        for (long vox_y = 0; vox_y < dim[1]; vox_y++) {
+            float *acc = f->tmp[0] + slice * slice_size + vox_y * dim[0];
+            char *row = out_bp + vox_y * f->out_stride[1];
+
+            memset(acc, 0, dim[0] * sizeof(float));
+            for (long k = -rz; k <= rz; k++) {
+                long src = gaussian_boundary_index(f->boundary, vox_z + k, dim[2]);
+
+                if (src >= 0) {
+                    gaussian_axpy(acc, f->tmp[1] + (slice - vox_z + src) * slice_size + vox_y * dim[0], wz[k], dim[0]);
+                }
+            }
+            if (f->out_format == VOXEL_GRID_HALF) {
+                gaussian_scale(acc, scale, dim[0]);
+                voxel_half_store(acc, row, f->out_stride[0], dim[0]);
+            } else {
+                for (long vox_x = 0; vox_x < dim[0]; vox_x++) {
+                    *(float *)(row + vox_x * f->out_stride[0]) = acc[vox_x] * scale;
+                }
+            }
+        }
+    }
+}
+
+// both separable passes over every grid of the frame; the two intermediate volumes
+// are borrowed from arena until the caller releases it
+static t_jit_err gaussian_run(t_gaussian *x, t_gaussian_frame *f, long batch, t_voxel_arena *arena) {
+    long count = f->dim[0] * f->dim[1] * f->dim[2] * batch;
+
+    if (!x->weights[0]) {
+        return JIT_ERR_OUT_OF_MEM;
+    }
+    f->tmp[0] = (float *)voxel_arena_alloc(arena, count * sizeof(float));
+    f->tmp[1] = (float *)voxel_arena_alloc(arena, count * sizeof(float));
+    f->lines = NULL;
+    if (f->in_format == VOXEL_GRID_HALF) {
+        f->lines = (float *)voxel_arena_alloc_rows(arena, voxel_parallel_threads(f->num_threads), f->dim[0] * sizeof(float),
+                                                   &f->line_stride);
+    }
+    if (!f->tmp[0] || !f->tmp[1] || (f->in_format == VOXEL_GRID_HALF && !f->lines)) {
+        return JIT_ERR_OUT_OF_MEM;
+    }
+
+    voxel_parallel_for(f->num_threads, f->affinity, f->dim[2] * batch, gaussian_xy_slab, f);
+    voxel_parallel_for(f->num_threads, f->affinity, f->dim[2] * batch, gaussian_z_slab, f);
+    return JIT_ERR_NONE;
+}
+
+void *gaussian_async_worker(void *arg) {
+    t_gaussian *x = (t_gaussian *)arg;
+    t_gaussian_buffer tmp;
+
+    pthread_mutex_lock(&x->mutex);
+    while (1) {
+        while (!x->pending_valid && !x->worker_quit) {
+            pthread_cond_wait(&x->cond, &x->mutex);
+        }
+        if (x->worker_quit) {
+            break;
+        }
+
+        // take the newest snapshot; calc may refill pending meanwhile
+        tmp = x->working;
+        x->working = x->pending;
+        x->pending = tmp;
+        x->pending_valid = 0;
+        x->busy = 1;
+        pthread_mutex_unlock(&x->mutex);
+
+        long *dim = x->working.dim;
+        int ok = gaussian_buffer_reserve(&x->back, dim[0] * dim[1] * dim[2] * dim[3]) == JIT_ERR_NONE;
+
+        if (ok) {
+            t_gaussian_frame frame;
+            long stride[4];
+
+            stride[0] = sizeof(float);
+            for (int i = 1; i < 4; i++) {
+                stride[i] = stride[i - 1] * dim[i - 1];
+            }
+            frame.x = x;
+            frame.in_bp = (char *)x->working.data;
+            frame.out_bp = (char *)x->back.data;
+            frame.dim = dim;
+            frame.in_stride = stride;
+            frame.out_stride = stride;
+            frame.batch_stride[0] = stride[3];
+            frame.batch_stride[1] = stride[3];
+            frame.in_format = VOXEL_GRID_FLOAT32;
+            frame.out_format = VOXEL_GRID_FLOAT32;
+            frame.boundary = x->working.boundary;
+            frame.num_threads = x->working.num_threads;
+            frame.affinity = x->working.affinity;
+
+            ok = gaussian_run(x, &frame, dim[3], &x->async_arena) == JIT_ERR_NONE;
+            voxel_arena_release(&x->async_arena);
+        }
+
+        pthread_mutex_lock(&x->mutex);
+        x->async_allocations = x->async_arena.allocations;
+        if (ok) {
+            tmp = x->front;
+            x->front = x->back;
+            x->back = tmp;
+            memcpy(x->front.dim, dim, sizeof(x->front.dim));
+            x->front.stamp = x->working.stamp;
+            x->result_fresh = 1;
+            x->latency = (float)(systimer_gettime() - x->working.stamp);
+        }
+        x->busy = 0;
+        pthread_cond_broadcast(&x->cond);
+    }
+    pthread_mutex_unlock(&x->mutex);
+
     return NULL;
 }
 
+// heap allocations of all the arenas; the worker's count is only read under the mutex
+static void gaussian_count_allocations(t_gaussian *x) {
+    long async_allocations;
+
+    pthread_mutex_lock(&x->mutex);
+    async_allocations = x->async_allocations;
+    pthread_mutex_unlock(&x->mutex);
+    x->allocations = x->arena.allocations + x->tables[0].allocations + x->tables[1].allocations + async_allocations;
+}
+
+// snapshots the input for the worker and outputs the newest finished result. Both
+// copies run outside the mutex on buffers only calc touches; under it, staging is
+// swapped in as the pending frame and a fresh result swapped out into shown
+static t_jit_err gaussian_async_calc(t_gaussian *x, t_gaussian_frame *f, long batch) {
+    long *dim = f->dim;
+    long packed;
+    t_gaussian_buffer tmp;
+    int current;
+
+    if (!x->worker_started) {
+        x->worker_quit = 0;
+        if (pthread_create(&x->worker, NULL, gaussian_async_worker, x) != 0) {
+            return gaussian_run(x, f, batch, &x->arena);
+        }
+        x->worker_started = 1;
+    }
+
+    if (gaussian_buffer_reserve(&x->staging, dim[0] * dim[1] * dim[2] * batch)) {
+        return JIT_ERR_OUT_OF_MEM;
+    }
+    packed = 0;
+    for (long grid = 0; grid < batch; grid++) {
+        char *in_bp = f->in_bp + grid * f->batch_stride[0];
+
+        for (long vox_z = 0; vox_z < dim[2]; vox_z++) {
+            for (long vox_y = 0; vox_y < dim[1]; vox_y++) {
+                for (long vox_x = 0; vox_x < dim[0]; vox_x++) {
+                    char *ip = in_bp + vox_x * f->in_stride[0] + vox_y * f->in_stride[1] + vox_z * f->in_stride[2];
+
+                    x->staging.data[packed++] = voxel_grid_read(ip, f->in_format);
+                }
+            }
+        }
+    }
+    x->staging.dim[0] = dim[0];
+    x->staging.dim[1] = dim[1];
+    x->staging.dim[2] = dim[2];
+    x->staging.dim[3] = batch;
+    x->staging.stamp = systimer_gettime();
+    x->staging.boundary = f->boundary;
+    x->staging.num_threads = f->num_threads;
+    x->staging.affinity = f->affinity;
+
+    pthread_mutex_lock(&x->mutex);
+
+    // a snapshot the worker has not picked up yet is replaced by this newer frame
+    if (x->pending_valid) {
+        x->dropped++;
+    }
+    tmp = x->pending;
+    x->pending = x->staging;
+    x->staging = tmp;
+    x->pending_valid = 1;
+
+    if (x->result_fresh) {
+        tmp = x->shown;
+        x->shown = x->front;
+        x->front = tmp;
+        x->result_fresh = 0;
+    }
+    pthread_cond_broadcast(&x->cond);
+
+    pthread_mutex_unlock(&x->mutex);
+
+    current = x->shown.data && x->shown.dim[0] == dim[0] && x->shown.dim[1] == dim[1] &&
+              x->shown.dim[2] == dim[2] && x->shown.dim[3] == batch;
+
+    packed = 0;
+    for (long grid = 0; grid < batch; grid++) {
+        char *out_bp = f->out_bp + grid * f->batch_stride[1];
+
+        for (long vox_z = 0; vox_z < dim[2]; vox_z++) {
+            for (long vox_y = 0; vox_y < dim[1]; vox_y++) {
+                for (long vox_x = 0; vox_x < dim[0]; vox_x++) {
+                    char *op = out_bp + vox_x * f->out_stride[0] + vox_y * f->out_stride[1] + vox_z * f->out_stride[2];
+
+                    voxel_grid_write(op, f->out_format, current ? x->shown.data[packed++] : 0.0f);
+                }
+            }
+        }
+    }
+
+    return JIT_ERR_NONE;
+}
+
 t_jit_err gaussian_matrix_calc(t_gaussian *x, void *inputs, void *outputs) {
+    double calc_start = systimer_gettime();
     t_jit_err err = JIT_ERR_NONE;
-    t_jit_matrix_info in_minfo;
-    char *in_bp, *out_bp;
+    t_jit_matrix_info in_minfo, out_minfo;
     t_jit_object *in_matrix, *out_matrix;
     long in_savelock, out_savelock;
     void *in_mdata, *out_mdata;
+    t_gaussian_frame frame;
+    long batch, planes;
+    uint64_t key = 0;
 
     in_matrix = jit_object_method(inputs, _jit_sym_getindex, 0);
     out_matrix = jit_object_method(outputs, _jit_sym_getindex, 0);
@@ -173,7 +760,7 @@ t_jit_err gaussian_matrix_calc(t_gaussian *x, void *inputs, void *outputs) {
     if (!in_matrix || !out_matrix) {
         return JIT_ERR_INVALID_INPUT;
     }
-    
+
     in_savelock = (long)jit_object_method(inputs, _jit_sym_lock, 1);
     out_savelock = (long)jit_object_method(outputs, _jit_sym_lock, 1);
 
@@ -185,6 +772,7 @@ t_jit_err gaussian_matrix_calc(t_gaussian *x, void *inputs, void *outputs) {
         goto out;
     }
 
+    jit_object_method(out_matrix, _jit_sym_getinfo, &out_minfo);
     jit_object_method(out_matrix, _jit_sym_getdata, &out_mdata);
 
     if (!out_mdata) {
@@ -192,121 +780,65 @@ t_jit_err gaussian_matrix_calc(t_gaussian *x, void *inputs, void *outputs) {
         goto out;
     }
 
-    in_bp = (char *)in_mdata;
-    out_bp = (char *)out_mdata;
+    if (in_minfo.dimcount < 3 || in_minfo.dimcount > 4) {
+        err = JIT_ERR_MISMATCH_DIM;
+        goto out;
+    }
 
-    if (x->num_threads > 1) {
-        pthread_t *threads = (pthread_t *)malloc(x->num_threads * sizeof(pthread_t));
-        t_thread_data *thread_data = (t_thread_data *)malloc(x->num_threads * sizeof(t_thread_data));
-        
-        if (!threads || !thread_data) {
-            err = JIT_ERR_OUT_OF_MEM;
-            if (threads) free(threads);
-            if (thread_data) free(thread_data);
-            goto out;
-        }
-        
-        long slices_per_thread = in_minfo.dim[2] / x->num_threads;
-        long remaining_slices = in_minfo.dim[2] % x->num_threads;
-        
-        for (long i = 0; i < x->num_threads; i++) {
-            thread_data[i].x = x;
-            thread_data[i].in_bp = in_bp;
-            thread_data[i].out_bp = out_bp;
-            thread_data[i].dim = in_minfo.dim;
-            thread_data[i].stride = in_minfo.dimstride;
-            thread_data[i].start_slice = i * slices_per_thread;
-            thread_data[i].end_slice = thread_data[i].start_slice + slices_per_thread - 1;
-            
-            // distribute remaining slices to first threads
-            if (i < remaining_slices) {
-                thread_data[i].end_slice++;
-                // adjust start positions for subsequent threads
-                for (long j = i + 1; j < x->num_threads; j++) {
-                    thread_data[j].start_slice++;
-                    thread_data[j].end_slice++;
-                }
-            }
-            
-            if (pthread_create(&threads[i], NULL, gaussian_thread_worker, &thread_data[i]) != 0) {
-                // fallback to single-threaded processing
-                err = JIT_ERR_GENERIC;
-                for (long j = 0; j < i; j++) {
-                    pthread_join(threads[j], NULL);
-                }
-                free(threads);
-                free(thread_data);
-                goto single_threaded_fallback;
-            }
-        }
-        
-        // wait for all threads
-        for (long i = 0; i < x->num_threads; i++) {
-            pthread_join(threads[i], NULL);
-        }
-        
-        free(threads);
-        free(thread_data);
-    } else {
-        for (long vox_z = 0; vox_z < in_minfo.dim[2]; vox_z++) {
-            for (long vox_y = 0; vox_y < in_minfo.dim[1]; vox_y++) {
-                for (long vox_x = 0; vox_x < in_minfo.dim[0]; vox_x++) {
-                    long index = vox_x * in_minfo.dimstride[0] + vox_y * in_minfo.dimstride[1] + vox_z * in_minfo.dimstride[2];
-                    float *fop = (float *)(out_bp + index);
-                    fop[0] = convolve(x, in_bp, in_minfo.dim, in_minfo.dimstride, vox_x, vox_y, vox_z);
-                }
-            }
-        }
+    // float32 grids, or half grids stored as char pairs; the output need not match the input
+    frame.in_format = voxel_grid_format(&in_minfo, x->precision == ps_half, &planes);
+    frame.out_format = voxel_grid_format(&out_minfo, x->precision == ps_half, &planes);
+    if (frame.in_format == VOXEL_GRID_INVALID || frame.out_format == VOXEL_GRID_INVALID) {
+        err = JIT_ERR_MISMATCH_TYPE;
+        goto out;
     }
-    
-    goto out;
 
-single_threaded_fallback:
-    for (long vox_z = 0; vox_z < in_minfo.dim[2]; vox_z++) {
-        for (long vox_y = 0; vox_y < in_minfo.dim[1]; vox_y++) {
-            for (long vox_x = 0; vox_x < in_minfo.dim[0]; vox_x++) {
-                long index = vox_x * in_minfo.dimstride[0] + vox_y * in_minfo.dimstride[1] + vox_z * in_minfo.dimstride[2];
-                float *fop = (float *)(out_bp + index);
-                fop[0] = convolve(x, in_bp, in_minfo.dim, in_minfo.dimstride, vox_x, vox_y, vox_z);
-            }
+    // a 4d matrix is a batch of same-sized grids along the last dimension
+    batch = in_minfo.dimcount == 4 ? in_minfo.dim[3] : 1;
+
+    frame.x = x;
+    frame.in_bp = (char *)in_mdata;
+    frame.out_bp = (char *)out_mdata;
+    frame.dim = in_minfo.dim;
+    frame.in_stride = in_minfo.dimstride;
+    frame.out_stride = out_minfo.dimstride;
+    frame.batch_stride[0] = batch > 1 ? in_minfo.dimstride[3] : 0;
+    frame.batch_stride[1] = batch > 1 ? out_minfo.dimstride[3] : 0;
+    // the worker reads these from its snapshot, never from the object, so they can be
+    // set while it runs; radius, sigma and spacing go through the setters instead
+    frame.boundary = x->boundary == ps_clamp ? GAUSSIAN_BOUNDARY_CLAMP :
+                     x->boundary == ps_mirror ? GAUSSIAN_BOUNDARY_MIRROR :
+                     x->boundary == ps_renormalize ? GAUSSIAN_BOUNDARY_RENORMALIZE : GAUSSIAN_BOUNDARY_ZERO;
+    frame.num_threads = x->num_threads;
+    frame.affinity = x->affinity;
+
+    // async frames write the output later, so they never come from or fill the cache
+    if (x->async) {
+        x->cache.valid = 0;
+        err = gaussian_async_calc(x, &frame, batch);
+        gaussian_count_allocations(x);
+        goto out;
+    }
+
+    if (x->cache.enabled) {
+        key = voxel_cache_key(x->num_threads, x->affinity, &in_minfo, frame.in_bp, &out_minfo, frame.out_bp);
+        key = voxel_hash_bytes(key, x->radius, sizeof(x->radius));
+        key = voxel_hash_bytes(key, x->sigma, sizeof(x->sigma));
+        key = voxel_hash_bytes(key, x->spacing, sizeof(x->spacing));
+        key = voxel_hash_bytes(key, &x->boundary, sizeof(x->boundary));
+        if (voxel_cache_hit(&x->cache, key)) {
+            goto out;
         }
     }
-    err = JIT_ERR_NONE;
+
+    err = gaussian_run(x, &frame, batch, &x->arena);
+    gaussian_count_allocations(x);
+    voxel_cache_store(&x->cache, key, err);
 
 out:
+    x->calctime = (float)(systimer_gettime() - calc_start);
+    voxel_arena_release(&x->arena);
     jit_object_method(in_matrix, _jit_sym_lock, in_savelock);
     jit_object_method(out_matrix, _jit_sym_lock, out_savelock);
     return err;
 }
-
-float convolve(t_gaussian *x, char *in_bp, long *dim, long *stride, long gx, long gy, long gz) {
-    float sum = 0.0f;
-    float total_weight = 0.0f;
-    long diameter = x->radius * 2 + 1;
-    long weight_idx = 0;
-    
-    // Calculate bounds
-    long z_start = (gz >= x->radius) ? gz - x->radius : 0;
-    long z_end = (gz + x->radius < dim[2]) ? gz + x->radius : dim[2] - 1;
-    long y_start = (gy >= x->radius) ? gy - x->radius : 0;
-    long y_end = (gy + x->radius < dim[1]) ? gy + x->radius : dim[1] - 1;
-    long x_start = (gx >= x->radius) ? gx - x->radius : 0;
-    long x_end = (gx + x->radius < dim[0]) ? gx + x->radius : dim[0] - 1;
-    
-    for (long vox_z = gz - x->radius; vox_z <= gz + x->radius; vox_z++) {
-        for (long vox_y = gy - x->radius; vox_y <= gy + x->radius; vox_y++) {
-            for (long vox_x = gx - x->radius; vox_x <= gx + x->radius; vox_x++) {
-                float weight = x->weight_cache[weight_idx++];
-                
-                if (vox_x >= x_start && vox_x <= x_end &&
-                    vox_y >= y_start && vox_y <= y_end &&
-                    vox_z >= z_start && vox_z <= z_end) {
-                    long index = vox_x * stride[0] + vox_y * stride[1] + vox_z * stride[2];
-                    float *fip = (float *)(in_bp + index);
-                    sum += fip[0] * weight;
-                }
-            }
-        }
-    }
-    return sum;
-}
@@ -52,8 +52,13 @@ void * max_gaussian_new(t_symbol *s, long argc, t_atom *argv) {
             max_jit_mop_inputs(x);
             max_jit_mop_outputs(x);
             
-            if(argc > 0 && atom_gettype(argv) == A_LONG){
-                max_jit_attr_set(x, gensym("radius"), argc, argv);
+            // leading ints are the radius, one for all axes or one per axis
+            long radius_argc = 0;
+            while (radius_argc < argc && radius_argc < 3 && atom_gettype(argv + radius_argc) == A_LONG) {
+                radius_argc++;
+            }
+            if (radius_argc > 0) {
+                max_jit_attr_set(x, gensym("radius"), radius_argc, argv);
             }
             
             max_jit_attr_args(x, argc, argv);
@@ -0,0 +1,314 @@
+#include "jit.common.h"
+#include "voxel.parallel.h"
+#include "voxel.index.h"
+#include <math.h>
+
+#define NEIGHBORS_MAX_K 32
+
+typedef struct _neighbors {
+    t_object ob;
+    t_symbol *index_name;
+    float radius;
+    long k;
+    long num_threads;
+    long affinity;
+    float calctime;
+} t_neighbors;
+
+typedef struct _neighbors_frame {
+    t_neighbors *x;
+    t_voxel_index *index;
+    char *in_bp;
+    char *count_bp;
+    char *knn_bp;
+    long in_dim[2];
+    long *in_stride;
+    long *count_stride;
+    long *knn_stride;
+    long k;
+} t_neighbors_frame;
+
+BEGIN_USING_C_LINKAGE
+t_jit_err neighbors_init(void);
+t_neighbors *neighbors_new(void);
+void neighbors_free(t_neighbors *x);
+t_jit_err neighbors_matrix_calc(t_neighbors *x, void *inputs, void *outputs);
+END_USING_C_LINKAGE
+
+static void *_neighbors_class = NULL;
+
+t_jit_err neighbors_init(void) {
+    long attrflags = JIT_ATTR_GET_DEFER_LOW | JIT_ATTR_SET_USURP_LOW;
+    t_jit_object *attr;
+    t_jit_object *mop;
+
+    _neighbors_class = jit_class_new("neighbors", (method)neighbors_new, (method)neighbors_free, sizeof(t_neighbors), 0L);
+
+    mop = jit_object_new(_jit_sym_jit_mop, 1, 2);
+    jit_mop_output_nolink(mop, 1);
+    jit_mop_output_nolink(mop, 2);
+    jit_class_addadornment(_neighbors_class, mop);
+
+    // methods
+    jit_class_addmethod(_neighbors_class, (method)neighbors_matrix_calc, "matrix_calc", A_CANT, 0L);
+
+    // attributes
+    attr = jit_object_new(_jit_sym_jit_attr_offset, "index", _jit_sym_symbol, attrflags,
+                          (method)NULL, (method)NULL, calcoffset(t_neighbors, index_name));
+    jit_class_addattr(_neighbors_class, attr);
+    CLASS_ATTR_LABEL(_neighbors_class, "index", 0, "Spatial Index Name");
+
+    attr = jit_object_new(_jit_sym_jit_attr_offset, "radius", _jit_sym_float32, attrflags,
+                          (method)NULL, (method)NULL, calcoffset(t_neighbors, radius));
+    jit_class_addattr(_neighbors_class, attr);
+    CLASS_ATTR_LABEL(_neighbors_class, "radius", 0, "Radius");
+
+    attr = jit_object_new(_jit_sym_jit_attr_offset, "k", _jit_sym_long, attrflags,
+                          (method)NULL, (method)NULL, calcoffset(t_neighbors, k));
+    jit_class_addattr(_neighbors_class, attr);
+    CLASS_ATTR_LABEL(_neighbors_class, "k", 0, "Nearest Neighbours");
+
+    voxel_parallel_class_attrs(_neighbors_class, calcoffset(t_neighbors, num_threads), calcoffset(t_neighbors, affinity), calcoffset(t_neighbors, calctime));
+
+    jit_class_register(_neighbors_class);
+
+    return JIT_ERR_NONE;
+}
+
+t_neighbors *neighbors_new(void) {
+    t_neighbors *x;
+
+    if ((x = (t_neighbors *)jit_object_alloc(_neighbors_class))) {
+        x->index_name = _jit_sym_nothing;
+        x->radius = 0.05f;
+        x->k = 0;
+        x->num_threads = 0;
+        x->affinity = 0;
+        x->calctime = 0.0f;
+    } else {
+        x = NULL;
+    }
+
+    return x;
+}
+
+void neighbors_free(t_neighbors *x) {
+}
+
+static inline float neighbors_dist_sq(const float *a, const float *b) {
+    float dx = a[0] - b[0], dy = a[1] - b[1], dz = a[2] - b[2];
+    return dx * dx + dy * dy + dz * dz;
+}
+
+static long neighbors_radius_count(t_voxel_index *index, const float *q, float radius) {
+    long lo[3], hi[3], count = 0;
+    float r_sq = radius * radius;
+
+    for (int i = 0; i < 3; i++) {
+        lo[i] = MAX(0, (long)floorf((q[i] - radius) * index->dim[i]));
+        hi[i] = MIN(index->dim[i] - 1, (long)floorf((q[i] + radius) * index->dim[i]));
+        if (lo[i] > hi[i]) {
+            return 0;
+        }
+    }
+
+    for (long cz = lo[2]; cz <= hi[2]; cz++) {
+        for (long cy = lo[1]; cy <= hi[1]; cy++) {
+            long row = (cz * index->dim[1] + cy) * index->dim[0];
+            long start = index->cell_start[row + lo[0]];
+            long end = index->cell_start[row + hi[0] + 1];
+
+            // cells of one row are adjacent in the sorted order
+            for (long p = start; p < end; p++) {
+                count += neighbors_dist_sq(q, index->points + p * 3) <= r_sq;
+            }
+        }
+    }
+    return count;
+}
+
+// keeps the k closest candidates sorted by distance
+static inline void neighbors_insert(float *best_d, t_int32 *best_id, long k, long *found, float d, t_int32 id) {
+    long n = *found;
+
+    if (n == k && d >= best_d[k - 1]) {
+        return;
+    }
+    long slot = n < k ? n++ : k - 1;
+    while (slot > 0 && best_d[slot - 1] > d) {
+        best_d[slot] = best_d[slot - 1];
+        best_id[slot] = best_id[slot - 1];
+        slot--;
+    }
+    best_d[slot] = d;
+    best_id[slot] = id;
+    *found = n;
+}
+
+// searches shells of cells around the query cell until no closer point can remain
+static void neighbors_knn(t_voxel_index *index, const float *q, long k, t_int32 *out) {
+    float best_d[NEIGHBORS_MAX_K];
+    t_int32 best_id[NEIGHBORS_MAX_K];
+    long found = 0;
+    long c[3];
+    long max_shell = MAX(index->dim[0], MAX(index->dim[1], index->dim[2]));
+
+    for (int i = 0; i < 3; i++) {
+        c[i] = CLAMP((long)floorf(q[i] * index->dim[i]), 0, index->dim[i] - 1);
+    }
+
+    for (long s = 0; s <= max_shell; s++) {
+        long lo[3], hi[3];
+        float reach = INFINITY;
+
+        for (int i = 0; i < 3; i++) {
+            lo[i] = MAX(0, c[i] - s);
+            hi[i] = MIN(index->dim[i] - 1, c[i] + s);
+            // distance from the query to the nearest face of the searched block that has unsearched cells beyond it
+            if (c[i] - s > 0) reach = MIN(reach, q[i] - (float)(c[i] - s) / index->dim[i]);
+            if (c[i] + s < index->dim[i] - 1) reach = MIN(reach, (float)(c[i] + s + 1) / index->dim[i] - q[i]);
+        }
+
+        for (long cz = lo[2]; cz <= hi[2]; cz++) {
+            for (long cy = lo[1]; cy <= hi[1]; cy++) {
+                int inner = s > 0 && cz > c[2] - s && cz < c[2] + s && cy > c[1] - s && cy < c[1] + s;
+                long row = (cz * index->dim[1] + cy) * index->dim[0];
+
+                for (long cx = lo[0]; cx <= hi[0]; cx++) {
+                    // only the surface of the shell is new
+                    if (inner && cx > c[0] - s && cx < c[0] + s) {
+                        cx = c[0] + s - 1;
+                        continue;
+                    }
+                    for (long p = index->cell_start[row + cx]; p < index->cell_start[row + cx + 1]; p++) {
+                        neighbors_insert(best_d, best_id, k, &found, neighbors_dist_sq(q, index->points + p * 3), index->ids[p]);
+                    }
+                }
+            }
+        }
+
+        if (found == k && best_d[k - 1] <= reach * reach) {
+            break;
+        }
+        if (reach == INFINITY) {
+            break;
+        }
+    }
+
+    for (long i = 0; i < k; i++) {
+        out[i] = i < found ? best_id[i] : -1;
+    }
+}
+
+static void neighbors_slab(void *ctx, long thread, long start, long end) {
+    t_neighbors_frame *f = (t_neighbors_frame *)ctx;
+
+    for (long i = start; i < end; i++) {
+        long qx = i % f->in_dim[0];
+        long qy = i / f->in_dim[0];
+        float *fip = (float *)(f->in_bp + qx * f->in_stride[0] + qy * f->in_stride[1]);
+        t_int32 *cop = (t_int32 *)(f->count_bp + qx * f->count_stride[0] + qy * f->count_stride[1]);
+        t_int32 *kop = (t_int32 *)(f->knn_bp + qx * f->knn_stride[0] + qy * f->knn_stride[1]);
+
+        cop[0] = f->x->radius > 0.0f ? (t_int32)neighbors_radius_count(f->index, fip, f->x->radius) : 0;
+
+        if (f->k > 0) {
+            neighbors_knn(f->index, fip, f->k, kop);
+        } else {
+            kop[0] = -1;
+        }
+    }
+}
+
+t_jit_err neighbors_matrix_calc(t_neighbors *x, void *inputs, void *outputs) {
+    double calc_start = systimer_gettime();
+    t_jit_err err = JIT_ERR_NONE;
+    t_jit_matrix_info in_minfo, count_minfo, knn_minfo;
+    t_jit_object *in_matrix, *count_matrix, *knn_matrix;
+    long in_savelock, count_savelock, knn_savelock;
+    void *in_mdata, *count_mdata, *knn_mdata;
+    t_neighbors_frame frame;
+    void *source;
+
+    in_matrix = jit_object_method(inputs, _jit_sym_getindex, 0);
+    count_matrix = jit_object_method(outputs, _jit_sym_getindex, 0);
+    knn_matrix = jit_object_method(outputs, _jit_sym_getindex, 1);
+
+    if (!in_matrix || !count_matrix || !knn_matrix) {
+        return JIT_ERR_INVALID_INPUT;
+    }
+
+    in_savelock = (long)jit_object_method(in_matrix, _jit_sym_lock, 1);
+    count_savelock = (long)jit_object_method(count_matrix, _jit_sym_lock, 1);
+    knn_savelock = (long)jit_object_method(knn_matrix, _jit_sym_lock, 1);
+
+    jit_object_method(in_matrix, _jit_sym_getinfo, &in_minfo);
+    jit_object_method(in_matrix, _jit_sym_getdata, &in_mdata);
+
+    if (!in_mdata) {
+        err = JIT_ERR_INVALID_INPUT;
+        goto out;
+    }
+    if (in_minfo.type != _jit_sym_float32) {
+        err = JIT_ERR_MISMATCH_TYPE;
+        goto out;
+    }
+    if (in_minfo.planecount < 3) {
+        err = JIT_ERR_MISMATCH_PLANE;
+        goto out;
+    }
+    if (in_minfo.dimcount > 2) {
+        err = JIT_ERR_MISMATCH_DIM;
+        goto out;
+    }
+
+    // the index lives in the voxel.pcloud2grid registered under this name
+    source = x->index_name != _jit_sym_nothing ? jit_object_findregistered(x->index_name) : NULL;
+    frame.index = source ? (t_voxel_index *)jit_object_method(source, gensym("spatialindex")) : NULL;
+
+    if (!frame.index || !frame.index->cell_start || frame.index->dim[0] <= 0) {
+        jit_object_error((t_object *)x, "voxel.neighbors: no spatial index named %s", x->index_name->s_name);
+        err = JIT_ERR_GENERIC;
+        goto out;
+    }
+
+    frame.k = CLAMP(x->k, 0, NEIGHBORS_MAX_K);
+
+    count_minfo = in_minfo;
+    count_minfo.type = _jit_sym_long;
+    count_minfo.planecount = 1;
+    jit_object_method(count_matrix, _jit_sym_setinfo, &count_minfo);
+    jit_object_method(count_matrix, _jit_sym_getinfo, &count_minfo);
+    jit_object_method(count_matrix, _jit_sym_getdata, &count_mdata);
+
+    knn_minfo = in_minfo;
+    knn_minfo.type = _jit_sym_long;
+    knn_minfo.planecount = MAX(frame.k, 1);
+    jit_object_method(knn_matrix, _jit_sym_setinfo, &knn_minfo);
+    jit_object_method(knn_matrix, _jit_sym_getinfo, &knn_minfo);
+    jit_object_method(knn_matrix, _jit_sym_getdata, &knn_mdata);
+
+    if (!count_mdata || !knn_mdata) {
+        err = JIT_ERR_INVALID_OUTPUT;
+        goto out;
+    }
+
+    frame.x = x;
+    frame.in_bp = (char *)in_mdata;
+    frame.count_bp = (char *)count_mdata;
+    frame.knn_bp = (char *)knn_mdata;
+    frame.in_dim[0] = in_minfo.dim[0];
+    frame.in_dim[1] = in_minfo.dimcount > 1 ? in_minfo.dim[1] : 1;
+    frame.in_stride = in_minfo.dimstride;
+    frame.count_stride = count_minfo.dimstride;
+    frame.knn_stride = knn_minfo.dimstride;
+
+    voxel_parallel_for(x->num_threads, x->affinity, frame.in_dim[0] * frame.in_dim[1], neighbors_slab, &frame);
+
+out:
+    x->calctime = (float)(systimer_gettime() - calc_start);
+    jit_object_method(in_matrix, _jit_sym_lock, in_savelock);
+    jit_object_method(count_matrix, _jit_sym_lock, count_savelock);
+    jit_object_method(knn_matrix, _jit_sym_lock, knn_savelock);
+    return err;
+}
@@ -0,0 +1,89 @@
+#include "jit.common.h"
+#include "max.jit.mop.h"
+
+typedef struct _max_neighbors {
+    t_object ob;
+    void *obex;
+} t_max_neighbors;
+
+BEGIN_USING_C_LINKAGE
+t_jit_err neighbors_init(void);
+void * max_neighbors_new(t_symbol *s, long argc, t_atom *argv);
+void max_neighbors_free(t_max_neighbors *x);
+void max_neighbors_assist(t_max_neighbors *x, void *b, long m, long a, char *s);
+END_USING_C_LINKAGE
+
+static void *max_neighbors_class = NULL;
+
+void ext_main(void *r) {
+    t_class *max_class, *jit_class;
+
+    neighbors_init();
+
+    max_class = class_new("voxel.neighbors", (method)max_neighbors_new, (method)max_neighbors_free, sizeof(t_max_neighbors), NULL, A_GIMME, 0);
+    max_jit_class_obex_setup(max_class, calcoffset(t_max_neighbors, obex));
+
+    jit_class = jit_class_findbyname(gensym("neighbors"));
+    max_jit_class_mop_wrap(max_class, jit_class,  MAX_JIT_MOP_FLAGS_OWN_ADAPT | MAX_JIT_MOP_FLAGS_OWN_OUTPUTMODE);
+    max_jit_class_wrap_standard(max_class, jit_class, 0);
+
+    class_addmethod(max_class, (method)max_neighbors_assist, "assist", A_CANT, 0);
+
+    class_register(CLASS_BOX, max_class);
+    max_neighbors_class = max_class;
+}
+
+/************************************************************************************/
+// Object Life Cycle
+
+void * max_neighbors_new(t_symbol *s, long argc, t_atom *argv) {
+    t_max_neighbors *x;
+    void *o;
+
+    x = (t_max_neighbors *)max_jit_object_alloc(max_neighbors_class, gensym("neighbors"));
+
+    if (x) {
+        o = jit_object_new(gensym("neighbors"));
+
+        if (o) {
+            max_jit_obex_jitob_set(x,o);
+            max_jit_obex_dumpout_set(x,outlet_new(x,NULL));
+            max_jit_mop_setup(x);
+            max_jit_mop_inputs(x);
+            max_jit_mop_outputs(x);
+            max_jit_attr_args(x, argc, argv);
+        } else {
+            jit_object_error((t_object *)x, "voxel.neighbors: could not allocate object");
+            object_free((t_object *)x);
+            x = NULL;
+        }
+    }
+
+    return (x);
+}
+
+void max_neighbors_free(t_max_neighbors *x) {
+    max_jit_mop_free(x);
+    jit_object_free(max_jit_obex_jitob_get(x));
+    max_jit_object_free(x);
+}
+
+void max_neighbors_assist(t_max_neighbors *x, void *b, long m, long a, char *s) {
+    if (m == 1) { // input
+        sprintf(s, "(matrix) query points xyz");
+    } else { // output
+        switch (a) {
+            case 0:
+                sprintf(s, "(matrix) neighbour count within radius");
+                break;
+
+            case 1:
+                sprintf(s, "(matrix) nearest point indices");
+                break;
+
+            default:
+                sprintf(s, "dumpout");
+                break;
+        }
+    }
+}
@@ -1,37 +1,86 @@
 #include "jit.common.h"
+#include "voxel.parallel.h"
+#include "voxel.index.h"
+#include "voxel.arena.h"
+#include "voxel.half.h"
 
 typedef struct _pcloud2grid {
     t_object ob;
     long autoclear;
+    long minpoints;
+    long minneighbors;
+    t_symbol *precision;
+    float fx;
+    float fy;
+    float cx;
+    float cy;
+    float depthscale;
+    float bounds[6];
     void *out_matrix;
+    t_symbol *index_name;
+    t_voxel_index index;
+    t_voxel_arena arena;
+    long allocations;
+    long num_threads;
+    long affinity;
+    float calctime;
 } t_pcloud2grid;
 
+typedef struct _pcloud2grid_frame {
+    t_pcloud2grid *x;
+    char *in_bp;
+    long in_width;
+    long *in_stride;
+    char *out_bp;
+    long *out_dim;
+    long *out_stride;
+    long out_format;
+    int build_index;
+    t_int32 *counts;
+    int depth;              // single plane depth image instead of xyz points
+    float inv_focal[2];     // depth input: 1 / fx, 1 / fy
+    float scale[3];         // depth input: grid cells per unit of camera space
+    float *lines;           // depth input: one row of grid coordinates per thread
+    size_t line_stride;     // depth input: bytes from one thread's row to the next
+    t_int32 *cells;         // depth input: cell of every pixel, -1 if dropped
+} t_pcloud2grid_frame;
+
 BEGIN_USING_C_LINKAGE
 t_jit_err pcloud2grid_init(void);
 t_pcloud2grid *pcloud2grid_new(void);
 void pcloud2grid_free(t_pcloud2grid *x);
 t_jit_err pcloud2grid_matrix_calc(t_pcloud2grid *x, void *inputs, void *outputs);
 void pcloud2grid_clear(t_pcloud2grid *x);
+t_jit_err pcloud2grid_index_set(t_pcloud2grid *x, void *attr, long ac, t_atom *av);
+t_voxel_index *pcloud2grid_spatialindex(t_pcloud2grid *x);
 END_USING_C_LINKAGE
 
 static void *_pcloud2grid_class = NULL;
+static t_symbol *ps_half;
 
 t_jit_err pcloud2grid_init(void) {
     long attrflags = JIT_ATTR_GET_DEFER_LOW | JIT_ATTR_SET_USURP_LOW;
+    long statflags = JIT_ATTR_SET_OPAQUE_USER | JIT_ATTR_GET_DEFER_LOW;
     t_jit_object *attr;
     t_jit_object *mop;
 
+    ps_half = gensym("half");
+
     _pcloud2grid_class = jit_class_new("pcloud2grid", (method)pcloud2grid_new, (method)pcloud2grid_free, sizeof(t_pcloud2grid), 0L);
 
     mop = jit_object_new(_jit_sym_jit_mop, 1, 1);
     jit_class_addadornment(_pcloud2grid_class, mop);
-    jit_mop_single_type(mop, gensym("float32"));
-    jit_mop_single_planecount(mop, 1);
+    // the output is float32 or half as char pairs, set by calc from @precision, and
+    // the input an xyz list or a depth image of any type; calc checks both and converts
+    // the input to float32 itself
+    jit_mop_input_nolink(mop, 1);
+    jit_mop_output_nolink(mop, 1);
     jit_attr_setlong(mop, _jit_sym_adapt, 0);
 
     // methods
     jit_class_addmethod(_pcloud2grid_class, (method)pcloud2grid_matrix_calc, "matrix_calc", A_CANT, 0L);
     jit_class_addmethod(_pcloud2grid_class, (method)pcloud2grid_clear, "clear", 0L); // Add the clear method
+    jit_class_addmethod(_pcloud2grid_class, (method)pcloud2grid_spatialindex, "spatialindex", A_CANT, 0L);
 
     // attributes
     attr = jit_object_new(_jit_sym_jit_attr_offset, "autoclear", _jit_sym_long, attrflags,
@@ -40,6 +89,63 @@ t_jit_err pcloud2grid_init(void) {
     CLASS_ATTR_LABEL(_pcloud2grid_class, "autoclear", 0, "Auto Clear Output");
     CLASS_ATTR_STYLE(_pcloud2grid_class, "autoclear", 0, "onoff");
 
+    attr = jit_object_new(_jit_sym_jit_attr_offset, "minpoints", _jit_sym_long, attrflags,
+                          (method)NULL, (method)NULL, calcoffset(t_pcloud2grid, minpoints));
+    jit_class_addattr(_pcloud2grid_class, attr);
+    CLASS_ATTR_LABEL(_pcloud2grid_class, "minpoints", 0, "Minimum Points Per Voxel");
+
+    attr = jit_object_new(_jit_sym_jit_attr_offset, "minneighbors", _jit_sym_long, attrflags,
+                          (method)NULL, (method)NULL, calcoffset(t_pcloud2grid, minneighbors));
+    jit_class_addattr(_pcloud2grid_class, attr);
+    CLASS_ATTR_LABEL(_pcloud2grid_class, "minneighbors", 0, "Minimum Occupied Neighbours");
+
+    attr = jit_object_new(_jit_sym_jit_attr_offset, "precision", _jit_sym_symbol, attrflags,
+                          (method)NULL, (method)NULL, calcoffset(t_pcloud2grid, precision));
+    jit_class_addattr(_pcloud2grid_class, attr);
+    CLASS_ATTR_LABEL(_pcloud2grid_class, "precision", 0, "Output Precision");
+    CLASS_ATTR_ENUM(_pcloud2grid_class, "precision", 0, "float32 half");
+
+    attr = jit_object_new(_jit_sym_jit_attr_offset, "fx", _jit_sym_float32, attrflags,
+                          (method)NULL, (method)NULL, calcoffset(t_pcloud2grid, fx));
+    jit_class_addattr(_pcloud2grid_class, attr);
+    CLASS_ATTR_LABEL(_pcloud2grid_class, "fx", 0, "Depth Focal Length X");
+
+    attr = jit_object_new(_jit_sym_jit_attr_offset, "fy", _jit_sym_float32, attrflags,
+                          (method)NULL, (method)NULL, calcoffset(t_pcloud2grid, fy));
+    jit_class_addattr(_pcloud2grid_class, attr);
+    CLASS_ATTR_LABEL(_pcloud2grid_class, "fy", 0, "Depth Focal Length Y");
+
+    attr = jit_object_new(_jit_sym_jit_attr_offset, "cx", _jit_sym_float32, attrflags,
+                          (method)NULL, (method)NULL, calcoffset(t_pcloud2grid, cx));
+    jit_class_addattr(_pcloud2grid_class, attr);
+    CLASS_ATTR_LABEL(_pcloud2grid_class, "cx", 0, "Depth Principal Point X");
+
+    attr = jit_object_new(_jit_sym_jit_attr_offset, "cy", _jit_sym_float32, attrflags,
+                          (method)NULL, (method)NULL, calcoffset(t_pcloud2grid, cy));
+    jit_class_addattr(_pcloud2grid_class, attr);
+    CLASS_ATTR_LABEL(_pcloud2grid_class, "cy", 0, "Depth Principal Point Y");
+
+    attr = jit_object_new(_jit_sym_jit_attr_offset, "depthscale", _jit_sym_float32, attrflags,
+                          (method)NULL, (method)NULL, calcoffset(t_pcloud2grid, depthscale));
+    jit_class_addattr(_pcloud2grid_class, attr);
+    CLASS_ATTR_LABEL(_pcloud2grid_class, "depthscale", 0, "Depth Units Per Input Value");
+
+    attr = jit_object_new(_jit_sym_jit_attr_offset_array, "bounds", _jit_sym_float32, 6, attrflags,
+                          (method)NULL, (method)NULL, 0, calcoffset(t_pcloud2grid, bounds));
+    jit_class_addattr(_pcloud2grid_class, attr);
+    CLASS_ATTR_LABEL(_pcloud2grid_class, "bounds", 0, "Depth Bounds (min xyz, max xyz)");
+
+    attr = jit_object_new(_jit_sym_jit_attr_offset, "index", _jit_sym_symbol, attrflags,
+                          (method)NULL, (method)pcloud2grid_index_set, calcoffset(t_pcloud2grid, index_name));
+    jit_class_addattr(_pcloud2grid_class, attr);
+    CLASS_ATTR_LABEL(_pcloud2grid_class, "index", 0, "Spatial Index Name");
+
+    attr = jit_object_new(_jit_sym_jit_attr_offset, "allocations", _jit_sym_long, statflags,
+                          (method)NULL, (method)NULL, calcoffset(t_pcloud2grid, allocations));
+    jit_class_addattr(_pcloud2grid_class, attr);
+
+    voxel_parallel_class_attrs(_pcloud2grid_class, calcoffset(t_pcloud2grid, num_threads), calcoffset(t_pcloud2grid, affinity), calcoffset(t_pcloud2grid, calctime));
+
     jit_class_register(_pcloud2grid_class);
 
     return JIT_ERR_NONE;
@@ -50,7 +156,29 @@ t_pcloud2grid *pcloud2grid_new(void) {
 
     if ((x = (t_pcloud2grid *)jit_object_alloc(_pcloud2grid_class))) {
         x->autoclear = 1;
+        x->minpoints = 1;
+        x->minneighbors = 0;
+        x->precision = _jit_sym_float32;
+        // kinect v2 depth camera, millimetres in, a 4 m cube in front of the sensor out
+        x->fx = 365.5f;
+        x->fy = 365.5f;
+        x->cx = 256.0f;
+        x->cy = 212.0f;
+        x->depthscale = 0.001f;
+        x->bounds[0] = -2.0f;
+        x->bounds[1] = -2.0f;
+        x->bounds[2] = 0.5f;
+        x->bounds[3] = 2.0f;
+        x->bounds[4] = 2.0f;
+        x->bounds[5] = 4.5f;
         x->out_matrix = NULL;
+        x->index_name = _jit_sym_nothing;
+        voxel_index_clear(&x->index);
+        voxel_arena_init(&x->arena);
+        x->allocations = 0;
+        x->num_threads = 0;
+        x->affinity = 0;
+        x->calctime = 0.0f;
     } else {
         x = NULL;
     }
@@ -59,25 +187,292 @@ t_pcloud2grid *pcloud2grid_new(void) {
 }
 
 void pcloud2grid_free(t_pcloud2grid *x) {
+    if (x->index_name != _jit_sym_nothing) {
+        jit_object_unregister(x);
+    }
+    voxel_index_free(&x->index);
+    voxel_arena_free(&x->arena);
+}
+
+// registers the object under the index name so voxel.neighbors can find it
+t_jit_err pcloud2grid_index_set(t_pcloud2grid *x, void *attr, long ac, t_atom *av) {
+    t_symbol *name = (ac && av) ? atom_getsym(av) : _jit_sym_nothing;
+
+    if (x->index_name != _jit_sym_nothing) {
+        jit_object_unregister(x);
+    }
+    x->index_name = name;
+    if (name != _jit_sym_nothing) {
+        jit_object_register(x, name);
+    } else {
+        voxel_index_free(&x->index);
+    }
+    return JIT_ERR_NONE;
+}
+
+t_voxel_index *pcloud2grid_spatialindex(t_pcloud2grid *x) {
+    return x->index_name != _jit_sym_nothing ? &x->index : NULL;
+}
+
+// grid coordinates of depth pixel (u, v), not clamped; the depth slab inlines the same
+// arithmetic per row so it vectorizes
+static inline void pcloud2grid_unproject(t_pcloud2grid_frame *f, float depth, long u, long v, float *g) {
+    t_pcloud2grid *x = f->x;
+    float d = depth * x->depthscale;
+
+    g[0] = (((float)u - x->cx) * d * f->inv_focal[0] - x->bounds[0]) * f->scale[0];
+    g[1] = ((x->cy - (float)v) * d * f->inv_focal[1] - x->bounds[1]) * f->scale[1];
+    g[2] = (d - x->bounds[2]) * f->scale[2];
+}
+
+// counting sort of the points by cell, in input order within each cell
+static void pcloud2grid_build_index(t_pcloud2grid_frame *f, t_jit_matrix_info *in_minfo, long rows) {
+    t_pcloud2grid *x = f->x;
+    char *in_bp = f->in_bp;
+    long *dim = f->out_dim;
+    t_voxel_index *index = &x->index;
+    long cell_count = dim[0] * dim[1] * dim[2];
+    long point_count = in_minfo->dim[0] * rows;
+    long c, p;
+
+    for (int i = 0; i < 3; i++) {
+        index->dim[i] = dim[i];
+    }
+    memset(index->cell_start, 0, (cell_count + 1) * sizeof(t_int32));
+
+    for (p = 0; p < point_count; p++) {
+        if (index->cells[p] >= 0) {
+            index->cell_start[index->cells[p] + 1]++;
+        }
+    }
+    for (c = 0; c < cell_count; c++) {
+        index->cell_start[c + 1] += index->cell_start[c];
+    }
+    index->point_count = index->cell_start[cell_count];
+
+    // cell_start[c] is used as the insertion cursor of cell c, then shifted back
+    for (p = 0; p < point_count; p++) {
+        c = index->cells[p];
+        if (c >= 0) {
+            long i = p % in_minfo->dim[0];
+            long j = p / in_minfo->dim[0];
+            float *fip = (float *)(in_bp + i * in_minfo->dimstride[0] + j * in_minfo->dimstride[1]);
+            long slot = index->cell_start[c]++;
+
+            if (f->depth) {
+                float g[3];
+
+                // depth points are indexed in the same normalized space as xyz input
+                pcloud2grid_unproject(f, fip[0], i, j, g);
+                for (int a = 0; a < 3; a++) {
+                    index->points[slot * 3 + a] = g[a] / dim[a];
+                }
+            } else {
+                index->points[slot * 3] = fip[0];
+                index->points[slot * 3 + 1] = fip[1];
+                index->points[slot * 3 + 2] = fip[2];
+            }
+            index->ids[slot] = (t_int32)p;
+        }
+    }
+    for (c = cell_count; c > 0; c--) {
+        index->cell_start[c] = index->cell_start[c - 1];
+    }
+    index->cell_start[0] = 0;
+}
+
+// clears the counts of z slices [start, end), on the thread that filters them later
+static void pcloud2grid_zero_slab(void *ctx, long thread, long start, long end) {
+    t_pcloud2grid_frame *f = (t_pcloud2grid_frame *)ctx;
+    long slice = f->out_dim[0] * f->out_dim[1];
+
+    memset(f->counts + start * slice, 0, (end - start) * slice * sizeof(t_int32));
+}
+
+// bins points into the grid; with counts, hits are tallied for the filter pass instead
+static void pcloud2grid_scatter_slab(void *ctx, long thread, long start, long end) {
+    t_pcloud2grid_frame *f = (t_pcloud2grid_frame *)ctx;
+    long *dim = f->out_dim;
+
+    for (long p = start; p < end; p++) {
+        long i = p % f->in_width;
+        long j = p / f->in_width;
+        float *fip = (float *)(f->in_bp + (j * f->in_stride[1]) + (i * f->in_stride[0]));
+
+        long grid_x = (long)(fip[0] * dim[0]);
+        long grid_y = (long)(fip[1] * dim[1]);
+        long grid_z = (long)(fip[2] * dim[2]);
+
+        // points outside the grid are clamped onto its faces, but left out of the index
+        if (f->build_index) {
+            int inside = fip[0] >= 0.0f && fip[1] >= 0.0f && fip[2] >= 0.0f &&
+                         grid_x < dim[0] && grid_y < dim[1] && grid_z < dim[2];
+            f->x->index.cells[p] = inside ? (t_int32)(grid_x + (grid_y + grid_z * dim[1]) * dim[0]) : -1;
+        }
+
+        grid_x = MAX(0, MIN(grid_x, dim[0] - 1));
+        grid_y = MAX(0, MIN(grid_y, dim[1] - 1));
+        grid_z = MAX(0, MIN(grid_z, dim[2] - 1));
+
+        if (f->counts) {
+            __atomic_fetch_add(&f->counts[grid_x + (grid_y + grid_z * dim[1]) * dim[0]], 1, __ATOMIC_RELAXED);
+        } else {
+            voxel_grid_write(f->out_bp + grid_x * f->out_stride[0] + grid_y * f->out_stride[1] + grid_z * f->out_stride[2], f->out_format, 1.0f);
+        }
+    }
+}
+
+// unprojects depth rows [start, end) into the cell of every pixel, tallying hits when
+// filtering. pixels without depth or outside the bounds are dropped rather than clamped
+static void pcloud2grid_depth_slab(void *ctx, long thread, long start, long end) {
+    t_pcloud2grid_frame *f = (t_pcloud2grid_frame *)ctx;
+    t_pcloud2grid *x = f->x;
+    long *dim = f->out_dim;
+    long width = f->in_width;
+    float *gx = (float *)((char *)f->lines + thread * f->line_stride);
+    float *gy = gx + width;
+    float *gz = gy + width;
+    float depthscale = x->depthscale;
+    float cx = x->cx, cy = x->cy;
+    float ifx = f->inv_focal[0], ify = f->inv_focal[1];
+    float sx = f->scale[0], sy = f->scale[1], sz = f->scale[2];
+    float bx = x->bounds[0], by = x->bounds[1], bz = x->bounds[2];
+
+    for (long v = start; v < end; v++) {
+        const float *depth = (const float *)(f->in_bp + v * f->in_stride[1]);
+        t_int32 *cells = f->cells ? f->cells + v * width : NULL;
+
+        // straight-line arithmetic over the row, same as pcloud2grid_unproject
+        for (long u = 0; u < width; u++) {
+            float d = depth[u] * depthscale;
+
+            gx[u] = (((float)u - cx) * d * ifx - bx) * sx;
+            gy[u] = ((cy - (float)v) * d * ify - by) * sy;
+            gz[u] = (d - bz) * sz;
+        }
+
+        for (long u = 0; u < width; u++) {
+            int inside = depth[u] * depthscale > 0.0f &&
+                         gx[u] >= 0.0f && gy[u] >= 0.0f && gz[u] >= 0.0f &&
+                         gx[u] < dim[0] && gy[u] < dim[1] && gz[u] < dim[2];
+            long cell = inside ? (long)gx[u] + ((long)gy[u] + (long)gz[u] * dim[1]) * dim[0] : -1;
+
+            if (cells) {
+                cells[u] = (t_int32)cell;
+            }
+            if (f->counts && cell >= 0) {
+                __atomic_fetch_add(&f->counts[cell], 1, __ATOMIC_RELAXED);
+            }
+        }
+    }
+}
+
+// marks the cells the depth slabs found, on one thread so no two writes race
+static void pcloud2grid_mark_cells(t_pcloud2grid_frame *f, long count) {
+    long *dim = f->out_dim;
+
+    for (long p = 0; p < count; p++) {
+        long cell = f->cells[p];
+
+        if (cell >= 0) {
+            long vox_x = cell % dim[0];
+            long vox_y = (cell / dim[0]) % dim[1];
+            long vox_z = cell / (dim[0] * dim[1]);
+
+            voxel_grid_write(f->out_bp + vox_x * f->out_stride[0] + vox_y * f->out_stride[1] + vox_z * f->out_stride[2], f->out_format, 1.0f);
+        }
+    }
+}
+
+// writes a voxel when it has at least minpoints hits and, optionally, at least
+// minneighbors of its 26 neighbours pass the same test
+static void pcloud2grid_filter_slab(void *ctx, long thread, long start, long end) {
+    t_pcloud2grid_frame *f = (t_pcloud2grid_frame *)ctx;
+    long *dim = f->out_dim;
+    t_int32 *counts = f->counts;
+    long minpoints = MAX(f->x->minpoints, 1);
+    long minneighbors = f->x->minneighbors;
+    long autoclear = f->x->autoclear;
+
+    for (long vox_z = start; vox_z < end; vox_z++) {
+        for (long vox_y = 0; vox_y < dim[1]; vox_y++) {
+            for (long vox_x = 0; vox_x < dim[0]; vox_x++) {
+                int keep = counts[vox_x + (vox_y + vox_z * dim[1]) * dim[0]] >= minpoints;
+
+                if (keep && minneighbors > 0) {
+                    long occupied = -1; // the voxel itself is counted below
+                    for (long nz = MAX(vox_z - 1, 0); nz <= MIN(vox_z + 1, dim[2] - 1); nz++) {
+                        for (long ny = MAX(vox_y - 1, 0); ny <= MIN(vox_y + 1, dim[1] - 1); ny++) {
+                            t_int32 *row = counts + (ny + nz * dim[1]) * dim[0];
+                            for (long nx = MAX(vox_x - 1, 0); nx <= MIN(vox_x + 1, dim[0] - 1); nx++) {
+                                occupied += row[nx] >= minpoints;
+                            }
+                        }
+                    }
+                    keep = occupied >= minneighbors;
+                }
+
+                char *op = f->out_bp + vox_x * f->out_stride[0] + vox_y * f->out_stride[1] + vox_z * f->out_stride[2];
+                if (keep) {
+                    voxel_grid_write(op, f->out_format, 1.0f);
+                } else if (autoclear) {
+                    voxel_grid_write(op, f->out_format, 0.0f);
+                }
+            }
+        }
+    }
+}
+
+// packs the first planes of float64, long or char input into float32 borrowed from
+// the arena and points in_minfo at the copy. char is scaled to [0, 1] like the jitter
+// type conversion the mop used to do, so an 8-bit depth image wants a larger depthscale
+static char *pcloud2grid_convert(t_pcloud2grid *x, t_jit_matrix_info *in_minfo, char *in_bp, long planes) {
+    long rows = in_minfo->dimcount > 1 ? in_minfo->dim[1] : 1;
+    float *packed = (float *)voxel_arena_alloc(&x->arena, in_minfo->dim[0] * rows * planes * sizeof(float));
+    float *fop = packed;
+
+    if (!packed) {
+        return NULL;
+    }
+    for (long j = 0; j < rows; j++) {
+        for (long i = 0; i < in_minfo->dim[0]; i++) {
+            char *ip = in_bp + i * in_minfo->dimstride[0] + (in_minfo->dimcount > 1 ? j * in_minfo->dimstride[1] : 0);
+
+            for (long plane = 0; plane < planes; plane++) {
+                if (in_minfo->type == _jit_sym_float64) {
+                    *fop++ = (float)((double *)ip)[plane];
+                } else if (in_minfo->type == _jit_sym_long) {
+                    *fop++ = (float)((t_int32 *)ip)[plane];
+                } else {
+                    *fop++ = ((unsigned char *)ip)[plane] * (1.0f / 255.0f);
+                }
+            }
+        }
+    }
+    in_minfo->type = _jit_sym_float32;
+    in_minfo->planecount = planes;
+    in_minfo->dimstride[0] = planes * sizeof(float);
+    in_minfo->dimstride[1] = in_minfo->dim[0] * in_minfo->dimstride[0];
+    return (char *)packed;
 }
 
 void pcloud2grid_clear(t_pcloud2grid *x) {
     if (x->out_matrix) {
         t_jit_matrix_info out_minfo;
         char *out_bp;
-        float *fop;
+        long format, planes;
         int vox_x, vox_y, vox_z;
 
         jit_object_method(x->out_matrix, _jit_sym_getinfo, &out_minfo);
         jit_object_method(x->out_matrix, _jit_sym_getdata, &out_bp);
+        format = voxel_grid_format(&out_minfo, x->precision == ps_half, &planes);
 
-        if (out_bp) {
+        if (out_bp && format != VOXEL_GRID_INVALID) {
             for(vox_z = 0; vox_z < out_minfo.dim[2]; vox_z++){
                 for(vox_y = 0; vox_y < out_minfo.dim[1]; vox_y++){
                     for(vox_x = 0; vox_x < out_minfo.dim[0]; vox_x++){
                         long index = vox_x * out_minfo.dimstride[0] + vox_y * out_minfo.dimstride[1] + vox_z * out_minfo.dimstride[2];
-                        fop = (float *)(out_bp + index);
-                        fop[0] = 0.0f;
+                        voxel_grid_write(out_bp + index, format, 0.0f);
                     }
                 }
             }
@@ -86,14 +481,16 @@ void pcloud2grid_clear(t_pcloud2grid *x) {
 }
 
 t_jit_err pcloud2grid_matrix_calc(t_pcloud2grid *x, void *inputs, void *outputs) {
+    double calc_start = systimer_gettime();
     t_jit_err err = JIT_ERR_NONE;
     t_jit_matrix_info in_minfo, out_minfo;
     long in_savelock, out_savelock;
     char *in_bp, *out_bp;
-    long i, j, k, index;
+    long rows, voxels, format, planes;
     t_jit_object *in_matrix;
     void *in_mdata, *out_mdata;
-    float *fip, *fop;
+    int build_index, filter, depth;
+    t_pcloud2grid_frame frame;
 
     in_matrix = jit_object_method(inputs, _jit_sym_getindex, 0);
     x->out_matrix = jit_object_method(outputs, _jit_sym_getindex, 0);
@@ -102,53 +499,156 @@ t_jit_err pcloud2grid_matrix_calc(t_pcloud2grid *x, void *inputs, void *outputs)
         return JIT_ERR_INVALID_INPUT;
     }
     
-    in_savelock = (long)jit_object_method(inputs, _jit_sym_lock, 1);
-    out_savelock = (long)jit_object_method(outputs, _jit_sym_lock, 1);
+    in_savelock = (long)jit_object_method(in_matrix, _jit_sym_lock, 1);
+    out_savelock = (long)jit_object_method(x->out_matrix, _jit_sym_lock, 1);
 
     jit_object_method(in_matrix, _jit_sym_getinfo, &in_minfo);
     jit_object_method(in_matrix, _jit_sym_getdata, &in_mdata);
 
     if (!in_mdata) {
-        return JIT_ERR_INVALID_INPUT;
+        err = JIT_ERR_INVALID_INPUT;
+        goto out;
     }
     
     jit_object_method(x->out_matrix, _jit_sym_getinfo, &out_minfo);
+
+    if (in_minfo.type != _jit_sym_float32 && in_minfo.type != _jit_sym_float64 && in_minfo.type != _jit_sym_long &&
+        in_minfo.type != _jit_sym_char) {
+        err = JIT_ERR_MISMATCH_TYPE;
+        goto out;
+    }
+    if (out_minfo.dimcount != 3) {
+        err = JIT_ERR_MISMATCH_DIM;
+        goto out;
+    }
+
+    // half precision stores the grid as char pairs, which halves what the objects
+    // downstream have to read; the output is switched over when the attribute changes
+    format = x->precision == ps_half ? VOXEL_GRID_HALF : VOXEL_GRID_FLOAT32;
+    if (voxel_grid_format(&out_minfo, format == VOXEL_GRID_HALF, &planes) != format || planes != 1) {
+        out_minfo.type = format == VOXEL_GRID_HALF ? _jit_sym_char : _jit_sym_float32;
+        out_minfo.planecount = format == VOXEL_GRID_HALF ? 2 : 1;
+        jit_object_method(x->out_matrix, _jit_sym_setinfo, &out_minfo);
+        jit_object_method(x->out_matrix, _jit_sym_getinfo, &out_minfo);
+    }
     jit_object_method(x->out_matrix, _jit_sym_getdata, &out_mdata);
 
     if (!out_mdata) {
-        return JIT_ERR_INVALID_OUTPUT;
+        err = JIT_ERR_INVALID_OUTPUT;
+        goto out;
     }
 
     in_bp = (char *)in_mdata;
     out_bp = (char *)out_mdata;
 
-    if (x->autoclear) {
-        pcloud2grid_clear(x);
+    // a single plane 2d matrix is a depth image, unprojected on the fly so no xyz
+    // matrix is needed in between; it only makes sense with usable intrinsics, and
+    // without them the frame is refused and the grid left as it was
+    depth = in_minfo.dimcount == 2 && in_minfo.planecount == 1;
+    if (depth && !(x->fx > 0.0f && x->fy > 0.0f && x->depthscale > 0.0f)) {
+        jit_object_error((t_object *)x, "voxel.pcloud2grid: depth input needs fx, fy and depthscale above 0, got %g %g %g",
+                         x->fx, x->fy, x->depthscale);
+        err = JIT_ERR_INVALID_INPUT;
+        goto out;
+    }
+    if (depth && !(x->bounds[3] > x->bounds[0] && x->bounds[4] > x->bounds[1] && x->bounds[5] > x->bounds[2])) {
+        jit_object_error((t_object *)x, "voxel.pcloud2grid: depth input needs bounds with each max above its min");
+        err = JIT_ERR_INVALID_INPUT;
+        goto out;
+    }
+    if (!depth && (in_minfo.dimcount > 2 || in_minfo.planecount < 3)) {
+        if (x->autoclear) {
+            pcloud2grid_clear(x);
+        }
+        goto out;
+    }
+    if (in_minfo.type != _jit_sym_float32 && !(in_bp = pcloud2grid_convert(x, &in_minfo, in_bp, depth ? 1 : 3))) {
+        err = JIT_ERR_OUT_OF_MEM;
+        goto out;
+    }
+    rows = in_minfo.dimcount == 2 ? in_minfo.dim[1] : 1;
+    voxels = out_minfo.dim[0] * out_minfo.dim[1] * out_minfo.dim[2];
+    filter = x->minpoints > 1 || x->minneighbors > 0;
+
+    build_index = x->index_name != _jit_sym_nothing;
+    if (build_index) {
+        if ((err = voxel_index_reserve(&x->index, in_minfo.dim[0] * rows, voxels))) {
+            goto out;
+        }
     }
 
-    if (in_minfo.dimcount == 2 && in_minfo.planecount >= 3) {
-        for (j = 0; j < in_minfo.dim[0]; j++) {
-            for (i = 0; i < in_minfo.dim[1]; i++) {
-                fip = (float *)(in_bp + (j * in_minfo.dimstride[1]) + (i * in_minfo.dimstride[0]));
+    frame.x = x;
+    frame.in_bp = in_bp;
+    frame.in_width = in_minfo.dim[0];
+    frame.in_stride = in_minfo.dimstride;
+    frame.out_bp = out_bp;
+    frame.out_dim = out_minfo.dim;
+    frame.out_stride = out_minfo.dimstride;
+    frame.out_format = format;
+    frame.build_index = build_index;
+    frame.counts = NULL;
+    frame.depth = depth;
+    frame.lines = NULL;
+    frame.cells = NULL;
 
-                long grid_x = (long)(fip[0] * out_minfo.dim[0]);
-                long grid_y = (long)(fip[1] * out_minfo.dim[1]);
-                long grid_z = (long)(fip[2] * out_minfo.dim[2]);
+    if (depth) {
+        frame.inv_focal[0] = 1.0f / x->fx;
+        frame.inv_focal[1] = 1.0f / x->fy;
+        for (int a = 0; a < 3; a++) {
+            frame.scale[a] = (float)out_minfo.dim[a] / (x->bounds[a + 3] - x->bounds[a]);
+        }
+        frame.lines = (float *)voxel_arena_alloc_rows(&x->arena, voxel_parallel_threads(x->num_threads),
+                                                      in_minfo.dim[0] * 3 * sizeof(float), &frame.line_stride);
 
-                grid_x = MAX(0, MIN(grid_x, out_minfo.dim[0] - 1));
-                grid_y = MAX(0, MIN(grid_y, out_minfo.dim[1] - 1));
-                grid_z = MAX(0, MIN(grid_z, out_minfo.dim[2] - 1));
-                
-                index = grid_x * out_minfo.dimstride[0] + grid_y * out_minfo.dimstride[1] + grid_z * out_minfo.dimstride[2];
-                fop = (float *)(out_bp + index);
+        // the index needs the cell of every pixel anyway; without a filter the cells
+        // are marked afterwards instead of counted
+        if (build_index) {
+            frame.cells = x->index.cells;
+        } else if (!filter) {
+            frame.cells = (t_int32 *)voxel_arena_alloc(&x->arena, in_minfo.dim[0] * rows * sizeof(t_int32));
+        }
 
-                if (index >= 0) {
-                    fop[0] = 1;
-                }
-            }
+        if (!frame.lines || (!filter && !frame.cells)) {
+            err = JIT_ERR_OUT_OF_MEM;
+            goto out;
         }
     }
+
+    if (filter) {
+        frame.counts = (t_int32 *)voxel_arena_alloc(&x->arena, voxels * sizeof(t_int32));
+
+        if (!frame.counts) {
+            err = JIT_ERR_OUT_OF_MEM;
+            goto out;
+        }
+
+        // the filter pass writes every voxel, so it also does the clearing
+        voxel_parallel_for(x->num_threads, x->affinity, out_minfo.dim[2], pcloud2grid_zero_slab, &frame);
+        if (depth) {
+            voxel_parallel_for(x->num_threads, x->affinity, rows, pcloud2grid_depth_slab, &frame);
+        } else {
+            voxel_parallel_for(x->num_threads, x->affinity, in_minfo.dim[0] * rows, pcloud2grid_scatter_slab, &frame);
+        }
+        voxel_parallel_for(x->num_threads, x->affinity, out_minfo.dim[2], pcloud2grid_filter_slab, &frame);
+    } else {
+        if (x->autoclear) {
+            pcloud2grid_clear(x);
+        }
+        if (depth) {
+            voxel_parallel_for(x->num_threads, x->affinity, rows, pcloud2grid_depth_slab, &frame);
+            pcloud2grid_mark_cells(&frame, in_minfo.dim[0] * rows);
+        } else {
+            pcloud2grid_scatter_slab(&frame, 0, 0, in_minfo.dim[0] * rows);
+        }
+    }
+
+    if (build_index) {
+        pcloud2grid_build_index(&frame, &in_minfo, rows);
+    }
 out:
+    x->calctime = (float)(systimer_gettime() - calc_start);
+    voxel_arena_release(&x->arena);
+    x->allocations = x->arena.allocations;
     jit_object_method(in_matrix, _jit_sym_lock, in_savelock);
     jit_object_method(x->out_matrix, _jit_sym_lock, out_savelock);
     return err;
@@ -0,0 +1,244 @@
+#include "jit.common.h"
+#include "voxel.parallel.h"
+#include "voxel.half.h"
+
+#define PYRAMID_LEVELS 3
+
+enum {
+    PYRAMID_MODE_MAX = 0,
+    PYRAMID_MODE_MEAN,
+    PYRAMID_MODE_ANY
+};
+
+typedef struct _pyramid {
+    t_object ob;
+    t_symbol *mode;
+    t_symbol *precision;
+    long num_threads;
+    long affinity;
+    float calctime;
+} t_pyramid;
+
+typedef struct _pyramid_level {
+    char *bp;
+    long dim[3];
+    long stride[3];
+} t_pyramid_level;
+
+typedef struct _pyramid_frame {
+    long mode;
+    long format;            // of the input and every level
+    t_pyramid_level level[PYRAMID_LEVELS + 1];
+} t_pyramid_frame;
+
+BEGIN_USING_C_LINKAGE
+t_jit_err pyramid_init(void);
+t_pyramid *pyramid_new(void);
+void pyramid_free(t_pyramid *x);
+t_jit_err pyramid_matrix_calc(t_pyramid *x, void *inputs, void *outputs);
+END_USING_C_LINKAGE
+
+static void *_pyramid_class = NULL;
+static t_symbol *ps_max, *ps_mean, *ps_any, *ps_half;
+
+t_jit_err pyramid_init(void) {
+    long attrflags = JIT_ATTR_GET_DEFER_LOW | JIT_ATTR_SET_USURP_LOW;
+    t_jit_object *attr;
+    t_jit_object *mop;
+
+    ps_max = gensym("max");
+    ps_mean = gensym("mean");
+    ps_any = gensym("any");
+    ps_half = gensym("half");
+
+    _pyramid_class = jit_class_new("pyramid", (method)pyramid_new, (method)pyramid_free, sizeof(t_pyramid), 0L);
+
+    // the levels take the input's format, float32 or half, set by calc
+    mop = jit_object_new(_jit_sym_jit_mop, 1, PYRAMID_LEVELS);
+    for (long i = 1; i <= PYRAMID_LEVELS; i++) {
+        jit_mop_output_nolink(mop, i);
+    }
+    jit_class_addadornment(_pyramid_class, mop);
+
+    // methods
+    jit_class_addmethod(_pyramid_class, (method)pyramid_matrix_calc, "matrix_calc", A_CANT, 0L);
+
+    // attributes
+    attr = jit_object_new(_jit_sym_jit_attr_offset, "mode", _jit_sym_symbol, attrflags,
+                          (method)NULL, (method)NULL, calcoffset(t_pyramid, mode));
+    jit_class_addattr(_pyramid_class, attr);
+    CLASS_ATTR_LABEL(_pyramid_class, "mode", 0, "Reduction Mode");
+    CLASS_ATTR_ENUM(_pyramid_class, "mode", 0, "max mean any");
+
+    voxel_grid_class_attrs(_pyramid_class, calcoffset(t_pyramid, precision));
+
+    voxel_parallel_class_attrs(_pyramid_class, calcoffset(t_pyramid, num_threads), calcoffset(t_pyramid, affinity), calcoffset(t_pyramid, calctime));
+
+    jit_class_register(_pyramid_class);
+
+    return JIT_ERR_NONE;
+}
+
+t_pyramid *pyramid_new(void) {
+    t_pyramid *x;
+
+    if ((x = (t_pyramid *)jit_object_alloc(_pyramid_class))) {
+        x->mode = ps_max;
+        x->precision = _jit_sym_float32;
+        x->num_threads = 0;
+        x->affinity = 0;
+        x->calctime = 0.0f;
+    } else {
+        x = NULL;
+    }
+
+    return x;
+}
+
+void pyramid_free(t_pyramid *x) {
+}
+
+// reduces 2x2x2 blocks of src into slices [z_start, z_end) of dst, clipping at odd edges
+static void pyramid_reduce(long mode, long format, t_pyramid_level *src, t_pyramid_level *dst, long z_start, long z_end) {
+    for (long vox_z = z_start; vox_z < z_end; vox_z++) {
+        long sz0 = vox_z * 2, sz1 = MIN(sz0 + 1, src->dim[2] - 1);
+
+        for (long vox_y = 0; vox_y < dst->dim[1]; vox_y++) {
+            long sy0 = vox_y * 2, sy1 = MIN(sy0 + 1, src->dim[1] - 1);
+            char *dp = dst->bp + vox_y * dst->stride[1] + vox_z * dst->stride[2];
+
+            for (long vox_x = 0; vox_x < dst->dim[0]; vox_x++) {
+                long sx0 = vox_x * 2, sx1 = MIN(sx0 + 1, src->dim[0] - 1);
+                float sum = 0.0f, peak = 0.0f;
+                long count = 0;
+
+                for (long sz = sz0; sz <= sz1; sz++) {
+                    for (long sy = sy0; sy <= sy1; sy++) {
+                        char *sp = src->bp + sy * src->stride[1] + sz * src->stride[2];
+                        for (long sx = sx0; sx <= sx1; sx++) {
+                            float v = voxel_grid_read(sp + sx * src->stride[0], format);
+                            peak = (count == 0 || v > peak) ? v : peak;
+                            sum += v;
+                            count++;
+                        }
+                    }
+                }
+
+                char *op = dp + vox_x * dst->stride[0];
+                switch (mode) {
+                    case PYRAMID_MODE_MEAN:
+                        voxel_grid_write(op, format, sum / count);
+                        break;
+                    case PYRAMID_MODE_ANY:
+                        voxel_grid_write(op, format, peak > 0.0f ? 1.0f : 0.0f);
+                        break;
+                    default:
+                        voxel_grid_write(op, format, peak);
+                        break;
+                }
+            }
+        }
+    }
+}
+
+static void pyramid_slab(void *ctx, long thread, long start, long end) {
+    t_pyramid_frame *f = (t_pyramid_frame *)ctx;
+
+    // each coarsest slice owns 2, 4 and 8 slices of the finer levels, so the
+    // finer results are still in cache when the next level reads them
+    for (long k = start; k < end; k++) {
+        for (long lvl = 1; lvl <= PYRAMID_LEVELS; lvl++) {
+            long span = 1L << (PYRAMID_LEVELS - lvl);
+            long z_start = k * span;
+            long z_end = MIN(z_start + span, f->level[lvl].dim[2]);
+            pyramid_reduce(f->mode, f->format, &f->level[lvl - 1], &f->level[lvl], z_start, z_end);
+        }
+    }
+}
+
+t_jit_err pyramid_matrix_calc(t_pyramid *x, void *inputs, void *outputs) {
+    double calc_start = systimer_gettime();
+    t_jit_err err = JIT_ERR_NONE;
+    t_jit_matrix_info in_minfo, out_minfo;
+    t_jit_object *in_matrix, *out_matrix[PYRAMID_LEVELS];
+    long in_savelock, out_savelock[PYRAMID_LEVELS];
+    void *in_mdata, *out_mdata;
+    t_pyramid_frame frame;
+    long i, planes, locked = 0;
+
+    in_matrix = jit_object_method(inputs, _jit_sym_getindex, 0);
+    for (i = 0; i < PYRAMID_LEVELS; i++) {
+        out_matrix[i] = jit_object_method(outputs, _jit_sym_getindex, i);
+        if (!out_matrix[i]) {
+            return JIT_ERR_INVALID_OUTPUT;
+        }
+    }
+
+    if (!in_matrix) {
+        return JIT_ERR_INVALID_INPUT;
+    }
+
+    in_savelock = (long)jit_object_method(in_matrix, _jit_sym_lock, 1);
+    for (locked = 0; locked < PYRAMID_LEVELS; locked++) {
+        out_savelock[locked] = (long)jit_object_method(out_matrix[locked], _jit_sym_lock, 1);
+    }
+
+    jit_object_method(in_matrix, _jit_sym_getinfo, &in_minfo);
+    jit_object_method(in_matrix, _jit_sym_getdata, &in_mdata);
+
+    if (!in_mdata) {
+        err = JIT_ERR_INVALID_INPUT;
+        goto out;
+    }
+    // the first plane of a float32 or half grid
+    frame.format = voxel_grid_format(&in_minfo, x->precision == ps_half, &planes);
+    if (frame.format == VOXEL_GRID_INVALID) {
+        err = JIT_ERR_MISMATCH_TYPE;
+        goto out;
+    }
+    if (in_minfo.dimcount != 3) {
+        err = JIT_ERR_MISMATCH_DIM;
+        goto out;
+    }
+
+    frame.mode = x->mode == ps_mean ? PYRAMID_MODE_MEAN : (x->mode == ps_any ? PYRAMID_MODE_ANY : PYRAMID_MODE_MAX);
+    frame.level[0].bp = (char *)in_mdata;
+    for (i = 0; i < 3; i++) {
+        frame.level[0].dim[i] = in_minfo.dim[i];
+        frame.level[0].stride[i] = in_minfo.dimstride[i];
+    }
+
+    // each level is half the previous one, rounded up
+    for (long lvl = 1; lvl <= PYRAMID_LEVELS; lvl++) {
+        out_minfo = in_minfo;
+        out_minfo.planecount = frame.format == VOXEL_GRID_HALF ? 2 : 1;
+        for (i = 0; i < 3; i++) {
+            out_minfo.dim[i] = (frame.level[lvl - 1].dim[i] + 1) / 2;
+        }
+
+        jit_object_method(out_matrix[lvl - 1], _jit_sym_setinfo, &out_minfo);
+        jit_object_method(out_matrix[lvl - 1], _jit_sym_getinfo, &out_minfo);
+        jit_object_method(out_matrix[lvl - 1], _jit_sym_getdata, &out_mdata);
+
+        if (!out_mdata) {
+            err = JIT_ERR_INVALID_OUTPUT;
+            goto out;
+        }
+
+        frame.level[lvl].bp = (char *)out_mdata;
+        for (i = 0; i < 3; i++) {
+            frame.level[lvl].dim[i] = out_minfo.dim[i];
+            frame.level[lvl].stride[i] = out_minfo.dimstride[i];
+        }
+    }
+
+    voxel_parallel_for(x->num_threads, x->affinity, frame.level[PYRAMID_LEVELS].dim[2], pyramid_slab, &frame);
+
+out:
+    x->calctime = (float)(systimer_gettime() - calc_start);
+    jit_object_method(in_matrix, _jit_sym_lock, in_savelock);
+    for (i = 0; i < locked; i++) {
+        jit_object_method(out_matrix[i], _jit_sym_lock, out_savelock[i]);
+    }
+    return err;
+}
@@ -0,0 +1,98 @@
+#include "jit.common.h"
+#include "max.jit.mop.h"
+
+typedef struct _max_pyramid {
+    t_object ob;
+    void *obex;
+} t_max_pyramid;
+
+BEGIN_USING_C_LINKAGE
+t_jit_err pyramid_init(void);
+void * max_pyramid_new(t_symbol *s, long argc, t_atom *argv);
+void max_pyramid_free(t_max_pyramid *x);
+void max_pyramid_assist(t_max_pyramid *x, void *b, long m, long a, char *s);
+END_USING_C_LINKAGE
+
+static void *max_pyramid_class = NULL;
+
+void ext_main(void *r) {
+    t_class *max_class, *jit_class;
+
+    pyramid_init();
+
+    max_class = class_new("voxel.pyramid", (method)max_pyramid_new, (method)max_pyramid_free, sizeof(t_max_pyramid), NULL, A_GIMME, 0);
+    max_jit_class_obex_setup(max_class, calcoffset(t_max_pyramid, obex));
+
+    jit_class = jit_class_findbyname(gensym("pyramid"));
+    max_jit_class_mop_wrap(max_class, jit_class,  MAX_JIT_MOP_FLAGS_OWN_ADAPT | MAX_JIT_MOP_FLAGS_OWN_OUTPUTMODE);
+    max_jit_class_wrap_standard(max_class, jit_class, 0);
+
+    class_addmethod(max_class, (method)max_pyramid_assist, "assist", A_CANT, 0);
+
+    class_register(CLASS_BOX, max_class);
+    max_pyramid_class = max_class;
+}
+
+/************************************************************************************/
+// Object Life Cycle
+
+void * max_pyramid_new(t_symbol *s, long argc, t_atom *argv) {
+    t_max_pyramid *x;
+    void *o;
+
+    x = (t_max_pyramid *)max_jit_object_alloc(max_pyramid_class, gensym("pyramid"));
+
+    if (x) {
+        o = jit_object_new(gensym("pyramid"));
+
+        if (o) {
+            max_jit_obex_jitob_set(x,o);
+            max_jit_obex_dumpout_set(x,outlet_new(x,NULL));
+            max_jit_mop_setup(x);
+            max_jit_mop_inputs(x);
+            max_jit_mop_outputs(x);
+            
+            if(argc > 0 && atom_gettype(argv) == A_SYM && atom_getsym(argv)->s_name[0] != '@'){
+                max_jit_attr_set(x, gensym("mode"), 1, argv);
+            }
+            
+            max_jit_attr_args(x, argc, argv);
+        } else {
+            jit_object_error((t_object *)x, "voxel.pyramid: could not allocate object");
+            object_free((t_object *)x);
+            x = NULL;
+        }
+    }
+
+    return (x);
+}
+
+void max_pyramid_free(t_max_pyramid *x) {
+    max_jit_mop_free(x);
+    jit_object_free(max_jit_obex_jitob_get(x));
+    max_jit_object_free(x);
+}
+
+void max_pyramid_assist(t_max_pyramid *x, void *b, long m, long a, char *s) {
+    if (m == 1) { // input
+        max_jit_mop_assist(x, b, m, a, s);
+    } else { // output
+        switch (a) {
+            case 0:
+                sprintf(s, "(matrix) voxel grid 1/2");
+                break;
+
+            case 1:
+                sprintf(s, "(matrix) voxel grid 1/4");
+                break;
+
+            case 2:
+                sprintf(s, "(matrix) voxel grid 1/8");
+                break;
+
+            default:
+                sprintf(s, "dumpout");
+                break;
+        }
+    }
+}
@@ -0,0 +1,412 @@
+#include "jit.common.h"
+#include "voxel.parallel.h"
+#include "voxel.arena.h"
+#include "voxel.hash.h"
+#include <math.h>
+
+#define RAYCAST_BRICK_SHIFT 3
+#define RAYCAST_BRICK (1L << RAYCAST_BRICK_SHIFT)
+
+typedef struct _raycast {
+    t_object ob;
+    float threshold;
+    float maxdist;
+    t_voxel_arena arena;
+    t_voxel_arena mask_arena;   // the brick mask, kept from frame to frame
+    unsigned char *bricks;
+    uint64_t mask_key;          // grid cells, dims and threshold the mask was built from
+    long rebuilds;
+    long allocations;
+    long num_threads;
+    long affinity;
+    float calctime;
+} t_raycast;
+
+typedef struct _raycast_frame {
+    t_raycast *x;
+    char *ray_bp;
+    char *grid_bp;
+    char *hit_bp;
+    char *index_bp;
+    long *ray_dim;
+    long *ray_stride;
+    long *grid_dim;
+    long *grid_stride;
+    long *hit_stride;
+    long *index_stride;
+    long brick_dim[3];
+    unsigned char *bricks;
+} t_raycast_frame;
+
+typedef struct _raycast_state {
+    long v[3];
+    long step[3];
+    float tmax[3];
+    float tdelta[3];
+} t_raycast_state;
+
+BEGIN_USING_C_LINKAGE
+t_jit_err raycast_init(void);
+t_raycast *raycast_new(void);
+void raycast_free(t_raycast *x);
+t_jit_err raycast_matrix_calc(t_raycast *x, void *inputs, void *outputs);
+END_USING_C_LINKAGE
+
+static void *_raycast_class = NULL;
+
+t_jit_err raycast_init(void) {
+    long attrflags = JIT_ATTR_GET_DEFER_LOW | JIT_ATTR_SET_USURP_LOW;
+    long statflags = JIT_ATTR_SET_OPAQUE_USER | JIT_ATTR_GET_DEFER_LOW;
+    t_jit_object *attr;
+    t_jit_object *mop;
+
+    _raycast_class = jit_class_new("raycast", (method)raycast_new, (method)raycast_free, sizeof(t_raycast), 0L);
+
+    mop = jit_object_new(_jit_sym_jit_mop, 2, 2);
+    jit_mop_input_nolink(mop, 2);
+    jit_mop_output_nolink(mop, 1);
+    jit_mop_output_nolink(mop, 2);
+    jit_class_addadornment(_raycast_class, mop);
+
+    // methods
+    jit_class_addmethod(_raycast_class, (method)raycast_matrix_calc, "matrix_calc", A_CANT, 0L);
+
+    // attributes
+    attr = jit_object_new(_jit_sym_jit_attr_offset, "threshold", _jit_sym_float32, attrflags,
+                          (method)NULL, (method)NULL, calcoffset(t_raycast, threshold));
+    jit_class_addattr(_raycast_class, attr);
+    CLASS_ATTR_LABEL(_raycast_class, "threshold", 0, "Occupancy Threshold");
+
+    attr = jit_object_new(_jit_sym_jit_attr_offset, "maxdist", _jit_sym_float32, attrflags,
+                          (method)NULL, (method)NULL, calcoffset(t_raycast, maxdist));
+    jit_class_addattr(_raycast_class, attr);
+    CLASS_ATTR_LABEL(_raycast_class, "maxdist", 0, "Maximum Distance");
+
+    attr = jit_object_new(_jit_sym_jit_attr_offset, "allocations", _jit_sym_long, statflags,
+                          (method)NULL, (method)NULL, calcoffset(t_raycast, allocations));
+    jit_class_addattr(_raycast_class, attr);
+
+    attr = jit_object_new(_jit_sym_jit_attr_offset, "rebuilds", _jit_sym_long, statflags,
+                          (method)NULL, (method)NULL, calcoffset(t_raycast, rebuilds));
+    jit_class_addattr(_raycast_class, attr);
+
+    voxel_parallel_class_attrs(_raycast_class, calcoffset(t_raycast, num_threads), calcoffset(t_raycast, affinity), calcoffset(t_raycast, calctime));
+
+    jit_class_register(_raycast_class);
+
+    return JIT_ERR_NONE;
+}
+
+t_raycast *raycast_new(void) {
+    t_raycast *x;
+
+    if ((x = (t_raycast *)jit_object_alloc(_raycast_class))) {
+        x->threshold = 0.0f;
+        x->maxdist = 2.0f;
+        voxel_arena_init(&x->arena);
+        voxel_arena_init(&x->mask_arena);
+        x->bricks = NULL;
+        x->mask_key = 0;
+        x->rebuilds = 0;
+        x->allocations = 0;
+        x->num_threads = 0;
+        x->affinity = 0;
+        x->calctime = 0.0f;
+    } else {
+        x = NULL;
+    }
+
+    return x;
+}
+
+void raycast_free(t_raycast *x) {
+    voxel_arena_free(&x->arena);
+    voxel_arena_free(&x->mask_arena);
+}
+
+// marks each 8x8x8 brick that holds at least one occupied voxel
+static void raycast_brick_slab(void *ctx, long thread, long start, long end) {
+    t_raycast_frame *f = (t_raycast_frame *)ctx;
+    long *dim = f->grid_dim;
+    long *stride = f->grid_stride;
+    float threshold = f->x->threshold;
+
+    for (long bz = start; bz < end; bz++) {
+        for (long by = 0; by < f->brick_dim[1]; by++) {
+            for (long bx = 0; bx < f->brick_dim[0]; bx++) {
+                long x_end = MIN((bx + 1) * RAYCAST_BRICK, dim[0]);
+                long y_end = MIN((by + 1) * RAYCAST_BRICK, dim[1]);
+                long z_end = MIN((bz + 1) * RAYCAST_BRICK, dim[2]);
+                unsigned char occupied = 0;
+
+                for (long vox_z = bz * RAYCAST_BRICK; vox_z < z_end && !occupied; vox_z++) {
+                    for (long vox_y = by * RAYCAST_BRICK; vox_y < y_end && !occupied; vox_y++) {
+                        char *ip = f->grid_bp + vox_y * stride[1] + vox_z * stride[2];
+                        for (long vox_x = bx * RAYCAST_BRICK; vox_x < x_end; vox_x++) {
+                            if (*(float *)(ip + vox_x * stride[0]) > threshold) {
+                                occupied = 1;
+                                break;
+                            }
+                        }
+                    }
+                }
+
+                f->bricks[(bz * f->brick_dim[1] + by) * f->brick_dim[0] + bx] = occupied;
+            }
+        }
+    }
+}
+
+static void raycast_setup(t_raycast_state *s, const float *o, const float *d) {
+    for (int i = 0; i < 3; i++) {
+        if (d[i] > 0.0f) {
+            s->step[i] = 1;
+            s->tdelta[i] = 1.0f / d[i];
+            s->tmax[i] = (s->v[i] + 1 - o[i]) / d[i];
+        } else if (d[i] < 0.0f) {
+            s->step[i] = -1;
+            s->tdelta[i] = -1.0f / d[i];
+            s->tmax[i] = (s->v[i] - o[i]) / d[i];
+        } else {
+            s->step[i] = 0;
+            s->tdelta[i] = INFINITY;
+            s->tmax[i] = INFINITY;
+        }
+    }
+}
+
+// 3D-DDA in voxel units; empty bricks are crossed in one step.
+// Returns the hit distance along the ray, or -1 on a miss.
+static float raycast_trace(t_raycast_frame *f, const float *o, const float *d, float t, float t_end, long *hit) {
+    long *dim = f->grid_dim;
+    long *stride = f->grid_stride;
+    float threshold = f->x->threshold;
+    t_raycast_state s;
+
+    for (int i = 0; i < 3; i++) {
+        s.v[i] = CLAMP((long)floorf(o[i] + d[i] * t), 0, dim[i] - 1);
+    }
+    raycast_setup(&s, o, d);
+
+    while (t <= t_end) {
+        long b[3] = { s.v[0] >> RAYCAST_BRICK_SHIFT, s.v[1] >> RAYCAST_BRICK_SHIFT, s.v[2] >> RAYCAST_BRICK_SHIFT };
+
+        if (!f->bricks[(b[2] * f->brick_dim[1] + b[1]) * f->brick_dim[0] + b[0]]) {
+            float t_exit = INFINITY;
+            int axis = 0;
+
+            for (int i = 0; i < 3; i++) {
+                if (s.step[i]) {
+                    long bound = (s.step[i] > 0 ? b[i] + 1 : b[i]) * RAYCAST_BRICK;
+                    float te = (bound - o[i]) / d[i];
+                    if (te < t_exit) {
+                        t_exit = te;
+                        axis = i;
+                    }
+                }
+            }
+
+            t = t_exit;
+            for (int i = 0; i < 3; i++) {
+                if (i == axis) {
+                    s.v[i] = s.step[i] > 0 ? (b[i] + 1) * RAYCAST_BRICK : b[i] * RAYCAST_BRICK - 1;
+                } else {
+                    long lo = b[i] * RAYCAST_BRICK;
+                    s.v[i] = CLAMP((long)floorf(o[i] + d[i] * t), lo, MIN(lo + RAYCAST_BRICK, dim[i]) - 1);
+                }
+            }
+            if (s.v[axis] < 0 || s.v[axis] >= dim[axis]) {
+                return -1.0f;
+            }
+            raycast_setup(&s, o, d);
+            continue;
+        }
+
+        if (*(float *)(f->grid_bp + s.v[0] * stride[0] + s.v[1] * stride[1] + s.v[2] * stride[2]) > threshold) {
+            hit[0] = s.v[0];
+            hit[1] = s.v[1];
+            hit[2] = s.v[2];
+            return t;
+        }
+
+        int axis = s.tmax[0] < s.tmax[1] ? (s.tmax[0] < s.tmax[2] ? 0 : 2) : (s.tmax[1] < s.tmax[2] ? 1 : 2);
+        t = s.tmax[axis];
+        s.v[axis] += s.step[axis];
+        s.tmax[axis] += s.tdelta[axis];
+
+        if (s.v[axis] < 0 || s.v[axis] >= dim[axis]) {
+            return -1.0f;
+        }
+    }
+
+    return -1.0f;
+}
+
+static void raycast_slab(void *ctx, long thread, long start, long end) {
+    t_raycast_frame *f = (t_raycast_frame *)ctx;
+    long *dim = f->grid_dim;
+
+    for (long i = start; i < end; i++) {
+        long rx = i % f->ray_dim[0];
+        long ry = i / f->ray_dim[0];
+        float *fip = (float *)(f->ray_bp + rx * f->ray_stride[0] + ry * f->ray_stride[1]);
+        float *fop = (float *)(f->hit_bp + rx * f->hit_stride[0] + ry * f->hit_stride[1]);
+        t_int32 *lop = (t_int32 *)(f->index_bp + rx * f->index_stride[0] + ry * f->index_stride[1]);
+        float len = sqrtf(fip[3] * fip[3] + fip[4] * fip[4] + fip[5] * fip[5]);
+        float dist = -1.0f;
+        long hit[3];
+
+        if (len > 0.0f) {
+            // rays are given in normalized grid space, traced in voxel units
+            float o[3], d[3];
+            float t = 0.0f, t_end = f->x->maxdist;
+
+            for (int j = 0; j < 3; j++) {
+                o[j] = fip[j] * dim[j];
+                d[j] = fip[j + 3] / len * dim[j];
+
+                if (d[j] != 0.0f) {
+                    float ta = -o[j] / d[j];
+                    float tb = (dim[j] - o[j]) / d[j];
+                    t = MAX(t, MIN(ta, tb));
+                    t_end = MIN(t_end, MAX(ta, tb));
+                } else if (o[j] < 0.0f || o[j] >= dim[j]) {
+                    t_end = -1.0f;
+                }
+            }
+
+            if (t <= t_end) {
+                dist = raycast_trace(f, o, d, t, t_end, hit);
+            }
+        }
+
+        if (dist >= 0.0f) {
+            fop[0] = fip[0] + fip[3] / len * dist;
+            fop[1] = fip[1] + fip[4] / len * dist;
+            fop[2] = fip[2] + fip[5] / len * dist;
+            fop[3] = dist;
+            lop[0] = (t_int32)(hit[0] + (hit[1] + hit[2] * dim[1]) * dim[0]);
+        } else {
+            fop[0] = fop[1] = fop[2] = 0.0f;
+            fop[3] = -1.0f;
+            lop[0] = -1;
+        }
+    }
+}
+
+t_jit_err raycast_matrix_calc(t_raycast *x, void *inputs, void *outputs) {
+    double calc_start = systimer_gettime();
+    t_jit_err err = JIT_ERR_NONE;
+    t_jit_matrix_info ray_minfo, grid_minfo, hit_minfo, index_minfo;
+    t_jit_object *ray_matrix, *grid_matrix, *hit_matrix, *index_matrix;
+    long ray_savelock, grid_savelock, hit_savelock, index_savelock;
+    void *ray_mdata, *grid_mdata, *hit_mdata, *index_mdata;
+    long ray_dim[2];
+    uint64_t key;
+    t_raycast_frame frame;
+
+    ray_matrix = jit_object_method(inputs, _jit_sym_getindex, 0);
+    grid_matrix = jit_object_method(inputs, _jit_sym_getindex, 1);
+    hit_matrix = jit_object_method(outputs, _jit_sym_getindex, 0);
+    index_matrix = jit_object_method(outputs, _jit_sym_getindex, 1);
+
+    if (!ray_matrix || !grid_matrix || !hit_matrix || !index_matrix) {
+        return JIT_ERR_INVALID_INPUT;
+    }
+
+    ray_savelock = (long)jit_object_method(ray_matrix, _jit_sym_lock, 1);
+    grid_savelock = (long)jit_object_method(grid_matrix, _jit_sym_lock, 1);
+    hit_savelock = (long)jit_object_method(hit_matrix, _jit_sym_lock, 1);
+    index_savelock = (long)jit_object_method(index_matrix, _jit_sym_lock, 1);
+
+    jit_object_method(ray_matrix, _jit_sym_getinfo, &ray_minfo);
+    jit_object_method(ray_matrix, _jit_sym_getdata, &ray_mdata);
+    jit_object_method(grid_matrix, _jit_sym_getinfo, &grid_minfo);
+    jit_object_method(grid_matrix, _jit_sym_getdata, &grid_mdata);
+
+    if (!ray_mdata || !grid_mdata) {
+        err = JIT_ERR_INVALID_INPUT;
+        goto out;
+    }
+    if (ray_minfo.type != _jit_sym_float32 || grid_minfo.type != _jit_sym_float32) {
+        err = JIT_ERR_MISMATCH_TYPE;
+        goto out;
+    }
+    if (ray_minfo.planecount < 6) {
+        err = JIT_ERR_MISMATCH_PLANE;
+        goto out;
+    }
+    if (ray_minfo.dimcount > 2 || grid_minfo.dimcount != 3) {
+        err = JIT_ERR_MISMATCH_DIM;
+        goto out;
+    }
+
+    // one hit per ray: position xyz and distance, plus the linear voxel index
+    hit_minfo = ray_minfo;
+    hit_minfo.planecount = 4;
+    jit_object_method(hit_matrix, _jit_sym_setinfo, &hit_minfo);
+    jit_object_method(hit_matrix, _jit_sym_getinfo, &hit_minfo);
+    jit_object_method(hit_matrix, _jit_sym_getdata, &hit_mdata);
+
+    index_minfo = ray_minfo;
+    index_minfo.type = _jit_sym_long;
+    index_minfo.planecount = 1;
+    jit_object_method(index_matrix, _jit_sym_setinfo, &index_minfo);
+    jit_object_method(index_matrix, _jit_sym_getinfo, &index_minfo);
+    jit_object_method(index_matrix, _jit_sym_getdata, &index_mdata);
+
+    if (!hit_mdata || !index_mdata) {
+        err = JIT_ERR_INVALID_OUTPUT;
+        goto out;
+    }
+
+    frame.x = x;
+    frame.ray_bp = (char *)ray_mdata;
+    frame.grid_bp = (char *)grid_mdata;
+    frame.hit_bp = (char *)hit_mdata;
+    frame.index_bp = (char *)index_mdata;
+    frame.grid_dim = grid_minfo.dim;
+    frame.grid_stride = grid_minfo.dimstride;
+    frame.ray_stride = ray_minfo.dimstride;
+    frame.hit_stride = hit_minfo.dimstride;
+    frame.index_stride = index_minfo.dimstride;
+
+    ray_dim[0] = ray_minfo.dim[0];
+    ray_dim[1] = ray_minfo.dimcount > 1 ? ray_minfo.dim[1] : 1;
+    frame.ray_dim = ray_dim;
+
+    for (int i = 0; i < 3; i++) {
+        frame.brick_dim[i] = (grid_minfo.dim[i] + RAYCAST_BRICK - 1) / RAYCAST_BRICK;
+    }
+
+    // the mask only changes with the grid, so it is rebuilt when the grid's fingerprint
+    // or the threshold differs from the one it was built from
+    key = voxel_hash_matrix(x->num_threads, x->affinity, &grid_minfo, frame.grid_bp);
+    key = voxel_hash_bytes(key, &x->threshold, sizeof(x->threshold));
+    if (!x->bricks || key != x->mask_key) {
+        long brick_count = frame.brick_dim[0] * frame.brick_dim[1] * frame.brick_dim[2];
+
+        voxel_arena_release(&x->mask_arena);
+        x->bricks = (unsigned char *)voxel_arena_alloc(&x->mask_arena, brick_count);
+        if (!x->bricks) {
+            err = JIT_ERR_OUT_OF_MEM;
+            goto out;
+        }
+        frame.bricks = x->bricks;
+        voxel_parallel_for(x->num_threads, x->affinity, frame.brick_dim[2], raycast_brick_slab, &frame);
+        x->mask_key = key;
+        x->rebuilds++;
+    }
+    frame.bricks = x->bricks;
+    voxel_parallel_for(x->num_threads, x->affinity, ray_dim[0] * ray_dim[1], raycast_slab, &frame);
+
+out:
+    x->calctime = (float)(systimer_gettime() - calc_start);
+    voxel_arena_release(&x->arena);
+    x->allocations = x->arena.allocations + x->mask_arena.allocations;
+    jit_object_method(ray_matrix, _jit_sym_lock, ray_savelock);
+    jit_object_method(grid_matrix, _jit_sym_lock, grid_savelock);
+    jit_object_method(hit_matrix, _jit_sym_lock, hit_savelock);
+    jit_object_method(index_matrix, _jit_sym_lock, index_savelock);
+    return err;
+}
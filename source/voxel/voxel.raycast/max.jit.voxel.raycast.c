@@ -0,0 +1,97 @@
+#include "jit.common.h"
+#include "max.jit.mop.h"
+
+typedef struct _max_raycast {
+    t_object ob;
+    void *obex;
+} t_max_raycast;
+
+BEGIN_USING_C_LINKAGE
+t_jit_err raycast_init(void);
+void * max_raycast_new(t_symbol *s, long argc, t_atom *argv);
+void max_raycast_free(t_max_raycast *x);
+void max_raycast_assist(t_max_raycast *x, void *b, long m, long a, char *s);
+END_USING_C_LINKAGE
+
+static void *max_raycast_class = NULL;
+
+void ext_main(void *r) {
+    t_class *max_class, *jit_class;
+
+    raycast_init();
+
+    max_class = class_new("voxel.raycast", (method)max_raycast_new, (method)max_raycast_free, sizeof(t_max_raycast), NULL, A_GIMME, 0);
+    max_jit_class_obex_setup(max_class, calcoffset(t_max_raycast, obex));
+
+    jit_class = jit_class_findbyname(gensym("raycast"));
+    max_jit_class_mop_wrap(max_class, jit_class,  MAX_JIT_MOP_FLAGS_OWN_ADAPT | MAX_JIT_MOP_FLAGS_OWN_OUTPUTMODE);
+    max_jit_class_wrap_standard(max_class, jit_class, 0);
+
+    class_addmethod(max_class, (method)max_raycast_assist, "assist", A_CANT, 0);
+
+    class_register(CLASS_BOX, max_class);
+    max_raycast_class = max_class;
+}
+
+/************************************************************************************/
+// Object Life Cycle
+
+void * max_raycast_new(t_symbol *s, long argc, t_atom *argv) {
+    t_max_raycast *x;
+    void *o;
+
+    x = (t_max_raycast *)max_jit_object_alloc(max_raycast_class, gensym("raycast"));
+
+    if (x) {
+        o = jit_object_new(gensym("raycast"));
+
+        if (o) {
+            max_jit_obex_jitob_set(x,o);
+            max_jit_obex_dumpout_set(x,outlet_new(x,NULL));
+            max_jit_mop_setup(x);
+            max_jit_mop_inputs(x);
+            max_jit_mop_outputs(x);
+            max_jit_attr_args(x, argc, argv);
+        } else {
+            jit_object_error((t_object *)x, "voxel.raycast: could not allocate object");
+            object_free((t_object *)x);
+            x = NULL;
+        }
+    }
+
+    return (x);
+}
+
+void max_raycast_free(t_max_raycast *x) {
+    max_jit_mop_free(x);
+    jit_object_free(max_jit_obex_jitob_get(x));
+    max_jit_object_free(x);
+}
+
+void max_raycast_assist(t_max_raycast *x, void *b, long m, long a, char *s) {
+    if (m == 1) { // input
+        switch (a) {
+            case 0:
+                sprintf(s, "(matrix) rays: origin xyz, direction xyz");
+                break;
+
+            default:
+                sprintf(s, "(matrix) voxel grid");
+                break;
+        }
+    } else { // output
+        switch (a) {
+            case 0:
+                sprintf(s, "(matrix) hit position xyz, distance");
+                break;
+
+            case 1:
+                sprintf(s, "(matrix) hit voxel index");
+                break;
+
+            default:
+                sprintf(s, "dumpout");
+                break;
+        }
+    }
+}
@@ -0,0 +1,417 @@
+#include "jit.common.h"
+#include "voxel.parallel.h"
+#include "voxel.arena.h"
+#include "voxel.half.h"
+
+#define STATS_MAX_MARGINAL 1024     // longer axes are folded into this many bins
+#define STATS_MAX_BINS 256
+
+enum {
+    STATS_MARGINALS = 1,
+    STATS_HISTOGRAM = 2,
+    STATS_OCTANTS = 4
+};
+
+typedef struct _stats {
+    t_object ob;
+    t_symbol *precision;
+    t_symbol *outputs[3];
+    long outputs_count;
+    long mask;
+    long bins;
+    float range[2];
+    float xmarginal[STATS_MAX_MARGINAL];
+    long xmarginal_count;
+    float ymarginal[STATS_MAX_MARGINAL];
+    long ymarginal_count;
+    float zmarginal[STATS_MAX_MARGINAL];
+    long zmarginal_count;
+    long histogram[STATS_MAX_BINS];
+    long histogram_count;
+    float octants[8];
+    long octants_count;
+    float mass;
+    long occupied;
+    t_voxel_arena arena;
+    long allocations;
+    long num_threads;
+    long affinity;
+    float calctime;
+} t_stats;
+
+typedef struct _stats_frame {
+    char *in_bp;
+    long *dim;
+    long *stride;
+    long format;
+    long mask;
+    long lengths[3];        // marginal bins along x, y and z
+    long bins;
+    float low;
+    float scale;            // weight to histogram bin
+    long *xbins;            // marginal bin of each x
+    long width;             // doubles per thread in partials
+    double *partials;       // marginals, histogram, octants, mass, occupied for each thread,
+                            // followed by its clamped row and the histogram bin of each voxel
+    size_t partial_stride;  // bytes from one thread's partials to the next
+} t_stats_frame;
+
+BEGIN_USING_C_LINKAGE
+t_jit_err stats_init(void);
+t_stats *stats_new(void);
+void stats_free(t_stats *x);
+t_jit_err stats_matrix_calc(t_stats *x, void *inputs, void *outputs);
+t_jit_err stats_outputs_set(t_stats *x, void *attr, long ac, t_atom *av);
+END_USING_C_LINKAGE
+
+static void *_stats_class = NULL;
+static t_symbol *ps_marginals, *ps_histogram, *ps_octants, *ps_half;
+
+t_jit_err stats_init(void) {
+    long attrflags = JIT_ATTR_GET_DEFER_LOW | JIT_ATTR_SET_USURP_LOW;
+    long statflags = JIT_ATTR_SET_OPAQUE_USER | JIT_ATTR_GET_DEFER_LOW;
+    t_jit_object *attr;
+    t_jit_object *mop;
+
+    ps_marginals = gensym("marginals");
+    ps_histogram = gensym("histogram");
+    ps_octants = gensym("octants");
+    ps_half = gensym("half");
+
+    _stats_class = jit_class_new("stats", (method)stats_new, (method)stats_free, sizeof(t_stats), 0L);
+
+    mop = jit_object_new(_jit_sym_jit_mop, 1, 0);
+    jit_class_addadornment(_stats_class, mop);
+
+    // methods
+    jit_class_addmethod(_stats_class, (method)stats_matrix_calc, "matrix_calc", A_CANT, 0L);
+
+    // attributes
+    attr = jit_object_new(_jit_sym_jit_attr_offset_array, "outputs", _jit_sym_symbol, 3, attrflags,
+                          (method)NULL, (method)stats_outputs_set, calcoffset(t_stats, outputs_count), calcoffset(t_stats, outputs));
+    jit_class_addattr(_stats_class, attr);
+    CLASS_ATTR_LABEL(_stats_class, "outputs", 0, "Outputs (marginals histogram octants)");
+
+    attr = jit_object_new(_jit_sym_jit_attr_offset, "bins", _jit_sym_long, attrflags,
+                          (method)NULL, (method)NULL, calcoffset(t_stats, bins));
+    jit_class_addattr(_stats_class, attr);
+    CLASS_ATTR_LABEL(_stats_class, "bins", 0, "Histogram Bins");
+
+    attr = jit_object_new(_jit_sym_jit_attr_offset_array, "range", _jit_sym_float32, 2, attrflags,
+                          (method)NULL, (method)NULL, 0, calcoffset(t_stats, range));
+    jit_class_addattr(_stats_class, attr);
+    CLASS_ATTR_LABEL(_stats_class, "range", 0, "Histogram Weight Range");
+
+    attr = jit_object_new(_jit_sym_jit_attr_offset_array, "xmarginal", _jit_sym_float32, STATS_MAX_MARGINAL, statflags,
+                          (method)NULL, (method)NULL, calcoffset(t_stats, xmarginal_count), calcoffset(t_stats, xmarginal));
+    jit_class_addattr(_stats_class, attr);
+
+    attr = jit_object_new(_jit_sym_jit_attr_offset_array, "ymarginal", _jit_sym_float32, STATS_MAX_MARGINAL, statflags,
+                          (method)NULL, (method)NULL, calcoffset(t_stats, ymarginal_count), calcoffset(t_stats, ymarginal));
+    jit_class_addattr(_stats_class, attr);
+
+    attr = jit_object_new(_jit_sym_jit_attr_offset_array, "zmarginal", _jit_sym_float32, STATS_MAX_MARGINAL, statflags,
+                          (method)NULL, (method)NULL, calcoffset(t_stats, zmarginal_count), calcoffset(t_stats, zmarginal));
+    jit_class_addattr(_stats_class, attr);
+
+    attr = jit_object_new(_jit_sym_jit_attr_offset_array, "histogram", _jit_sym_long, STATS_MAX_BINS, statflags,
+                          (method)NULL, (method)NULL, calcoffset(t_stats, histogram_count), calcoffset(t_stats, histogram));
+    jit_class_addattr(_stats_class, attr);
+
+    attr = jit_object_new(_jit_sym_jit_attr_offset_array, "octants", _jit_sym_float32, 8, statflags,
+                          (method)NULL, (method)NULL, calcoffset(t_stats, octants_count), calcoffset(t_stats, octants));
+    jit_class_addattr(_stats_class, attr);
+
+    attr = jit_object_new(_jit_sym_jit_attr_offset, "mass", _jit_sym_float32, statflags,
+                          (method)NULL, (method)NULL, calcoffset(t_stats, mass));
+    jit_class_addattr(_stats_class, attr);
+
+    attr = jit_object_new(_jit_sym_jit_attr_offset, "occupied", _jit_sym_long, statflags,
+                          (method)NULL, (method)NULL, calcoffset(t_stats, occupied));
+    jit_class_addattr(_stats_class, attr);
+
+    attr = jit_object_new(_jit_sym_jit_attr_offset, "allocations", _jit_sym_long, statflags,
+                          (method)NULL, (method)NULL, calcoffset(t_stats, allocations));
+    jit_class_addattr(_stats_class, attr);
+
+    voxel_grid_class_attrs(_stats_class, calcoffset(t_stats, precision));
+    voxel_parallel_class_attrs(_stats_class, calcoffset(t_stats, num_threads), calcoffset(t_stats, affinity), calcoffset(t_stats, calctime));
+
+    jit_class_register(_stats_class);
+
+    return JIT_ERR_NONE;
+}
+
+t_stats *stats_new(void) {
+    t_stats *x;
+
+    if ((x = (t_stats *)jit_object_alloc(_stats_class))) {
+        x->precision = _jit_sym_float32;
+        x->outputs[0] = ps_marginals;
+        x->outputs[1] = ps_histogram;
+        x->outputs[2] = ps_octants;
+        x->outputs_count = 3;
+        x->mask = STATS_MARGINALS | STATS_HISTOGRAM | STATS_OCTANTS;
+        x->bins = 16;
+        x->range[0] = 0.0f;
+        x->range[1] = 1.0f;
+        x->xmarginal_count = 0;
+        x->ymarginal_count = 0;
+        x->zmarginal_count = 0;
+        x->histogram_count = 0;
+        x->octants_count = 0;
+        x->mass = 0.0f;
+        x->occupied = 0;
+        voxel_arena_init(&x->arena);
+        x->allocations = 0;
+        x->num_threads = 0;
+        x->affinity = 0;
+        x->calctime = 0.0f;
+    } else {
+        x = NULL;
+    }
+
+    return x;
+}
+
+void stats_free(t_stats *x) {
+    voxel_arena_free(&x->arena);
+}
+
+// mass and occupied are always computed; the listed outputs are computed on top
+t_jit_err stats_outputs_set(t_stats *x, void *attr, long ac, t_atom *av) {
+    long n = 0;
+
+    x->mask = 0;
+    for (long i = 0; i < ac && n < 3; i++) {
+        t_symbol *output = atom_getsym(av + i);
+        long bit = output == ps_marginals ? STATS_MARGINALS :
+                   output == ps_histogram ? STATS_HISTOGRAM :
+                   output == ps_octants ? STATS_OCTANTS : 0;
+
+        if (!bit) {
+            jit_object_error((t_object *)x, "voxel.stats: unknown output %s, expected marginals, histogram or octants", output->s_name);
+            continue;
+        }
+        if (!(x->mask & bit)) {
+            x->outputs[n++] = output;
+            x->mask |= bit;
+        }
+    }
+    x->outputs_count = n;
+    return JIT_ERR_NONE;
+}
+
+// one thread's partial sums over a range of z slices. The partials are cleared here
+// rather than before the pass so they are first touched by the thread that fills them.
+// Each row is first clamped into the thread's line, empty voxels becoming 0, so the
+// passes over it that follow need no branches
+static void stats_slab(void *ctx, long thread, long start, long end) {
+    t_stats_frame *f = (t_stats_frame *)ctx;
+    long *dim = f->dim;
+    long split = dim[0] / 2;
+    double *xm = (double *)((char *)f->partials + thread * f->partial_stride);
+    double *ym = xm + f->lengths[0];
+    double *zm = ym + f->lengths[1];
+    double *histogram = zm + f->lengths[2];
+    double *octants = histogram + f->bins;
+    double *totals = octants + 8;
+    float *line = (float *)(xm + f->width);
+    float base = f->low, scale = f->scale, last = (float)(f->bins - 1);
+    t_int32 spare = (t_int32)f->bins;
+    t_int32 *slots = (t_int32 *)(line + dim[0]);
+    long counts[4][STATS_MAX_BINS + 1];
+
+    for (long i = 0; i < f->width; i++) {
+        xm[i] = 0.0;
+    }
+    memset(counts, 0, sizeof(counts));
+
+    for (long vox_z = start; vox_z < end; vox_z++) {
+        double slice_mass = 0.0;
+        long slice_occupied = 0;
+        long upper = (vox_z >= dim[2] / 2) << 2;
+
+        for (long vox_y = 0; vox_y < dim[1]; vox_y++) {
+            char *row = f->in_bp + vox_y * f->stride[1] + vox_z * f->stride[2];
+            const float *values = (const float *)row;
+            long octant = upper | (vox_y >= dim[1] / 2) << 1;
+            double low = 0.0, high = 0.0;
+
+            if (f->format == VOXEL_GRID_HALF) {
+                voxel_half_load(row, f->stride[0], line, dim[0]);
+                values = line;
+            }
+            for (long vox_x = 0; vox_x < dim[0]; vox_x++) {
+                float weight = values[vox_x];
+                slice_occupied += weight > 0;
+                line[vox_x] = weight > 0 ? weight : 0.0f;
+            }
+
+            // the two x halves give the octant masses, and together the row mass
+            for (long vox_x = 0; vox_x < split; vox_x++) {
+                low += line[vox_x];
+            }
+            for (long vox_x = split; vox_x < dim[0]; vox_x++) {
+                high += line[vox_x];
+            }
+            octants[octant] += low;
+            octants[octant | 1] += high;
+            slice_mass += low + high;
+
+            if (f->mask & STATS_MARGINALS) {
+                if (f->lengths[0] == dim[0]) {
+                    for (long vox_x = 0; vox_x < dim[0]; vox_x++) {
+                        xm[vox_x] += line[vox_x];
+                    }
+                } else {
+                    for (long vox_x = 0; vox_x < dim[0]; vox_x++) {
+                        xm[f->xbins[vox_x]] += line[vox_x];
+                    }
+                }
+                ym[vox_y * f->lengths[1] / dim[1]] += low + high;
+            }
+
+            // bin of each voxel first, which vectorizes, with empty voxels in a spare bin
+            // past the end; then four interleaved counts so neighbouring voxels in the
+            // same bin do not wait on each other's increments
+            if (f->mask & STATS_HISTOGRAM) {
+                long vox_x;
+
+                for (vox_x = 0; vox_x < dim[0]; vox_x++) {
+                    float position = (line[vox_x] - base) * scale;
+                    t_int32 bin;
+
+                    position = position > 0.0f ? position : 0.0f;
+                    bin = (t_int32)(position < last ? position : last);
+                    slots[vox_x] = line[vox_x] > 0 ? bin : spare;
+                }
+                for (vox_x = 0; vox_x + 4 <= dim[0]; vox_x += 4) {
+                    counts[0][slots[vox_x]]++;
+                    counts[1][slots[vox_x + 1]]++;
+                    counts[2][slots[vox_x + 2]]++;
+                    counts[3][slots[vox_x + 3]]++;
+                }
+                for (; vox_x < dim[0]; vox_x++) {
+                    counts[0][slots[vox_x]]++;
+                }
+            }
+        }
+
+        if (f->mask & STATS_MARGINALS) {
+            zm[vox_z * f->lengths[2] / dim[2]] += slice_mass;
+        }
+        totals[0] += slice_mass;
+        totals[1] += slice_occupied;
+    }
+
+    for (long i = 0; i < f->bins; i++) {
+        histogram[i] = (double)counts[0][i] + counts[1][i] + counts[2][i] + counts[3][i];
+    }
+}
+
+t_jit_err stats_matrix_calc(t_stats *x, void *inputs, void *outputs) {
+    double calc_start = systimer_gettime();
+    t_jit_err err = JIT_ERR_NONE;
+    t_jit_matrix_info in_minfo;
+    t_jit_object *in_matrix;
+    long savelock, planes, slabs, total;
+    void *in_mdata;
+    t_stats_frame frame;
+    double *totals;
+
+    in_matrix = jit_object_method(inputs, _jit_sym_getindex, 0);
+
+    if (!in_matrix) {
+        return JIT_ERR_INVALID_INPUT;
+    }
+
+    savelock = (long)jit_object_method(in_matrix, _jit_sym_lock, 1);
+
+    jit_object_method(in_matrix, _jit_sym_getinfo, &in_minfo);
+    jit_object_method(in_matrix, _jit_sym_getdata, &in_mdata);
+
+    if (!in_mdata) {
+        err = JIT_ERR_INVALID_INPUT;
+        goto out;
+    }
+
+    // single plane 3d grid, float32 or half stored as char pairs
+    frame.format = voxel_grid_format(&in_minfo, x->precision == ps_half, &planes);
+    if (frame.format == VOXEL_GRID_INVALID || planes != 1 || in_minfo.dimcount != 3) {
+        err = JIT_ERR_MISMATCH_TYPE;
+        goto out;
+    }
+
+    frame.in_bp = (char *)in_mdata;
+    frame.dim = in_minfo.dim;
+    frame.stride = in_minfo.dimstride;
+    frame.mask = x->mask;
+    for (int a = 0; a < 3; a++) {
+        frame.lengths[a] = frame.mask & STATS_MARGINALS ? MIN(in_minfo.dim[a], STATS_MAX_MARGINAL) : 0;
+    }
+    frame.bins = frame.mask & STATS_HISTOGRAM ? CLAMP(x->bins, 1, STATS_MAX_BINS) : 0;
+    frame.low = x->range[0];
+    frame.scale = x->range[1] > x->range[0] ? frame.bins / (x->range[1] - x->range[0]) : 0.0f;
+    total = frame.lengths[0] + frame.lengths[1] + frame.lengths[2];
+    // whole cache lines, so the row after the partials stays aligned
+    frame.width = (total + frame.bins + 10 + 7) & ~7L;
+
+    frame.xbins = (long *)voxel_arena_alloc(&x->arena, in_minfo.dim[0] * sizeof(long));
+    frame.partials = (double *)voxel_arena_alloc_rows(&x->arena, voxel_parallel_threads(x->num_threads),
+                                                      frame.width * sizeof(double) + in_minfo.dim[0] * (sizeof(float) + sizeof(t_int32)),
+                                                      &frame.partial_stride);
+    if (!frame.xbins || !frame.partials) {
+        err = JIT_ERR_OUT_OF_MEM;
+        goto out;
+    }
+    for (long vox_x = 0; vox_x < in_minfo.dim[0]; vox_x++) {
+        frame.xbins[vox_x] = frame.lengths[0] ? vox_x * frame.lengths[0] / in_minfo.dim[0] : 0;
+    }
+
+    slabs = voxel_parallel_for(x->num_threads, x->affinity, in_minfo.dim[2], stats_slab, &frame);
+
+    // merge in thread order into the first thread's partials
+    for (long i = 0; !slabs && i < frame.width; i++) {
+        frame.partials[i] = 0.0;
+    }
+    for (long thread = 1; thread < slabs; thread++) {
+        double *partial = (double *)((char *)frame.partials + thread * frame.partial_stride);
+
+        for (long i = 0; i < frame.width; i++) {
+            frame.partials[i] += partial[i];
+        }
+    }
+
+    for (long i = 0; i < frame.lengths[0]; i++) {
+        x->xmarginal[i] = (float)frame.partials[i];
+    }
+    for (long i = 0; i < frame.lengths[1]; i++) {
+        x->ymarginal[i] = (float)frame.partials[frame.lengths[0] + i];
+    }
+    for (long i = 0; i < frame.lengths[2]; i++) {
+        x->zmarginal[i] = (float)frame.partials[frame.lengths[0] + frame.lengths[1] + i];
+    }
+    for (long i = 0; i < frame.bins; i++) {
+        x->histogram[i] = (long)frame.partials[total + i];
+    }
+    for (int i = 0; i < 8; i++) {
+        x->octants[i] = (float)frame.partials[total + frame.bins + i];
+    }
+    x->xmarginal_count = frame.lengths[0];
+    x->ymarginal_count = frame.lengths[1];
+    x->zmarginal_count = frame.lengths[2];
+    x->histogram_count = frame.bins;
+    x->octants_count = frame.mask & STATS_OCTANTS ? 8 : 0;
+
+    totals = frame.partials + total + frame.bins + 8;
+    x->mass = (float)totals[0];
+    x->occupied = (long)totals[1];
+
+out:
+    x->calctime = (float)(systimer_gettime() - calc_start);
+    voxel_arena_release(&x->arena);
+    x->allocations = x->arena.allocations;
+    jit_object_method(in_matrix, _jit_sym_lock, savelock);
+    return err;
+}
@@ -0,0 +1,142 @@
+#include "jit.common.h"
+#include "max.jit.mop.h"
+
+#define MAX_STATS_ATOMS 1024        // STATS_MAX_MARGINAL in jit.voxel.stats.c
+
+typedef struct _max_stats {
+    t_object ob;
+    void *obex;
+    void *statsout;
+    t_atom *av;
+} t_max_stats;
+
+BEGIN_USING_C_LINKAGE
+t_jit_err stats_init(void);
+void * max_stats_new(t_symbol *s, long argc, t_atom *argv);
+void max_stats_free(t_max_stats *x);
+void max_stats_assist(t_max_stats *x, void *b, long m, long a, char *s);
+void max_stats_bang(t_max_stats *x);
+void max_stats_mproc(t_max_stats *x, void *mop);
+END_USING_C_LINKAGE
+
+static void *max_stats_class = NULL;
+
+void ext_main(void *r) {
+    t_class *max_class, *jit_class;
+
+    stats_init();
+
+    max_class = class_new("voxel.stats", (method)max_stats_new, (method)max_stats_free, sizeof(t_max_stats), NULL, A_GIMME, 0);
+    max_jit_class_obex_setup(max_class, calcoffset(t_max_stats, obex));
+
+    jit_class = jit_class_findbyname(gensym("stats"));
+    max_jit_class_mop_wrap(max_class, jit_class,
+                           MAX_JIT_MOP_FLAGS_OWN_BANG |
+                           MAX_JIT_MOP_FLAGS_OWN_OUTPUTMATRIX |
+                           MAX_JIT_MOP_FLAGS_OWN_ADAPT |
+                           MAX_JIT_MOP_FLAGS_OWN_OUTPUTMODE);
+    max_jit_classex_mop_mproc(max_class, jit_class, max_stats_mproc);
+    max_jit_class_wrap_standard(max_class, jit_class, 0);
+
+    class_addmethod(max_class, (method)max_stats_assist, "assist", A_CANT, 0);
+    class_addmethod(max_class, (method)max_stats_bang, "bang");
+
+    class_register(CLASS_BOX, max_class);
+    max_stats_class = max_class;
+}
+
+// sends one array attribute as a message named after it; outputs that were not
+// computed are empty and skipped
+static void max_stats_outputarray(t_max_stats *x, void *o, const char *name, const char *getter) {
+    long ac = MAX_STATS_ATOMS;
+
+    jit_object_method(o, gensym(getter), &ac, &(x->av));
+    if (ac) {
+        outlet_anything(x->statsout, gensym(name), ac, x->av);
+    }
+}
+
+void max_stats_bang(t_max_stats *x) {
+    void *o;
+
+    // each output is its own message so a route can split them; mass and occupied last
+    if (max_jit_mop_getoutputmode(x) && x->av) {
+        o = max_jit_obex_jitob_get(x);
+        max_stats_outputarray(x, o, "xmarginal", "getxmarginal");
+        max_stats_outputarray(x, o, "ymarginal", "getymarginal");
+        max_stats_outputarray(x, o, "zmarginal", "getzmarginal");
+        max_stats_outputarray(x, o, "histogram", "gethistogram");
+        max_stats_outputarray(x, o, "octants", "getoctants");
+
+        atom_setfloat(x->av, jit_attr_getfloat(o, gensym("mass")));
+        atom_setlong(x->av + 1, jit_attr_getlong(o, gensym("occupied")));
+        outlet_anything(x->statsout, gensym("mass"), 2, x->av);
+    }
+}
+
+void max_stats_mproc(t_max_stats *x, void *mop) {
+    t_jit_err err;
+
+    if (mop) {
+        if ((err = (t_jit_err)jit_object_method(
+                 max_jit_obex_jitob_get(x), _jit_sym_matrix_calc,
+                 jit_object_method(mop, _jit_sym_getinputlist),
+                 jit_object_method(mop, _jit_sym_getoutputlist)))) {
+            jit_error_code(x, err);
+        } else {
+            max_stats_bang(x);
+        }
+    }
+}
+
+void max_stats_assist(t_max_stats *x, void *b, long m, long a, char *s) {
+    if (m == 1) { // input
+        max_jit_mop_assist(x, b, m, a, s);
+    } else { // output
+        switch (a) {
+            case 0:
+                sprintf(s, "(messages) xmarginal, ymarginal, zmarginal, histogram, octants, mass");
+                break;
+
+            case 1:
+                sprintf(s, "dumpout");
+                break;
+        }
+    }
+}
+
+void max_stats_free(t_max_stats *x) {
+    max_jit_mop_free(x);
+    jit_object_free(max_jit_obex_jitob_get(x));
+
+    if (x->av) {
+        jit_freebytes(x->av, sizeof(t_atom) * MAX_STATS_ATOMS);
+    }
+
+    max_jit_object_free(x);
+}
+
+void * max_stats_new(t_symbol *s, long argc, t_atom *argv) {
+    t_max_stats *x;
+    void *o;
+
+    x = (t_max_stats *)max_jit_object_alloc(max_stats_class, gensym("stats"));
+
+    if (x) {
+        x->av = NULL;
+        o = jit_object_new(gensym("stats"));
+
+        if (o) {
+            max_jit_mop_setup_simple(x, o, argc, argv);
+            x->statsout = outlet_new(x, 0L);
+            x->av = jit_getbytes(sizeof(t_atom) * MAX_STATS_ATOMS);
+            max_jit_attr_args(x, argc, argv);
+        } else {
+            jit_object_error((t_object *)x, "voxel.stats: could not allocate object");
+            object_free((t_object *)x);
+            x = NULL;
+        }
+    }
+
+    return (x);
+}
@@ -0,0 +1,339 @@
+#include "jit.common.h"
+#include "voxel.parallel.h"
+#include <limits.h>
+#include <math.h>
+
+typedef struct _temporal {
+    t_object ob;
+    float alpha;
+    float threshold;
+    long changed;
+    float bounds[6];
+    float *ema;
+    float *prev;
+    long history_dim[3];
+    long num_threads;
+    long affinity;
+    float calctime;
+} t_temporal;
+
+typedef struct _temporal_partial {
+    long changed;
+    long min[3];
+    long max[3];
+} t_temporal_partial;
+
+typedef struct _temporal_frame {
+    t_temporal *x;
+    char *in_bp;
+    char *smooth_bp;
+    char *mask_bp;
+    long *dim;
+    long *in_stride;
+    long *smooth_stride;
+    long *mask_stride;
+    t_temporal_partial partials[VOXEL_MAX_THREADS];
+} t_temporal_frame;
+
+BEGIN_USING_C_LINKAGE
+t_jit_err temporal_init(void);
+t_temporal *temporal_new(void);
+void temporal_free(t_temporal *x);
+t_jit_err temporal_matrix_calc(t_temporal *x, void *inputs, void *outputs);
+void temporal_reset(t_temporal *x);
+END_USING_C_LINKAGE
+
+static void *_temporal_class = NULL;
+
+t_jit_err temporal_init(void) {
+    long attrflags = JIT_ATTR_GET_DEFER_LOW | JIT_ATTR_SET_USURP_LOW;
+    long statflags = JIT_ATTR_SET_OPAQUE_USER | JIT_ATTR_GET_DEFER_LOW;
+    t_jit_object *attr;
+    t_jit_object *mop;
+
+    _temporal_class = jit_class_new("temporal", (method)temporal_new, (method)temporal_free, sizeof(t_temporal), 0L);
+
+    mop = jit_object_new(_jit_sym_jit_mop, 1, 2);
+    jit_mop_single_type(mop, _jit_sym_float32);
+    jit_mop_single_planecount(mop, 1);
+    jit_class_addadornment(_temporal_class, mop);
+
+    // methods
+    jit_class_addmethod(_temporal_class, (method)temporal_matrix_calc, "matrix_calc", A_CANT, 0L);
+    jit_class_addmethod(_temporal_class, (method)temporal_reset, "reset", 0L);
+
+    // attributes
+    attr = jit_object_new(_jit_sym_jit_attr_offset, "alpha", _jit_sym_float32, attrflags,
+                          (method)NULL, (method)NULL, calcoffset(t_temporal, alpha));
+    jit_class_addattr(_temporal_class, attr);
+    CLASS_ATTR_LABEL(_temporal_class, "alpha", 0, "Smoothing Factor");
+    CLASS_ATTR_FILTER_CLIP(_temporal_class, "alpha", 0, 1);
+
+    attr = jit_object_new(_jit_sym_jit_attr_offset, "threshold", _jit_sym_float32, attrflags,
+                          (method)NULL, (method)NULL, calcoffset(t_temporal, threshold));
+    jit_class_addattr(_temporal_class, attr);
+    CLASS_ATTR_LABEL(_temporal_class, "threshold", 0, "Change Threshold");
+
+    attr = jit_object_new(_jit_sym_jit_attr_offset, "changed", _jit_sym_long, statflags,
+                          (method)NULL, (method)NULL, calcoffset(t_temporal, changed));
+    jit_class_addattr(_temporal_class, attr);
+
+    attr = jit_object_new(_jit_sym_jit_attr_offset_array, "bounds", _jit_sym_float32, 6, statflags,
+                          (method)NULL, (method)NULL, 0, calcoffset(t_temporal, bounds));
+    jit_class_addattr(_temporal_class, attr);
+
+    voxel_parallel_class_attrs(_temporal_class, calcoffset(t_temporal, num_threads), calcoffset(t_temporal, affinity), calcoffset(t_temporal, calctime));
+
+    jit_class_register(_temporal_class);
+
+    return JIT_ERR_NONE;
+}
+
+t_temporal *temporal_new(void) {
+    t_temporal *x;
+
+    if ((x = (t_temporal *)jit_object_alloc(_temporal_class))) {
+        x->alpha = 0.5f;
+        x->threshold = 0.0f;
+        x->changed = 0;
+        for (int i = 0; i < 6; i++) {
+            x->bounds[i] = 0.0f;
+        }
+        x->ema = NULL;
+        x->prev = NULL;
+        x->history_dim[0] = x->history_dim[1] = x->history_dim[2] = 0;
+        x->num_threads = 0;
+        x->affinity = 0;
+        x->calctime = 0.0f;
+    } else {
+        x = NULL;
+    }
+
+    return x;
+}
+
+void temporal_free(t_temporal *x) {
+    if (x->ema) {
+        free(x->ema);
+    }
+    if (x->prev) {
+        free(x->prev);
+    }
+}
+
+void temporal_reset(t_temporal *x) {
+    // history is reseeded from the next input frame
+    x->history_dim[0] = x->history_dim[1] = x->history_dim[2] = 0;
+}
+
+static t_jit_err temporal_history_alloc(t_temporal *x, long *dim) {
+    long count = dim[0] * dim[1] * dim[2];
+
+    if (x->ema) {
+        free(x->ema);
+    }
+    if (x->prev) {
+        free(x->prev);
+    }
+    x->ema = (float *)malloc(count * sizeof(float));
+    x->prev = (float *)malloc(count * sizeof(float));
+
+    if (!x->ema || !x->prev) {
+        if (x->ema) free(x->ema);
+        if (x->prev) free(x->prev);
+        x->ema = x->prev = NULL;
+        return JIT_ERR_OUT_OF_MEM;
+    }
+    return JIT_ERR_NONE;
+}
+
+static void temporal_seed_slab(void *ctx, long thread, long start, long end) {
+    t_temporal_frame *f = (t_temporal_frame *)ctx;
+    long *dim = f->dim;
+
+    for (long vox_z = start; vox_z < end; vox_z++) {
+        for (long vox_y = 0; vox_y < dim[1]; vox_y++) {
+            long row = (vox_z * dim[1] + vox_y) * dim[0];
+            char *ip = f->in_bp + vox_y * f->in_stride[1] + vox_z * f->in_stride[2];
+
+            for (long vox_x = 0; vox_x < dim[0]; vox_x++) {
+                float v = *(float *)(ip + vox_x * f->in_stride[0]);
+                f->x->ema[row + vox_x] = v;
+                f->x->prev[row + vox_x] = v;
+            }
+        }
+    }
+}
+
+static void temporal_slab(void *ctx, long thread, long start, long end) {
+    t_temporal_frame *f = (t_temporal_frame *)ctx;
+    t_temporal_partial *p = &f->partials[thread];
+    long *dim = f->dim;
+    float alpha = f->x->alpha;
+    float threshold = f->x->threshold;
+    int packed = f->in_stride[0] == sizeof(float) && f->smooth_stride[0] == sizeof(float) && f->mask_stride[0] == sizeof(float);
+
+    p->changed = 0;
+    p->min[0] = p->min[1] = p->min[2] = LONG_MAX;
+    p->max[0] = p->max[1] = p->max[2] = -1;
+
+    for (long vox_z = start; vox_z < end; vox_z++) {
+        for (long vox_y = 0; vox_y < dim[1]; vox_y++) {
+            long row = (vox_z * dim[1] + vox_y) * dim[0];
+            float *restrict ema = f->x->ema + row;
+            float *restrict prev = f->x->prev + row;
+            char *ip = f->in_bp + vox_y * f->in_stride[1] + vox_z * f->in_stride[2];
+            char *sp = f->smooth_bp + vox_y * f->smooth_stride[1] + vox_z * f->smooth_stride[2];
+            char *mp = f->mask_bp + vox_y * f->mask_stride[1] + vox_z * f->mask_stride[2];
+            long row_changed = 0;
+
+            if (packed) {
+                // contiguous rows: branch-free so the compiler can vectorize
+                const float *restrict fip = (const float *)ip;
+                float *restrict fsp = (float *)sp;
+                float *restrict fmp = (float *)mp;
+
+                for (long vox_x = 0; vox_x < dim[0]; vox_x++) {
+                    float v = fip[vox_x];
+                    float e = ema[vox_x] + alpha * (v - ema[vox_x]);
+                    int c = fabsf(v - prev[vox_x]) > threshold;
+                    ema[vox_x] = e;
+                    prev[vox_x] = v;
+                    fsp[vox_x] = e;
+                    fmp[vox_x] = (float)c;
+                    row_changed += c;
+                }
+            } else {
+                for (long vox_x = 0; vox_x < dim[0]; vox_x++) {
+                    float v = *(float *)(ip + vox_x * f->in_stride[0]);
+                    float e = ema[vox_x] + alpha * (v - ema[vox_x]);
+                    int c = fabsf(v - prev[vox_x]) > threshold;
+                    ema[vox_x] = e;
+                    prev[vox_x] = v;
+                    *(float *)(sp + vox_x * f->smooth_stride[0]) = e;
+                    *(float *)(mp + vox_x * f->mask_stride[0]) = (float)c;
+                    row_changed += c;
+                }
+            }
+
+            if (row_changed > 0) {
+                long first = 0, last = dim[0] - 1;
+                while (*(float *)(mp + first * f->mask_stride[0]) == 0.0f) first++;
+                while (*(float *)(mp + last * f->mask_stride[0]) == 0.0f) last--;
+
+                p->changed += row_changed;
+                p->min[0] = MIN(p->min[0], first);
+                p->max[0] = MAX(p->max[0], last);
+                p->min[1] = MIN(p->min[1], vox_y);
+                p->max[1] = MAX(p->max[1], vox_y);
+                p->min[2] = MIN(p->min[2], vox_z);
+                p->max[2] = MAX(p->max[2], vox_z);
+            }
+        }
+    }
+}
+
+t_jit_err temporal_matrix_calc(t_temporal *x, void *inputs, void *outputs) {
+    double calc_start = systimer_gettime();
+    t_jit_err err = JIT_ERR_NONE;
+    t_jit_matrix_info in_minfo, smooth_minfo, mask_minfo;
+    t_jit_object *in_matrix, *smooth_matrix, *mask_matrix;
+    long in_savelock, smooth_savelock, mask_savelock;
+    void *in_mdata, *smooth_mdata, *mask_mdata;
+    t_temporal_frame frame;
+
+    in_matrix = jit_object_method(inputs, _jit_sym_getindex, 0);
+    smooth_matrix = jit_object_method(outputs, _jit_sym_getindex, 0);
+    mask_matrix = jit_object_method(outputs, _jit_sym_getindex, 1);
+
+    if (!in_matrix || !smooth_matrix || !mask_matrix) {
+        return JIT_ERR_INVALID_INPUT;
+    }
+
+    in_savelock = (long)jit_object_method(in_matrix, _jit_sym_lock, 1);
+    smooth_savelock = (long)jit_object_method(smooth_matrix, _jit_sym_lock, 1);
+    mask_savelock = (long)jit_object_method(mask_matrix, _jit_sym_lock, 1);
+
+    jit_object_method(in_matrix, _jit_sym_getinfo, &in_minfo);
+    jit_object_method(in_matrix, _jit_sym_getdata, &in_mdata);
+    jit_object_method(smooth_matrix, _jit_sym_getinfo, &smooth_minfo);
+    jit_object_method(smooth_matrix, _jit_sym_getdata, &smooth_mdata);
+    jit_object_method(mask_matrix, _jit_sym_getinfo, &mask_minfo);
+    jit_object_method(mask_matrix, _jit_sym_getdata, &mask_mdata);
+
+    if (!in_mdata) {
+        err = JIT_ERR_INVALID_INPUT;
+        goto out;
+    }
+    if (!smooth_mdata || !mask_mdata) {
+        err = JIT_ERR_INVALID_OUTPUT;
+        goto out;
+    }
+    // single plane float32 grids, both outputs the size of the input
+    if (in_minfo.dimcount != 3 || smooth_minfo.dimcount != 3 || mask_minfo.dimcount != 3) {
+        err = JIT_ERR_MISMATCH_DIM;
+        goto out;
+    }
+    for (int a = 0; a < 3; a++) {
+        if (smooth_minfo.dim[a] != in_minfo.dim[a] || mask_minfo.dim[a] != in_minfo.dim[a]) {
+            err = JIT_ERR_MISMATCH_DIM;
+            goto out;
+        }
+    }
+    if (in_minfo.type != _jit_sym_float32 || smooth_minfo.type != _jit_sym_float32 || mask_minfo.type != _jit_sym_float32 ||
+        in_minfo.planecount != 1 || smooth_minfo.planecount != 1 || mask_minfo.planecount != 1) {
+        err = JIT_ERR_MISMATCH_TYPE;
+        goto out;
+    }
+
+    frame.x = x;
+    frame.in_bp = (char *)in_mdata;
+    frame.smooth_bp = (char *)smooth_mdata;
+    frame.mask_bp = (char *)mask_mdata;
+    frame.dim = in_minfo.dim;
+    frame.in_stride = in_minfo.dimstride;
+    frame.smooth_stride = smooth_minfo.dimstride;
+    frame.mask_stride = mask_minfo.dimstride;
+
+    if (x->history_dim[0] != in_minfo.dim[0] || x->history_dim[1] != in_minfo.dim[1] || x->history_dim[2] != in_minfo.dim[2]) {
+        if ((err = temporal_history_alloc(x, in_minfo.dim))) {
+            x->history_dim[0] = x->history_dim[1] = x->history_dim[2] = 0;
+            goto out;
+        }
+        voxel_parallel_for(x->num_threads, x->affinity, in_minfo.dim[2], temporal_seed_slab, &frame);
+        x->history_dim[0] = in_minfo.dim[0];
+        x->history_dim[1] = in_minfo.dim[1];
+        x->history_dim[2] = in_minfo.dim[2];
+    }
+
+    long slabs = voxel_parallel_for(x->num_threads, x->affinity, in_minfo.dim[2], temporal_slab, &frame);
+
+    // merge per-thread counts and bounds
+    t_temporal_partial total = frame.partials[0];
+    for (long i = 1; i < slabs; i++) {
+        t_temporal_partial *p = &frame.partials[i];
+        total.changed += p->changed;
+        for (int j = 0; j < 3; j++) {
+            total.min[j] = MIN(total.min[j], p->min[j]);
+            total.max[j] = MAX(total.max[j], p->max[j]);
+        }
+    }
+
+    x->changed = total.changed;
+    for (int j = 0; j < 3; j++) {
+        if (total.changed > 0) {
+            x->bounds[j] = (float)total.min[j] / in_minfo.dim[j];
+            x->bounds[j + 3] = (float)(total.max[j] + 1) / in_minfo.dim[j];
+        } else {
+            x->bounds[j] = 0.0f;
+            x->bounds[j + 3] = 0.0f;
+        }
+    }
+
+out:
+    x->calctime = (float)(systimer_gettime() - calc_start);
+    jit_object_method(in_matrix, _jit_sym_lock, in_savelock);
+    jit_object_method(smooth_matrix, _jit_sym_lock, smooth_savelock);
+    jit_object_method(mask_matrix, _jit_sym_lock, mask_savelock);
+    return err;
+}
@@ -0,0 +1,131 @@
+#include "jit.common.h"
+#include "max.jit.mop.h"
+
+typedef struct _max_temporal {
+    t_object ob;
+    void *obex;
+    void *statsout;
+    t_atom *av;
+} t_max_temporal;
+
+BEGIN_USING_C_LINKAGE
+t_jit_err temporal_init(void);
+void * max_temporal_new(t_symbol *s, long argc, t_atom *argv);
+void max_temporal_free(t_max_temporal *x);
+void max_temporal_assist(t_max_temporal *x, void *b, long m, long a, char *s);
+void max_temporal_mproc(t_max_temporal *x, void *mop);
+END_USING_C_LINKAGE
+
+static void *max_temporal_class = NULL;
+
+void ext_main(void *r) {
+    t_class *max_class, *jit_class;
+
+    temporal_init();
+
+    max_class = class_new("voxel.temporal", (method)max_temporal_new, (method)max_temporal_free, sizeof(t_max_temporal), NULL, A_GIMME, 0);
+    max_jit_class_obex_setup(max_class, calcoffset(t_max_temporal, obex));
+
+    jit_class = jit_class_findbyname(gensym("temporal"));
+    max_jit_class_mop_wrap(max_class, jit_class,  MAX_JIT_MOP_FLAGS_OWN_ADAPT | MAX_JIT_MOP_FLAGS_OWN_OUTPUTMODE);
+    max_jit_classex_mop_mproc(max_class, jit_class, max_temporal_mproc);
+    max_jit_class_wrap_standard(max_class, jit_class, 0);
+
+    class_addmethod(max_class, (method)max_temporal_assist, "assist", A_CANT, 0);
+
+    class_register(CLASS_BOX, max_class);
+    max_temporal_class = max_class;
+}
+
+void max_temporal_mproc(t_max_temporal *x, void *mop) {
+    t_jit_err err;
+    void *o;
+    float bounds[6];
+
+    if (mop) {
+        o = max_jit_obex_jitob_get(x);
+
+        if ((err = (t_jit_err)jit_object_method(
+                 o, _jit_sym_matrix_calc,
+                 jit_object_method(mop, _jit_sym_getinputlist),
+                 jit_object_method(mop, _jit_sym_getoutputlist)))) {
+            jit_error_code(x, err);
+        } else {
+            // changed voxel count and bounds first, so downstream gates are set before the grids arrive
+            jit_attr_getfloat_array(o, gensym("bounds"), 6, bounds);
+            atom_setlong(x->av, jit_attr_getlong(o, gensym("changed")));
+            atom_setfloat_array(6, x->av + 1, 6, bounds);
+            outlet_anything(x->statsout, _jit_sym_list, 7, x->av);
+
+            max_jit_mop_outputmatrix(x);
+        }
+    }
+}
+
+void max_temporal_assist(t_max_temporal *x, void *b, long m, long a, char *s) {
+    if (m == 1) { // input
+        max_jit_mop_assist(x, b, m, a, s);
+    } else { // output
+        switch (a) {
+            case 0:
+                sprintf(s, "(matrix) smoothed voxel grid");
+                break;
+
+            case 1:
+                sprintf(s, "(matrix) change mask");
+                break;
+
+            case 2:
+                sprintf(s, "(list) changed count, bounds min xyz, max xyz");
+                break;
+
+            default:
+                sprintf(s, "dumpout");
+                break;
+        }
+    }
+}
+
+/************************************************************************************/
+// Object Life Cycle
+
+void * max_temporal_new(t_symbol *s, long argc, t_atom *argv) {
+    t_max_temporal *x;
+    void *o;
+
+    x = (t_max_temporal *)max_jit_object_alloc(max_temporal_class, gensym("temporal"));
+
+    if (x) {
+        x->av = NULL;
+        o = jit_object_new(gensym("temporal"));
+
+        if (o) {
+            max_jit_obex_jitob_set(x,o);
+            max_jit_obex_dumpout_set(x,outlet_new(x,NULL));
+            x->statsout = outlet_new(x, 0L);
+            x->av = jit_getbytes(sizeof(t_atom) * 7);
+            max_jit_mop_setup(x);
+            max_jit_mop_inputs(x);
+            max_jit_mop_outputs(x);
+
+            max_jit_attr_args(x, argc, argv);
+        } else {
+            jit_object_error((t_object *)x, "voxel.temporal: could not allocate object");
+            object_free((t_object *)x);
+            x = NULL;
+        }
+    }
+
+    return (x);
+}
+
+void max_temporal_free(t_max_temporal *x) {
+    max_jit_mop_free(x);
+    jit_object_free(max_jit_obex_jitob_get(x));
+
+    if (x->av) {
+        jit_freebytes(x->av, sizeof(t_atom) * 7);
+    }
+
+    max_jit_object_free(x);
+}
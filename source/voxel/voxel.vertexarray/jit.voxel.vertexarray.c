@@ -1,8 +1,18 @@
 #include "jit.common.h"
+#include "voxel.arena.h"
+#include "voxel.half.h"
+#include "voxel.hash.h"
+
+#define VERTEXARRAY_COLOR_PLANES 4
 
 typedef struct _vertexarray {
     t_object ob;
+    t_symbol *precision;
     long size;
+    long normals;
+    long color;
+    t_voxel_arena arena;
+    t_voxel_cache cache;
 } t_vertexarray;
 
 BEGIN_USING_C_LINKAGE
@@ -14,10 +24,15 @@ void vertexarray_clear(t_vertexarray *x);
 END_USING_C_LINKAGE
 
 static void *_vertexarray_class = NULL;
+static t_symbol *ps_half;
 
 t_jit_err vertexarray_init(void) {
+    long attrflags = JIT_ATTR_GET_DEFER_LOW | JIT_ATTR_SET_USURP_LOW;
+    t_jit_object *attr;
     t_jit_object *mop;
 
+    ps_half = gensym("half");
+
     _vertexarray_class = jit_class_new("vertexarray", (method)vertexarray_new, (method)vertexarray_free, sizeof(t_vertexarray), 0L);
 
     mop = jit_object_new(_jit_sym_jit_mop, 1, 1);
@@ -27,28 +42,80 @@ t_jit_err vertexarray_init(void) {
     // methods
     jit_class_addmethod(_vertexarray_class, (method)vertexarray_matrix_calc, "matrix_calc", A_CANT, 0L);
 
+    // attributes
+    attr = jit_object_new(_jit_sym_jit_attr_offset, "normals", _jit_sym_long, attrflags,
+                          (method)NULL, (method)NULL, calcoffset(t_vertexarray, normals));
+    jit_class_addattr(_vertexarray_class, attr);
+    CLASS_ATTR_LABEL(_vertexarray_class, "normals", 0, "Output Gradient Normals");
+    CLASS_ATTR_STYLE(_vertexarray_class, "normals", 0, "onoff");
+
+    attr = jit_object_new(_jit_sym_jit_attr_offset, "color", _jit_sym_long, attrflags,
+                          (method)NULL, (method)NULL, calcoffset(t_vertexarray, color));
+    jit_class_addattr(_vertexarray_class, attr);
+    CLASS_ATTR_LABEL(_vertexarray_class, "color", 0, "Output Colour From Extra Planes");
+    CLASS_ATTR_STYLE(_vertexarray_class, "color", 0, "onoff");
+
+    voxel_grid_class_attrs(_vertexarray_class, calcoffset(t_vertexarray, precision));
+    voxel_cache_class_attrs(_vertexarray_class, calcoffset(t_vertexarray, cache));
+
     jit_class_register(_vertexarray_class);
 
     return JIT_ERR_NONE;
 }
 
 t_vertexarray *vertexarray_new(void) {
-    return (t_vertexarray *)jit_object_alloc(_vertexarray_class);
+    t_vertexarray *x;
+
+    if ((x = (t_vertexarray *)jit_object_alloc(_vertexarray_class))) {
+        x->precision = _jit_sym_float32;
+        x->normals = 0;
+        x->color = 0;
+        voxel_arena_init(&x->arena);
+        voxel_cache_clear(&x->cache);
+    } else {
+        x = NULL;
+    }
+
+    return x;
 }
 
 void vertexarray_free(t_vertexarray *x) {
+    voxel_arena_free(&x->arena);
+}
+
+// copies the weight plane of slice z into its slot of the 3-slice window
+static void vertexarray_load_slice(float *window, char *in_bp, t_jit_matrix_info *in_minfo, long format, long z) {
+    long *dim = in_minfo->dim;
+    float *dst = window + (z % 3) * dim[0] * dim[1];
+
+    for (long y = 0; y < dim[1]; y++) {
+        char *row = in_bp + y * in_minfo->dimstride[1] + z * in_minfo->dimstride[2];
+
+        if (format == VOXEL_GRID_HALF) {
+            voxel_half_load(row, in_minfo->dimstride[0], dst + y * dim[0], dim[0]);
+            continue;
+        }
+        for (long x = 0; x < dim[0]; x++) {
+            dst[y * dim[0] + x] = *(float *)(row + x * in_minfo->dimstride[0]);
+        }
+    }
 }
 
 t_jit_err vertexarray_matrix_calc(t_vertexarray *x, void *inputs, void *outputs) {
     t_jit_err err = JIT_ERR_NONE;
     t_jit_matrix_info in_minfo, out_minfo;
     char *in_bp, *out_bp;
-    long i, j, k, index;
+    long index;
     t_jit_object *in_matrix, *out_matrix;
     long in_savelock, out_savelock;
     void *in_mdata, *out_mdata;
-    float *fip, *fop;
+    char *ip;
+    float *fop;
+    float *window = NULL;
+    long slice_size, loaded;
+    long format, planes, color_planes, value_size;
     int vox_x, vox_y, vox_z;
+    uint64_t key = 0;
 
     in_matrix = jit_object_method(inputs, _jit_sym_getindex, 0);
     out_matrix = jit_object_method(outputs, _jit_sym_getindex, 0);
@@ -56,19 +123,34 @@ t_jit_err vertexarray_matrix_calc(t_vertexarray *x, void *inputs, void *outputs)
     if (!in_matrix || !out_matrix) {
         return JIT_ERR_INVALID_INPUT;
     }
-    
-    in_savelock = (long)jit_object_method(inputs, _jit_sym_lock, 1);
-    out_savelock = (long)jit_object_method(outputs, _jit_sym_lock, 1);
-    
+
+    in_savelock = (long)jit_object_method(in_matrix, _jit_sym_lock, 1);
+    out_savelock = (long)jit_object_method(out_matrix, _jit_sym_lock, 1);
 
     jit_object_method(in_matrix, _jit_sym_getinfo, &in_minfo);
     jit_object_method(in_matrix, _jit_sym_getdata, &in_mdata);
 
     if (!in_mdata) {
-        return JIT_ERR_INVALID_INPUT;
+        err = JIT_ERR_INVALID_INPUT;
+        goto out;
     }
 
-    int p_count = 4;
+    // float32 grids, or half grids stored as char pairs
+    format = voxel_grid_format(&in_minfo, x->precision == ps_half, &planes);
+    if (format == VOXEL_GRID_INVALID) {
+        err = JIT_ERR_MISMATCH_TYPE;
+        goto out;
+    }
+    if (in_minfo.dimcount < 3) {
+        err = JIT_ERR_MISMATCH_DIM;
+        goto out;
+    }
+    value_size = format == VOXEL_GRID_HALF ? sizeof(uint16_t) : sizeof(float);
+
+    // plane 0 is the weight; any further planes are grey, rgb or rgba colour
+    color_planes = x->color ? MIN(planes - 1, VERTEXARRAY_COLOR_PLANES) : 0;
+
+    int p_count = 4 + (x->normals ? 3 : 0) + (x->color ? VERTEXARRAY_COLOR_PLANES : 0);
 
     out_minfo.type = _jit_sym_float32;
     out_minfo.dimcount = 1;
@@ -80,39 +162,138 @@ t_jit_err vertexarray_matrix_calc(t_vertexarray *x, void *inputs, void *outputs)
     jit_object_method(out_matrix, _jit_sym_getdata, &out_mdata);
 
     if (!out_mdata) {
-        return JIT_ERR_INVALID_OUTPUT;
+        err = JIT_ERR_INVALID_OUTPUT;
+        goto out;
     }
 
     in_bp = (char *)in_mdata;
     out_bp = (char *)out_mdata;
 
+    if (x->cache.enabled) {
+        // the kernel itself runs on the calling thread, so the hash does too rather
+        // than waking a thread per cpu
+        key = voxel_cache_key(1, 0, &in_minfo, in_bp, &out_minfo, out_bp);
+        key = voxel_hash_bytes(key, &x->normals, sizeof(x->normals));
+        key = voxel_hash_bytes(key, &x->color, sizeof(x->color));
+        if (voxel_cache_hit(&x->cache, key)) {
+            goto out;
+        }
+    }
+
     fop = (float *)out_bp;
-    
+
+    // normals read the weights through a window of the previous, current and next
+    // slice, filled one slice ahead, so each input voxel is fetched once
+    slice_size = in_minfo.dim[0] * in_minfo.dim[1];
+    loaded = 0;
+    if (x->normals) {
+        window = (float *)voxel_arena_alloc(&x->arena, slice_size * 3 * sizeof(float));
+
+        if (!window) {
+            err = JIT_ERR_OUT_OF_MEM;
+            goto out;
+        }
+    }
+
     index = 0;
     for(vox_z = 0; vox_z < in_minfo.dim[2]; vox_z++){
+        long zm = MAX(vox_z - 1, 0), zp = MIN(vox_z + 1, in_minfo.dim[2] - 1);
+        float *cur = NULL, *below = NULL, *above = NULL;
+
+        if (window) {
+            while (loaded <= zp) {
+                vertexarray_load_slice(window, in_bp, &in_minfo, format, loaded++);
+            }
+            cur = window + (vox_z % 3) * slice_size;
+            below = window + (zm % 3) * slice_size;
+            above = window + (zp % 3) * slice_size;
+        }
+
         for(vox_y = 0; vox_y < in_minfo.dim[1]; vox_y++){
+            long ym = MAX(vox_y - 1, 0), yp = MIN(vox_y + 1, in_minfo.dim[1] - 1);
+
             for(vox_x = 0; vox_x < in_minfo.dim[0]; vox_x++){
-                fip = (float *)(in_bp + (vox_x * in_minfo.dimstride[0] + vox_y * in_minfo.dimstride[1] + vox_z * in_minfo.dimstride[2]));
-                float weight = fip[0];
-                
+                ip = in_bp + (vox_x * in_minfo.dimstride[0] + vox_y * in_minfo.dimstride[1] + vox_z * in_minfo.dimstride[2]);
+                float weight = cur ? cur[vox_y * in_minfo.dim[0] + vox_x] : voxel_grid_read(ip, format);
+                float *vp = fop + index;
+
                 if(weight > 0){
-                    fop[index] = (float)vox_x / in_minfo.dim[0] + 1.0f / in_minfo.dim[0] * .5f;
-                    fop[index + 1] = (float)vox_y / in_minfo.dim[1] + 1.0f / in_minfo.dim[1] * .5f;
-                    fop[index + 2] = (float)vox_z / in_minfo.dim[2] + 1.0f / in_minfo.dim[2] * .5f;
-                    fop[index + 3] = weight;
+                    vp[0] = (float)vox_x / in_minfo.dim[0] + 1.0f / in_minfo.dim[0] * .5f;
+                    vp[1] = (float)vox_y / in_minfo.dim[1] + 1.0f / in_minfo.dim[1] * .5f;
+                    vp[2] = (float)vox_z / in_minfo.dim[2] + 1.0f / in_minfo.dim[2] * .5f;
+                    vp[3] = weight;
                 }
                 else{
-                    fop[index] = 0;
-                    fop[index + 1] = 0;
-                    fop[index + 2] = 0;
-                    fop[index + 3] = 0;
+                    vp[0] = 0;
+                    vp[1] = 0;
+                    vp[2] = 0;
+                    vp[3] = 0;
+                }
+                vp += 4;
+
+                if (x->normals) {
+                    long xm = MAX(vox_x - 1, 0), xp = MIN(vox_x + 1, in_minfo.dim[0] - 1);
+                    float g[3] = { 0.0f, 0.0f, 0.0f };
+                    float length;
+
+                    // central differences in normalized space, one-sided at the faces
+                    if (xp > xm) {
+                        g[0] = (cur[vox_y * in_minfo.dim[0] + xp] - cur[vox_y * in_minfo.dim[0] + xm]) / (xp - xm) * in_minfo.dim[0];
+                    }
+                    if (yp > ym) {
+                        g[1] = (cur[yp * in_minfo.dim[0] + vox_x] - cur[ym * in_minfo.dim[0] + vox_x]) / (yp - ym) * in_minfo.dim[1];
+                    }
+                    if (zp > zm) {
+                        g[2] = (above[vox_y * in_minfo.dim[0] + vox_x] - below[vox_y * in_minfo.dim[0] + vox_x]) / (zp - zm) * in_minfo.dim[2];
+                    }
+                    length = sqrtf(g[0] * g[0] + g[1] * g[1] + g[2] * g[2]);
+
+                    // normals point from the dense side towards empty space
+                    for (int j = 0; j < 3; j++) {
+                        vp[j] = weight > 0 && length > 0.0f ? -g[j] / length : 0.0f;
+                    }
+                    vp += 3;
                 }
-                
+
+                if (x->color) {
+                    float cip[VERTEXARRAY_COLOR_PLANES];
+
+                    for (long j = 0; j < color_planes; j++) {
+                        cip[j] = voxel_grid_read(ip + (j + 1) * value_size, format);
+                    }
+
+                    switch (color_planes) {
+                        case 1:
+                            vp[0] = vp[1] = vp[2] = cip[0];
+                            vp[3] = 1.0f;
+                            break;
+                        case 3:
+                            vp[0] = cip[0];
+                            vp[1] = cip[1];
+                            vp[2] = cip[2];
+                            vp[3] = 1.0f;
+                            break;
+                        case 4:
+                            vp[0] = cip[0];
+                            vp[1] = cip[1];
+                            vp[2] = cip[2];
+                            vp[3] = cip[3];
+                            break;
+                        default:
+                            // no colour planes, or two which have no obvious meaning
+                            vp[0] = vp[1] = vp[2] = vp[3] = 1.0f;
+                            break;
+                    }
+                }
+
                 index += p_count;
             }
         }
     }
+
+    voxel_cache_store(&x->cache, key, err);
 out:
+    voxel_arena_release(&x->arena);
     jit_object_method(in_matrix, _jit_sym_lock, in_savelock);
     jit_object_method(out_matrix, _jit_sym_lock, out_savelock);
     return err;
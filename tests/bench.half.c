@@ -0,0 +1,43 @@
+// Throughput of one grid reading object on the same grid stored as float32 and as
+// half: ms per frame, voxels per second and the input bandwidth that amounts to.
+// CMake builds one bench.half.<object> per object with VOXEL_BENCH_SOURCE and
+// VOXEL_BENCH_<OBJECT> set; ctest does not run them, the numbers only mean
+// something on a quiet machine:
+//
+//   ./bench.half.gaussian [size]
+#include "voxel.bench.h"
+
+int main(int argc, char **argv) {
+    long size = argc > 1 ? MAX(atol(argv[1]), 1) : 128;
+    long dim[3] = { size, size, size };
+    double ms[2];
+
+    bench_init();
+    test_seed(39);
+    printf("%s %ld^3, one thread\n", BENCH_NAME, size);
+
+    for (long format = VOXEL_GRID_FLOAT32; format <= VOXEL_GRID_HALF; format++) {
+        t_stub_matrix *in = test_grid_new(format, 1, 3, dim, 0);
+        t_stub_matrix *out = BENCH_OUTPUT(format, dim);
+        t_stub_list inputs = stub_list(1, in), outputs = stub_list(1, out);
+        t_bench *x = bench_new();
+        t_test_timing run = { (t_test_calc)bench_calc, x, &inputs, out ? &outputs : NULL };
+        double bytes = (double)size * size * size * (format == VOXEL_GRID_HALF ? 2 : 4);
+
+        BENCH_THREADS(x, 1, 0);
+        x->precision = format == VOXEL_GRID_HALF ? ps_half : _jit_sym_float32;
+        test_grid_fill(in, format, 0.5f, 0.0f, 1.0f);
+        ms[format] = test_time(test_timing_run, &run, 5);
+        printf("  %-8s %8.2f ms  %8.1f Mvoxel/s  %6.2f GB/s read\n", format == VOXEL_GRID_HALF ? "half" : "float32",
+               ms[format], (double)size * size * size / (ms[format] * 1e3), bytes / (ms[format] * 1e6));
+
+        bench_free(x);
+        free(x);
+        stub_matrix_free(in);
+        if (out) {
+            stub_matrix_free(out);
+        }
+    }
+    printf("  half takes %.2fx the time of float32\n", ms[VOXEL_GRID_HALF] / ms[VOXEL_GRID_FLOAT32]);
+    return 0;
+}
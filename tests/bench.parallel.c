@@ -0,0 +1,50 @@
+// Scaling of one threaded object over 1, 2, 4, 8, 16 and 32 threads, unpinned and
+// pinned: ms per frame and the speedup over one thread. CMake builds one
+// bench.parallel.<object> per threaded object; ctest does not run them, the numbers
+// only mean something on a quiet machine with the cores to spare:
+//
+//   ./bench.parallel.gaussian [size]
+#include "voxel.bench.h"
+
+#define BENCH_SWEEP 6
+
+int main(int argc, char **argv) {
+    long size = argc > 1 ? MAX(atol(argv[1]), 1) : 128;
+    long dim[3] = { size, size, size };
+    t_stub_matrix *in = test_grid_new(VOXEL_GRID_FLOAT32, 1, 3, dim, 0);
+    t_stub_matrix *out = BENCH_OUTPUT(VOXEL_GRID_FLOAT32, dim);
+    t_stub_list inputs = stub_list(1, in), outputs = stub_list(1, out);
+    double serial = 0.0;
+
+    bench_init();
+    test_seed(36);
+    test_grid_fill(in, VOXEL_GRID_FLOAT32, 0.5f, 0.0f, 1.0f);
+    printf("%s %ld^3, %ld cpus\n", BENCH_NAME, size, voxel_parallel_cpus());
+
+    for (long pin = 0; pin < 2; pin++) {
+        for (long k = 0; k < BENCH_SWEEP; k++) {
+            long threads = 1L << k;
+            t_bench *x = bench_new();
+            t_test_timing run = { (t_test_calc)bench_calc, x, &inputs, out ? &outputs : NULL };
+            double ms;
+
+            BENCH_THREADS(x, threads, pin);
+            // the first frame starts the pool and fills the arena
+            test_timing_run(&run);
+            ms = test_time(test_timing_run, &run, 5);
+            if (!pin && threads == 1) {
+                serial = ms;
+            }
+            printf("  %-8s %2ld threads %8.2f ms  %5.2fx\n", pin ? "pinned" : "unpinned", threads, ms, serial / ms);
+
+            bench_free(x);
+            free(x);
+        }
+    }
+
+    stub_matrix_free(in);
+    if (out) {
+        stub_matrix_free(out);
+    }
+    return 0;
+}
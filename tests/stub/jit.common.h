@@ -0,0 +1,88 @@
+#ifndef JIT_COMMON_STUB_H
+#define JIT_COMMON_STUB_H
+
+// Headless stand-in for the Jitter headers: just the types, constants and calls the
+// kernels use, so each jit class builds and runs without Max. Matrices and lists are
+// the fakes in jit.stub.h
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+typedef long t_jit_err;
+typedef long t_atom_long;
+typedef int t_int32;
+typedef void *(*method)(void *, ...);
+
+typedef struct _symbol { char *s_name; } t_symbol;
+typedef struct _atom { long a_type; union { long w_long; float w_float; t_symbol *w_sym; } a_w; } t_atom;
+typedef struct _object { void *o_messlist; } t_object;
+typedef t_object t_jit_object;
+typedef t_object t_class;
+
+typedef struct _jit_matrix_info {
+    long size;
+    t_symbol *type;
+    long flags;
+    long dimcount;
+    long dim[32];
+    long dimstride[32];
+    long planecount;
+} t_jit_matrix_info;
+
+enum { A_NOTHING, A_LONG, A_FLOAT, A_SYM, A_OBJ, A_DEFLONG, A_DEFFLOAT, A_DEFSYM, A_GIMME, A_CANT };
+enum {
+    JIT_ERR_NONE = 0, JIT_ERR_GENERIC, JIT_ERR_INVALID_INPUT, JIT_ERR_INVALID_OUTPUT, JIT_ERR_OUT_OF_MEM,
+    JIT_ERR_MISMATCH_TYPE, JIT_ERR_MISMATCH_PLANE, JIT_ERR_MISMATCH_DIM
+};
+
+#define JIT_ATTR_GET_DEFER_LOW 1
+#define JIT_ATTR_SET_USURP_LOW 2
+#define JIT_ATTR_SET_OPAQUE_USER 4
+
+#define MAX(a, b) ((a) > (b) ? (a) : (b))
+#define MIN(a, b) ((a) < (b) ? (a) : (b))
+#define CLAMP(a, lo, hi) ((a) < (lo) ? (lo) : ((a) > (hi) ? (hi) : (a)))
+#define BEGIN_USING_C_LINKAGE
+#define END_USING_C_LINKAGE
+#define calcoffset(x, y) ((long)(&(((x *)0L)->y)))
+
+#define CLASS_ATTR_LABEL(c, a, f, l)
+#define CLASS_ATTR_STYLE(c, a, f, l)
+#define CLASS_ATTR_ENUM(c, a, f, l)
+#define CLASS_ATTR_FILTER_MIN(c, a, v)
+#define CLASS_ATTR_FILTER_CLIP(c, a, lo, hi)
+
+extern t_symbol *_jit_sym_adapt, *_jit_sym_char, *_jit_sym_float32, *_jit_sym_float64, *_jit_sym_getdata,
+    *_jit_sym_getindex, *_jit_sym_getinfo, *_jit_sym_getsize, *_jit_sym_jit_attr_offset, *_jit_sym_jit_attr_offset_array,
+    *_jit_sym_jit_mop, *_jit_sym_lock, *_jit_sym_long, *_jit_sym_nothing, *_jit_sym_setinfo, *_jit_sym_symbol;
+
+t_symbol *gensym(const char *s);
+double systimer_gettime(void);
+
+void *jit_class_new(const char *name, method mnew, method mfree, long size, ...);
+t_jit_err jit_class_addmethod(void *c, method m, const char *name, ...);
+t_jit_err jit_class_addattr(void *c, void *attr);
+t_jit_err jit_class_addadornment(void *c, void *o);
+t_jit_err jit_class_register(void *c);
+void *jit_object_alloc(void *c);
+void *jit_object_new(t_symbol *s, ...);
+void *jit_object_method(void *x, t_symbol *s, ...);
+void *jit_object_register(void *x, t_symbol *s);
+void *jit_object_findregistered(t_symbol *s);
+t_jit_err jit_object_unregister(void *x);
+void jit_object_error(t_object *x, const char *s, ...);
+t_jit_err jit_mop_single_type(void *x, t_symbol *s);
+t_jit_err jit_mop_single_planecount(void *x, long c);
+t_jit_err jit_mop_output_nolink(void *x, long index);
+t_jit_err jit_mop_input_nolink(void *x, long index);
+t_jit_err jit_attr_setlong(void *x, t_symbol *s, long c);
+
+long atom_getlong(const t_atom *a);
+double atom_getfloat(const t_atom *a);
+t_symbol *atom_getsym(const t_atom *a);
+t_jit_err atom_setlong(t_atom *a, long v);
+t_jit_err atom_setfloat(t_atom *a, double v);
+t_jit_err atom_setsym(t_atom *a, t_symbol *s);
+
+#endif
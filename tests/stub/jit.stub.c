@@ -0,0 +1,259 @@
+#include "jit.stub.h"
+#include <stdarg.h>
+#include <time.h>
+
+#define STUB_MATRIX 0x4d415452u
+#define STUB_LIST 0x4c495354u
+
+#define STUB_SYMBOLS(X) X(adapt) X(char) X(float32) X(float64) X(getdata) X(getindex) X(getinfo) X(getsize) \
+    X(jit_attr_offset) X(jit_attr_offset_array) X(jit_mop) X(lock) X(long) X(nothing) X(setinfo) X(symbol)
+#define STUB_DEFINE(name) static t_symbol stub_sym_##name = { #name }; t_symbol *_jit_sym_##name = &stub_sym_##name;
+STUB_SYMBOLS(STUB_DEFINE)
+
+long stub_errors = 0;
+
+t_symbol *gensym(const char *s) {
+    static t_symbol table[256];
+    static long count = 0;
+
+#define STUB_LOOKUP(name) if (!strcmp(s, #name)) return _jit_sym_##name;
+    STUB_SYMBOLS(STUB_LOOKUP)
+    for (long i = 0; i < count; i++) {
+        if (!strcmp(table[i].s_name, s)) {
+            return &table[i];
+        }
+    }
+    if (count == 256) {
+        abort();
+    }
+    table[count].s_name = strdup(s);
+    return &table[count++];
+}
+
+double systimer_gettime(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1e6;
+}
+
+#define STUB_METHODS 32
+#define STUB_REGISTRY 16
+
+// a class remembers the size of its instances and its methods by name, so
+// jit_object_method can reach an A_CANT method such as spatialindex
+typedef struct _stub_class {
+    long size;
+    long count;
+    t_symbol *names[STUB_METHODS];
+    method methods[STUB_METHODS];
+} t_stub_class;
+
+// objects registered by name, as jit_object_register does in Max
+static struct {
+    t_symbol *name;
+    void *x;
+} stub_registry[STUB_REGISTRY];
+
+void *jit_class_new(const char *name, method mnew, method mfree, long size, ...) {
+    t_stub_class *c = (t_stub_class *)calloc(1, sizeof(t_stub_class));
+
+    c->size = size;
+    return c;
+}
+
+t_jit_err jit_class_addmethod(void *c, method m, const char *name, ...) {
+    t_stub_class *sc = (t_stub_class *)c;
+
+    if (sc->count == STUB_METHODS) {
+        abort();
+    }
+    sc->names[sc->count] = gensym(name);
+    sc->methods[sc->count++] = m;
+    return JIT_ERR_NONE;
+}
+
+t_jit_err jit_class_addattr(void *c, void *attr) { return JIT_ERR_NONE; }
+t_jit_err jit_class_addadornment(void *c, void *o) { return JIT_ERR_NONE; }
+t_jit_err jit_class_register(void *c) { return JIT_ERR_NONE; }
+
+// the class stands in for the message list, as it does in Max
+void *jit_object_alloc(void *c) {
+    t_object *x = (t_object *)calloc(1, ((t_stub_class *)c)->size);
+
+    if (x) {
+        x->o_messlist = c;
+    }
+    return x;
+}
+
+void *jit_object_new(t_symbol *s, ...) {
+    static long object;
+    return &object;
+}
+
+void *jit_object_register(void *x, t_symbol *s) {
+    for (long i = 0; i < STUB_REGISTRY; i++) {
+        if (!stub_registry[i].x) {
+            stub_registry[i].name = s;
+            stub_registry[i].x = x;
+            return x;
+        }
+    }
+    abort();
+}
+
+void *jit_object_findregistered(t_symbol *s) {
+    for (long i = 0; i < STUB_REGISTRY; i++) {
+        if (stub_registry[i].x && stub_registry[i].name == s) {
+            return stub_registry[i].x;
+        }
+    }
+    return NULL;
+}
+
+t_jit_err jit_object_unregister(void *x) {
+    for (long i = 0; i < STUB_REGISTRY; i++) {
+        if (stub_registry[i].x == x) {
+            stub_registry[i].x = NULL;
+        }
+    }
+    return JIT_ERR_NONE;
+}
+
+void jit_object_error(t_object *x, const char *s, ...) {
+    va_list args;
+
+    va_start(args, s);
+    fprintf(stderr, "jit_object_error: ");
+    vfprintf(stderr, s, args);
+    fprintf(stderr, "\n");
+    va_end(args);
+    stub_errors++;
+}
+
+t_jit_err jit_mop_single_type(void *x, t_symbol *s) { return JIT_ERR_NONE; }
+t_jit_err jit_mop_single_planecount(void *x, long c) { return JIT_ERR_NONE; }
+t_jit_err jit_mop_output_nolink(void *x, long index) { return JIT_ERR_NONE; }
+t_jit_err jit_mop_input_nolink(void *x, long index) { return JIT_ERR_NONE; }
+t_jit_err jit_attr_setlong(void *x, t_symbol *s, long c) { return JIT_ERR_NONE; }
+
+long atom_getlong(const t_atom *a) { return a->a_type == A_FLOAT ? (long)a->a_w.w_float : a->a_w.w_long; }
+double atom_getfloat(const t_atom *a) { return a->a_type == A_LONG ? a->a_w.w_long : a->a_w.w_float; }
+t_symbol *atom_getsym(const t_atom *a) { return a->a_type == A_SYM ? a->a_w.w_sym : gensym(""); }
+
+t_jit_err atom_setlong(t_atom *a, long v) { a->a_type = A_LONG; a->a_w.w_long = v; return JIT_ERR_NONE; }
+t_jit_err atom_setfloat(t_atom *a, double v) { a->a_type = A_FLOAT; a->a_w.w_float = (float)v; return JIT_ERR_NONE; }
+t_jit_err atom_setsym(t_atom *a, t_symbol *s) { a->a_type = A_SYM; a->a_w.w_sym = s; return JIT_ERR_NONE; }
+
+static void stub_matrix_layout(t_stub_matrix *m) {
+    t_jit_matrix_info *info = &m->info;
+    long stride = (info->type == _jit_sym_char ? 1 : info->type == _jit_sym_float64 ? 8 : 4) * info->planecount;
+
+    for (long d = 0; d < info->dimcount; d++) {
+        info->dimstride[d] = stride;
+        stride *= info->dim[d] + (d < info->dimcount - 1 ? m->pad : 0);
+    }
+    info->size = stride;
+    free(m->data);
+    m->data = (char *)calloc(1, MAX(stride, 1));
+}
+
+t_stub_matrix *stub_matrix_new(t_symbol *type, long planecount, long dimcount, const long *dim, long pad) {
+    t_stub_matrix *m = (t_stub_matrix *)calloc(1, sizeof(t_stub_matrix));
+
+    m->magic = STUB_MATRIX;
+    m->info.type = type;
+    m->info.planecount = planecount;
+    m->info.dimcount = dimcount;
+    for (long d = 0; d < dimcount; d++) {
+        m->info.dim[d] = dim[d];
+    }
+    m->pad = pad;
+    stub_matrix_layout(m);
+    return m;
+}
+
+void stub_matrix_free(t_stub_matrix *m) {
+    free(m->data);
+    free(m);
+}
+
+char *stub_matrix_cell(t_stub_matrix *m, long x, long y, long z, long w) {
+    long *stride = m->info.dimstride;
+
+    return m->data + x * stride[0] + (m->info.dimcount > 1 ? y * stride[1] : 0) +
+           (m->info.dimcount > 2 ? z * stride[2] : 0) + (m->info.dimcount > 3 ? w * stride[3] : 0);
+}
+
+t_stub_list stub_list(long count, ...) {
+    t_stub_list list = { STUB_LIST, count };
+    va_list args;
+
+    va_start(args, count);
+    for (long i = 0; i < count && i < STUB_LIST_MAX; i++) {
+        list.matrix[i] = va_arg(args, t_stub_matrix *);
+    }
+    va_end(args);
+    return list;
+}
+
+// setinfo keeps the data when nothing changes and relays the matrix out packed otherwise
+static void stub_matrix_setinfo(t_stub_matrix *m, t_jit_matrix_info *info) {
+    int same = m->info.type == info->type && m->info.planecount == info->planecount &&
+               m->info.dimcount == info->dimcount;
+
+    for (long d = 0; same && d < info->dimcount; d++) {
+        same = m->info.dim[d] == info->dim[d];
+    }
+    if (same) {
+        return;
+    }
+    m->info.type = info->type;
+    m->info.planecount = info->planecount;
+    m->info.dimcount = info->dimcount;
+    for (long d = 0; d < info->dimcount; d++) {
+        m->info.dim[d] = info->dim[d];
+    }
+    m->pad = 0;
+    stub_matrix_layout(m);
+}
+
+void *jit_object_method(void *x, t_symbol *s, ...) {
+    va_list args;
+    void *result = NULL;
+
+    va_start(args, s);
+    if (x && *(unsigned *)x == STUB_LIST) {
+        t_stub_list *list = (t_stub_list *)x;
+
+        if (s == _jit_sym_getindex) {
+            long index = va_arg(args, long);
+            result = index >= 0 && index < list->count ? list->matrix[index] : NULL;
+        } else if (s == _jit_sym_getsize) {
+            result = (void *)list->count;
+        }
+    } else if (x && *(unsigned *)x == STUB_MATRIX) {
+        t_stub_matrix *m = (t_stub_matrix *)x;
+
+        if (s == _jit_sym_getinfo) {
+            *va_arg(args, t_jit_matrix_info *) = m->info;
+        } else if (s == _jit_sym_getdata) {
+            *va_arg(args, void **) = m->data;
+        } else if (s == _jit_sym_setinfo) {
+            stub_matrix_setinfo(m, va_arg(args, t_jit_matrix_info *));
+        }
+    } else if (x && ((t_object *)x)->o_messlist) {
+        // methods of a class object take no arguments here; none of the tests send any
+        t_stub_class *c = (t_stub_class *)((t_object *)x)->o_messlist;
+
+        for (long i = 0; i < c->count; i++) {
+            if (c->names[i] == s) {
+                result = c->methods[i](x);
+                break;
+            }
+        }
+    }
+    va_end(args);
+    return result;
+}
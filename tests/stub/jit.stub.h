@@ -0,0 +1,32 @@
+#ifndef JIT_STUB_H
+#define JIT_STUB_H
+
+#include "jit.common.h"
+
+// Matrices and matrix lists answering the messages the kernels send: getinfo,
+// getdata, setinfo and lock on a matrix, getindex and getsize on a list. pad adds
+// unused elements to the end of every row and slice so the dimstrides are not packed
+typedef struct _stub_matrix {
+    unsigned magic;
+    t_jit_matrix_info info;
+    long pad;
+    char *data;
+} t_stub_matrix;
+
+#define STUB_LIST_MAX 16
+
+typedef struct _stub_list {
+    unsigned magic;
+    long count;
+    t_stub_matrix *matrix[STUB_LIST_MAX];
+} t_stub_list;
+
+t_stub_matrix *stub_matrix_new(t_symbol *type, long planecount, long dimcount, const long *dim, long pad);
+void stub_matrix_free(t_stub_matrix *m);
+char *stub_matrix_cell(t_stub_matrix *m, long x, long y, long z, long w);
+t_stub_list stub_list(long count, ...);
+
+// errors posted through jit_object_error since the last reset
+extern long stub_errors;
+
+#endif
@@ -0,0 +1,166 @@
+#include "voxel.blob.c"
+#include "voxel.test.h"
+
+// the output keeps axes and extents rather than the covariance, so it is rebuilt as
+// the sum of lambda * axis * axis^T with lambda = extent^2 / 3 and compared against
+// the reference relative to its trace
+static float blob_error(float *blob, float *r) {
+    float cov[6] = { 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f };
+    float trace = r[5] + r[8] + r[10];
+    float error = 0.0f;
+
+    for (int k = 0; k < 3; k++) {
+        float lambda = blob[14 + k] * blob[14 + k] / 3.0f;
+        float *axis = blob + 5 + k * 3;
+
+        cov[0] += lambda * axis[0] * axis[0];
+        cov[1] += lambda * axis[0] * axis[1];
+        cov[2] += lambda * axis[0] * axis[2];
+        cov[3] += lambda * axis[1] * axis[1];
+        cov[4] += lambda * axis[1] * axis[2];
+        cov[5] += lambda * axis[2] * axis[2];
+    }
+    error = MAX(error, fabsf(blob[0] - r[0]));
+    error = MAX(error, fabsf(blob[1] - r[1]) / MAX(1.0f, fabsf(r[1])));
+    for (int a = 0; a < 3; a++) {
+        error = MAX(error, fabsf(blob[2 + a] - r[2 + a]));
+    }
+    for (int c = 0; c < 6; c++) {
+        error = MAX(error, fabsf(cov[c] - r[5 + c]) / MAX(trace, 1e-6f));
+    }
+    return error;
+}
+
+int main(void) {
+    t_symbol *connectivities[3];
+
+    blob_init();
+    connectivities[0] = ps_face;
+    connectivities[1] = ps_edge;
+    connectivities[2] = ps_vertex;
+    test_seed(45);
+
+    for (int c = 0; c < 64; c++) {
+        long dim[3], stride[3], voxels, components, kept = 0, emitted;
+        long format = test_random() < 0.3f ? VOXEL_GRID_HALF : VOXEL_GRID_FLOAT32;
+        long connectivity = test_random_range(1, 3);
+        long *labels, *queue;
+        float *packed, *ref, error = 0.0f;
+        t_blob_order *order;
+        t_stub_matrix *in, *out;
+        t_stub_list inputs, outputs;
+        t_blob *x = blob_new();
+        t_jit_err err;
+
+        test_random_dim(dim, 32);
+        x->connectivity = connectivities[connectivity - 1];
+        x->minsize = test_random_range(1, 4);
+        x->maxblobs = test_random_range(1, 80);
+        x->num_threads = test_random_range(1, 4);
+        x->precision = format == VOXEL_GRID_HALF ? ps_half : _jit_sym_float32;
+
+        in = test_grid_new(format, 1, 3, dim, test_random_range(0, 3));
+        out = stub_matrix_new(_jit_sym_float32, BLOB_PLANES, 1, dim, 0);
+        test_grid_fill(in, format, test_random() < 0.5f ? 0.5f : 0.8f, 0.1f, 1.0f);
+        inputs = stub_list(1, in);
+        outputs = stub_list(1, out);
+
+        err = blob_matrix_calc(x, &inputs, &outputs);
+        TEST_EXPECT(err == JIT_ERR_NONE, "case %d: calc returned %ld", c, err);
+
+        voxels = dim[0] * dim[1] * dim[2];
+        labels = (long *)malloc(voxels * sizeof(long));
+        queue = (long *)malloc(voxels * sizeof(long));
+        ref = (float *)malloc(voxels * VOXEL_REFERENCE_BLOB * sizeof(float));
+        order = (t_blob_order *)malloc(voxels * sizeof(t_blob_order));
+        packed = test_grid_expand(in, format, 0, stride);
+        components = voxel_reference_blobs((char *)packed, dim, stride, connectivity, labels, queue, ref, voxels);
+
+        // largest first, ties in scan order, as the object sorts them
+        for (long i = 0; i < components; i++) {
+            if (ref[i * VOXEL_REFERENCE_BLOB] >= x->minsize) {
+                order[kept].count = (long)ref[i * VOXEL_REFERENCE_BLOB];
+                order[kept].first = i;
+                order[kept].index = i;
+                kept++;
+            }
+        }
+        qsort(order, kept, sizeof(t_blob_order), blob_compare);
+        emitted = MIN(kept, x->maxblobs);
+        TEST_EXPECT(x->blobs == kept, "case %d: %ld blobs, expected %ld", c, x->blobs, kept);
+        TEST_EXPECT(out->info.dim[0] == MAX(emitted, 1), "case %d: %ld cells out, expected %ld",
+                    c, out->info.dim[0], MAX(emitted, 1));
+
+        for (long i = 0; i < MIN(emitted, out->info.dim[0]); i++) {
+            error = MAX(error, blob_error((float *)stub_matrix_cell(out, i, 0, 0, 0), ref + order[i].index * VOXEL_REFERENCE_BLOB));
+        }
+        TEST_EXPECT(error <= 1e-3f, "case %d: %ldx%ldx%ld connectivity %ld differs by %g",
+                    c, dim[0], dim[1], dim[2], connectivity, error);
+
+        free(labels);
+        free(queue);
+        free(ref);
+        free(order);
+        free(packed);
+        blob_free(x);
+        free(x);
+        stub_matrix_free(in);
+        stub_matrix_free(out);
+    }
+
+    {
+        t_blob *x = blob_new();
+
+        test_precision_gate("blob", (t_test_calc)blob_matrix_calc, x, &x->precision, 1);
+        blob_free(x);
+        free(x);
+    }
+
+    // the slab buffers come from the per thread arenas and count in allocations, and a
+    // repeated frame borrows them all back without touching the heap
+    {
+        long dim[3] = { 40, 36, 30 }, blobs, allocations;
+        t_stub_matrix *in = test_grid_new(VOXEL_GRID_FLOAT32, 1, 3, dim, 0);
+        t_stub_matrix *out = stub_matrix_new(_jit_sym_float32, BLOB_PLANES, 1, dim, 0);
+        t_stub_list inputs = stub_list(1, in), outputs = stub_list(1, out);
+        t_blob *x = blob_new();
+
+        x->num_threads = 3;
+        test_grid_fill(in, VOXEL_GRID_FLOAT32, 0.6f, 0.1f, 1.0f);
+        TEST_EXPECT(blob_matrix_calc(x, &inputs, &outputs) == JIT_ERR_NONE, "first frame refused");
+        blobs = x->blobs;
+        allocations = x->allocations;
+        TEST_EXPECT(allocations > x->arena.allocations, "slab buffers not counted: %ld allocations, %ld for the merge",
+                    allocations, x->arena.allocations);
+        for (int frame = 0; frame < 4; frame++) {
+            TEST_EXPECT(blob_matrix_calc(x, &inputs, &outputs) == JIT_ERR_NONE, "frame %d refused", frame);
+            TEST_EXPECT(x->blobs == blobs, "frame %d: %ld blobs, first frame found %ld", frame, x->blobs, blobs);
+            TEST_EXPECT(x->allocations == allocations, "frame %d: %ld allocations, first frame made %ld",
+                        frame, x->allocations, allocations);
+        }
+
+        blob_free(x);
+        free(x);
+        stub_matrix_free(in);
+        stub_matrix_free(out);
+    }
+
+    {
+        long dim[3] = { 128, 128, 128 };
+        t_stub_matrix *in = test_grid_new(VOXEL_GRID_FLOAT32, 1, 3, dim, 0);
+        t_stub_matrix *out = stub_matrix_new(_jit_sym_float32, BLOB_PLANES, 1, dim, 0);
+        t_stub_list inputs = stub_list(1, in), outputs = stub_list(1, out);
+        t_blob *x = blob_new();
+        t_test_timing timing = { (t_test_calc)blob_matrix_calc, x, &inputs, &outputs };
+
+        x->num_threads = 1;
+        test_grid_fill(in, VOXEL_GRID_FLOAT32, 0.7f, 0.1f, 1.0f);
+        test_budget("blob 128^3 face connectivity, one thread", test_time(test_timing_run, &timing, 5), 55.0);
+
+        blob_free(x);
+        free(x);
+        stub_matrix_free(in);
+        stub_matrix_free(out);
+    }
+    return test_finish("blob");
+}
@@ -0,0 +1,89 @@
+#include "jit.voxel.centroid.c"
+#include "voxel.test.h"
+
+int main(void) {
+    centroid_init();
+    test_seed(29);
+
+    for (int c = 0; c < 64; c++) {
+        long dim[4], stride[3];
+        long format = test_random() < 0.3f ? VOXEL_GRID_HALF : VOXEL_GRID_FLOAT32;
+        float mean[3], error = 0.0f;
+        t_stub_matrix *in;
+        t_stub_list inputs;
+        t_centroid *x = centroid_new();
+        t_jit_err err;
+
+        test_random_dim(dim, 33);
+        dim[3] = test_random_range(1, 4);
+        x->num_threads = test_random_range(1, 5);
+        x->precision = format == VOXEL_GRID_HALF ? ps_half : _jit_sym_float32;
+        in = test_grid_new(format, 1, dim[3] > 1 ? 4 : 3, dim, test_random_range(0, 3));
+        test_grid_fill(in, format, test_random(), 0.0f, 3.0f);
+        inputs = stub_list(1, in);
+
+        err = centroid_matrix_calc(x, &inputs, NULL);
+        TEST_EXPECT(err == JIT_ERR_NONE, "case %d: calc returned %ld", c, err);
+        TEST_EXPECT(x->means_count == dim[3] * 3, "case %d: %ld means for %ld grids", c, x->means_count, dim[3]);
+
+        for (long w = 0; w < dim[3]; w++) {
+            float *packed = test_grid_expand(in, format, w, stride);
+
+            voxel_reference_centroid((char *)packed, dim, stride, mean);
+            for (int j = 0; j < 3; j++) {
+                error = MAX(error, fabsf(x->means[w * 3 + j] - mean[j]));
+            }
+            free(packed);
+        }
+        TEST_EXPECT(error <= VOXEL_REFERENCE_TOLERANCE, "case %d: %ldx%ldx%ldx%ld differs by %g",
+                    c, dim[0], dim[1], dim[2], dim[3], error);
+
+        centroid_free(x);
+        free(x);
+        stub_matrix_free(in);
+    }
+
+    // a batch past CENTROID_MAX_GRIDS is refused rather than cut short
+    {
+        long full[4] = { 3, 3, 2, CENTROID_MAX_GRIDS }, over[4] = { 3, 3, 2, CENTROID_MAX_GRIDS + 1 };
+        t_stub_matrix *fits = test_grid_new(VOXEL_GRID_FLOAT32, 1, 4, full, 0);
+        t_stub_matrix *large = test_grid_new(VOXEL_GRID_FLOAT32, 1, 4, over, 0);
+        t_stub_list inputs = stub_list(1, fits);
+        t_centroid *x = centroid_new();
+
+        TEST_EXPECT(centroid_matrix_calc(x, &inputs, NULL) == JIT_ERR_NONE && x->means_count == CENTROID_MAX_GRIDS * 3,
+                    "batch of %d refused", CENTROID_MAX_GRIDS);
+        inputs = stub_list(1, large);
+        TEST_EXPECT(centroid_matrix_calc(x, &inputs, NULL) == JIT_ERR_MISMATCH_DIM, "batch of %d accepted", CENTROID_MAX_GRIDS + 1);
+
+        centroid_free(x);
+        free(x);
+        stub_matrix_free(fits);
+        stub_matrix_free(large);
+    }
+
+    {
+        t_centroid *x = centroid_new();
+
+        test_precision_gate("centroid", (t_test_calc)centroid_matrix_calc, x, &x->precision, 0);
+        centroid_free(x);
+        free(x);
+    }
+
+    {
+        long dim[3] = { 128, 128, 128 };
+        t_stub_matrix *in = test_grid_new(VOXEL_GRID_FLOAT32, 1, 3, dim, 0);
+        t_stub_list inputs = stub_list(1, in);
+        t_centroid *x = centroid_new();
+        t_test_timing timing = { (t_test_calc)centroid_matrix_calc, x, &inputs, NULL };
+
+        x->num_threads = 1;
+        test_grid_fill(in, VOXEL_GRID_FLOAT32, 0.5f, 0.0f, 1.0f);
+        test_budget("centroid 128^3, one thread", test_time(test_timing_run, &timing, 5), 26.0);
+
+        centroid_free(x);
+        free(x);
+        stub_matrix_free(in);
+    }
+    return test_finish("centroid");
+}
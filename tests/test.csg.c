@@ -0,0 +1,146 @@
+#include "jit.voxel.csg.c"
+#include "voxel.test.h"
+
+int main(void) {
+    t_symbol *names[4];
+
+    csg_init();
+    names[CSG_UNION] = ps_union;
+    names[CSG_INTERSECT] = ps_intersect;
+    names[CSG_SUBTRACT] = ps_subtract;
+    names[CSG_XOR] = ps_xor;
+    test_seed(41);
+
+    for (int c = 0; c < 64; c++) {
+        long dim[3], count = test_random_range(1, 5), ops[CSG_MAX_INPUTS - 1], format[CSG_MAX_INPUTS];
+        long packed_stride[CSG_MAX_INPUTS][3], *stride[CSG_MAX_INPUTS];
+        char *bp[CSG_MAX_INPUTS];
+        float *packed[CSG_MAX_INPUTS];
+        t_stub_matrix *in[CSG_MAX_INPUTS], *out;
+        t_stub_list inputs = stub_list(0), outputs;
+        t_atom av[CSG_MAX_INPUTS - 1];
+        t_csg *x = csg_new();
+        long out_format, planes, occupied[CSG_MAX_INPUTS] = { 0 };
+        float error = 0.0f;
+        t_jit_err err;
+
+        test_random_dim(dim, 20);
+        dim[0] = test_random_range(1, 150);
+        x->threshold = test_random() * 0.5f;
+        x->count = 1;
+        x->num_threads = test_random_range(1, 4);
+        for (long i = 0; i < count - 1; i++) {
+            ops[i] = test_random_range(0, 3);
+            atom_setsym(av + i, names[ops[i]]);
+        }
+        csg_ops_set(x, NULL, count - 1, av);
+
+        inputs.count = count;
+        for (long i = 0; i < count; i++) {
+            format[i] = test_random() < 0.3f ? VOXEL_GRID_HALF : VOXEL_GRID_FLOAT32;
+            if (format[i] == VOXEL_GRID_HALF) {
+                x->precision = ps_half;
+            }
+            in[i] = test_grid_new(format[i], test_random_range(1, 2), 3, dim, test_random_range(0, 3));
+            test_grid_fill(in[i], format[i], 0.2f, 0.0f, 1.0f);
+            inputs.matrix[i] = in[i];
+            packed[i] = test_grid_expand(in[i], format[i], 0, packed_stride[i]);
+            bp[i] = (char *)packed[i];
+            stride[i] = packed_stride[i];
+        }
+        out = stub_matrix_new(_jit_sym_float32, 1, 3, dim, 0);
+        outputs = stub_list(1, out);
+
+        err = csg_matrix_calc(x, &inputs, &outputs);
+        TEST_EXPECT(err == JIT_ERR_NONE, "case %d: calc returned %ld", c, err);
+        out_format = voxel_grid_format(&out->info, x->precision == ps_half, &planes);
+
+        for (long z = 0; z < dim[2]; z++) {
+            for (long y = 0; y < dim[1]; y++) {
+                for (long v = 0; v < dim[0]; v++) {
+                    float ref = voxel_reference_csg(bp, stride, count, ops, x->threshold, v, y, z);
+
+                    error = MAX(error, fabsf(test_grid_read(out, out_format, v, y, z, 0) - ref));
+                    for (long i = 1; i < count; i++) {
+                        occupied[i] += voxel_reference_csg(bp, stride, i + 1, ops, x->threshold, v, y, z) > 0.0f;
+                    }
+                }
+            }
+        }
+        TEST_EXPECT(error <= VOXEL_REFERENCE_TOLERANCE, "case %d: %ld inputs %ldx%ldx%ld differs by %g",
+                    c, count, dim[0], dim[1], dim[2], error);
+        TEST_EXPECT(x->counts_count == count - 1, "case %d: %ld counts for %ld ops", c, x->counts_count, count - 1);
+        for (long i = 1; i < count && i - 1 < x->counts_count; i++) {
+            TEST_EXPECT(x->counts[i - 1] == occupied[i], "case %d: %ld occupied after op %ld, expected %ld",
+                        c, x->counts[i - 1], i - 1, occupied[i]);
+        }
+
+        csg_free(x);
+        free(x);
+        for (long i = 0; i < count; i++) {
+            stub_matrix_free(in[i]);
+            free(packed[i]);
+        }
+        stub_matrix_free(out);
+    }
+
+    // a list with an unknown op, or too many, is refused and the previous ops stay
+    {
+        t_atom av[CSG_MAX_INPUTS];
+        t_csg *x = csg_new();
+
+        atom_setsym(av, ps_subtract);
+        atom_setsym(av + 1, ps_xor);
+        TEST_EXPECT(csg_ops_set(x, NULL, 2, av) == JIT_ERR_NONE, "valid ops refused");
+        atom_setsym(av, ps_union);
+        atom_setsym(av + 1, gensym("onion"));
+        atom_setsym(av + 2, ps_intersect);
+        TEST_EXPECT(csg_ops_set(x, NULL, 3, av) != JIT_ERR_NONE, "unknown op accepted");
+        for (int i = 0; i < CSG_MAX_INPUTS; i++) {
+            atom_setsym(av + i, ps_union);
+        }
+        TEST_EXPECT(csg_ops_set(x, NULL, CSG_MAX_INPUTS, av) != JIT_ERR_NONE, "%d ops accepted", CSG_MAX_INPUTS);
+        TEST_EXPECT(x->ops_count == 2 && x->ops[0] == ps_subtract && x->ops[1] == ps_xor,
+                    "refused lists changed the ops to %ld entries", x->ops_count);
+
+        csg_free(x);
+        free(x);
+    }
+
+    {
+        t_csg *x = csg_new();
+
+        test_precision_gate("csg", (t_test_calc)csg_matrix_calc, x, &x->precision, 1);
+        csg_free(x);
+        free(x);
+    }
+
+    {
+        long dim[3] = { 128, 128, 128 };
+        t_stub_matrix *a = test_grid_new(VOXEL_GRID_FLOAT32, 1, 3, dim, 0);
+        t_stub_matrix *b = test_grid_new(VOXEL_GRID_FLOAT32, 1, 3, dim, 0);
+        t_stub_matrix *c = test_grid_new(VOXEL_GRID_FLOAT32, 1, 3, dim, 0);
+        t_stub_matrix *out = stub_matrix_new(_jit_sym_float32, 1, 3, dim, 0);
+        t_stub_list inputs = stub_list(3, a, b, c), outputs = stub_list(1, out);
+        t_csg *x = csg_new();
+        t_test_timing timing = { (t_test_calc)csg_matrix_calc, x, &inputs, &outputs };
+        t_atom av[2];
+
+        atom_setsym(av, ps_subtract);
+        atom_setsym(av + 1, ps_xor);
+        csg_ops_set(x, NULL, 2, av);
+        x->num_threads = 1;
+        test_grid_fill(a, VOXEL_GRID_FLOAT32, 0.5f, 0.0f, 1.0f);
+        test_grid_fill(b, VOXEL_GRID_FLOAT32, 0.5f, 0.0f, 1.0f);
+        test_grid_fill(c, VOXEL_GRID_FLOAT32, 0.5f, 0.0f, 1.0f);
+        test_budget("csg three 128^3 grids, one thread", test_time(test_timing_run, &timing, 5), 9.0);
+
+        csg_free(x);
+        free(x);
+        stub_matrix_free(a);
+        stub_matrix_free(b);
+        stub_matrix_free(c);
+        stub_matrix_free(out);
+    }
+    return test_finish("csg");
+}
@@ -0,0 +1,229 @@
+#include "jit.voxel.flow.c"
+#include "voxel.test.h"
+
+// two frames, each matched against the other as it moves back and forth
+static void flow_timing_run(void *ctx) {
+    t_test_timing *t = (t_test_timing *)ctx;
+    test_timing_run(&t[0]);
+    test_timing_run(&t[1]);
+}
+
+// frame b is frame a moved by shift, with some voxels changed so the match is not exact
+static void flow_shifted(t_stub_matrix *a, t_stub_matrix *b, long format, const long *shift, float noise) {
+    long *dim = a->info.dim;
+
+    for (long z = 0; z < dim[2]; z++) {
+        for (long y = 0; y < dim[1]; y++) {
+            for (long x = 0; x < dim[0]; x++) {
+                long sx = x - shift[0], sy = y - shift[1], sz = z - shift[2];
+                float value = 0.0f;
+
+                if (sx >= 0 && sx < dim[0] && sy >= 0 && sy < dim[1] && sz >= 0 && sz < dim[2]) {
+                    value = test_grid_read(a, format, sx, sy, sz, 0);
+                }
+                if (test_random() < noise) {
+                    value = test_random();
+                }
+                voxel_grid_write(stub_matrix_cell(b, x, y, z, 0), format, value);
+            }
+        }
+    }
+}
+
+// smooth content moved by shift: random values on a lattice of cell voxels, zero with
+// probability 0.3, trilinearly interpolated
+static void flow_smooth(t_stub_matrix *m, const float *lattice, const long *n, long cell, const long *shift) {
+    long *dim = m->info.dim;
+
+    for (long z = 0; z < dim[2]; z++) {
+        for (long y = 0; y < dim[1]; y++) {
+            for (long x = 0; x < dim[0]; x++) {
+                long p[3] = { x - shift[0] + cell, y - shift[1] + cell, z - shift[2] + cell }, i0[3];
+                float t[3], value = 0.0f;
+
+                for (int a = 0; a < 3; a++) {
+                    i0[a] = p[a] / cell;
+                    t[a] = (float)(p[a] % cell) / cell;
+                }
+                for (int k = 0; k < 2; k++) {
+                    for (int j = 0; j < 2; j++) {
+                        for (int i = 0; i < 2; i++) {
+                            value += (i ? t[0] : 1.0f - t[0]) * (j ? t[1] : 1.0f - t[1]) * (k ? t[2] : 1.0f - t[2]) *
+                                     lattice[i0[0] + i + (i0[1] + j) * n[0] + (i0[2] + k) * n[0] * n[1]];
+                        }
+                    }
+                }
+                *(float *)stub_matrix_cell(m, x, y, z, 0) = value;
+            }
+        }
+    }
+}
+
+static t_flow *flow_pair(t_stub_matrix *first, t_stub_matrix *second, long cell, const long *shift) {
+    long *dim = first->info.dim, n[3], zero[3] = { 0, 0, 0 };
+    t_flow *x = flow_new();
+    float *lattice;
+
+    for (int a = 0; a < 3; a++) {
+        n[a] = (dim[a] + 2 * FLOW_MAX_SEARCH) / cell + 3;
+    }
+    lattice = (float *)malloc(n[0] * n[1] * n[2] * sizeof(float));
+    for (long i = 0; i < n[0] * n[1] * n[2]; i++) {
+        lattice[i] = test_random() < 0.3f ? 0.0f : test_random();
+    }
+    flow_smooth(first, lattice, n, cell, zero);
+    flow_smooth(second, lattice, n, cell, shift);
+    free(lattice);
+
+    x->num_threads = 1;
+    return x;
+}
+
+int main(void) {
+    flow_init();
+    test_seed(44);
+
+    for (int c = 0; c < 40; c++) {
+        long dim[3], bricks[3], prev_stride[3], cur_stride[3], shift[3];
+        long format = test_random() < 0.3f ? VOXEL_GRID_HALF : VOXEL_GRID_FLOAT32;
+        float *prev, *cur, error = 0.0f;
+        t_stub_matrix *first, *second, *out;
+        t_stub_list inputs, outputs;
+        t_flow *x = flow_new();
+        t_jit_err err;
+
+        test_random_dim(dim, 28);
+        x->brick = test_random_range(2, 9);
+        x->levels = test_random_range(1, 3);
+        x->search = test_random_range(1, 3);
+        x->num_threads = test_random_range(1, 4);
+        x->precision = format == VOXEL_GRID_HALF ? ps_half : _jit_sym_float32;
+        for (int a = 0; a < 3; a++) {
+            shift[a] = test_random_range(-3, 3);
+        }
+
+        first = test_grid_new(format, 1, 3, dim, test_random_range(0, 3));
+        second = test_grid_new(format, 1, 3, dim, test_random_range(0, 3));
+        out = stub_matrix_new(_jit_sym_float32, 4, 3, dim, 0);
+        test_grid_fill(first, format, 0.5f, 0.0f, 1.0f);
+        flow_shifted(first, second, format, shift, 0.05f);
+        outputs = stub_list(1, out);
+
+        inputs = stub_list(1, first);
+        err = flow_matrix_calc(x, &inputs, &outputs);
+        TEST_EXPECT(err == JIT_ERR_NONE, "case %d: first frame returned %ld", c, err);
+        inputs = stub_list(1, second);
+        err = flow_matrix_calc(x, &inputs, &outputs);
+        TEST_EXPECT(err == JIT_ERR_NONE, "case %d: second frame returned %ld", c, err);
+
+        {
+            long brick = CLAMP(x->brick, 2, FLOW_MAX_BRICK), levels = CLAMP(x->levels, 1, FLOW_MAX_LEVELS), finest, count;
+            long *estimate;
+            float *ref;
+
+            for (finest = 1; (brick >> finest) > 0 && finest < levels; finest++);
+            for (int a = 0; a < 3; a++) {
+                bricks[a] = (dim[a] + brick - 1) / brick;
+                TEST_EXPECT(out->info.dim[a] == bricks[a], "case %d: %ld bricks along %d, expected %ld",
+                            c, out->info.dim[a], a, bricks[a]);
+            }
+            count = bricks[0] * bricks[1] * bricks[2];
+            estimate = (long *)malloc(count * 6 * sizeof(long));
+            ref = (float *)malloc(count * 4 * sizeof(float));
+            prev = test_grid_expand(first, format, 0, prev_stride);
+            cur = test_grid_expand(second, format, 0, cur_stride);
+            voxel_reference_flow((char *)prev, prev_stride, (char *)cur, cur_stride, dim, brick, finest,
+                                 CLAMP(x->search, 1, FLOW_MAX_SEARCH), FLOW_REFINE, estimate, ref);
+            for (long index = 0; index < count; index++) {
+                float *result = (float *)stub_matrix_cell(out, index % bricks[0], (index / bricks[0]) % bricks[1],
+                                                          index / (bricks[0] * bricks[1]), 0);
+                float *r = ref + index * 4;
+
+                for (int j = 0; j < 3; j++) {
+                    error = MAX(error, fabsf(result[j] - r[j]));
+                }
+                error = MAX(error, fabsf(result[3] - r[3]) / MAX(1.0f, fabsf(r[3])));
+            }
+            free(estimate);
+            free(ref);
+            free(prev);
+            free(cur);
+        }
+        TEST_EXPECT(error <= VOXEL_REFERENCE_TOLERANCE, "case %d: %ldx%ldx%ld brick %ld levels %ld search %ld differs by %g",
+                    c, dim[0], dim[1], dim[2], x->brick, x->levels, x->search, error);
+
+        flow_free(x);
+        free(x);
+        stub_matrix_free(first);
+        stub_matrix_free(second);
+        stub_matrix_free(out);
+    }
+
+    // known shifts within reach of defaults brick 8 and search 2, on levels 1 to 3;
+    // bricks whose neighborhood moved in from outside the grid are not counted
+    for (long levels = 1; levels <= 3; levels++) {
+        for (long cell = 3; cell <= 6; cell += 3) {
+            long dim[3] = { 96, 96, 96 }, shift[3] = { levels, -levels, 2 * levels - 1 }, correct = 0, total = 0;
+            t_stub_matrix *first = stub_matrix_new(_jit_sym_float32, 1, 3, dim, 0);
+            t_stub_matrix *second = stub_matrix_new(_jit_sym_float32, 1, 3, dim, 0);
+            t_stub_matrix *out = stub_matrix_new(_jit_sym_float32, 4, 3, dim, 0);
+            t_stub_list inputs = stub_list(1, first), outputs = stub_list(1, out);
+            t_flow *x = flow_pair(first, second, cell, shift);
+
+            x->levels = levels;
+            flow_matrix_calc(x, &inputs, &outputs);
+            inputs = stub_list(1, second);
+            flow_matrix_calc(x, &inputs, &outputs);
+
+            for (long bz = 1; bz < out->info.dim[2] - 1; bz++) {
+                for (long by = 1; by < out->info.dim[1] - 1; by++) {
+                    for (long bx = 1; bx < out->info.dim[0] - 1; bx++) {
+                        float *d = (float *)stub_matrix_cell(out, bx, by, bz, 0);
+
+                        correct += d[0] == shift[0] && d[1] == shift[1] && d[2] == shift[2];
+                        total++;
+                    }
+                }
+            }
+            printf("flow levels %ld, lattice %ld, shift %ld %ld %ld: %ld of %ld bricks\n",
+                   levels, cell, shift[0], shift[1], shift[2], correct, total);
+            // a brick is two voxels wide on the top level of three, so a few still match wrongly
+            TEST_EXPECT(correct >= total * (levels < 3 ? 0.99 : 0.95), "levels %ld lattice %ld: %ld of %ld bricks tracked",
+                        levels, cell, correct, total);
+
+            flow_free(x);
+            free(x);
+            stub_matrix_free(first);
+            stub_matrix_free(second);
+            stub_matrix_free(out);
+        }
+    }
+
+    {
+        t_flow *x = flow_new();
+
+        test_precision_gate("flow", (t_test_calc)flow_matrix_calc, x, &x->precision, 1);
+        flow_free(x);
+        free(x);
+    }
+
+    {
+        long dim[3] = { 128, 128, 128 }, shift[3] = { 2, -1, 1 };
+        t_stub_matrix *first = stub_matrix_new(_jit_sym_float32, 1, 3, dim, 0);
+        t_stub_matrix *second = stub_matrix_new(_jit_sym_float32, 1, 3, dim, 0);
+        t_stub_matrix *out = stub_matrix_new(_jit_sym_float32, 4, 3, dim, 0);
+        t_stub_list inputs[2] = { stub_list(1, first), stub_list(1, second) }, outputs = stub_list(1, out);
+        t_flow *x = flow_pair(first, second, 4, shift);
+        t_test_timing timing[2] = { { (t_test_calc)flow_matrix_calc, x, &inputs[0], &outputs },
+                                    { (t_test_calc)flow_matrix_calc, x, &inputs[1], &outputs } };
+
+        test_budget("flow 128^3 defaults per frame, one thread", test_time(flow_timing_run, timing, 5) / 2.0, 60.0);
+
+        flow_free(x);
+        free(x);
+        stub_matrix_free(first);
+        stub_matrix_free(second);
+        stub_matrix_free(out);
+    }
+    return test_finish("flow");
+}
@@ -0,0 +1,197 @@
+#include "jit.voxel.gaussian.c"
+#include "voxel.test.h"
+
+static t_jit_err gaussian_set(t_gaussian *x, t_jit_err (*set)(t_gaussian *, void *, long, t_atom *), const float *values) {
+    t_atom av[3];
+
+    for (int a = 0; a < 3; a++) {
+        atom_setfloat(av + a, values[a]);
+    }
+    return set(x, NULL, 3, av);
+}
+
+int main(void) {
+    t_symbol *boundaries[4];
+
+    gaussian_init();
+    boundaries[0] = ps_zero;
+    boundaries[1] = ps_clamp;
+    boundaries[2] = ps_mirror;
+    boundaries[3] = ps_renormalize;
+    test_seed(34);
+
+    for (int c = 0; c < 48; c++) {
+        long dim[4], radius[3], ref_stride[3], pad = test_random_range(0, 3);
+        long in_format = test_random() < 0.3f ? VOXEL_GRID_HALF : VOXEL_GRID_FLOAT32;
+        long out_format = test_random() < 0.3f ? VOXEL_GRID_HALF : VOXEL_GRID_FLOAT32;
+        long boundary = test_random_range(0, 3);
+        float sigma[3], spacing[3], values[3], error = 0.0f;
+        t_stub_matrix *in, *out;
+        t_stub_list inputs, outputs;
+        t_gaussian *x = gaussian_new();
+        t_jit_err err;
+
+        test_random_dim(dim, 19);
+        dim[3] = test_random_range(1, 3);
+        for (int a = 0; a < 3; a++) {
+            radius[a] = test_random_range(0, 4);
+            sigma[a] = 0.2f + test_random() * 1.3f;
+            spacing[a] = test_random() < 0.5f ? 1.0f : 0.5f + test_random() * 2.0f;
+            values[a] = (float)radius[a];
+        }
+        gaussian_set(x, gaussian_radius_set, values);
+        gaussian_set(x, gaussian_sigma_set, sigma);
+        gaussian_set(x, gaussian_spacing_set, spacing);
+        x->boundary = boundaries[boundary];
+        x->num_threads = test_random_range(1, 4);
+        x->precision = in_format == VOXEL_GRID_HALF || out_format == VOXEL_GRID_HALF ? ps_half : _jit_sym_float32;
+
+        in = test_grid_new(in_format, 1, dim[3] > 1 ? 4 : 3, dim, pad);
+        out = test_grid_new(out_format, 1, dim[3] > 1 ? 4 : 3, dim, test_random_range(0, 2));
+        test_grid_fill(in, in_format, 0.3f, 0.0f, 2.0f);
+        inputs = stub_list(1, in);
+        outputs = stub_list(1, out);
+
+        err = gaussian_matrix_calc(x, &inputs, &outputs);
+        TEST_EXPECT(err == JIT_ERR_NONE, "case %d: calc returned %ld", c, err);
+
+        for (long w = 0; w < dim[3]; w++) {
+            float *packed = test_grid_expand(in, in_format, w, ref_stride);
+
+            for (long z = 0; z < dim[2]; z++) {
+                for (long y = 0; y < dim[1]; y++) {
+                    for (long v = 0; v < dim[0]; v++) {
+                        float ref = voxel_reference_gaussian((char *)packed, dim, ref_stride, radius, sigma, spacing,
+                                                             boundary, v, y, z);
+                        float result = test_grid_read(out, out_format, v, y, z, w);
+
+                        error = MAX(error, out_format == VOXEL_GRID_HALF ? voxel_half_error(result, ref) : fabsf(result - ref));
+                    }
+                }
+            }
+            free(packed);
+        }
+        TEST_EXPECT(error <= VOXEL_REFERENCE_TOLERANCE, "case %d: %ldx%ldx%ldx%ld boundary %ld differs by %g",
+                    c, dim[0], dim[1], dim[2], dim[3], boundary, error);
+
+        gaussian_free(x);
+        free(x);
+        stub_matrix_free(in);
+        stub_matrix_free(out);
+    }
+
+    // weight tables come from the tables arenas: sizes seen before do no heap traffic,
+    // and a radius too large to allocate is refused with the previous kernel kept
+    {
+        long dim[3] = { 6, 5, 4 }, allocations;
+        float small[3] = { 1.0f, 2.0f, 3.0f }, large[3] = { 4.0f, 5.0f, 6.0f }, huge[3] = { 1.0f, 1.0f, 35184372088832.0f };
+        t_stub_matrix *in = test_grid_new(VOXEL_GRID_FLOAT32, 1, 3, dim, 0);
+        t_stub_matrix *out = test_grid_new(VOXEL_GRID_FLOAT32, 1, 3, dim, 0);
+        t_stub_list inputs = stub_list(1, in), outputs = stub_list(1, out);
+        t_gaussian *x = gaussian_new();
+
+        gaussian_set(x, gaussian_radius_set, large);
+        gaussian_set(x, gaussian_radius_set, small);
+        allocations = x->tables[0].allocations + x->tables[1].allocations;
+        for (int i = 0; i < 4; i++) {
+            gaussian_set(x, gaussian_radius_set, i & 1 ? small : large);
+        }
+        TEST_EXPECT(x->tables[0].allocations + x->tables[1].allocations == allocations, "%ld heap allocations for sizes seen before",
+                    x->tables[0].allocations + x->tables[1].allocations - allocations);
+
+        TEST_EXPECT(gaussian_set(x, gaussian_radius_set, huge) == JIT_ERR_OUT_OF_MEM, "huge radius allocated");
+        TEST_EXPECT(x->radius[0] == 1 && x->radius[1] == 2 && x->radius[2] == 3 && x->taps[2] == 7,
+                    "refused radius left %ld %ld %ld, %ld taps", x->radius[0], x->radius[1], x->radius[2], x->taps[2]);
+        TEST_EXPECT(gaussian_matrix_calc(x, &inputs, &outputs) == JIT_ERR_NONE, "calc refused after a refused radius");
+
+        gaussian_free(x);
+        free(x);
+        stub_matrix_free(in);
+        stub_matrix_free(out);
+    }
+
+    // async frames come back at the next calc, once the worker has finished them
+    {
+        long dim[3] = { 48, 40, 32 };
+        t_stub_matrix *in = test_grid_new(VOXEL_GRID_FLOAT32, 1, 3, dim, 1);
+        t_stub_matrix *out = test_grid_new(VOXEL_GRID_FLOAT32, 1, 3, dim, 0);
+        t_stub_matrix *ref = test_grid_new(VOXEL_GRID_FLOAT32, 1, 3, dim, 0);
+        t_stub_list inputs = stub_list(1, in), outputs = stub_list(1, out), ref_outputs = stub_list(1, ref);
+        t_gaussian *x = gaussian_new(), *sync = gaussian_new();
+        float first = 0.0f, error = 0.0f;
+        int idle = 0;
+
+        test_grid_fill(in, VOXEL_GRID_FLOAT32, 0.5f, 0.0f, 1.0f);
+        sync->boundary = ps_clamp;
+        gaussian_matrix_calc(sync, &inputs, &ref_outputs);
+        x->async = 1;
+        x->boundary = ps_clamp;
+        TEST_EXPECT(gaussian_matrix_calc(x, &inputs, &outputs) == JIT_ERR_NONE, "first async frame refused");
+        // the queued frame keeps the attributes it was taken with while the worker runs it
+        x->boundary = ps_mirror;
+        x->num_threads = 3;
+        x->affinity = 1;
+        for (long z = 0; z < dim[2]; z++) {
+            for (long y = 0; y < dim[1]; y++) {
+                for (long v = 0; v < dim[0]; v++) {
+                    first = MAX(first, fabsf(test_grid_read(out, VOXEL_GRID_FLOAT32, v, y, z, 0)));
+                }
+            }
+        }
+        TEST_EXPECT(first == 0.0f, "async output before any result is %g", first);
+
+        while (!idle) {
+            pthread_mutex_lock(&x->mutex);
+            idle = !x->busy && !x->pending_valid;
+            pthread_mutex_unlock(&x->mutex);
+            sched_yield();
+        }
+        TEST_EXPECT(gaussian_matrix_calc(x, &inputs, &outputs) == JIT_ERR_NONE, "second async frame refused");
+        for (long z = 0; z < dim[2]; z++) {
+            for (long y = 0; y < dim[1]; y++) {
+                for (long v = 0; v < dim[0]; v++) {
+                    error = MAX(error, fabsf(test_grid_read(out, VOXEL_GRID_FLOAT32, v, y, z, 0) -
+                                             test_grid_read(ref, VOXEL_GRID_FLOAT32, v, y, z, 0)));
+                }
+            }
+        }
+        TEST_EXPECT(error <= VOXEL_REFERENCE_TOLERANCE, "async result differs from the synchronous one by %g", error);
+
+        gaussian_free(x);
+        free(x);
+        gaussian_free(sync);
+        free(sync);
+        stub_matrix_free(in);
+        stub_matrix_free(out);
+        stub_matrix_free(ref);
+    }
+
+    {
+        t_gaussian *x = gaussian_new();
+
+        test_precision_gate("gaussian", (t_test_calc)gaussian_matrix_calc, x, &x->precision, 1);
+        gaussian_free(x);
+        free(x);
+    }
+
+    {
+        long dim[3] = { 96, 96, 96 };
+        t_stub_matrix *in = test_grid_new(VOXEL_GRID_FLOAT32, 1, 3, dim, 0);
+        t_stub_matrix *out = test_grid_new(VOXEL_GRID_FLOAT32, 1, 3, dim, 0);
+        t_stub_list inputs = stub_list(1, in), outputs = stub_list(1, out);
+        t_gaussian *x = gaussian_new();
+        t_test_timing timing = { (t_test_calc)gaussian_matrix_calc, x, &inputs, &outputs };
+        float radius[3] = { 2.0f, 2.0f, 2.0f };
+
+        gaussian_set(x, gaussian_radius_set, radius);
+        x->num_threads = 1;
+        test_grid_fill(in, VOXEL_GRID_FLOAT32, 0.5f, 0.0f, 1.0f);
+        test_budget("gaussian 96^3 radius 2, one thread", test_time(test_timing_run, &timing, 5), 9.0);
+
+        gaussian_free(x);
+        free(x);
+        stub_matrix_free(in);
+        stub_matrix_free(out);
+    }
+    return test_finish("gaussian");
+}
@@ -0,0 +1,230 @@
+#include "jit.voxel.pcloud2grid.c"
+#include "jit.voxel.neighbors.c"
+#include "voxel.test.h"
+
+// one coordinate along an axis of n cells: uniform, on a cell boundary, or beyond
+// either face of the grid
+static float neighbors_random_coord(long n, float outside) {
+    float r = test_random();
+
+    if (r < outside) {
+        return test_random() < 0.5f ? -0.3f * test_random() - 0.01f : 1.01f + 0.3f * test_random();
+    }
+    if (r < 0.4f) {
+        return (float)test_random_range(0, n - 1) / n;
+    }
+    return test_random();
+}
+
+// points or queries: some on cell boundaries, some repeating an earlier one so
+// distances tie, and with outside > 0 some beyond the grid
+static void neighbors_fill(t_stub_matrix *m, long *dim, float outside) {
+    long rows = m->info.dimcount > 1 ? m->info.dim[1] : 1;
+    long count = m->info.dim[0] * rows;
+
+    for (long p = 0; p < count; p++) {
+        float *v = (float *)stub_matrix_cell(m, p % m->info.dim[0], p / m->info.dim[0], 0, 0);
+
+        if (p > 0 && test_random() < 0.1f) {
+            long q = test_random_range(0, p - 1);
+            float *u = (float *)stub_matrix_cell(m, q % m->info.dim[0], q / m->info.dim[0], 0, 0);
+
+            v[0] = u[0];
+            v[1] = u[1];
+            v[2] = u[2];
+            continue;
+        }
+        for (int a = 0; a < 3; a++) {
+            v[a] = neighbors_random_coord(dim[a], outside);
+        }
+    }
+}
+
+// the points pcloud2grid keeps in the index, packed in input order with their ids
+static long neighbors_indexed(t_stub_matrix *cloud, long *dim, float *points, long *ids) {
+    long rows = cloud->info.dimcount > 1 ? cloud->info.dim[1] : 1;
+    long count = 0;
+
+    for (long p = 0; p < cloud->info.dim[0] * rows; p++) {
+        float *v = (float *)stub_matrix_cell(cloud, p % cloud->info.dim[0], p / cloud->info.dim[0], 0, 0);
+        int inside = 1;
+
+        for (int a = 0; a < 3; a++) {
+            inside = inside && v[a] >= 0.0f && (long)(v[a] * dim[a]) < dim[a];
+        }
+        if (inside) {
+            points[count * 3] = v[0];
+            points[count * 3 + 1] = v[1];
+            points[count * 3 + 2] = v[2];
+            ids[count++] = p;
+        }
+    }
+    return count;
+}
+
+int main(void) {
+    t_symbol *name = gensym("cloud");
+    t_atom av;
+
+    pcloud2grid_init();
+    neighbors_init();
+    test_seed(30);
+    atom_setsym(&av, name);
+
+    for (int c = 0; c < 64; c++) {
+        long dim[3], cloud_dim[2], query_dim[2], query_dimcount = test_random_range(1, 2), count, k;
+        t_stub_matrix *cloud, *grid, *queries, *counts, *knn;
+        t_stub_list inputs, outputs;
+        t_pcloud2grid *p = pcloud2grid_new();
+        t_neighbors *x = neighbors_new();
+        float *points, dist[NEIGHBORS_MAX_K];
+        long *ids;
+        t_jit_err err;
+
+        test_random_dim(dim, 24);
+        // a few points in a large grid leave most cells empty, and k often beyond the count
+        cloud_dim[0] = c % 4 == 0 ? test_random_range(1, 12) : test_random_range(1, 600);
+        cloud_dim[1] = test_random_range(1, 2);
+        query_dim[0] = test_random_range(1, 40);
+        query_dim[1] = test_random_range(1, 4);
+        cloud = stub_matrix_new(_jit_sym_float32, test_random_range(3, 4), cloud_dim[1] > 1 ? 2 : 1, cloud_dim,
+                                test_random_range(0, 2));
+        grid = stub_matrix_new(_jit_sym_float32, 1, 3, dim, 0);
+        queries = stub_matrix_new(_jit_sym_float32, test_random_range(3, 4), query_dimcount, query_dim,
+                                  test_random_range(0, 2));
+        counts = stub_matrix_new(_jit_sym_long, 1, query_dimcount, query_dim, test_random_range(0, 2));
+        knn = stub_matrix_new(_jit_sym_long, 1, query_dimcount, query_dim, 0);
+        neighbors_fill(cloud, dim, 0.1f);
+        neighbors_fill(queries, dim, 0.05f);
+        points = (float *)malloc(cloud_dim[0] * cloud_dim[1] * 3 * sizeof(float));
+        ids = (long *)malloc(cloud_dim[0] * cloud_dim[1] * sizeof(long));
+        count = neighbors_indexed(cloud, dim, points, ids);
+
+        pcloud2grid_index_set(p, NULL, 1, &av);
+        p->num_threads = test_random_range(1, 4);
+        inputs = stub_list(1, cloud);
+        outputs = stub_list(1, grid);
+        err = pcloud2grid_matrix_calc(p, &inputs, &outputs);
+        TEST_EXPECT(err == JIT_ERR_NONE && p->index.point_count == count,
+                    "case %d: calc returned %ld, %ld of %ld points indexed", c, err, p->index.point_count, count);
+
+        x->index_name = name;
+        // radius from a fraction of a cell to several cells, sometimes an exact cell width
+        x->radius = test_random() < 0.3f ? (float)test_random_range(1, 3) / dim[0] : 0.3f * test_random();
+        x->k = test_random() < 0.1f ? 0 : test_random_range(1, NEIGHBORS_MAX_K);
+        x->num_threads = test_random_range(1, 4);
+        k = x->k;
+        inputs = stub_list(1, queries);
+        outputs = stub_list(2, counts, knn);
+        err = neighbors_matrix_calc(x, &inputs, &outputs);
+        TEST_EXPECT(err == JIT_ERR_NONE, "case %d: calc returned %ld", c, err);
+        TEST_EXPECT(knn->info.planecount == MAX(k, 1), "case %d: %ld knn planes for k %ld", c, knn->info.planecount, k);
+
+        for (long q = 0; q < query_dim[0] * (query_dimcount > 1 ? query_dim[1] : 1); q++) {
+            long qx = q % query_dim[0], qy = q / query_dim[0];
+            float *v = (float *)stub_matrix_cell(queries, qx, qy, 0, 0);
+            t_int32 *found = (t_int32 *)stub_matrix_cell(knn, qx, qy, 0, 0);
+            long ref = voxel_reference_radius(points, count, v, x->radius);
+            long out = *(t_int32 *)stub_matrix_cell(counts, qx, qy, 0, 0);
+
+            TEST_EXPECT(out == ref, "case %d query %ld (%g %g %g): %ld within %g, expected %ld", c, q, v[0], v[1], v[2],
+                        out, x->radius, ref);
+
+            if (!k) {
+                TEST_EXPECT(found[0] == -1, "case %d query %ld: neighbor %d with k 0", c, q, found[0]);
+                continue;
+            }
+            // ties may come in any order, so the distances are compared, and every id must
+            // be a distinct indexed point
+            voxel_reference_knn(points, count, v, k, dist);
+            for (long i = 0; i < k; i++) {
+                long slot = -1;
+
+                for (long j = 0; found[i] >= 0 && j < count; j++) {
+                    slot = ids[j] == found[i] ? j : slot;
+                }
+                for (long j = 0; j < i; j++) {
+                    TEST_EXPECT(found[i] < 0 || found[j] != found[i], "case %d query %ld: point %d found twice", c, q,
+                                found[i]);
+                }
+                if (i >= count) {
+                    TEST_EXPECT(found[i] == -1, "case %d query %ld: neighbor %ld is %d with %ld points", c, q, i,
+                                found[i], count);
+                } else {
+                    TEST_EXPECT(slot >= 0 && voxel_reference_dist_sq(v, points + slot * 3) == dist[i],
+                                "case %d query %ld (%g %g %g): neighbor %ld is %d, expected one at squared distance %g",
+                                c, q, v[0], v[1], v[2], i, found[i], dist[i]);
+                }
+            }
+        }
+
+        neighbors_free(x);
+        free(x);
+        pcloud2grid_free(p);
+        free(p);
+        free(points);
+        free(ids);
+        stub_matrix_free(cloud);
+        stub_matrix_free(grid);
+        stub_matrix_free(queries);
+        stub_matrix_free(counts);
+        stub_matrix_free(knn);
+    }
+
+    // with the pcloud2grid gone there is no index to search
+    {
+        long dim[1] = { 4 };
+        t_stub_matrix *queries = stub_matrix_new(_jit_sym_float32, 3, 1, dim, 0);
+        t_stub_matrix *counts = stub_matrix_new(_jit_sym_long, 1, 1, dim, 0);
+        t_stub_matrix *knn = stub_matrix_new(_jit_sym_long, 1, 1, dim, 0);
+        t_stub_list inputs = stub_list(1, queries), outputs = stub_list(2, counts, knn);
+        t_neighbors *x = neighbors_new();
+        long errors = stub_errors;
+
+        x->index_name = name;
+        TEST_EXPECT(neighbors_matrix_calc(x, &inputs, &outputs) == JIT_ERR_GENERIC && stub_errors == errors + 1,
+                    "a missing index is not reported");
+
+        neighbors_free(x);
+        free(x);
+        stub_matrix_free(queries);
+        stub_matrix_free(counts);
+        stub_matrix_free(knn);
+    }
+
+    {
+        long dim[3] = { 64, 64, 64 }, cloud_dim[1] = { 100000 }, query_dim[2] = { 128, 128 };
+        t_stub_matrix *cloud = stub_matrix_new(_jit_sym_float32, 3, 1, cloud_dim, 0);
+        t_stub_matrix *grid = stub_matrix_new(_jit_sym_float32, 1, 3, dim, 0);
+        t_stub_matrix *queries = stub_matrix_new(_jit_sym_float32, 3, 2, query_dim, 0);
+        t_stub_matrix *counts = stub_matrix_new(_jit_sym_long, 1, 2, query_dim, 0);
+        t_stub_matrix *knn = stub_matrix_new(_jit_sym_long, 8, 2, query_dim, 0);
+        t_stub_list cloud_inputs = stub_list(1, cloud), cloud_outputs = stub_list(1, grid);
+        t_stub_list inputs = stub_list(1, queries), outputs = stub_list(2, counts, knn);
+        t_pcloud2grid *p = pcloud2grid_new();
+        t_neighbors *x = neighbors_new();
+        t_test_timing timing = { (t_test_calc)neighbors_matrix_calc, x, &inputs, &outputs };
+
+        neighbors_fill(cloud, dim, 0.0f);
+        neighbors_fill(queries, dim, 0.0f);
+        pcloud2grid_index_set(p, NULL, 1, &av);
+        pcloud2grid_matrix_calc(p, &cloud_inputs, &cloud_outputs);
+        x->index_name = name;
+        x->radius = 0.05f;
+        x->k = 8;
+        x->num_threads = 1;
+        test_budget("neighbors 128x128 queries, radius and 8 nearest in 100k points, one thread",
+                    test_time(test_timing_run, &timing, 5), 100.0);
+
+        neighbors_free(x);
+        free(x);
+        pcloud2grid_free(p);
+        free(p);
+        stub_matrix_free(cloud);
+        stub_matrix_free(grid);
+        stub_matrix_free(queries);
+        stub_matrix_free(counts);
+        stub_matrix_free(knn);
+    }
+    return test_finish("neighbors");
+}
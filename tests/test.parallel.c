@@ -0,0 +1,171 @@
+#include "jit.common.h"
+#include "voxel.parallel.h"
+#include "voxel.test.h"
+
+#define PARALLEL_MAX_COUNT 512
+
+typedef struct _parallel_case {
+    long hits[PARALLEL_MAX_COUNT];
+    long thread[PARALLEL_MAX_COUNT];
+    long pinned[VOXEL_MAX_THREADS];     // cpus the slab's thread may run on, -1 where unknown
+    long nested;            // count of an inner dispatch from every slab, 0 for none
+    long inner[VOXEL_MAX_THREADS][PARALLEL_MAX_COUNT];
+} t_parallel_case;
+
+typedef struct _parallel_inner {
+    long *hits;
+} t_parallel_inner;
+
+static void parallel_inner_slab(void *ctx, long thread, long start, long end) {
+    t_parallel_inner *inner = (t_parallel_inner *)ctx;
+
+    for (long i = start; i < end; i++) {
+        inner->hits[i]++;
+    }
+}
+
+static long parallel_cpus_allowed(void) {
+#if defined(__linux__) && defined(CPU_COUNT)
+    cpu_set_t set;
+
+    if (!pthread_getaffinity_np(pthread_self(), sizeof(set), &set)) {
+        return CPU_COUNT(&set);
+    }
+#endif
+    return -1;
+}
+
+static void parallel_slab(void *ctx, long thread, long start, long end) {
+    t_parallel_case *c = (t_parallel_case *)ctx;
+
+    for (long i = start; i < end; i++) {
+        c->hits[i]++;
+        c->thread[i] = thread;
+    }
+    c->pinned[thread] = parallel_cpus_allowed();
+    if (c->nested) {
+        t_parallel_inner inner = { c->inner[thread] };
+        voxel_parallel_for(3, 0, c->nested, parallel_inner_slab, &inner);
+    }
+}
+
+// every index once, slabs contiguous and numbered in order
+static long parallel_check(t_parallel_case *c, long count, long slabs) {
+    long errors = 0;
+
+    for (long i = 0; i < count; i++) {
+        errors += c->hits[i] != 1;
+        errors += c->thread[i] < 0 || c->thread[i] >= slabs;
+        errors += i && c->thread[i] < c->thread[i - 1];
+    }
+    for (long s = 0; s < slabs && c->nested; s++) {
+        for (long i = 0; i < c->nested; i++) {
+            errors += c->inner[s][i] != 1;
+        }
+    }
+    return errors;
+}
+
+static void *parallel_caller(void *arg) {
+    t_parallel_case *c = (t_parallel_case *)arg;
+
+    for (int round = 0; round < 200; round++) {
+        long slabs;
+
+        memset(c, 0, sizeof(t_parallel_case));
+        slabs = voxel_parallel_for(4, round & 1, 97, parallel_slab, c);
+        if (parallel_check(c, 97, slabs)) {
+            return c;
+        }
+    }
+    return NULL;
+}
+
+static void parallel_empty(void *ctx, long thread, long start, long end) {
+}
+
+static void parallel_dispatches(void *ctx) {
+    for (int i = 0; i < 1000; i++) {
+        voxel_parallel_for(4, 0, 4, parallel_empty, NULL);
+    }
+}
+
+int main(void) {
+    static t_parallel_case c;
+    long cpus = voxel_parallel_cpus();
+
+    test_seed(36);
+
+    for (int k = 0; k < 400; k++) {
+        long count = test_random_range(1, PARALLEL_MAX_COUNT);
+        long threads = test_random_range(0, 9);
+        long affinity = test_random() < 0.5f;
+        long slabs;
+
+        memset(&c, 0, sizeof(c));
+        c.nested = test_random() < 0.2f ? test_random_range(1, 40) : 0;
+        slabs = voxel_parallel_for(threads, affinity, count, parallel_slab, &c);
+        TEST_EXPECT(slabs == MIN(voxel_parallel_threads(threads), count), "case %d: %ld slabs for %ld threads, count %ld",
+                    k, slabs, threads, count);
+        TEST_EXPECT(!parallel_check(&c, count, slabs), "case %d: count %ld threads %ld affinity %ld nested %ld split wrongly",
+                    k, count, threads, affinity, c.nested);
+#if defined(__linux__) && defined(CPU_SET)
+        // pinned slabs run on one cpu, the others on every cpu the process may use
+        for (long s = 0; s < slabs; s++) {
+            TEST_EXPECT(c.pinned[s] == (affinity ? 1 : cpus), "case %d: slab %ld may run on %ld cpus, affinity %ld",
+                        k, s, c.pinned[s], affinity);
+        }
+#endif
+    }
+
+    {
+        static t_parallel_case cases[2];
+        pthread_t callers[2];
+        void *failed[2];
+
+        for (int i = 0; i < 2; i++) {
+            pthread_create(&callers[i], NULL, parallel_caller, &cases[i]);
+        }
+        for (int i = 0; i < 2; i++) {
+            pthread_join(callers[i], &failed[i]);
+            TEST_EXPECT(!failed[i], "caller %d: concurrent dispatch split wrongly", i);
+        }
+    }
+
+    // every allowed cpu once, and the slabs of a dispatch spread over all of them in
+    // that order, so no two slabs share a cpu while there are cpus to go round
+    {
+        static long order[VOXEL_MAX_CPUS];
+        long n = voxel_parallel_order(order, VOXEL_MAX_CPUS), duplicates = 0;
+
+        for (long i = 0; i < n; i++) {
+            for (long j = 0; j < i; j++) {
+                duplicates += order[i] == order[j];
+            }
+        }
+#if defined(__linux__) && defined(CPU_SET)
+        TEST_EXPECT(n == cpus, "order lists %ld cpus of %ld", n, cpus);
+#endif
+        TEST_EXPECT(!duplicates, "order lists %ld cpus twice", duplicates);
+        TEST_EXPECT(voxel_pool.cpus == n, "pool ordered %ld cpus, expected %ld", voxel_pool.cpus, n);
+        for (long count = 1; count <= VOXEL_MAX_THREADS && n; count++) {
+            long last = -1;
+
+            for (long thread = 0; thread < count; thread++) {
+                long cpu = voxel_parallel_place(thread, count), at = 0;
+
+                while (at < n && order[at] != cpu) {
+                    at++;
+                }
+                TEST_EXPECT(at < n, "slab %ld of %ld placed on cpu %ld outside the order", thread, count, cpu);
+                TEST_EXPECT(count > n ? at >= last : at > last, "slab %ld of %ld placed at %ld after %ld",
+                            thread, count, at, last);
+                last = at;
+            }
+        }
+    }
+
+    printf("parallel: %ld cpus\n", cpus);
+    test_budget("parallel 1000 empty dispatches, 4 threads", test_time(parallel_dispatches, NULL, 5), 50.0);
+    return test_finish("parallel");
+}
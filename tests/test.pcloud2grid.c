@@ -0,0 +1,249 @@
+#include "jit.voxel.pcloud2grid.c"
+#include "voxel.test.h"
+
+// xyz points, mostly inside the unit cube with some beyond every face
+static void pcloud2grid_fill_points(t_stub_matrix *m) {
+    long rows = m->info.dimcount > 1 ? m->info.dim[1] : 1;
+
+    for (long j = 0; j < rows; j++) {
+        for (long i = 0; i < m->info.dim[0]; i++) {
+            float *p = (float *)stub_matrix_cell(m, i, j, 0, 0);
+
+            for (long a = 0; a < m->info.planecount; a++) {
+                p[a] = test_random() * 1.2f - 0.1f;
+            }
+        }
+    }
+}
+
+// depth in millimetres, with holes and some pixels out of range
+static void pcloud2grid_fill_depth(t_stub_matrix *m) {
+    for (long j = 0; j < m->info.dim[1]; j++) {
+        for (long i = 0; i < m->info.dim[0]; i++) {
+            *(float *)stub_matrix_cell(m, i, j, 0, 0) = test_random() < 0.1f ? 0.0f : 300.0f + test_random() * 4700.0f;
+        }
+    }
+}
+
+int main(void) {
+    pcloud2grid_init();
+    test_seed(31);
+
+    for (int c = 0; c < 64; c++) {
+        long dim[3], in_dim[2], counts_size;
+        int depth = test_random() < 0.4f;
+        t_stub_matrix *in, *out;
+        t_stub_list inputs, outputs;
+        t_pcloud2grid *x = pcloud2grid_new();
+        t_int32 *counts;
+        float error = 0.0f;
+        long format, planes;
+        t_jit_err err;
+
+        test_random_dim(dim, 24);
+        x->precision = test_random() < 0.3f ? ps_half : _jit_sym_float32;
+        x->minpoints = test_random_range(0, 3);
+        x->minneighbors = test_random_range(0, 4);
+        x->num_threads = test_random_range(1, 4);
+
+        if (depth) {
+            in_dim[0] = test_random_range(8, 64);
+            in_dim[1] = test_random_range(8, 48);
+            x->fx = x->fy = 20.0f + test_random() * 60.0f;
+            x->cx = in_dim[0] * 0.5f;
+            x->cy = in_dim[1] * 0.5f;
+            in = stub_matrix_new(_jit_sym_float32, 1, 2, in_dim, test_random_range(0, 2));
+            pcloud2grid_fill_depth(in);
+        } else {
+            in_dim[0] = test_random_range(1, 2000);
+            in_dim[1] = test_random_range(1, 3);
+            in = stub_matrix_new(_jit_sym_float32, test_random_range(3, 4), in_dim[1] > 1 ? 2 : 1, in_dim, test_random_range(0, 2));
+            pcloud2grid_fill_points(in);
+        }
+        out = stub_matrix_new(_jit_sym_float32, 1, 3, dim, test_random_range(0, 2));
+        inputs = stub_list(1, in);
+        outputs = stub_list(1, out);
+
+        err = pcloud2grid_matrix_calc(x, &inputs, &outputs);
+        TEST_EXPECT(err == JIT_ERR_NONE, "case %d: calc returned %ld", c, err);
+
+        format = voxel_grid_format(&out->info, x->precision == ps_half, &planes);
+        TEST_EXPECT(format == (x->precision == ps_half ? VOXEL_GRID_HALF : VOXEL_GRID_FLOAT32) && planes == 1,
+                    "case %d: output is %s with %ld planes", c, out->info.type->s_name, out->info.planecount);
+
+        counts_size = dim[0] * dim[1] * dim[2];
+        counts = (t_int32 *)malloc(counts_size * sizeof(t_int32));
+        if (depth) {
+            float camera[5] = { x->fx, x->fy, x->cx, x->cy, x->depthscale };
+            voxel_reference_depth_scatter(in->data, in_dim[0], in_dim[1], in->info.dimstride, camera, x->bounds, dim, counts);
+        } else {
+            voxel_reference_scatter(in->data, in_dim[0], in->info.dimcount > 1 ? in_dim[1] : 1, in->info.dimstride, dim, counts);
+        }
+        for (long z = 0; z < dim[2]; z++) {
+            for (long y = 0; y < dim[1]; y++) {
+                for (long v = 0; v < dim[0]; v++) {
+                    float ref = voxel_reference_occupied(counts, dim, x->minpoints, x->minneighbors, v, y, z);
+                    error = MAX(error, fabsf(test_grid_read(out, format, v, y, z, 0) - ref));
+                }
+            }
+        }
+        free(counts);
+        TEST_EXPECT(error <= VOXEL_REFERENCE_TOLERANCE, "case %d: %s into %ldx%ldx%ld minpoints %ld minneighbors %ld differs by %g",
+                    c, depth ? "depth" : "points", dim[0], dim[1], dim[2], x->minpoints, x->minneighbors, error);
+
+        pcloud2grid_free(x);
+        free(x);
+        stub_matrix_free(in);
+        stub_matrix_free(out);
+    }
+
+    // float64, long and char input is converted to float32 by calc, so each gives the
+    // grid of the same values sent as float32; char is scaled to [0, 1] on the way
+    for (int k = 0; k < 4; k++) {
+        t_symbol *types[4] = { _jit_sym_float64, _jit_sym_long, _jit_sym_long, _jit_sym_char };
+        long dim[3] = { 12, 10, 9 }, in_dim[2] = { k ? 40 : 300, k ? 30 : 2 }, planes = k == 1 ? 3 : k ? 1 : 4;
+        t_stub_matrix *in = stub_matrix_new(types[k], planes, 2, in_dim, 1);
+        t_stub_matrix *ref = stub_matrix_new(_jit_sym_float32, planes, 2, in_dim, 0);
+        t_stub_matrix *out = stub_matrix_new(_jit_sym_float32, 1, 3, dim, 0);
+        t_stub_matrix *expected = stub_matrix_new(_jit_sym_float32, 1, 3, dim, 0);
+        t_stub_list inputs = stub_list(1, in), outputs = stub_list(1, out);
+        t_stub_list ref_inputs = stub_list(1, ref), ref_outputs = stub_list(1, expected);
+        t_pcloud2grid *x = pcloud2grid_new(), *y = pcloud2grid_new();
+        float error = 0.0f;
+
+        for (long j = 0; j < in_dim[1]; j++) {
+            for (long i = 0; i < in_dim[0]; i++) {
+                char *ip = stub_matrix_cell(in, i, j, 0, 0);
+                float *fop = (float *)stub_matrix_cell(ref, i, j, 0, 0);
+
+                for (long a = 0; a < planes; a++) {
+                    if (k == 0) {
+                        ((double *)ip)[a] = test_random() * 1.2 - 0.1;
+                        fop[a] = (float)((double *)ip)[a];
+                    } else if (k == 1) {
+                        ((t_int32 *)ip)[a] = test_random_range(-1, 12);
+                        fop[a] = (float)((t_int32 *)ip)[a];
+                    } else if (k == 2) {
+                        ((t_int32 *)ip)[a] = test_random() < 0.1f ? 0 : test_random_range(300, 5000);
+                        fop[a] = (float)((t_int32 *)ip)[a];
+                    } else {
+                        ((unsigned char *)ip)[a] = test_random_range(0, 255);
+                        fop[a] = ((unsigned char *)ip)[a] / 255.0f;
+                    }
+                }
+            }
+        }
+        // whole number points pile up on the corners of the grid, which the filter thins out
+        if (k == 1) {
+            x->minpoints = y->minpoints = 2;
+        }
+        if (k == 3) {
+            x->depthscale = y->depthscale = 4.0f;
+        }
+        for (int i = 0; i < 2; i++) {
+            t_pcloud2grid *o = i ? y : x;
+
+            o->fx = o->fy = 30.0f;
+            o->cx = in_dim[0] * 0.5f;
+            o->cy = in_dim[1] * 0.5f;
+            o->num_threads = 2;
+        }
+
+        TEST_EXPECT(pcloud2grid_matrix_calc(x, &inputs, &outputs) == JIT_ERR_NONE, "%s input refused", types[k]->s_name);
+        TEST_EXPECT(pcloud2grid_matrix_calc(y, &ref_inputs, &ref_outputs) == JIT_ERR_NONE, "float32 input refused");
+        for (long z = 0; z < dim[2]; z++) {
+            for (long v = 0; v < dim[1]; v++) {
+                for (long u = 0; u < dim[0]; u++) {
+                    error = MAX(error, fabsf(test_grid_read(out, VOXEL_GRID_FLOAT32, u, v, z, 0) -
+                                             test_grid_read(expected, VOXEL_GRID_FLOAT32, u, v, z, 0)));
+                }
+            }
+        }
+        TEST_EXPECT(error == 0.0f, "%s input %ld planes differs from float32 by %g", types[k]->s_name, planes, error);
+
+        pcloud2grid_free(x);
+        pcloud2grid_free(y);
+        free(x);
+        free(y);
+        stub_matrix_free(in);
+        stub_matrix_free(ref);
+        stub_matrix_free(out);
+        stub_matrix_free(expected);
+    }
+
+    // other types are still refused
+    {
+        long dim[3] = { 6, 5, 4 }, in_dim[1] = { 10 };
+        t_stub_matrix *in = stub_matrix_new(gensym("float16"), 3, 1, in_dim, 0);
+        t_stub_matrix *out = stub_matrix_new(_jit_sym_float32, 1, 3, dim, 0);
+        t_stub_list inputs = stub_list(1, in), outputs = stub_list(1, out);
+        t_pcloud2grid *x = pcloud2grid_new();
+
+        TEST_EXPECT(pcloud2grid_matrix_calc(x, &inputs, &outputs) == JIT_ERR_MISMATCH_TYPE, "float16 points accepted");
+
+        pcloud2grid_free(x);
+        free(x);
+        stub_matrix_free(in);
+        stub_matrix_free(out);
+    }
+
+    // unusable intrinsics refuse a depth frame with an error and leave the grid alone
+    {
+        long dim[3] = { 6, 5, 4 }, in_dim[2] = { 32, 24 }, errors;
+        t_stub_matrix *in = stub_matrix_new(_jit_sym_float32, 1, 2, in_dim, 0);
+        t_stub_matrix *out = stub_matrix_new(_jit_sym_float32, 1, 3, dim, 0);
+        t_stub_list inputs = stub_list(1, in), outputs = stub_list(1, out);
+        t_pcloud2grid *x = pcloud2grid_new();
+
+        pcloud2grid_fill_depth(in);
+        for (int k = 0; k < 4; k++) {
+            float kept = 1.0f;
+
+            x->fx = k == 0 ? 0.0f : 40.0f;
+            x->depthscale = k == 1 ? -0.001f : 0.001f;
+            x->bounds[5] = k == 2 ? x->bounds[2] : 4.5f;
+            x->autoclear = 1;
+            test_grid_fill(out, VOXEL_GRID_FLOAT32, 0.0f, 1.0f, 1.0f);
+            errors = stub_errors;
+            if (k < 3) {
+                TEST_EXPECT(pcloud2grid_matrix_calc(x, &inputs, &outputs) == JIT_ERR_INVALID_INPUT,
+                            "intrinsics case %d accepted", k);
+                TEST_EXPECT(stub_errors == errors + 1, "intrinsics case %d posted %ld errors", k, stub_errors - errors);
+                for (long z = 0; z < dim[2]; z++) {
+                    for (long y = 0; y < dim[1]; y++) {
+                        for (long v = 0; v < dim[0]; v++) {
+                            kept = MIN(kept, test_grid_read(out, VOXEL_GRID_FLOAT32, v, y, z, 0));
+                        }
+                    }
+                }
+                TEST_EXPECT(kept == 1.0f, "intrinsics case %d cleared the grid", k);
+            } else {
+                TEST_EXPECT(pcloud2grid_matrix_calc(x, &inputs, &outputs) == JIT_ERR_NONE, "usable intrinsics refused");
+            }
+        }
+
+        pcloud2grid_free(x);
+        free(x);
+        stub_matrix_free(in);
+        stub_matrix_free(out);
+    }
+
+    {
+        long dim[3] = { 128, 128, 128 }, in_dim[2] = { 512, 424 };
+        t_stub_matrix *in = stub_matrix_new(_jit_sym_float32, 1, 2, in_dim, 0);
+        t_stub_matrix *out = stub_matrix_new(_jit_sym_float32, 1, 3, dim, 0);
+        t_stub_list inputs = stub_list(1, in), outputs = stub_list(1, out);
+        t_pcloud2grid *x = pcloud2grid_new();
+        t_test_timing timing = { (t_test_calc)pcloud2grid_matrix_calc, x, &inputs, &outputs };
+
+        x->num_threads = 1;
+        pcloud2grid_fill_depth(in);
+        test_budget("pcloud2grid 512x424 depth into 128^3, one thread", test_time(test_timing_run, &timing, 5), 8.0);
+
+        pcloud2grid_free(x);
+        free(x);
+        stub_matrix_free(in);
+        stub_matrix_free(out);
+    }
+    return test_finish("pcloud2grid");
+}
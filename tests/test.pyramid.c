@@ -0,0 +1,109 @@
+#include "jit.voxel.pyramid.c"
+#include "voxel.test.h"
+
+int main(void) {
+    t_symbol *modes[3];
+
+    pyramid_init();
+    test_seed(27);
+    modes[0] = ps_max;
+    modes[1] = ps_mean;
+    modes[2] = ps_any;
+
+    for (int c = 0; c < 60; c++) {
+        long dim[3], size[3], stride[3];
+        long format = test_random() < 0.3f ? VOXEL_GRID_HALF : VOXEL_GRID_FLOAT32;
+        long mode = test_random_range(0, 2);
+        t_stub_matrix *in, *levels[PYRAMID_LEVELS];
+        t_stub_list inputs, outputs;
+        t_pyramid *x = pyramid_new();
+        float error = 0.0f;
+        t_jit_err err;
+
+        test_random_dim(dim, 33);
+        x->mode = modes[mode];
+        x->num_threads = test_random_range(1, 4);
+        x->precision = format == VOXEL_GRID_HALF ? ps_half : _jit_sym_float32;
+        in = test_grid_new(format, test_random_range(1, 2), 3, dim, test_random_range(0, 3));
+        for (int l = 0; l < PYRAMID_LEVELS; l++) {
+            levels[l] = stub_matrix_new(_jit_sym_float32, 1, 3, dim, test_random_range(0, 2));
+        }
+        test_grid_fill(in, format, 0.4f, 0.0f, 1.0f);
+        inputs = stub_list(1, in);
+        outputs = stub_list(3, levels[0], levels[1], levels[2]);
+
+        err = pyramid_matrix_calc(x, &inputs, &outputs);
+        TEST_EXPECT(err == JIT_ERR_NONE, "case %d: calc returned %ld", c, err);
+
+        // each level against the naive reduction of the one below it as the object left it,
+        // so a half level is off by no more than its own rounding
+        for (int l = 0; l < PYRAMID_LEVELS; l++) {
+            t_stub_matrix *src = l ? levels[l - 1] : in;
+            float *packed = test_grid_expand(src, format, 0, stride);
+            long planes = 0;
+
+            for (int a = 0; a < 3; a++) {
+                size[a] = (src->info.dim[a] + 1) / 2;
+                TEST_EXPECT(levels[l]->info.dim[a] == size[a], "case %d level %d: %ld cells along %d, expected %ld",
+                            c, l + 1, levels[l]->info.dim[a], a, size[a]);
+            }
+            TEST_EXPECT(voxel_grid_format(&levels[l]->info, format == VOXEL_GRID_HALF, &planes) == format && planes == 1,
+                        "case %d level %d: %s with %ld planes", c, l + 1, levels[l]->info.type->s_name,
+                        levels[l]->info.planecount);
+            for (long z = 0; z < size[2]; z++) {
+                for (long y = 0; y < size[1]; y++) {
+                    for (long v = 0; v < size[0]; v++) {
+                        float ref = voxel_reference_pyramid((char *)packed, src->info.dim, stride, mode, v, y, z);
+                        float out = test_grid_read(levels[l], format, v, y, z, 0);
+
+                        error = MAX(error, format == VOXEL_GRID_HALF ? voxel_half_error(out, ref) : fabsf(out - ref));
+                    }
+                }
+            }
+            free(packed);
+        }
+        TEST_EXPECT(error <= VOXEL_REFERENCE_TOLERANCE, "case %d: %ldx%ldx%ld %s %s differs by %g", c, dim[0], dim[1],
+                    dim[2], modes[mode]->s_name, format == VOXEL_GRID_HALF ? "half" : "float32", error);
+
+        pyramid_free(x);
+        free(x);
+        stub_matrix_free(in);
+        for (int l = 0; l < PYRAMID_LEVELS; l++) {
+            stub_matrix_free(levels[l]);
+        }
+    }
+
+    {
+        t_pyramid *x = pyramid_new();
+
+        test_precision_gate("pyramid", (t_test_calc)pyramid_matrix_calc, x, &x->precision, PYRAMID_LEVELS);
+        pyramid_free(x);
+        free(x);
+    }
+
+    {
+        long dim[3] = { 128, 128, 128 };
+        t_stub_matrix *in = stub_matrix_new(_jit_sym_float32, 1, 3, dim, 0);
+        t_stub_matrix *levels[PYRAMID_LEVELS];
+        t_stub_list inputs = stub_list(1, in), outputs;
+        t_pyramid *x = pyramid_new();
+        t_test_timing timing = { (t_test_calc)pyramid_matrix_calc, x, &inputs, &outputs };
+
+        for (int l = 0; l < PYRAMID_LEVELS; l++) {
+            levels[l] = stub_matrix_new(_jit_sym_float32, 1, 3, dim, 0);
+        }
+        outputs = stub_list(3, levels[0], levels[1], levels[2]);
+        x->mode = ps_mean;
+        x->num_threads = 1;
+        test_grid_fill(in, VOXEL_GRID_FLOAT32, 0.5f, 0.0f, 1.0f);
+        test_budget("pyramid 128^3 mean, one thread", test_time(test_timing_run, &timing, 5), 16.0);
+
+        pyramid_free(x);
+        free(x);
+        stub_matrix_free(in);
+        for (int l = 0; l < PYRAMID_LEVELS; l++) {
+            stub_matrix_free(levels[l]);
+        }
+    }
+    return test_finish("pyramid");
+}
@@ -0,0 +1,244 @@
+#include "jit.voxel.raycast.c"
+#include "voxel.test.h"
+
+// march step of the reference, in normalized units
+#define RAYCAST_TEST_STEP 2.5e-4
+
+// part [tin, tout] of the ray o + u t, t in [0, maxdist], inside voxel index; 0 when
+// the ray does not pass through it
+static int raycast_segment(long *dim, long index, const float *o, const float *u, float maxdist, double *tin,
+                           double *tout) {
+    long v[3] = { index % dim[0], (index / dim[0]) % dim[1], index / (dim[0] * dim[1]) };
+
+    *tin = 0.0;
+    *tout = maxdist;
+    for (int a = 0; a < 3; a++) {
+        double lo = (double)v[a] / dim[a], hi = (double)(v[a] + 1) / dim[a];
+
+        if (u[a] == 0.0f) {
+            if (o[a] < lo || o[a] >= hi) {
+                return 0;
+            }
+            continue;
+        }
+        *tin = MAX(*tin, MIN((lo - o[a]) / u[a], (hi - o[a]) / u[a]));
+        *tout = MIN(*tout, MAX((lo - o[a]) / u[a], (hi - o[a]) / u[a]));
+    }
+    return *tin <= *tout;
+}
+
+// one random ray of kind: 0 from around the grid toward a point inside it, 1 from
+// inside in any direction, 2 along an axis, 3 from outside pointing away, 4 from
+// inside parallel to a face
+static void raycast_random_ray(long kind, float *ray) {
+    float scale = 0.1f + 4.0f * test_random();
+
+    for (int a = 0; a < 3; a++) {
+        ray[a] = test_random();
+        ray[a + 3] = 2.0f * test_random() - 1.0f;
+    }
+    if (kind == 0) {
+        for (int a = 0; a < 3; a++) {
+            ray[a] = 2.0f * test_random() - 0.5f;
+            ray[a + 3] = test_random() - ray[a];
+        }
+    } else if (kind == 2) {
+        long axis = test_random_range(0, 2);
+
+        ray[axis] = 2.0f * test_random() - 0.5f;
+        ray[3] = ray[4] = ray[5] = 0.0f;
+        ray[axis + 3] = test_random() < 0.5f ? -1.0f : 1.0f;
+    } else if (kind == 3) {
+        for (int a = 0; a < 3; a++) {
+            ray[a] = 1.1f + test_random();
+            ray[a + 3] = 0.05f + test_random();
+        }
+    } else if (kind == 4) {
+        ray[test_random_range(0, 2) + 3] = 0.0f;
+    }
+    for (int a = 3; a < 6; a++) {
+        ray[a] *= scale;
+    }
+}
+
+static void raycast_fill_rays(t_stub_matrix *rays) {
+    long *dim = rays->info.dim;
+    long rows = rays->info.dimcount > 1 ? dim[1] : 1;
+
+    for (long j = 0; j < rows; j++) {
+        for (long i = 0; i < dim[0]; i++) {
+            float *ray = (float *)stub_matrix_cell(rays, i, j, 0, 0);
+
+            raycast_random_ray((i + j * dim[0]) % 5, ray);
+        }
+    }
+    // a ray without a direction misses
+    ((float *)stub_matrix_cell(rays, 0, 0, 0, 0))[3] = 0.0f;
+    ((float *)stub_matrix_cell(rays, 0, 0, 0, 0))[4] = 0.0f;
+    ((float *)stub_matrix_cell(rays, 0, 0, 0, 0))[5] = 0.0f;
+}
+
+// every ray of a frame against the fixed-step march. A hit must be an occupied voxel
+// the ray passes through, at the distance it enters it. Where the two disagree, the
+// voxel found first must be one the ray crosses for less than a step, which the march
+// can step over; those are counted in grazes
+static void raycast_check(t_raycast *x, t_stub_matrix *grid, t_stub_matrix *rays, t_stub_matrix *hit,
+                          t_stub_matrix *index, int c, const char *frame, long *grazes) {
+    long *dim = grid->info.dim;
+    long rows = rays->info.dimcount > 1 ? rays->info.dim[1] : 1;
+    double h = RAYCAST_TEST_STEP, eps = VOXEL_REFERENCE_TOLERANCE;
+
+    for (long j = 0; j < rows; j++) {
+        for (long i = 0; i < rays->info.dim[0]; i++) {
+            float *ray = (float *)stub_matrix_cell(rays, i, j, 0, 0);
+            float *out = (float *)stub_matrix_cell(hit, i, j, 0, 0);
+            long k = *(t_int32 *)stub_matrix_cell(index, i, j, 0, 0);
+            double len = sqrt((double)ray[3] * ray[3] + (double)ray[4] * ray[4] + (double)ray[5] * ray[5]);
+            double rdist, tin, tout;
+            float u[3];
+            long r;
+
+            if (len == 0.0) {
+                TEST_EXPECT(k == -1 && out[3] == -1.0f, "case %d %s ray %ld,%ld: no direction but hit %ld", c, frame,
+                            i, j, k);
+                continue;
+            }
+            for (int a = 0; a < 3; a++) {
+                u[a] = (float)(ray[a + 3] / len);
+            }
+            r = voxel_reference_raycast(grid->data, dim, grid->info.dimstride, x->threshold, ray, u, x->maxdist, h,
+                                        &rdist);
+
+            if (k < 0) {
+                TEST_EXPECT(out[3] == -1.0f, "case %d %s ray %ld,%ld: miss at distance %g", c, frame, i, j, out[3]);
+            } else if (k >= dim[0] * dim[1] * dim[2]) {
+                TEST_EXPECT(0, "case %d %s ray %ld,%ld: index %ld outside the grid", c, frame, i, j, k);
+                continue;
+            } else {
+                long v[3] = { k % dim[0], (k / dim[0]) % dim[1], k / (dim[0] * dim[1]) };
+
+                TEST_EXPECT(test_grid_read(grid, VOXEL_GRID_FLOAT32, v[0], v[1], v[2], 0) > x->threshold,
+                            "case %d %s ray %ld,%ld: hit empty voxel %ld", c, frame, i, j, k);
+                TEST_EXPECT(raycast_segment(dim, k, ray, u, x->maxdist, &tin, &tout) && out[3] >= tin - eps &&
+                                out[3] <= tin + eps,
+                            "case %d %s ray %ld,%ld: hit voxel %ld at %g, the ray enters it at %g", c, frame, i, j, k,
+                            out[3], tin);
+                for (int a = 0; a < 3; a++) {
+                    TEST_EXPECT(fabs(out[a] - (ray[a] + u[a] * out[3])) <= eps,
+                                "case %d %s ray %ld,%ld: hit position %d is %g, not on the ray", c, frame, i, j, a,
+                                out[a]);
+                }
+            }
+
+            if (k == r) {
+                TEST_EXPECT(k < 0 || fabs(out[3] - rdist) <= h + eps, "case %d %s ray %ld,%ld: hit at %g, march at %g",
+                            c, frame, i, j, out[3], rdist);
+            } else {
+                // the voxel met first by either is the one the other stepped past
+                long first = k >= 0 && (r < 0 || out[3] < rdist) ? k : r;
+                int grazed = raycast_segment(dim, first, ray, u, x->maxdist, &tin, &tout) && tout - tin <= h + eps;
+
+                TEST_EXPECT(grazed, "case %d %s ray %ld,%ld: hit %ld at %g, march hit %ld at %g", c, frame, i, j, k,
+                            out[3], r, rdist);
+                (*grazes)++;
+            }
+        }
+    }
+}
+
+static t_jit_err raycast_calc_into(t_raycast *x, t_stub_matrix *rays, t_stub_matrix *grid, t_stub_matrix *hit,
+                                   t_stub_matrix *index) {
+    t_stub_list inputs = stub_list(2, rays, grid), outputs = stub_list(2, hit, index);
+    return raycast_matrix_calc(x, &inputs, &outputs);
+}
+
+int main(void) {
+    long grazes = 0, traced = 0;
+
+    raycast_init();
+    test_seed(28);
+
+    for (int c = 0; c < 40; c++) {
+        long dim[3], ray_dim[2], ray_dimcount = test_random_range(1, 2);
+        float empty = c % 3 == 0 ? 0.9f : c % 3 == 1 ? 0.99f : 0.999f;
+        t_stub_matrix *grid, *rays, *hit, *index;
+        t_raycast *x = raycast_new();
+        t_jit_err err;
+        long v[3];
+
+        test_random_dim(dim, 40);
+        ray_dim[0] = test_random_range(5, 16);
+        ray_dim[1] = test_random_range(1, 8);
+        x->threshold = 0.5f * test_random();
+        x->maxdist = c % 3 == 2 ? 0.2f + test_random() : 2.0f;
+        x->num_threads = test_random_range(1, 4);
+        grid = stub_matrix_new(_jit_sym_float32, 1, 3, dim, test_random_range(0, 3));
+        rays = stub_matrix_new(_jit_sym_float32, test_random_range(6, 7), ray_dimcount, ray_dim, test_random_range(0, 2));
+        hit = stub_matrix_new(_jit_sym_float32, 4, ray_dimcount, ray_dim, test_random_range(0, 2));
+        index = stub_matrix_new(_jit_sym_long, 1, ray_dimcount, ray_dim, test_random_range(0, 2));
+        test_grid_fill(grid, VOXEL_GRID_FLOAT32, empty, 0.0f, 1.0f);
+        traced += ray_dim[0] * (ray_dimcount > 1 ? ray_dim[1] : 1) * 4;
+
+        raycast_fill_rays(rays);
+        err = raycast_calc_into(x, rays, grid, hit, index);
+        TEST_EXPECT(err == JIT_ERR_NONE, "case %d: calc returned %ld", c, err);
+        raycast_check(x, grid, rays, hit, index, c, "first", &grazes);
+
+        // new rays through the same grid reuse the mask
+        raycast_fill_rays(rays);
+        err = raycast_calc_into(x, rays, grid, hit, index);
+        TEST_EXPECT(err == JIT_ERR_NONE && x->rebuilds == 1, "case %d: calc returned %ld after %ld rebuilds", c, err,
+                    x->rebuilds);
+        raycast_check(x, grid, rays, hit, index, c, "same grid", &grazes);
+
+        // one voxel filled in place, where a stale mask would skip its brick
+        for (int a = 0; a < 3; a++) {
+            v[a] = test_random_range(0, dim[a] - 1);
+        }
+        voxel_grid_write(stub_matrix_cell(grid, v[0], v[1], v[2], 0), VOXEL_GRID_FLOAT32, 1.0f);
+        err = raycast_calc_into(x, rays, grid, hit, index);
+        TEST_EXPECT(err == JIT_ERR_NONE && x->rebuilds == 2, "case %d: calc returned %ld after %ld rebuilds", c, err,
+                    x->rebuilds);
+        raycast_check(x, grid, rays, hit, index, c, "filled", &grazes);
+
+        x->threshold += 0.25f;
+        err = raycast_calc_into(x, rays, grid, hit, index);
+        TEST_EXPECT(err == JIT_ERR_NONE && x->rebuilds == 3, "case %d: calc returned %ld after %ld rebuilds", c, err,
+                    x->rebuilds);
+        raycast_check(x, grid, rays, hit, index, c, "threshold", &grazes);
+
+        raycast_free(x);
+        free(x);
+        stub_matrix_free(grid);
+        stub_matrix_free(rays);
+        stub_matrix_free(hit);
+        stub_matrix_free(index);
+    }
+    // grazing is rare at this step; many of them would hide real misses
+    TEST_EXPECT(grazes * 50 <= traced, "%ld of %ld rays only agree on a grazed voxel", grazes, traced);
+
+    {
+        long dim[3] = { 128, 128, 128 }, ray_dim[2] = { 256, 256 };
+        t_stub_matrix *grid = stub_matrix_new(_jit_sym_float32, 1, 3, dim, 0);
+        t_stub_matrix *rays = stub_matrix_new(_jit_sym_float32, 6, 2, ray_dim, 0);
+        t_stub_matrix *hit = stub_matrix_new(_jit_sym_float32, 4, 2, ray_dim, 0);
+        t_stub_matrix *index = stub_matrix_new(_jit_sym_long, 1, 2, ray_dim, 0);
+        t_stub_list inputs = stub_list(2, rays, grid), outputs = stub_list(2, hit, index);
+        t_raycast *x = raycast_new();
+        t_test_timing timing = { (t_test_calc)raycast_matrix_calc, x, &inputs, &outputs };
+
+        x->num_threads = 1;
+        test_grid_fill(grid, VOXEL_GRID_FLOAT32, 0.999f, 0.0f, 1.0f);
+        raycast_fill_rays(rays);
+        test_budget("raycast 256x256 rays into a sparse 128^3, one thread", test_time(test_timing_run, &timing, 5),
+                    100.0);
+
+        raycast_free(x);
+        free(x);
+        stub_matrix_free(grid);
+        stub_matrix_free(rays);
+        stub_matrix_free(hit);
+        stub_matrix_free(index);
+    }
+    return test_finish("raycast");
+}
@@ -0,0 +1,130 @@
+#include "jit.voxel.stats.c"
+#include "voxel.test.h"
+
+// sums are compared relative to their size, since the marginals of a large grid grow with it
+static float stats_error(double out, double ref) {
+    return (float)(fabs(out - ref) / MAX(1.0, fabs(ref)));
+}
+
+int main(void) {
+    t_symbol *names[3];
+
+    stats_init();
+    names[0] = ps_marginals;
+    names[1] = ps_histogram;
+    names[2] = ps_octants;
+    test_seed(42);
+
+    for (int c = 0; c < 64; c++) {
+        long dim[3], stride[3], lengths[3], total, count = 0, mask = 0;
+        long format = test_random() < 0.3f ? VOXEL_GRID_HALF : VOXEL_GRID_FLOAT32;
+        double *marginals, *histogram, octants[8], mass = 0.0, occupied = 0.0;
+        float *published[3], *packed, error = 0.0f;
+        long published_count[3];
+        t_stub_matrix *in;
+        t_stub_list inputs;
+        t_atom av[3];
+        t_stats *x = stats_new();
+        t_jit_err err;
+
+        test_random_dim(dim, 40);
+        if (test_random() < 0.1f) {
+            dim[test_random_range(0, 2)] = test_random_range(1025, 1500);
+        }
+        for (int i = 0; i < 3; i++) {
+            if (test_random() < 0.6f) {
+                atom_setsym(av + count++, names[i]);
+                mask |= 1 << i;
+            }
+        }
+        stats_outputs_set(x, NULL, count, av);
+        x->bins = test_random_range(1, 40);
+        x->range[0] = test_random() * 0.5f - 0.2f;
+        x->range[1] = x->range[0] + test_random() * 2.0f;
+        x->num_threads = test_random_range(1, 4);
+        x->precision = format == VOXEL_GRID_HALF ? ps_half : _jit_sym_float32;
+
+        in = test_grid_new(format, 1, 3, dim, test_random_range(0, 3));
+        test_grid_fill(in, format, 0.3f, -0.3f, 1.7f);
+        inputs = stub_list(1, in);
+
+        err = stats_matrix_calc(x, &inputs, NULL);
+        TEST_EXPECT(err == JIT_ERR_NONE, "case %d: calc returned %ld", c, err);
+
+        for (int a = 0; a < 3; a++) {
+            lengths[a] = MIN(dim[a], STATS_MAX_MARGINAL);
+        }
+        total = lengths[0] + lengths[1] + lengths[2];
+        marginals = (double *)malloc(total * sizeof(double));
+        histogram = (double *)malloc(x->bins * sizeof(double));
+        packed = test_grid_expand(in, format, 0, stride);
+        voxel_reference_stats((char *)packed, dim, stride, lengths, x->bins, x->range, marginals, histogram, octants);
+
+        published[0] = x->xmarginal;
+        published[1] = x->ymarginal;
+        published[2] = x->zmarginal;
+        published_count[0] = x->xmarginal_count;
+        published_count[1] = x->ymarginal_count;
+        published_count[2] = x->zmarginal_count;
+        if (mask & STATS_MARGINALS) {
+            for (long a = 0, i = 0; a < 3; a++) {
+                TEST_EXPECT(published_count[a] == lengths[a], "case %d: marginal %ld has %ld bins, expected %ld",
+                            c, a, published_count[a], lengths[a]);
+                for (long j = 0; j < lengths[a]; j++, i++) {
+                    error = MAX(error, stats_error(published[a][j], marginals[i]));
+                }
+            }
+        }
+        if (mask & STATS_HISTOGRAM) {
+            TEST_EXPECT(x->histogram_count == x->bins, "case %d: %ld histogram bins, expected %ld", c, x->histogram_count, x->bins);
+        }
+        for (long i = 0; i < x->bins; i++) {
+            if (mask & STATS_HISTOGRAM) {
+                error = MAX(error, stats_error(x->histogram[i], histogram[i]));
+            }
+            occupied += histogram[i];
+        }
+        for (int i = 0; i < 8; i++) {
+            if (mask & STATS_OCTANTS) {
+                error = MAX(error, stats_error(x->octants[i], octants[i]));
+            }
+            mass += octants[i];
+        }
+        error = MAX(error, stats_error(x->mass, mass));
+        error = MAX(error, stats_error(x->occupied, occupied));
+        TEST_EXPECT(error <= VOXEL_REFERENCE_TOLERANCE, "case %d: %ldx%ldx%ld outputs %ld differs by %g",
+                    c, dim[0], dim[1], dim[2], mask, error);
+
+        free(marginals);
+        free(histogram);
+        free(packed);
+        stats_free(x);
+        free(x);
+        stub_matrix_free(in);
+    }
+
+    {
+        t_stats *x = stats_new();
+
+        test_precision_gate("stats", (t_test_calc)stats_matrix_calc, x, &x->precision, 0);
+        stats_free(x);
+        free(x);
+    }
+
+    {
+        long dim[3] = { 128, 128, 128 };
+        t_stub_matrix *in = test_grid_new(VOXEL_GRID_FLOAT32, 1, 3, dim, 0);
+        t_stub_list inputs = stub_list(1, in);
+        t_stats *x = stats_new();
+        t_test_timing timing = { (t_test_calc)stats_matrix_calc, x, &inputs, NULL };
+
+        x->num_threads = 1;
+        test_grid_fill(in, VOXEL_GRID_FLOAT32, 0.5f, 0.0f, 1.0f);
+        test_budget("stats 128^3 all outputs, one thread", test_time(test_timing_run, &timing, 5), 7.0);
+
+        stats_free(x);
+        free(x);
+        stub_matrix_free(in);
+    }
+    return test_finish("stats");
+}
@@ -0,0 +1,135 @@
+#include "jit.voxel.temporal.c"
+#include "voxel.test.h"
+
+static t_jit_err temporal_calc_into(t_temporal *x, t_stub_matrix *in, t_stub_matrix *smooth, t_stub_matrix *mask) {
+    t_stub_list inputs = stub_list(1, in), outputs = stub_list(2, smooth, mask);
+    return temporal_matrix_calc(x, &inputs, &outputs);
+}
+
+int main(void) {
+    temporal_init();
+    test_seed(26);
+
+    for (int c = 0; c < 48; c++) {
+        long dim[3], count, changed = 0, lo[3] = { LONG_MAX, LONG_MAX, LONG_MAX }, hi[3] = { -1, -1, -1 };
+        float *ema, *prev, error = 0.0f;
+        t_stub_matrix *in, *smooth, *mask;
+        t_temporal *x = temporal_new();
+        t_jit_err err;
+
+        test_random_dim(dim, 20);
+        count = dim[0] * dim[1] * dim[2];
+        x->alpha = test_random();
+        x->threshold = test_random() * 0.5f;
+        x->num_threads = test_random_range(1, 4);
+        in = stub_matrix_new(_jit_sym_float32, 1, 3, dim, test_random_range(0, 3));
+        smooth = stub_matrix_new(_jit_sym_float32, 1, 3, dim, test_random_range(0, 2));
+        mask = stub_matrix_new(_jit_sym_float32, 1, 3, dim, test_random_range(0, 2));
+        ema = (float *)malloc(count * sizeof(float));
+        prev = (float *)malloc(count * sizeof(float));
+
+        // the first frame seeds the history, the ones after are compared
+        for (int frame = 0; frame < 3; frame++) {
+            test_grid_fill(in, VOXEL_GRID_FLOAT32, 0.4f, 0.0f, 1.0f);
+            err = temporal_calc_into(x, in, smooth, mask);
+            TEST_EXPECT(err == JIT_ERR_NONE, "case %d frame %d: calc returned %ld", c, frame, err);
+
+            changed = 0;
+            for (int a = 0; a < 3; a++) {
+                lo[a] = LONG_MAX;
+                hi[a] = -1;
+            }
+            for (long z = 0, i = 0; z < dim[2]; z++) {
+                for (long y = 0; y < dim[1]; y++) {
+                    for (long v = 0; v < dim[0]; v++, i++) {
+                        float value = test_grid_read(in, VOXEL_GRID_FLOAT32, v, y, z, 0);
+                        long moved;
+
+                        if (!frame) {
+                            ema[i] = prev[i] = value;
+                        }
+                        ema[i] += x->alpha * (value - ema[i]);
+                        moved = fabsf(value - prev[i]) > x->threshold;
+                        prev[i] = value;
+                        error = MAX(error, fabsf(test_grid_read(smooth, VOXEL_GRID_FLOAT32, v, y, z, 0) - ema[i]));
+                        error = MAX(error, fabsf(test_grid_read(mask, VOXEL_GRID_FLOAT32, v, y, z, 0) - (float)moved));
+                        if (moved) {
+                            long p[3] = { v, y, z };
+
+                            changed++;
+                            for (int a = 0; a < 3; a++) {
+                                lo[a] = MIN(lo[a], p[a]);
+                                hi[a] = MAX(hi[a], p[a]);
+                            }
+                        }
+                    }
+                }
+            }
+            TEST_EXPECT(x->changed == changed, "case %d frame %d: %ld changed, expected %ld", c, frame, x->changed, changed);
+            for (int a = 0; a < 3 && changed; a++) {
+                error = MAX(error, fabsf(x->bounds[a] - (float)lo[a] / dim[a]));
+                error = MAX(error, fabsf(x->bounds[a + 3] - (float)(hi[a] + 1) / dim[a]));
+            }
+        }
+        TEST_EXPECT(error <= VOXEL_REFERENCE_TOLERANCE, "case %d: %ldx%ldx%ld differs by %g", c, dim[0], dim[1], dim[2], error);
+
+        free(ema);
+        free(prev);
+        temporal_free(x);
+        free(x);
+        stub_matrix_free(in);
+        stub_matrix_free(smooth);
+        stub_matrix_free(mask);
+    }
+
+    // outputs that do not match the input are refused rather than written past
+    {
+        long dim[3] = { 8, 6, 5 }, small[3] = { 8, 6, 4 }, flat[2] = { 8, 30 };
+        t_stub_matrix *in = stub_matrix_new(_jit_sym_float32, 1, 3, dim, 0);
+        t_stub_matrix *good = stub_matrix_new(_jit_sym_float32, 1, 3, dim, 0);
+        t_stub_matrix *shorter = stub_matrix_new(_jit_sym_float32, 1, 3, small, 0);
+        t_stub_matrix *plane2 = stub_matrix_new(_jit_sym_float32, 1, 2, flat, 0);
+        t_stub_matrix *chars = stub_matrix_new(_jit_sym_char, 1, 3, dim, 0);
+        t_stub_matrix *planes = stub_matrix_new(_jit_sym_float32, 2, 3, dim, 0);
+        t_temporal *x = temporal_new();
+
+        test_grid_fill(in, VOXEL_GRID_FLOAT32, 0.5f, 0.0f, 1.0f);
+        TEST_EXPECT(temporal_calc_into(x, in, good, good) == JIT_ERR_NONE, "matching outputs refused");
+        TEST_EXPECT(temporal_calc_into(x, in, shorter, good) == JIT_ERR_MISMATCH_DIM, "smaller smooth output accepted");
+        TEST_EXPECT(temporal_calc_into(x, in, good, shorter) == JIT_ERR_MISMATCH_DIM, "smaller mask output accepted");
+        TEST_EXPECT(temporal_calc_into(x, in, plane2, good) == JIT_ERR_MISMATCH_DIM, "2d smooth output accepted");
+        TEST_EXPECT(temporal_calc_into(x, in, good, chars) == JIT_ERR_MISMATCH_TYPE, "char mask output accepted");
+        TEST_EXPECT(temporal_calc_into(x, in, planes, good) == JIT_ERR_MISMATCH_TYPE, "2 plane smooth output accepted");
+        TEST_EXPECT(temporal_calc_into(x, chars, good, good) == JIT_ERR_MISMATCH_TYPE, "char input accepted");
+
+        temporal_free(x);
+        free(x);
+        stub_matrix_free(in);
+        stub_matrix_free(good);
+        stub_matrix_free(shorter);
+        stub_matrix_free(plane2);
+        stub_matrix_free(chars);
+        stub_matrix_free(planes);
+    }
+
+    {
+        long dim[3] = { 128, 128, 128 };
+        t_stub_matrix *in = stub_matrix_new(_jit_sym_float32, 1, 3, dim, 0);
+        t_stub_matrix *smooth = stub_matrix_new(_jit_sym_float32, 1, 3, dim, 0);
+        t_stub_matrix *mask = stub_matrix_new(_jit_sym_float32, 1, 3, dim, 0);
+        t_stub_list inputs = stub_list(1, in), outputs = stub_list(2, smooth, mask);
+        t_temporal *x = temporal_new();
+        t_test_timing timing = { (t_test_calc)temporal_matrix_calc, x, &inputs, &outputs };
+
+        x->num_threads = 1;
+        test_grid_fill(in, VOXEL_GRID_FLOAT32, 0.5f, 0.0f, 1.0f);
+        test_budget("temporal 128^3, one thread", test_time(test_timing_run, &timing, 5), 4.0);
+
+        temporal_free(x);
+        free(x);
+        stub_matrix_free(in);
+        stub_matrix_free(smooth);
+        stub_matrix_free(mask);
+    }
+    return test_finish("temporal");
+}
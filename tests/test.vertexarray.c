@@ -0,0 +1,158 @@
+#include "jit.voxel.vertexarray.c"
+#include "voxel.test.h"
+
+// colour the vertex array holds for one cell: grey, rgb or rgba from the planes after
+// the weight, opaque white for none or two
+static void vertexarray_expected_color(t_stub_matrix *m, long format, long planes, long x, long y, long z, float *color) {
+    char *cell = stub_matrix_cell(m, x, y, z, 0);
+    long size = format == VOXEL_GRID_HALF ? 2 : 4;
+    float c[4];
+
+    planes = MIN(planes - 1, 4);
+    for (long j = 0; j < planes; j++) {
+        c[j] = voxel_grid_read(cell + (j + 1) * size, format);
+    }
+    color[0] = color[1] = color[2] = color[3] = 1.0f;
+    if (planes == 1) {
+        color[0] = color[1] = color[2] = c[0];
+    } else if (planes >= 3) {
+        for (long j = 0; j < planes; j++) {
+            color[j] = c[j];
+        }
+    }
+}
+
+int main(void) {
+    vertexarray_init();
+    test_seed(38);
+
+    for (int c = 0; c < 64; c++) {
+        long dim[3], stride[3], planes = test_random_range(1, 5);
+        long format = test_random() < 0.3f ? VOXEL_GRID_HALF : VOXEL_GRID_FLOAT32;
+        long count, size;
+        float error = 0.0f, *packed;
+        t_stub_matrix *in, *out;
+        t_stub_list inputs, outputs;
+        t_vertexarray *x = vertexarray_new();
+        t_jit_err err;
+
+        test_random_dim(dim, 17);
+        count = dim[0] * dim[1] * dim[2];
+        x->normals = test_random() < 0.6f;
+        x->precision = format == VOXEL_GRID_HALF ? ps_half : _jit_sym_float32;
+        x->color = test_random() < 0.6f;
+        size = 4 + (x->normals ? 3 : 0) + (x->color ? 4 : 0);
+
+        in = test_grid_new(format, planes, 3, dim, test_random_range(0, 3));
+        out = stub_matrix_new(_jit_sym_float32, 1, 1, dim, 0);
+        for (long z = 0; z < dim[2]; z++) {
+            for (long y = 0; y < dim[1]; y++) {
+                for (long v = 0; v < dim[0]; v++) {
+                    char *cell = stub_matrix_cell(in, v, y, z, 0);
+
+                    for (long j = 0; j < planes; j++) {
+                        float value = test_random() < 0.3f ? 0.0f : test_random();
+                        voxel_grid_write(cell + j * (format == VOXEL_GRID_HALF ? 2 : 4), format, value);
+                    }
+                }
+            }
+        }
+        inputs = stub_list(1, in);
+        outputs = stub_list(1, out);
+
+        err = vertexarray_matrix_calc(x, &inputs, &outputs);
+        TEST_EXPECT(err == JIT_ERR_NONE, "case %d: calc returned %ld", c, err);
+        TEST_EXPECT(out->info.dim[0] == count && out->info.planecount == size, "case %d: output is %ld cells of %ld planes",
+                    c, out->info.dim[0], out->info.planecount);
+
+        packed = test_grid_expand(in, format, 0, stride);
+        for (long i = 0; i < count && !err; i++) {
+            float *result = (float *)(out->data + i * out->info.dimstride[0]);
+            float vertex[4], normal[3], color[4];
+
+            voxel_reference_vertex((char *)packed, dim, stride, i, vertex);
+            for (int j = 0; j < 4; j++) {
+                error = MAX(error, fabsf(result[j] - vertex[j]));
+            }
+            result += 4;
+            if (x->normals) {
+                voxel_reference_normal((char *)packed, dim, stride, i, normal);
+                for (int j = 0; j < 3; j++) {
+                    error = MAX(error, fabsf(result[j] - (vertex[3] > 0 ? normal[j] : 0.0f)));
+                }
+                result += 3;
+            }
+            if (x->color) {
+                vertexarray_expected_color(in, format, planes, i % dim[0], (i / dim[0]) % dim[1], i / (dim[0] * dim[1]), color);
+                for (int j = 0; j < 4; j++) {
+                    error = MAX(error, fabsf(result[j] - color[j]));
+                }
+            }
+        }
+        free(packed);
+        TEST_EXPECT(error <= VOXEL_REFERENCE_TOLERANCE, "case %d: %ldx%ldx%ld planes %ld normals %ld color %ld differs by %g",
+                    c, dim[0], dim[1], dim[2], planes, x->normals, x->color, error);
+
+        vertexarray_free(x);
+        free(x);
+        stub_matrix_free(in);
+        stub_matrix_free(out);
+    }
+
+    // a cached frame is recognised without starting any pool workers
+    {
+        long dim[3] = { 16, 12, 10 };
+        t_stub_matrix *in = test_grid_new(VOXEL_GRID_FLOAT32, 1, 3, dim, 0);
+        t_stub_matrix *out = stub_matrix_new(_jit_sym_float32, 1, 1, dim, 0);
+        t_stub_list inputs = stub_list(1, in), outputs = stub_list(1, out);
+        t_vertexarray *x = vertexarray_new();
+
+        test_grid_fill(in, VOXEL_GRID_FLOAT32, 0.5f, 0.0f, 1.0f);
+        x->cache.enabled = 1;
+        vertexarray_matrix_calc(x, &inputs, &outputs);
+        vertexarray_matrix_calc(x, &inputs, &outputs);
+        TEST_EXPECT(x->cache.hits == 1, "%ld cache hits for a repeated frame", x->cache.hits);
+        TEST_EXPECT(voxel_pool.started == 0, "hashing started %ld pool workers", voxel_pool.started);
+
+        vertexarray_free(x);
+        free(x);
+        stub_matrix_free(in);
+        stub_matrix_free(out);
+    }
+
+    // grids are 3d
+    {
+        long dim[3] = { 6, 5, 4 };
+        t_stub_matrix *flat = test_grid_new(VOXEL_GRID_FLOAT32, 1, 2, dim, 0);
+        t_stub_matrix *out = stub_matrix_new(_jit_sym_float32, 1, 1, dim, 0);
+        t_stub_list inputs = stub_list(1, flat), outputs = stub_list(1, out);
+        t_vertexarray *x = vertexarray_new();
+
+        test_precision_gate("vertexarray", (t_test_calc)vertexarray_matrix_calc, x, &x->precision, 1);
+        TEST_EXPECT(vertexarray_matrix_calc(x, &inputs, &outputs) == JIT_ERR_MISMATCH_DIM, "2d input accepted");
+
+        vertexarray_free(x);
+        free(x);
+        stub_matrix_free(flat);
+        stub_matrix_free(out);
+    }
+
+    {
+        long dim[3] = { 96, 96, 96 };
+        t_stub_matrix *in = test_grid_new(VOXEL_GRID_FLOAT32, 1, 3, dim, 0);
+        t_stub_matrix *out = stub_matrix_new(_jit_sym_float32, 1, 1, dim, 0);
+        t_stub_list inputs = stub_list(1, in), outputs = stub_list(1, out);
+        t_vertexarray *x = vertexarray_new();
+        t_test_timing timing = { (t_test_calc)vertexarray_matrix_calc, x, &inputs, &outputs };
+
+        x->normals = 1;
+        test_grid_fill(in, VOXEL_GRID_FLOAT32, 0.5f, 0.0f, 1.0f);
+        test_budget("vertexarray 96^3 with normals", test_time(test_timing_run, &timing, 5), 21.0);
+
+        vertexarray_free(x);
+        free(x);
+        stub_matrix_free(in);
+        stub_matrix_free(out);
+    }
+    return test_finish("vertexarray");
+}
@@ -0,0 +1,79 @@
+#ifndef VOXEL_BENCH_H
+#define VOXEL_BENCH_H
+
+// The object a bench.* program measures. CMake builds one program per object with
+// VOXEL_BENCH_SOURCE naming its jit file and VOXEL_BENCH_<OBJECT> set; this picks the
+// calls, the output matrix it wants and how to set its thread count
+#define BENCH_STRING(s) #s
+#define BENCH_INCLUDE(s) BENCH_STRING(s)
+#include BENCH_INCLUDE(VOXEL_BENCH_SOURCE)
+#include "voxel.test.h"
+
+#if defined(VOXEL_BENCH_GAUSSIAN)
+typedef t_gaussian t_bench;
+#define BENCH_NAME "gaussian"
+#define bench_init gaussian_init
+#define bench_new gaussian_new
+#define bench_free gaussian_free
+#define bench_calc gaussian_matrix_calc
+#define BENCH_OUTPUT(format, dim) test_grid_new(format, 1, 3, dim, 0)
+#define BENCH_THREADS(x, n, pin) ((x)->num_threads = (n), (x)->affinity = (pin))
+#elif defined(VOXEL_BENCH_CENTROID)
+typedef t_centroid t_bench;
+#define BENCH_NAME "centroid"
+#define bench_init centroid_init
+#define bench_new centroid_new
+#define bench_free centroid_free
+#define bench_calc centroid_matrix_calc
+#define BENCH_OUTPUT(format, dim) NULL
+#define BENCH_THREADS(x, n, pin) ((x)->num_threads = (n), (x)->affinity = (pin))
+#elif defined(VOXEL_BENCH_VERTEXARRAY)
+typedef t_vertexarray t_bench;
+#define BENCH_NAME "vertexarray"
+#define bench_init vertexarray_init
+#define bench_new vertexarray_new
+#define bench_free vertexarray_free
+#define bench_calc vertexarray_matrix_calc
+#define BENCH_OUTPUT(format, dim) stub_matrix_new(_jit_sym_float32, 1, 1, dim, 0)
+#define BENCH_THREADS(x, n, pin)
+#elif defined(VOXEL_BENCH_CSG)
+typedef t_csg t_bench;
+#define BENCH_NAME "csg"
+#define bench_init csg_init
+#define bench_new csg_new
+#define bench_free csg_free
+#define bench_calc csg_matrix_calc
+#define BENCH_OUTPUT(format, dim) test_grid_new(format, 1, 3, dim, 0)
+#define BENCH_THREADS(x, n, pin) ((x)->num_threads = (n), (x)->affinity = (pin))
+#elif defined(VOXEL_BENCH_STATS)
+typedef t_stats t_bench;
+#define BENCH_NAME "stats"
+#define bench_init stats_init
+#define bench_new stats_new
+#define bench_free stats_free
+#define bench_calc stats_matrix_calc
+#define BENCH_OUTPUT(format, dim) NULL
+#define BENCH_THREADS(x, n, pin) ((x)->num_threads = (n), (x)->affinity = (pin))
+#elif defined(VOXEL_BENCH_FLOW)
+typedef t_flow t_bench;
+#define BENCH_NAME "flow"
+#define bench_init flow_init
+#define bench_new flow_new
+#define bench_free flow_free
+#define bench_calc flow_matrix_calc
+#define BENCH_OUTPUT(format, dim) stub_matrix_new(_jit_sym_float32, 4, 3, dim, 0)
+#define BENCH_THREADS(x, n, pin) ((x)->num_threads = (n), (x)->affinity = (pin))
+#elif defined(VOXEL_BENCH_BLOB)
+typedef t_blob t_bench;
+#define BENCH_NAME "blob"
+#define bench_init blob_init
+#define bench_new blob_new
+#define bench_free blob_free
+#define bench_calc blob_matrix_calc
+#define BENCH_OUTPUT(format, dim) stub_matrix_new(_jit_sym_float32, BLOB_PLANES, 1, dim, 0)
+#define BENCH_THREADS(x, n, pin) ((x)->num_threads = (n), (x)->affinity = (pin))
+#else
+#error "VOXEL_BENCH_<OBJECT> names the object to measure"
+#endif
+
+#endif
@@ -0,0 +1,665 @@
+#ifndef VOXEL_REFERENCE_H
+#define VOXEL_REFERENCE_H
+
+#include <math.h>
+#include "voxel.half.h"
+
+// Naive reference kernels for the headless tests. They follow the original per-voxel
+// implementations, read the input through its dimstrides on every access and share no
+// code with the optimized paths.
+#define VOXEL_REFERENCE_TOLERANCE 1e-4f
+
+// first plane of a 3d grid as a packed float volume, so the float-only reference
+// kernels can read half grids; stride is set to the packed layout
+static inline void voxel_grid_expand(const char *bp, long format, long *dim, long *in_stride, float *dst, long *stride) {
+    for (long z = 0; z < dim[2]; z++) {
+        for (long y = 0; y < dim[1]; y++) {
+            const char *row = bp + y * in_stride[1] + z * in_stride[2];
+            float *out = dst + (z * dim[1] + y) * dim[0];
+
+            if (format == VOXEL_GRID_HALF) {
+                voxel_half_load(row, in_stride[0], out, dim[0]);
+            } else {
+                for (long x = 0; x < dim[0]; x++) {
+                    out[x] = *(const float *)(row + x * in_stride[0]);
+                }
+            }
+        }
+    }
+    stride[0] = sizeof(float);
+    stride[1] = stride[0] * dim[0];
+    stride[2] = stride[1] * dim[1];
+}
+
+// difference from a float reference beyond what storing it in half precision explains
+static inline float voxel_half_error(float out, float ref) {
+    return MAX(0.0f, fabsf(out - ref) - fabsf(ref) * VOXEL_HALF_EPSILON);
+}
+
+static inline float voxel_reference_read(char *bp, long *stride, long x, long y, long z) {
+    return *(float *)(bp + x * stride[0] + y * stride[1] + z * stride[2]);
+}
+
+// tap position i on an axis of n voxels for boundary 0 zero, 1 clamp, 2 mirror,
+// 3 renormalize; -1 if the tap is dropped
+static inline long voxel_reference_tap(long boundary, long i, long n) {
+    while (i < 0 || i >= n) {
+        if (boundary == 1) {
+            i = i < 0 ? 0 : n - 1;
+        } else if (boundary == 2 && n > 1) {
+            i = i < 0 ? -i : 2 * (n - 1) - i;
+        } else if (boundary == 2) {
+            i = 0;
+        } else {
+            return -1;
+        }
+    }
+    return i;
+}
+
+// radius in taps on each axis: radius counts voxels of the finest spacing
+static inline void voxel_reference_gaussian_taps(const long *radius, const float *spacing, long *r) {
+    double finest = MIN(spacing[0], MIN(spacing[1], spacing[2]));
+
+    for (int a = 0; a < 3; a++) {
+        r[a] = (long)floor(radius[a] * finest / spacing[a] + 0.5);
+    }
+}
+
+// unnormalized weight of tap k of an axis with r taps either side
+static inline double voxel_reference_gaussian_weight(long k, long r, double sigma) {
+    double norm = r > 0 ? (double)k / r : 0.0;
+    return exp(-norm * norm / (2.0 * sigma * sigma));
+}
+
+// one voxel of the gaussian as a direct 3d gather. The kernel is built here from
+// radius, sigma and spacing: the product of one gaussian per axis over [-1, 1] of
+// the axis radius, each normalized to sum to 1
+static inline float voxel_reference_gaussian(char *bp, long *dim, long *stride, const long *radius, const float *sigma,
+                                             const float *spacing, long boundary, long gx, long gy, long gz) {
+    long r[3];
+    double total[3] = { 0.0, 0.0, 0.0 };
+    double sum = 0.0, inside = 0.0;
+
+    voxel_reference_gaussian_taps(radius, spacing, r);
+    for (int a = 0; a < 3; a++) {
+        for (long k = -r[a]; k <= r[a]; k++) {
+            total[a] += voxel_reference_gaussian_weight(k, r[a], sigma[a]);
+        }
+    }
+
+    for (long k = -r[2]; k <= r[2]; k++) {
+        for (long j = -r[1]; j <= r[1]; j++) {
+            for (long i = -r[0]; i <= r[0]; i++) {
+                long vx = voxel_reference_tap(boundary, gx + i, dim[0]);
+                long vy = voxel_reference_tap(boundary, gy + j, dim[1]);
+                long vz = voxel_reference_tap(boundary, gz + k, dim[2]);
+                double weight = voxel_reference_gaussian_weight(i, r[0], sigma[0]) / total[0] *
+                                voxel_reference_gaussian_weight(j, r[1], sigma[1]) / total[1] *
+                                voxel_reference_gaussian_weight(k, r[2], sigma[2]) / total[2];
+
+                if (vx < 0 || vy < 0 || vz < 0) {
+                    continue;
+                }
+                sum += voxel_reference_read(bp, stride, vx, vy, vz) * weight;
+                inside += weight;
+            }
+        }
+    }
+    if (boundary == 3) {
+        return inside > 0.0 ? (float)(sum / inside) : 0.0f;
+    }
+    return (float)sum;
+}
+
+// weighted mean of the voxel centers of one grid
+static inline void voxel_reference_centroid(char *bp, long *dim, long *stride, float *mean) {
+    double sum[4] = { 0.0, 0.0, 0.0, 0.0 };
+
+    for (long z = 0; z < dim[2]; z++) {
+        for (long y = 0; y < dim[1]; y++) {
+            for (long x = 0; x < dim[0]; x++) {
+                float weight = voxel_reference_read(bp, stride, x, y, z);
+
+                if (weight > 0) {
+                    sum[0] += ((x + 0.5) / dim[0]) * weight;
+                    sum[1] += ((y + 0.5) / dim[1]) * weight;
+                    sum[2] += ((z + 0.5) / dim[2]) * weight;
+                    sum[3] += weight;
+                }
+            }
+        }
+    }
+    for (int j = 0; j < 3; j++) {
+        mean[j] = sum[3] > 0 ? (float)(sum[j] / sum[3]) : 0.0f;
+    }
+}
+
+// the vertex the vertex array holds for voxel index: normalized center and weight,
+// all zero for empty voxels
+static inline void voxel_reference_vertex(char *bp, long *dim, long *stride, long index, float *vertex) {
+    long x = index % dim[0];
+    long y = (index / dim[0]) % dim[1];
+    long z = index / (dim[0] * dim[1]);
+    float weight = voxel_reference_read(bp, stride, x, y, z);
+
+    if (weight > 0) {
+        vertex[0] = (x + 0.5f) / dim[0];
+        vertex[1] = (y + 0.5f) / dim[1];
+        vertex[2] = (z + 0.5f) / dim[2];
+        vertex[3] = weight;
+    } else {
+        vertex[0] = vertex[1] = vertex[2] = vertex[3] = 0.0f;
+    }
+}
+
+// gradient normal the vertex array holds for voxel index: central differences of the
+// weight in normalized space (one-sided at the faces), negated to point away from the
+// dense side and normalized; zero where the field is flat
+static inline void voxel_reference_normal(char *bp, long *dim, long *stride, long index, float *normal) {
+    long v[3] = { index % dim[0], (index / dim[0]) % dim[1], index / (dim[0] * dim[1]) };
+    double g[3], length = 0.0;
+
+    for (int a = 0; a < 3; a++) {
+        long lo[3] = { v[0], v[1], v[2] };
+        long hi[3] = { v[0], v[1], v[2] };
+
+        lo[a] = MAX(v[a] - 1, 0);
+        hi[a] = MIN(v[a] + 1, dim[a] - 1);
+        g[a] = hi[a] > lo[a] ? (voxel_reference_read(bp, stride, hi[0], hi[1], hi[2]) -
+                                voxel_reference_read(bp, stride, lo[0], lo[1], lo[2])) / (double)(hi[a] - lo[a]) * dim[a] : 0.0;
+        length += g[a] * g[a];
+    }
+    length = sqrt(length);
+    for (int a = 0; a < 3; a++) {
+        normal[a] = length > 0.0 ? (float)(-g[a] / length) : 0.0f;
+    }
+}
+
+// occupancy of one voxel after folding the inputs left to right through ops
+// (0 union, 1 intersect, 2 subtract, 3 xor); a voxel is occupied above threshold
+static inline float voxel_reference_csg(char **bp, long **stride, long count, const long *ops, float threshold,
+                                        long x, long y, long z) {
+    int result = voxel_reference_read(bp[0], stride[0], x, y, z) > threshold;
+
+    for (long i = 1; i < count; i++) {
+        int occupied = voxel_reference_read(bp[i], stride[i], x, y, z) > threshold;
+
+        switch (ops[i - 1]) {
+            case 1: result = result && occupied; break;
+            case 2: result = result && !occupied; break;
+            case 3: result = result != occupied; break;
+            default: result = result || occupied; break;
+        }
+    }
+    return result ? 1.0f : 0.0f;
+}
+
+// spatial statistics of one grid over its occupied voxels (weight above 0): mass per
+// marginal bin along x, y and z packed one axis after another (lengths[a] bins, voxel v
+// falling in bin v * lengths[a] / dim[a]), voxel counts per weight bin over range with
+// the ends clamped, and mass per octant (bit 0 upper x half, bit 1 y, bit 2 z)
+static inline void voxel_reference_stats(char *bp, long *dim, long *stride, long *lengths, long bins, float *range,
+                                         double *marginals, double *histogram, double *octants) {
+    float scale = range[1] > range[0] ? bins / (range[1] - range[0]) : 0.0f;
+
+    for (long i = 0; i < lengths[0] + lengths[1] + lengths[2]; i++) {
+        marginals[i] = 0.0;
+    }
+    for (long i = 0; i < bins; i++) {
+        histogram[i] = 0.0;
+    }
+    for (int i = 0; i < 8; i++) {
+        octants[i] = 0.0;
+    }
+    for (long z = 0; z < dim[2]; z++) {
+        for (long y = 0; y < dim[1]; y++) {
+            for (long x = 0; x < dim[0]; x++) {
+                float weight = voxel_reference_read(bp, stride, x, y, z);
+                float position;
+
+                if (!(weight > 0)) {
+                    continue;
+                }
+                marginals[x * lengths[0] / dim[0]] += weight;
+                marginals[lengths[0] + y * lengths[1] / dim[1]] += weight;
+                marginals[lengths[0] + lengths[1] + z * lengths[2] / dim[2]] += weight;
+
+                position = (weight - range[0]) * scale;
+                histogram[position > 0 ? (position < bins ? (long)position : bins - 1) : 0] += 1.0;
+
+                octants[(x >= dim[0] / 2) | (y >= dim[1] / 2) << 1 | (z >= dim[2] / 2) << 2] += weight;
+            }
+        }
+    }
+}
+
+// voxel (x, y, z) of pyramid level 0 (the grid itself) or above: the mean of its
+// children one level down that lie inside the grid, 0 outside it
+static inline float voxel_reference_level(char *bp, long *dim, long *stride, long level, long x, long y, long z) {
+    long size[3], child[3];
+    long p[3] = { x, y, z };
+    float sum = 0.0f;
+    long count = 0;
+
+    for (int a = 0; a < 3; a++) {
+        size[a] = (dim[a] + (1L << level) - 1) >> level;
+        if (p[a] < 0 || p[a] >= size[a]) {
+            return 0.0f;
+        }
+    }
+    if (level == 0) {
+        return voxel_reference_read(bp, stride, x, y, z);
+    }
+    for (int a = 0; a < 3; a++) {
+        child[a] = (dim[a] + (1L << (level - 1)) - 1) >> (level - 1);
+    }
+    for (long k = 0; k < 2; k++) {
+        for (long j = 0; j < 2; j++) {
+            for (long i = 0; i < 2; i++) {
+                if (2 * x + i < child[0] && 2 * y + j < child[1] && 2 * z + k < child[2]) {
+                    sum += voxel_reference_level(bp, dim, stride, level - 1, 2 * x + i, 2 * y + j, 2 * z + k);
+                    count++;
+                }
+            }
+        }
+    }
+    return sum / count;
+}
+
+// voxel (x, y, z) of the next pyramid level from one level: mode 0 the max, 1 the
+// mean and 2 whether any is above 0, over the children 2x .. 2x + 1 per axis that lie
+// inside the level, so a cell on an odd edge has fewer
+static inline float voxel_reference_pyramid(char *bp, long *dim, long *stride, long mode, long x, long y, long z) {
+    float sum = 0.0f, peak = -INFINITY;
+    long count = 0;
+
+    for (long k = 2 * z; k < MIN(2 * z + 2, dim[2]); k++) {
+        for (long j = 2 * y; j < MIN(2 * y + 2, dim[1]); j++) {
+            for (long i = 2 * x; i < MIN(2 * x + 2, dim[0]); i++) {
+                float v = voxel_reference_read(bp, stride, i, j, k);
+
+                sum += v;
+                peak = MAX(peak, v);
+                count++;
+            }
+        }
+    }
+    return mode == 1 ? sum / count : mode == 2 ? (float)(peak > 0.0f) : peak;
+}
+
+// sum of absolute differences between a brick of cur and the same brick of prev moved
+// back by d, on one pyramid level. Each column of the brick is summed over its rows in
+// float and the columns are added in order, as the vector kernels do, so ties break
+// the same way
+static inline float voxel_reference_sad(char *prev, long *prev_stride, char *cur, long *cur_stride, long *dim,
+                                        long level, long *origin, long *size, long *d) {
+    float sum = 0.0f;
+
+    for (long x = origin[0]; x < origin[0] + size[0]; x++) {
+        float column = 0.0f;
+
+        for (long z = origin[2]; z < origin[2] + size[2]; z++) {
+            for (long y = origin[1]; y < origin[1] + size[1]; y++) {
+                column += fabsf(voxel_reference_level(cur, dim, cur_stride, level, x, y, z) -
+                                voxel_reference_level(prev, dim, prev_stride, level, x - d[0], y - d[1], z - d[2]));
+            }
+        }
+        sum += column;
+    }
+    return sum;
+}
+
+// one candidate of voxel_reference_flow: replaces the estimate when its SAD is lower
+static inline void voxel_reference_candidate(char *prev, long *prev_stride, char *cur, long *cur_stride, long *dim,
+                                             long level, long *origin, long *size, long *candidate, float *best, long *d) {
+    float sad = voxel_reference_sad(prev, prev_stride, cur, cur_stride, dim, level, origin, size, candidate);
+
+    if (sad < *best) {
+        *best = sad;
+        d[0] = candidate[0];
+        d[1] = candidate[1];
+        d[2] = candidate[2];
+    }
+}
+
+// displacement in voxels of every brick from prev to cur and its mass in cur, four
+// floats per brick in scan order. Coarse to fine, one level at a time over all bricks:
+// +-search voxels around zero on the top level; on each level below, starting from
+// the doubled estimate of the level above, the zero vector and the doubled estimates
+// of the face neighbors -x +x -y +y -z +z are tried unless equal to it, then +-refine
+// around the best of them is scanned z, y, x from the negative end. A candidate is
+// kept only when its SAD is lower. Bricks with no occupied voxel in cur report no
+// motion. estimate holds 6 longs per brick
+static inline void voxel_reference_flow(char *prev, long *prev_stride, char *cur, long *cur_stride, long *dim,
+                                        long brick, long levels, long search, long refine, long *estimate, float *out) {
+    long bricks[3] = { (dim[0] + brick - 1) / brick, (dim[1] + brick - 1) / brick, (dim[2] + brick - 1) / brick };
+    long count = bricks[0] * bricks[1] * bricks[2];
+    long *above = estimate, *below = estimate + 3 * count;
+
+    for (long index = 0; index < count; index++) {
+        long b[3] = { index % bricks[0], (index / bricks[0]) % bricks[1], index / (bricks[0] * bricks[1]) };
+        double mass = 0.0;
+        long occupied = 0;
+
+        for (long z = b[2] * brick; z < MIN((b[2] + 1) * brick, dim[2]); z++) {
+            for (long y = b[1] * brick; y < MIN((b[1] + 1) * brick, dim[1]); y++) {
+                for (long x = b[0] * brick; x < MIN((b[0] + 1) * brick, dim[0]); x++) {
+                    float weight = voxel_reference_read(cur, cur_stride, x, y, z);
+
+                    mass += weight;
+                    occupied += weight > 0;
+                }
+            }
+        }
+        out[index * 4 + 3] = (float)mass;
+        // the occupied count rides in the output until the last level overwrites it
+        out[index * 4] = (float)occupied;
+        above[index * 3] = above[index * 3 + 1] = above[index * 3 + 2] = 0;
+    }
+
+    for (long level = levels - 1; level >= 0; level--) {
+        long top = level == levels - 1, radius = top ? search : refine, *swap;
+
+        for (long index = 0; index < count; index++) {
+            long b[3] = { index % bricks[0], (index / bricks[0]) % bricks[1], index / (bricks[0] * bricks[1]) };
+            long origin[3], size[3], center[3], *d = below + index * 3;
+            float best;
+
+            for (int a = 0; a < 3; a++) {
+                long extent = (dim[a] + (1L << level) - 1) >> level;
+
+                origin[a] = (b[a] * brick) >> level;
+                size[a] = MIN(MAX(brick >> level, 1), extent - origin[a]);
+                center[a] = above[index * 3 + a] * 2;
+                d[a] = center[a];
+            }
+            if (!(out[index * 4] > 0)) {
+                continue;
+            }
+            best = voxel_reference_sad(prev, prev_stride, cur, cur_stride, dim, level, origin, size, center);
+
+            for (int n = 0; n < 7 && !top; n++) {
+                long candidate[3] = { 0, 0, 0 };
+
+                if (n) {
+                    long axis = (n - 1) >> 1, step = (n & 1) ? -1 : 1;
+                    long neighbor[3] = { b[0], b[1], b[2] };
+
+                    neighbor[axis] += step;
+                    if (neighbor[axis] < 0 || neighbor[axis] >= bricks[axis]) {
+                        continue;
+                    }
+                    for (int a = 0; a < 3; a++) {
+                        candidate[a] = above[(neighbor[0] + neighbor[1] * bricks[0] + neighbor[2] * bricks[0] * bricks[1]) * 3 + a] * 2;
+                    }
+                }
+                if (candidate[0] != center[0] || candidate[1] != center[1] || candidate[2] != center[2]) {
+                    voxel_reference_candidate(prev, prev_stride, cur, cur_stride, dim, level, origin, size, candidate, &best, d);
+                }
+            }
+            center[0] = d[0];
+            center[1] = d[1];
+            center[2] = d[2];
+            for (long k = -radius; k <= radius; k++) {
+                for (long j = -radius; j <= radius; j++) {
+                    for (long i = -radius; i <= radius; i++) {
+                        long candidate[3] = { center[0] + i, center[1] + j, center[2] + k };
+
+                        if (i || j || k) {
+                            voxel_reference_candidate(prev, prev_stride, cur, cur_stride, dim, level, origin, size,
+                                                      candidate, &best, d);
+                        }
+                    }
+                }
+            }
+        }
+        swap = above;
+        above = below;
+        below = swap;
+    }
+
+    for (long index = 0; index < count; index++) {
+        out[index * 4] = (float)above[index * 3];
+        out[index * 4 + 1] = (float)above[index * 3 + 1];
+        out[index * 4 + 2] = (float)above[index * 3 + 2];
+    }
+}
+
+// connected components of the occupied voxels (weight above 0), flood filled over a
+// full label volume; neighbors share a face (connectivity 1), an edge (2) or a corner
+// (3). Components are numbered in scan order of their first voxel and out holds
+// VOXEL_REFERENCE_BLOB floats for each: voxel count, mass, the weighted mean of the
+// normalized voxel centers and their weighted covariance xx xy xz yy yz zz. labels and
+// queue hold one long per voxel. Returns the component count; only the first capacity
+// are written
+#define VOXEL_REFERENCE_BLOB 11
+
+static inline long voxel_reference_blobs(char *bp, long *dim, long *stride, long connectivity, long *labels, long *queue,
+                                         float *out, long capacity) {
+    long voxels = dim[0] * dim[1] * dim[2];
+    long components = 0;
+
+    for (long i = 0; i < voxels; i++) {
+        labels[i] = -1;
+    }
+    for (long seed = 0; seed < voxels; seed++) {
+        long head = 0, tail = 0;
+        double mass = 0.0, mean[3] = { 0.0, 0.0, 0.0 }, cov[6] = { 0.0, 0.0, 0.0, 0.0, 0.0, 0.0 };
+
+        if (labels[seed] >= 0 ||
+            !(voxel_reference_read(bp, stride, seed % dim[0], (seed / dim[0]) % dim[1], seed / (dim[0] * dim[1])) > 0)) {
+            continue;
+        }
+        labels[seed] = components;
+        queue[tail++] = seed;
+
+        // breadth first; the queue keeps the whole component for the moment passes
+        while (head < tail) {
+            long v = queue[head++];
+            long p[3] = { v % dim[0], (v / dim[0]) % dim[1], v / (dim[0] * dim[1]) };
+
+            for (long k = -1; k <= 1; k++) {
+                for (long j = -1; j <= 1; j++) {
+                    for (long i = -1; i <= 1; i++) {
+                        long q[3] = { p[0] + i, p[1] + j, p[2] + k };
+                        long n;
+
+                        if ((i != 0) + (j != 0) + (k != 0) > connectivity || (!i && !j && !k) ||
+                            q[0] < 0 || q[0] >= dim[0] || q[1] < 0 || q[1] >= dim[1] || q[2] < 0 || q[2] >= dim[2]) {
+                            continue;
+                        }
+                        n = q[0] + q[1] * dim[0] + q[2] * dim[0] * dim[1];
+                        if (labels[n] < 0 && voxel_reference_read(bp, stride, q[0], q[1], q[2]) > 0) {
+                            labels[n] = components;
+                            queue[tail++] = n;
+                        }
+                    }
+                }
+            }
+        }
+
+        for (long i = 0; i < tail; i++) {
+            long p[3] = { queue[i] % dim[0], (queue[i] / dim[0]) % dim[1], queue[i] / (dim[0] * dim[1]) };
+            double weight = voxel_reference_read(bp, stride, p[0], p[1], p[2]);
+
+            mass += weight;
+            for (int a = 0; a < 3; a++) {
+                mean[a] += weight * ((p[a] + 0.5) / dim[a]);
+            }
+        }
+        for (int a = 0; a < 3; a++) {
+            mean[a] /= mass;
+        }
+        for (long i = 0; i < tail; i++) {
+            long p[3] = { queue[i] % dim[0], (queue[i] / dim[0]) % dim[1], queue[i] / (dim[0] * dim[1]) };
+            double weight = voxel_reference_read(bp, stride, p[0], p[1], p[2]);
+            double d[3];
+
+            for (int a = 0; a < 3; a++) {
+                d[a] = (p[a] + 0.5) / dim[a] - mean[a];
+            }
+            cov[0] += weight * d[0] * d[0];
+            cov[1] += weight * d[0] * d[1];
+            cov[2] += weight * d[0] * d[2];
+            cov[3] += weight * d[1] * d[1];
+            cov[4] += weight * d[1] * d[2];
+            cov[5] += weight * d[2] * d[2];
+        }
+
+        if (components < capacity) {
+            float *blob = out + components * VOXEL_REFERENCE_BLOB;
+
+            blob[0] = (float)tail;
+            blob[1] = (float)mass;
+            for (int a = 0; a < 3; a++) {
+                blob[2 + a] = (float)mean[a];
+            }
+            for (int c = 0; c < 6; c++) {
+                blob[5 + c] = (float)(cov[c] / mass);
+            }
+        }
+        components++;
+    }
+    return components;
+}
+
+// hit count per voxel for a 1d or 2d matrix of xyz points, clamped onto the grid faces
+static inline void voxel_reference_scatter(char *bp, long width, long rows, long *in_stride, long *dim, t_int32 *counts) {
+    memset(counts, 0, dim[0] * dim[1] * dim[2] * sizeof(t_int32));
+
+    for (long j = 0; j < rows; j++) {
+        for (long i = 0; i < width; i++) {
+            float *p = (float *)(bp + j * in_stride[1] + i * in_stride[0]);
+            long v[3];
+
+            for (int a = 0; a < 3; a++) {
+                v[a] = MAX(0, MIN((long)(p[a] * dim[a]), dim[a] - 1));
+            }
+            counts[v[0] + (v[1] + v[2] * dim[1]) * dim[0]]++;
+        }
+    }
+}
+
+// hit count per voxel for a depth image unprojected through camera (fx, fy, cx, cy,
+// depth scale) into bounds (min xyz, max xyz); y is flipped so up in the image is up
+// in the grid. pixels without depth or outside the bounds are dropped
+static inline void voxel_reference_depth_scatter(char *bp, long width, long rows, long *in_stride,
+                                                 const float *camera, const float *bounds, long *dim, t_int32 *counts) {
+    float inv_focal[2] = { 1.0f / camera[0], 1.0f / camera[1] };
+    float scale[3];
+
+    for (int a = 0; a < 3; a++) {
+        scale[a] = (float)dim[a] / (bounds[a + 3] - bounds[a]);
+    }
+    memset(counts, 0, dim[0] * dim[1] * dim[2] * sizeof(t_int32));
+
+    for (long v = 0; v < rows; v++) {
+        for (long u = 0; u < width; u++) {
+            float d = *(float *)(bp + v * in_stride[1] + u * in_stride[0]) * camera[4];
+            float g[3];
+            long cell[3];
+
+            if (!(d > 0.0f)) {
+                continue;
+            }
+            g[0] = (((float)u - camera[2]) * d * inv_focal[0] - bounds[0]) * scale[0];
+            g[1] = ((camera[3] - (float)v) * d * inv_focal[1] - bounds[1]) * scale[1];
+            g[2] = (d - bounds[2]) * scale[2];
+
+            for (int a = 0; a < 3; a++) {
+                cell[a] = g[a] >= 0.0f && g[a] < dim[a] ? (long)g[a] : -1;
+            }
+            if (cell[0] >= 0 && cell[1] >= 0 && cell[2] >= 0) {
+                counts[cell[0] + (cell[1] + cell[2] * dim[1]) * dim[0]]++;
+            }
+        }
+    }
+}
+
+// 1 if a voxel passes the minpoints / minneighbors filter over the scattered counts
+static inline float voxel_reference_occupied(t_int32 *counts, long *dim, long minpoints, long minneighbors,
+                                             long x, long y, long z) {
+    long neighbors = 0;
+
+    minpoints = MAX(minpoints, 1);
+    if (counts[x + (y + z * dim[1]) * dim[0]] < minpoints) {
+        return 0.0f;
+    }
+    for (long k = -1; k <= 1; k++) {
+        for (long j = -1; j <= 1; j++) {
+            for (long i = -1; i <= 1; i++) {
+                long nx = x + i, ny = y + j, nz = z + k;
+
+                if ((i || j || k) && nx >= 0 && ny >= 0 && nz >= 0 && nx < dim[0] && ny < dim[1] && nz < dim[2]) {
+                    neighbors += counts[nx + (ny + nz * dim[1]) * dim[0]] >= minpoints;
+                }
+            }
+        }
+    }
+    return neighbors >= minneighbors ? 1.0f : 0.0f;
+}
+
+// first voxel above threshold met by marching the ray o + u t (normalized space, u of
+// unit length) in fixed steps of h from t = 0 to maxdist; its linear index and the
+// distance of the sample that found it, or -1 when no sample lands in one
+static inline long voxel_reference_raycast(char *bp, long *dim, long *stride, float threshold, const float *o,
+                                           const float *u, float maxdist, double h, double *dist) {
+    for (long i = 0; i * h <= maxdist; i++) {
+        double t = i * h;
+        long v[3];
+
+        for (int a = 0; a < 3; a++) {
+            v[a] = (long)floor((o[a] + u[a] * t) * dim[a]);
+        }
+        if (v[0] < 0 || v[1] < 0 || v[2] < 0 || v[0] >= dim[0] || v[1] >= dim[1] || v[2] >= dim[2]) {
+            continue;
+        }
+        if (voxel_reference_read(bp, stride, v[0], v[1], v[2]) > threshold) {
+            *dist = t;
+            return v[0] + (v[1] + v[2] * dim[1]) * dim[0];
+        }
+    }
+    *dist = -1.0;
+    return -1;
+}
+
+// squared distance between two xyz points, summed as the index search sums it
+static inline float voxel_reference_dist_sq(const float *a, const float *b) {
+    float dx = a[0] - b[0], dy = a[1] - b[1], dz = a[2] - b[2];
+    return dx * dx + dy * dy + dz * dz;
+}
+
+// how many of count packed xyz points lie within radius of q, over all of them
+static inline long voxel_reference_radius(const float *points, long count, const float *q, float radius) {
+    long found = 0;
+
+    for (long p = 0; p < count; p++) {
+        found += voxel_reference_dist_sq(q, points + p * 3) <= radius * radius;
+    }
+    return found;
+}
+
+// squared distances from q to its k nearest of count packed xyz points, ascending;
+// INFINITY past the last point
+static inline void voxel_reference_knn(const float *points, long count, const float *q, long k, float *dist) {
+    for (long i = 0; i < k; i++) {
+        dist[i] = INFINITY;
+    }
+    for (long p = 0; p < count; p++) {
+        float d = voxel_reference_dist_sq(q, points + p * 3);
+        long slot = k;
+
+        while (slot > 0 && dist[slot - 1] > d) {
+            if (slot < k) {
+                dist[slot] = dist[slot - 1];
+            }
+            slot--;
+        }
+        if (slot < k) {
+            dist[slot] = d;
+        }
+    }
+}
+
+#endif
@@ -0,0 +1,172 @@
+#ifndef VOXEL_TEST_H
+#define VOXEL_TEST_H
+
+// Shared helpers for the headless tests. Each test includes the jit class it covers
+// (so its static kernels are in reach), runs it on stub matrices and compares the
+// output with the naive kernels in voxel.reference.h.
+//
+// Grids are random: odd and degenerate dims, padded dimstrides, float32 and half.
+// The seed comes from VOXEL_TEST_SEED when set, so a failure can be replayed.
+//
+// Timings are printed next to the figure recorded for the case on a single core of the
+// development machine. They only fail a case when VOXEL_TEST_SLACK is set above 0, and
+// then when it runs slower than the recorded figure times the slack; Debug builds,
+// sanitizers and busy runners leave it unset.
+#include "jit.stub.h"
+#include "voxel.reference.h"
+#include <math.h>
+
+static long test_failures = 0;
+static unsigned long test_state = 1;
+
+#define TEST_EXPECT(cond, ...)                                       \
+    do {                                                             \
+        if (!(cond)) {                                               \
+            fprintf(stderr, "%s:%d: ", __FILE__, __LINE__);          \
+            fprintf(stderr, __VA_ARGS__);                            \
+            fprintf(stderr, "\n");                                   \
+            test_failures++;                                         \
+        }                                                            \
+    } while (0)
+
+static inline void test_seed(unsigned long seed) {
+    const char *env = getenv("VOXEL_TEST_SEED");
+
+    test_state = env ? strtoul(env, NULL, 10) : seed;
+    printf("seed %lu\n", test_state);
+}
+
+// uniform in [0, 1)
+static inline float test_random(void) {
+    test_state = test_state * 6364136223846793005UL + 1442695040888963407UL;
+    return (float)((test_state >> 40) & 0xffffff) / 16777216.0f;
+}
+
+static inline long test_random_range(long lo, long hi) {
+    return lo + (long)(test_random() * (hi - lo + 1));
+}
+
+// a float32 or half grid of dims dim, with pad extra elements per row and slice
+static inline t_stub_matrix *test_grid_new(long format, long planes, long dimcount, const long *dim, long pad) {
+    if (format == VOXEL_GRID_HALF) {
+        return stub_matrix_new(_jit_sym_char, planes * 2, dimcount, dim, pad);
+    }
+    return stub_matrix_new(_jit_sym_float32, planes, dimcount, dim, pad);
+}
+
+// first plane of every cell: zero with probability empty, else uniform in [lo, hi)
+static inline void test_grid_fill(t_stub_matrix *m, long format, float empty, float lo, float hi) {
+    t_jit_matrix_info *info = &m->info;
+    long batch = info->dimcount > 3 ? info->dim[3] : 1;
+
+    for (long w = 0; w < batch; w++) {
+        for (long z = 0; z < info->dim[2]; z++) {
+            for (long y = 0; y < info->dim[1]; y++) {
+                for (long x = 0; x < info->dim[0]; x++) {
+                    float value = test_random() < empty ? 0.0f : lo + (hi - lo) * test_random();
+                    voxel_grid_write(stub_matrix_cell(m, x, y, z, w), format, value);
+                }
+            }
+        }
+    }
+}
+
+static inline float test_grid_read(t_stub_matrix *m, long format, long x, long y, long z, long w) {
+    return voxel_grid_read(stub_matrix_cell(m, x, y, z, w), format);
+}
+
+// grid w of m as a packed float volume for the reference kernels; free the result
+static inline float *test_grid_expand(t_stub_matrix *m, long format, long w, long *stride) {
+    long *dim = m->info.dim;
+    float *packed = (float *)malloc(MAX(dim[0] * dim[1] * dim[2], 1) * sizeof(float));
+
+    voxel_grid_expand(stub_matrix_cell(m, 0, 0, 0, w), format, dim, m->info.dimstride, packed, stride);
+    return packed;
+}
+
+// random dims in [1, max] per axis, odd more often than not
+static inline void test_random_dim(long *dim, long max) {
+    for (int a = 0; a < 3; a++) {
+        dim[a] = test_random_range(1, max) | (test_random() < 0.7f);
+    }
+}
+
+// matrix_calc of any jit class, so one helper can drive every object
+typedef t_jit_err (*t_test_calc)(void *x, void *inputs, void *outputs);
+
+// one calc on fixed lists, for test_time; outputs is NULL for objects without any
+typedef struct _test_timing {
+    t_test_calc calc;
+    void *x;
+    t_stub_list *inputs;
+    t_stub_list *outputs;
+} t_test_timing;
+
+static inline void test_timing_run(void *ctx) {
+    t_test_timing *t = (t_test_timing *)ctx;
+    t->calc(t->x, t->inputs, t->outputs);
+}
+
+// a char matrix is only read as half with @precision half: calc refuses a small half
+// grid until precision is set to half, then takes it. outputs is the count of float32
+// output matrices the object fills, 0 for one without an output list
+static inline void test_precision_gate(const char *name, t_test_calc calc, void *x, t_symbol **precision, long outputs) {
+    long dim[3] = { 6, 5, 4 };
+    t_stub_matrix *in = test_grid_new(VOXEL_GRID_HALF, 1, 3, dim, 0);
+    t_stub_matrix *out[3] = { NULL, NULL, NULL };
+    t_stub_list inputs = stub_list(1, in), output_list;
+
+    for (long i = 0; i < outputs; i++) {
+        out[i] = stub_matrix_new(_jit_sym_float32, 1, 3, dim, 0);
+    }
+    output_list = stub_list(outputs, out[0], out[1], out[2]);
+    test_grid_fill(in, VOXEL_GRID_HALF, 0.5f, 0.0f, 1.0f);
+    *precision = _jit_sym_float32;
+    TEST_EXPECT(calc(x, &inputs, outputs ? &output_list : NULL) == JIT_ERR_MISMATCH_TYPE,
+                "%s: char input read without @precision half", name);
+    *precision = gensym("half");
+    TEST_EXPECT(calc(x, &inputs, outputs ? &output_list : NULL) == JIT_ERR_NONE,
+                "%s: char input refused with @precision half", name);
+
+    stub_matrix_free(in);
+    for (long i = 0; i < outputs; i++) {
+        stub_matrix_free(out[i]);
+    }
+}
+
+static inline double test_slack(void) {
+    const char *env = getenv("VOXEL_TEST_SLACK");
+    return env ? atof(env) : 0.0;
+}
+
+// best of runs calls of fn(ctx), in ms
+static inline double test_time(void (*fn)(void *), void *ctx, int runs) {
+    double best = 1e30;
+
+    for (int i = 0; i < runs; i++) {
+        double start = systimer_gettime();
+
+        fn(ctx);
+        best = MIN(best, systimer_gettime() - start);
+    }
+    return best;
+}
+
+static inline void test_budget(const char *name, double ms, double recorded) {
+    double slack = test_slack();
+
+    printf("%s: %.3f ms (recorded %.3f ms)\n", name, ms, recorded);
+    TEST_EXPECT(slack <= 0.0 || ms <= recorded * slack, "%s took %.3f ms, over %.1fx the recorded %.3f ms",
+                name, ms, slack, recorded);
+}
+
+static inline int test_finish(const char *name) {
+    if (test_failures) {
+        fprintf(stderr, "%s: %ld failures\n", name, test_failures);
+        return 1;
+    }
+    printf("%s: ok\n", name);
+    return 0;
+}
+
+#endif